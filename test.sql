@@ -12,3 +12,99 @@ create virtual table xbin using xbin(./test.bin);
 -- update xbin set id = 15 where rowid = 100000;
 -- explain select rowid, * from xbin where row = 4;
 select rowid, * from xbin where row >= 4 limit 5;
+
+.echo off
+-- Checks, on the files written by test/gen_data.py.  Each prints
+-- "name: ok" or "name: FAIL"; make test fails unless all print ok.
+.timer off
+.header off
+.mode list
+
+-- Plans against a plain copy of the file: sorted.bin is in order of
+-- (id, iq) and walks the id x iq grid, runs.bin starts over every 8008
+-- records
+create virtual table s using xbin(./sorted.bin);
+create virtual table r using xbin(./runs.bin);
+create temp table sref as select row, id, iq, speed, torque, ld, lq, lambda, Rs, temp from s;
+create temp table rref as select row, id, iq, speed, torque, ld, lq, lambda, Rs, temp from r;
+
+select 'count: ' || iif((select count(*) from s) = 20000 and (select count(*) from r) = 100000, 'ok', 'FAIL');
+select 'row range: ' || iif((select group_concat(row) from s where row between 5 and 9) = '5,6,7,8,9', 'ok', 'FAIL');
+select 'row desc: ' || iif((select group_concat(row) from (select row from s order by row desc limit 3)) = '20000,19999,19998', 'ok', 'FAIL');
+select 'key eq: ' || iif((select group_concat(row) from (select row from s where id = 1234 order by row))
+                       = (select group_concat(row) from (select row from sref where id = 1234 order by row)), 'ok', 'FAIL');
+select 'key range desc: ' || iif((select group_concat(row) from (select row from s where id between 10 and 12 and iq > 5 order by id desc, iq desc))
+                               = (select group_concat(row) from (select row from sref where id between 10 and 12 and iq > 5 order by id desc, iq desc)), 'ok', 'FAIL');
+select 'grid: ' || iif((select group_concat(row) from (select row from s where id in (7, 1500) and iq = 3 order by row))
+                     = (select group_concat(row) from (select row from sref where id in (7, 1500) and iq = 3 order by row)), 'ok', 'FAIL');
+select 'runs: ' || iif((select group_concat(row) from (select row from r where id = 999 and iq < 2 order by row))
+                     = (select group_concat(row) from (select row from rref where id = 999 and iq < 2 order by row)), 'ok', 'FAIL');
+select 'predicate: ' || iif((select count(*) || ',' || total(torque) from r where torque > 50 and temp = 83)
+                          = (select count(*) || ',' || total(torque) from rref where torque > 50 and temp = 83), 'ok', 'FAIL');
+select 'filter: ' || iif((select count(*) from r where filter = 'sqrt(id*id + iq*iq) < 10 or temp > 85')
+                       = (select count(*) from rref where sqrt(id*id + iq*iq) < 10 or temp > 85), 'ok', 'FAIL');
+
+-- A plan made on the sort key of a file that is then replaced by one
+-- in another order fails with SQLITE_SCHEMA and is prepared again
+select length(writefile('scratch.bin', readfile('sorted.bin'))) > 0;
+create virtual table sc using xbin(./scratch.bin, grid=temp);
+select 'schema before: ' || iif((select count(*) from sc where id = 3) = 8, 'ok', 'FAIL');
+select 'schema: ' || iif((select count(*) from (select writefile('scratch.bin', readfile('runs.bin')) w) x cross join sc
+                          where x.w > 0 and sc.id = 3)
+                       = (select count(*) from rref where id = 3), 'ok', 'FAIL');
+
+-- The sort key is only looked for by a statement on the data columns,
+-- not by count(*) or a rowid lookup
+select length(writefile('lazy.bin', readfile('sorted.bin'))) > 0;
+select writefile('lazy.bin.meta', '') = 0;
+create virtual table lz using xbin(./lazy.bin);
+select 'lazy count: ' || iif((select count(*) from lz) = 20000 and (select id from lz where row = 100) = 12, 'ok', 'FAIL');
+select 'lazy meta: ' || iif(length(readfile('lazy.bin.meta')) = 0, 'ok', 'FAIL');
+select 'lazy key: ' || iif((select count(*) from lz where id = 12) = 8, 'ok', 'FAIL');
+select 'lazy meta key: ' || iif(readfile('lazy.bin.meta') like '%sort=id,iq%', 'ok', 'FAIL');
+
+-- A sample of a file smaller than one stratum still picks one of its
+-- 25 blocks, whatever the seed
+select 'sample small file: ' || iif((select min(n) from (select (select count(*) from r where sample = 0.01 and seed = v.column1) n
+                                                         from (values (1), (2), (3), (4), (5), (6), (7), (8)) v)) > 0, 'ok', 'FAIL');
+select 'sample same seed: ' || iif((select total(row) from r where sample = 0.1 and seed = 42)
+                                 = (select total(row) from r where sample = 0.1 and seed = 42), 'ok', 'FAIL');
+
+
+-- zip= reads thermal.bin in step with sorted.bin, and an insert, which
+-- would only append to sorted.bin, is refused with an error
+create virtual table z using xbin(./sorted.bin, zip='th:./thermal.bin');
+create virtual table th using xbin(./thermal.bin);
+select 'zip: ' || iif((select count(*) from z join th using (row) where z.th_temp = th.temp and z.torque = th.torque) = 20000, 'ok', 'FAIL');
+insert into z(id, iq) values (1, 2);
+select 'zip insert: ' || iif((select count(*) from z) = 20000 and (select count(*) from s) = 20000, 'ok', 'FAIL');
+
+-- An unqualified table name given to a function means the table SQLite
+-- finds: temp, main, then the attached databases in order
+attach ':memory:' as a1;
+attach ':memory:' as a2;
+create virtual table a1.t using xbin(./sorted.bin);
+create virtual table a2.t using xbin(./runs.bin);
+select 'attached: ' || iif((select count from xbin_stats('t') where name = 'id') = 20000
+                         and (select count from xbin_stats('a2.t') where name = 'id') = 100000, 'ok', 'FAIL');
+create virtual table temp.t using xbin(./test.bin);
+select 'attached temp: ' || iif((select count from xbin_stats('t') where name = 'id') = 10
+                              and (select count from xbin_stats('a1.t') where name = 'id') = 20000, 'ok', 'FAIL');
+
+-- FILTER of xbin_histogram() and xbin_groupby() reads as the filter column
+select 'histogram filter: ' || iif((select sum(count) from xbin_histogram('r', 'speed', '1,-1e30,1e30', null, null,
+                                                                          'sqrt(id*id + iq*iq) < 10 or temp > 85'))
+                                 = (select count(*) from rref where (sqrt(id*id + iq*iq) < 10 or temp > 85)
+                                                               and speed is not null), 'ok', 'FAIL');
+select 'groupby filter: ' || iif((select group_concat(k1 || ':' || n) from (select k1, n from xbin_groupby('r', 'temp', 'count(*)',
+                                                                                'abs(torque) > 50 or id between 0 and 1') order by k1))
+                               = (select group_concat(temp || ':' || n) from (select temp, count(*) as n from rref
+                                                  where abs(torque) > 50 or id between 0 and 1 group by temp order by temp)), 'ok', 'FAIL');
+create virtual table rd using xbin(./runs.bin, derive='p: torque*speed');
+select 'derived filter: ' || iif((select sum(n) from xbin_groupby('rd', 'temp', 'count(*)', 'p > 1000'))
+                               = (select count(*) from rref where torque*speed > 1000), 'ok', 'FAIL');
+
+-- threads= up to XBIN_MAX_THREADS gives the rows a serial scan does
+create virtual table rt using xbin(./runs.bin, threads=32);
+select 'threads: ' || iif((select count(*) || ',' || total(torque) from rt where torque > 10 and temp <> 83)
+                        = (select count(*) || ',' || total(torque) from rref where torque > 10 and temp <> 83), 'ok', 'FAIL');
@@ -3,32 +3,42 @@ import struct
 def value(n):
     return bytearray(struct.pack("<f", float(n)))
 
-with open("../test.bin", "wb") as bf:
-    id_ = 0
-    iq_ = 0
-    speed = 500
-    ld = 0.01
-    lq = 0.02
-    Rs = 0.001
-    lamb = 0.003
-    temp = 80
-    for row in range(10):
-        bf.write(value(id_))
-        bf.write(value(iq_))
-        bf.write(value(speed))
-        bf.write(value(id_*0.1 + iq_*11))
-        bf.write(value(ld))
-        bf.write(value(lq))
-        bf.write(value(Rs))
-        bf.write(value(lamb))
-        bf.write(value(temp))
+def write(name, rows, id_max=1000, seed=0):
+    with open("../" + name, "wb") as bf:
+        id_ = 0
+        iq_ = 0
+        speed = 500 + seed
+        ld = 0.01
+        lq = 0.02
+        Rs = 0.001
+        lamb = 0.003
+        temp = 80 + seed
+        for row in range(rows):
+            bf.write(value(id_))
+            bf.write(value(iq_))
+            bf.write(value(speed))
+            bf.write(value(id_*0.1 + iq_*11))
+            bf.write(value(ld))
+            bf.write(value(lq))
+            bf.write(value(Rs))
+            bf.write(value(lamb))
+            bf.write(value(temp + row % 7))
 
-        if iq_ == 7:
-            id_ += 1
-            iq_ = 0
-        else:
-            iq_ += 1
+            if iq_ == 7:
+                id_ += 1
+                iq_ = 0
+            else:
+                iq_ += 1
 
-        if id_ > 1000:
-            id_ = 0
+            if id_ > id_max:
+                id_ = 0
 
+# test.bin: the example of test.sql
+write("test.bin", 10)
+
+# Data of the checks in test.sql: sorted.bin is in order of (id, iq),
+# runs.bin starts over every 8008 records, and thermal.bin is zipped
+# with sorted.bin
+write("sorted.bin", 20000, id_max=1000000)
+write("runs.bin", 100000)
+write("thermal.bin", 20000, id_max=1000000, seed=1)
@@ -1,350 +1,12126 @@
-/*
-** 2020-04-03 by hgl10
-** xbin interface for sqlite virtual table
-**
-** .load xbin
-** create virtual table xbin using xbin(./test.bin);
-** select count(*) from xbin;
-** .timer on
-** select rowid, * from xbin where rowid > 100000 order by rowid limit 10;
-** delete from xbin where rowid = 1;
-*/
-
-#if !defined(SQLITEINT_H)
-#include "sqlite3ext.h"
-#endif
-SQLITE_EXTENSION_INIT1
-#include <string.h>
-#include <assert.h>
-#include <ctype.h>
-#include <stdio.h>
-#include <stdint.h>
-
-typedef struct xbinData {
-  float id;
-  float iq;
-  float speed;
-  float torque;
-  float Ld;
-  float Lq;
-  float Lambda;
-  float Rs;
-  float Temp;
-} xbinData;
-
-/* XbinTable is a subclass of sqlite3_vtab which is
-** underlying representation of the virtual table
-*/
-typedef struct XbinTable {
-  sqlite3_vtab base;  /* Base class - must be first */
-  char *filename;     /* Name of the xbin file */
-  FILE *fptr;         /* used to scan file */
-} XbinTable;
-
-/* XbinCursor is a subclass of sqlite3_vtab_cursor which will
-** serve as the underlying representation of a cursor that scans
-** over rows of the result
-*/
-typedef struct XbinCursor {
-  sqlite3_vtab_cursor base;   /* Base class - must be first */
-  FILE *fptr;                 /* used to scan file */
-  sqlite3_int64 row;          /* The rowid */
-  xbinData data;
-} XbinCursor;
-
-/*
-** The xbinConnect() method is invoked to create a new
-** template virtual table.
-**
-** Think of this routine as the constructor for XbinTable objects.
-**
-** All this routine needs to do is:
-**
-**    (1) Allocate the XbinTable object and initialize all fields.
-**
-**    (2) Tell SQLite (via the sqlite3_declare_vtab() interface) what the
-**        result set of queries against the virtual table will look like.
-*/
-static int xbinConnect(
-  sqlite3 *db,
-  void *pAux,
-  int argc, const char *const*argv,
-  sqlite3_vtab **ppVtab,
-  char **pzErr
-) {
-  XbinTable *pTab;
-  int rc;
-  const char *filename = argv[3];
-  if ( argc != 4 ) return SQLITE_ERROR;
-
-  pTab = sqlite3_malloc( sizeof(*pTab) );
-  *ppVtab = (sqlite3_vtab*)pTab;
-  if ( pTab == 0 ) return SQLITE_NOMEM;
-  memset(pTab, 0, sizeof(*pTab));
-
-  pTab->filename = sqlite3_mprintf( "%s", filename );
-
-  rc = sqlite3_declare_vtab(db,
-                            "CREATE TABLE x(row INTEGER PRIMARY KEY, id REAL, iq REAL, speed REAL, torque REAL, ld REAL, lq REAL, lambda REAL, Rs REAL, temp REAL)"
-                           );
-
-  if ( rc != SQLITE_OK ) {
-    sqlite3_free( pTab->filename );
-    sqlite3_free( pTab );
-    return SQLITE_ERROR;
-  }
-
-  pTab->fptr = fopen( pTab->filename, "r+b" );
-  if ( pTab->fptr == NULL ) {
-    sqlite3_free(pTab->base.zErrMsg);
-    pTab->base.zErrMsg = sqlite3_mprintf("==> Database File Not Found!");
-    sqlite3_free( pTab->filename );
-    sqlite3_free( pTab );
-    return SQLITE_ERROR;
-  }
-
-  return rc;
-}
-
-/*
-** This method is the destructor for XbinTable objects.
-*/
-static int xbinDisconnect(sqlite3_vtab *pVtab) {
-  XbinTable *pTab = (XbinTable*)pVtab;
-  if (pTab->fptr != NULL) {
-    fclose(pTab->fptr);
-  }
-  sqlite3_free( pTab->filename );
-  sqlite3_free(pTab);
-  return SQLITE_OK;
-}
-
-/*
-** Constructor for a new XbinCursor object.
-*/
-static int xbinOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
-  XbinTable   *pTab = (XbinTable*) p;
-  XbinCursor  *pCur;
-  FILE        *fptr;
-
-  pCur = sqlite3_malloc( sizeof(*pCur) );
-  if ( pCur == 0 ) {
-    return SQLITE_NOMEM;
-  }
-  memset(pCur, 0, sizeof(*pCur));
-
-  pCur->fptr = pTab->fptr;
-  *cur = &pCur->base;
-  return SQLITE_OK;
-}
-
-/*
-** Destructor for a XbinCursor.
-*/
-static int xbinClose(sqlite3_vtab_cursor *cur) {
-  XbinCursor *pCur = (XbinCursor*)cur;
-  sqlite3_free(pCur);
-  return SQLITE_OK;
-}
-
-static int xbin_get_line( XbinCursor *pCur ) {
-  pCur->row ++;
-  fread(&pCur->data, sizeof(xbinData), 1, pCur->fptr);
-
-  return SQLITE_OK;
-}
-
-/*
-** Advance a XbinCursor to its next row of output.
-*/
-static int xbinNext(sqlite3_vtab_cursor *cur) {
-  return xbin_get_line((XbinCursor*)cur);
-}
-
-/*
-** Return values of columns for the row at which the XbinCursor
-** is currently pointing.
-*/
-static int xbinColumn(
-  sqlite3_vtab_cursor *cur,   /* The cursor */
-  sqlite3_context *ctx,       /* First argument to sqlite3_result_...() */
-  int i                       /* Which column to return */
-) {
-  XbinCursor *pCur = (XbinCursor*)cur;
-  if (i == 0) {
-    sqlite3_result_int64(ctx, pCur->row);
-    return SQLITE_OK;
-  }
-  float *start = (float *) & (pCur->data);
-  sqlite3_result_double(ctx, (double)start[i - 1]);
-  return SQLITE_OK;
-}
-
-/*
-** Return the rowid for the current row, just same as the row number.
-*/
-static int xbinRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
-  *pRowid = ((XbinCursor*)cur)->row;
-  return SQLITE_OK;
-}
-
-/*
-** Return TRUE if the cursor has been moved off of the last
-** row of output.
-*/
-static int xbinEof(sqlite3_vtab_cursor *cur) {
-  XbinCursor* pCur = (XbinCursor*) cur;
-  return feof(pCur->fptr);
-}
-
-/*
-** This method is called to "rewind" the XbinCursor object back
-** to the first row of output.  This method is always called at least
-** once prior to any call to xbinColumn() or xbinRowid() or
-** xbinEof().
-*/
-static int xbinFilter(
-  sqlite3_vtab_cursor *pVtabCursor,
-  int idxNum, const char *idxStr,
-  int argc, sqlite3_value **argv
-) {
-  XbinCursor *pCur = (XbinCursor *)pVtabCursor;
-  if (idxNum == 0) {
-    fseek( pCur->fptr, 0, SEEK_SET );
-    pCur->row = 0;
-    return xbin_get_line(pCur);
-  } else if (idxNum == 1) {
-    pCur->row = sqlite3_value_int64(argv[0]) - 1;
-    fseek( pCur->fptr, (pCur->row) * sizeof(xbinData), SEEK_SET );
-    return xbin_get_line(pCur);
-  }
-}
-
-/*
-** SQLite will invoke this method one or more times while planning a query
-** that uses the virtual table.  This routine needs to create
-** a query plan for each invocation and compute an estimated cost for that
-** plan.
-*/
-static int xbinBestIndex(
-  sqlite3_vtab *tab,
-  sqlite3_index_info *pIdxInfo
-) {
-  int i;
-  int idx = -1;
-
-  for (i = 0; i < pIdxInfo->nOrderBy; i++) {
-    /*for rowid*/
-    if ( pIdxInfo->aOrderBy[i].iColumn == 0 ) {
-      pIdxInfo->orderByConsumed = 1;
-      break;
-    }
-  }
-
-  for (i = 0; i < pIdxInfo->nConstraint; i++) {
-    if ( pIdxInfo->aConstraint[i].iColumn != 0 ) continue;
-    if ( pIdxInfo->aConstraint[i].usable == 0 ) {
-      return SQLITE_CONSTRAINT;
-    }
-    if ( (pIdxInfo->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_EQ) || (pIdxInfo->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_GE) ) {
-      idx = i;
-    }
-  }
-
-  if ( idx >= 0 ) {
-    pIdxInfo->aConstraintUsage[idx].argvIndex = 1;
-    pIdxInfo->aConstraintUsage[idx].omit = 1;
-    pIdxInfo->estimatedRows = 1;
-    pIdxInfo->idxNum = 1;
-    pIdxInfo->estimatedCost = 1.0;
-    pIdxInfo->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
-    return SQLITE_OK;
-  }
-
-  pIdxInfo->idxNum = 0;
-  pIdxInfo->estimatedCost = 100000.0;
-  pIdxInfo->estimatedRows = 100000;
-  return SQLITE_OK;
-}
-
-static int xbinUpdate(
-  sqlite3_vtab *vtab,
-  int argc, sqlite3_value **argv,
-  sqlite_int64 *rowid
-) {
-  XbinTable* pTab = (XbinTable*) vtab;
-  if (argc == 1) {
-    // argc = 1
-    // argv[0] ≠ NULL
-    // DELETE: The single row with rowid or PRIMARY KEY equal to argv[0] is deleted. No insert occurs.
-    sqlite3_free(pTab->base.zErrMsg);
-    pTab->base.zErrMsg = sqlite3_mprintf("Delete Error: delete is disabled by default.");
-    return SQLITE_ERROR;
-  } else if ((argc > 1) && (sqlite3_value_type(argv[0]) == SQLITE_NULL)) {
-    // argc > 1
-    // argv[0] = NULL
-    // INSERT: A new row is inserted with column values taken from argv[2] and following.
-    // In a rowid virtual table, if argv[1] is an SQL NULL, then a new unique rowid is generated automatically.
-    fseek(pTab->fptr, 0, SEEK_END);
-
-    xbinData data;
-    data.id = sqlite3_value_double(argv[3]);
-    data.iq = sqlite3_value_double(argv[4]);
-    data.speed = sqlite3_value_double(argv[5]);
-    data.torque = sqlite3_value_double(argv[6]);
-    data.Ld = sqlite3_value_double(argv[7]);
-    data.Lq = sqlite3_value_double(argv[8]);
-    data.Lambda = sqlite3_value_double(argv[9]);
-    data.Rs = sqlite3_value_double(argv[10]);
-    data.Temp = sqlite3_value_double(argv[11]);
-
-    fwrite(&data, sizeof(xbinData), 1, pTab->fptr);
-  }
-  return SQLITE_OK;
-}
-
-/*
-** This following structure defines all the methods for the
-** virtual table.
-*/
-static sqlite3_module xbinModule = {
-  /* iVersion    */ 0,
-  /* xCreate     */ xbinConnect,
-  /* xConnect    */ xbinConnect,
-  /* xBestIndex  */ xbinBestIndex,
-  /* xDisconnect */ xbinDisconnect,
-  /* xDestroy    */ xbinDisconnect,
-  /* xOpen       */ xbinOpen,
-  /* xClose      */ xbinClose,
-  /* xFilter     */ xbinFilter,
-  /* xNext       */ xbinNext,
-  /* xEof        */ xbinEof,
-  /* xColumn     */ xbinColumn,
-  /* xRowid      */ xbinRowid,
-  /* xUpdate     */ xbinUpdate,
-  /* xBegin      */ 0,
-  /* xSync       */ 0,
-  /* xCommit     */ 0,
-  /* xRollback   */ 0,
-  /* xFindMethod */ 0,
-  /* xRename     */ 0,
-  /* xSavepoint  */ 0,
-  /* xRelease    */ 0,
-  /* xRollbackTo */ 0,
-  /* xShadowName */ 0
-};
-
-
-#ifdef _WIN32
-__declspec(dllexport)
-#endif
-int sqlite3_xbin_init(
-  sqlite3 *db,
-  char **pzErrMsg,
-  const sqlite3_api_routines *pApi
-) {
-  int rc = SQLITE_OK;
-  SQLITE_EXTENSION_INIT2(pApi);
-  rc = sqlite3_create_module(db, "xbin", &xbinModule, NULL);
-  return rc;
-}
+/*
+** 2020-04-03 by hgl10
+** xbin interface for sqlite virtual table
+**
+** .load xbin
+** create virtual table xbin using xbin(./test.bin);
+** select count(*) from xbin;
+** .timer on
+** select rowid, * from xbin where rowid > 100000 order by rowid limit 10;
+** delete from xbin where rowid = 1;
+*/
+
+#if !defined(SQLITEINT_H)
+#include "sqlite3ext.h"
+#endif
+SQLITE_EXTENSION_INIT1
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <glob.h>
+#endif
+#ifndef XBIN_OMIT_THREADS
+# ifdef _WIN32
+#  include <windows.h>
+# else
+#  include <pthread.h>
+#  include <unistd.h>
+# endif
+#endif
+
+#ifndef XBIN_OMIT_SIMD
+# if defined(__x86_64__) || defined(_M_X64)
+#  include <immintrin.h>
+#  define XBIN_SIMD_SSE2 1
+#  if defined(__GNUC__)
+#   define XBIN_SIMD_AVX2 1
+#  endif
+# endif
+#endif
+
+#ifdef XBIN_SIMD_AVX2
+static int xbinSimdAvx2 = 0;    /* True if the CPU runs AVX2, see sqlite3_xbin_init() */
+#endif
+
+#ifdef _WIN32
+# define xbin_fseek _fseeki64
+# define xbin_ftell _ftelli64
+#else
+# define xbin_fseek fseeko
+# define xbin_ftell ftello
+#endif
+
+#define XBIN_NCOL        9      /* float columns in one record */
+#define XBIN_BLOCK_ROWS  4096   /* records fetched by one block read */
+#define XBIN_PROBE_ROWS  128    /* records fetched by a lookup of one row */
+#define XBIN_GATHER_GAP  256    /* lookups this close share one read */
+#define XBIN_MAX_ROW     (((sqlite3_int64)1) << 62)
+#define XBIN_SORT_RUN    65536  /* fewest entries sorted by one thread */
+#define XBIN_INDEX_COST  8      /* cost of a row fetched by index, in rows scanned */
+#define XBIN_LIST_AHEAD  16     /* rows of an index lookup announced ahead */
+#define XBIN_BLOOM_RATE  0.01   /* default false positive rate of a Bloom filter */
+#define XBIN_KD_LEAF     16     /* most points in a k-d tree node that is not split */
+#define XBIN_PAR_BLOCKS  4      /* blocks queued per thread of a parallel scan */
+#define XBIN_DETECT_ROWS (16 * XBIN_BLOCK_ROWS)  /* records a sort key is picked on */
+
+/* Threads one operation may start; threads= asking for more is an error */
+#ifndef XBIN_MAX_THREADS
+# define XBIN_MAX_THREADS 64
+#endif
+
+typedef struct xbinData {
+  float id;
+  float iq;
+  float speed;
+  float torque;
+  float Ld;
+  float Lq;
+  float Lambda;
+  float Rs;
+  float Temp;
+} xbinData;
+
+/* Value of column iCol (1..XBIN_NCOL) of the record at p */
+#define XBIN_VALUE(p, iCol)  (((const float*)(p))[(iCol) - 1])
+
+/* Bit of column iCol in a column mask, the same layout as colUsed */
+#define XBIN_COLBIT(iCol)    (((sqlite3_uint64)1) << (iCol))
+
+/* Mask of the columns stored in the records, i.e. all but row */
+#define XBIN_DATA_COLS       (XBIN_COLBIT(XBIN_NCOL + 1) - XBIN_COLBIT(1))
+
+/* Declaration of the record columns, in the order of xbinData */
+#define XBIN_DATA_SCHEMA \
+  "id REAL, iq REAL, speed REAL, torque REAL, ld REAL, lq REAL, lambda REAL, Rs REAL, temp REAL"
+
+/* Hidden columns of xbin tables, after the record columns */
+#define XBIN_SAMPLE_COL      (XBIN_NCOL + 1)  /* sample = F reads a fraction F of the blocks */
+#define XBIN_SEED_COL        (XBIN_NCOL + 2)  /* seed = N picks the same blocks every time */
+#define XBIN_FILTER_COL      (XBIN_NCOL + 3)  /* filter = 'expr' keeps the rows where expr is true */
+
+/* Columns computed from the others by the derive= arguments, last */
+#define XBIN_DERIVED_COL     (XBIN_NCOL + 4)  /* first of them */
+#define XBIN_MAX_DERIVED     16
+
+/* Row-aligned files zipped onto the table by zip= arguments, whose
+** columns come after the derived ones */
+#define XBIN_MAX_ZIP         4
+
+/* Union of the files matching a glob= argument, see xbinUnionStart() */
+#define XBIN_FILE_COL        (XBIN_NCOL + 4)  /* file holds the name of the file of a row */
+#define XBIN_FILE_SHIFT      32     /* rowid = (file number << XBIN_FILE_SHIFT) + row */
+#define XBIN_UNION_POOL      32     /* files of a union kept open when not in use */
+
+/* Column names as declared to SQLite, indexed by column number */
+static const char *const azXbinCol[] = {
+  "row", "id", "iq", "speed", "torque", "ld", "lq", "lambda", "Rs", "temp"
+};
+
+typedef struct XbinTable XbinTable;
+typedef struct XbinBitmap XbinBitmap;
+typedef struct XbinKdTree XbinKdTree;
+typedef struct XbinPla XbinPla;
+typedef struct XbinPyr XbinPyr;
+typedef struct XbinExpr XbinExpr;
+typedef struct XbinParScan XbinParScan;
+
+/* Zone map entry: the smallest and largest value of each column over
+** one aligned block of XBIN_BLOCK_ROWS records.  NaN values, which SQL
+** sees as NULL, are left out of aMin/aMax and flagged in mNan.
+*/
+typedef struct XbinZone {
+  float aMin[XBIN_NCOL];
+  float aMax[XBIN_NCOL];
+  unsigned int mNan;          /* Bit iCol-1 set if column iCol has a NaN */
+  unsigned int pad;
+} XbinZone;
+
+/* Statistics of one column over the whole file, see xbinStatsRefresh() */
+typedef struct XbinColStats {
+  sqlite3_int64 nValue;       /* Values that are not NULL */
+  double rMin;                /* Smallest value, +Inf if there is none */
+  double rMax;                /* Largest value, -Inf if there is none */
+  double rMean;               /* Mean value */
+  double rM2;                 /* Sum of squared differences from the mean */
+} XbinColStats;
+
+/* Header of the secondary index sidecar of one column, see
+** xbinIndexRefresh().  The entries follow it.
+*/
+typedef struct XbinIdxHdr {
+  char zMagic[8];             /* "xbinidx1" */
+  int iCol;                   /* Column indexed */
+  int pad;
+  sqlite3_int64 nRow;         /* Records covered */
+  sqlite3_int64 nEntry;       /* Entries, one per record where iCol is not NULL */
+  sqlite3_int64 nDistinct;    /* Distinct values among them */
+  xbinData tail;              /* Record nRow */
+} XbinIdxHdr;
+
+/* One axis of a regular grid: column iCol steps through the values
+** r0, r0+rStep, ... r0+(n-1)*rStep, moving on every nStride records.
+** See xbinGridCheck().
+*/
+typedef struct XbinAxis {
+  int iCol;                   /* Column of the axis */
+  int pad;
+  double r0;                  /* First value */
+  double rStep;               /* Distance between two values, never 0 */
+  sqlite3_int64 n;            /* Number of values */
+  sqlite3_int64 nStride;      /* Records per value */
+} XbinAxis;
+
+/* A regular grid that the records of a file walk through, outermost
+** axis first, starting over every nPeriod records if the file repeats
+** it.
+*/
+typedef struct XbinGrid {
+  int nAxis;                  /* Number of axes, 0 if the file is not a grid */
+  XbinAxis aAxis[XBIN_NCOL];  /* The axes, the last one moving fastest */
+  sqlite3_int64 nPeriod;      /* Records in one pass over the grid, 0 if only one */
+} XbinGrid;
+
+/* One file of a union table.  The summary is the zone map of the
+** whole file, all of its blocks merged, kept while the file keeps the
+** size and modification time it had when the summary was made.
+*/
+typedef struct XbinUnionFile {
+  XbinTable *pSub;            /* Table over the file, 0 if not open */
+  int nRef;                   /* Cursors reading pSub */
+  int bSum;                   /* True if sum is valid */
+  sqlite3_uint64 iUse;        /* When pSub was last used, to close the oldest */
+  XbinZone sum;               /* Summary of the zone map */
+  sqlite3_int64 nSumSize;     /* Size of the file when sum was made */
+  sqlite3_int64 iSumTime;     /* Modification time of the file then */
+} XbinUnionFile;
+
+/* Metadata sidecar that could not be written (a read-only directory),
+** kept in memory so that the file is not examined again.
+*/
+typedef struct XbinMetaCache XbinMetaCache;
+struct XbinMetaCache {
+  char *zPath;                /* Name of the sidecar */
+  char *zText;                /* What it would hold */
+  XbinMetaCache *pNext;       /* Next entry of the registry */
+};
+
+/* All xbin tables of one database connection, so that the functions
+** of this extension can find a table by name.  There is one registry
+** per connection, the client data of the modules.
+*/
+typedef struct XbinRegistry {
+  sqlite3 *db;                /* The database connection */
+  XbinTable *pFirst;          /* Connected tables */
+  XbinMetaCache *pMeta;       /* Metadata sidecars that could not be written */
+} XbinRegistry;
+
+/* The table-valued functions of this extension (xbin_gather(),
+** xbin_knn(), xbin_stats() ...) are virtual tables that only need the
+** registry, to find the xbin table named by their TABLE argument.
+*/
+typedef struct XbinFuncTab {
+  sqlite3_vtab base;          /* Base class - must be first */
+  XbinRegistry *pReg;         /* Where to look TABLE up */
+} XbinFuncTab;
+
+/* XbinTable is a subclass of sqlite3_vtab which is
+** underlying representation of the virtual table
+*/
+struct XbinTable {
+  sqlite3_vtab base;  /* Base class - must be first */
+  XbinRegistry *pReg; /* Registry this table is linked into */
+  XbinTable *pNext;   /* Next table in pReg */
+  char *zDb;          /* Schema holding the table, e.g. "main" */
+  char *zName;        /* Name of the table */
+  char *filename;     /* Name of the xbin file */
+  FILE *fptr;         /* used to scan file */
+  sqlite3_int64 nRow; /* Number of records in the file */
+
+  /* Metadata kept in the "<filename>.meta" sidecar */
+  sqlite3_int64 nMetaRow;     /* Records described by the metadata, -1 if unread */
+  xbinData metaTail;          /* Record nMetaRow, to notice a replaced file */
+  int nKey;                   /* Number of columns in the sort key */
+  int aKey[XBIN_NCOL];        /* The file is in ascending order of these columns */
+  sqlite3_uint64 mConst;      /* Columns holding one value in every record */
+  int nMetaDecl;              /* The sort= argument the metadata was made for */
+  int aMetaDecl[XBIN_NCOL];
+  int nDeclKey;               /* Number of columns in the sort= argument */
+  int aDeclKey[XBIN_NCOL];    /* Sort key declared by the sort= argument */
+  XbinGrid grid;              /* Grid the records form, if any */
+  int nMetaGridDecl;          /* The grid= argument the metadata was made for */
+  int aMetaGridDecl[XBIN_NCOL];
+  int nGridDecl;              /* Number of columns in the grid= argument */
+  int aGridDecl[XBIN_NCOL];   /* Grid axes declared by the grid= argument */
+
+  /* Zone maps kept in the "<filename>.zone" sidecar */
+  XbinZone *aZone;            /* One entry per block of XBIN_BLOCK_ROWS records */
+  sqlite3_int64 nZoneRow;     /* Records covered by aZone[], -1 if unread */
+  xbinData zoneTail;          /* Record nZoneRow, to notice a replaced file */
+  int aBloomBlk[XBIN_NCOL];   /* Bloom filter groups per block of each column */
+  unsigned int *aBloom[XBIN_NCOL]; /* The filters, aBloomBlk[]*8 words per block */
+
+  /* Secondary indexes kept in "<filename>.<column>.idx" sidecars */
+  int bIndexProbed;           /* True once mIndex and aIdx[] are loaded */
+  sqlite3_uint64 mIndex;      /* Columns that have an index */
+  XbinIdxHdr aIdx[XBIN_NCOL]; /* Header of the index on each column */
+
+  /* Bitmap indexes kept in "<filename>.<column>.bm" sidecars */
+  sqlite3_uint64 mBitmap;     /* Columns that have a bitmap index */
+  int aBmValue[XBIN_NCOL];    /* Distinct values in each of them */
+  XbinBitmap *apBm[XBIN_NCOL];/* Bitmap indexes loaded so far */
+
+  /* Learned indexes kept in "<filename>.<column>.pla" sidecars */
+  sqlite3_uint64 mLearned;    /* Columns that have a learned index */
+  XbinPla *apPla[XBIN_NCOL];  /* Learned indexes loaded so far */
+
+  /* Rollup pyramids kept in "<filename>.<column>.pyr" sidecars */
+  XbinPyr *apPyr[XBIN_NCOL];  /* Pyramids loaded so far */
+
+  /* Column statistics kept in the "<filename>.stats" sidecar */
+  sqlite3_int64 nStatsRow;    /* Records covered by aStats, -1 if unread */
+  xbinData statsTail;         /* Record nStatsRow, to notice a replaced file */
+  XbinColStats aStats[XBIN_NCOL];
+
+  /* K-d tree kept in the "<filename>.kd" sidecar */
+  XbinKdTree *pKd;            /* The tree, once loaded */
+
+  /* Derived columns, from the derive= arguments */
+  int nDerived;               /* Number of them */
+  char *azDerived[XBIN_MAX_DERIVED];       /* Their names */
+  XbinExpr *apDerived[XBIN_MAX_DERIVED];   /* Their compiled expressions */
+
+  /* Zipped files, from the zip= arguments */
+  int nZip;                   /* Number of them */
+  int iZipCol;                /* Column of the first record column of the first */
+  char *azZip[XBIN_MAX_ZIP];  /* Their names, the prefix of their columns */
+  FILE *apZip[XBIN_MAX_ZIP];  /* The open files */
+
+  /* Files of a union table, from a glob= argument */
+  int bUnion;                 /* True for a union table, whose fptr is 0 */
+  int nFile;                  /* Number of files, in order of name */
+  char **azFile;              /* Their names */
+  XbinUnionFile *aFile;       /* Their state */
+  int *aOpen;                 /* Files with an open pSub */
+  int nOpen;                  /* Number of entries in aOpen[] */
+  sqlite3_uint64 iUseClock;   /* Last value given to XbinUnionFile.iUse */
+
+  int nThread;                /* Threads of a scan, from threads=, 0 or 1 for none */
+};
+
+/* Block of records of a zipped file, buffered by a cursor */
+typedef struct XbinZipBlock {
+  xbinData *a;                /* The records, 0 until first needed */
+  sqlite3_int64 iBlock;       /* Rowid of a[0] */
+  int nBlock;                 /* Number of valid records in a[] */
+} XbinZipBlock;
+
+/* XbinCursor is a subclass of sqlite3_vtab_cursor which will
+** serve as the underlying representation of a cursor that scans
+** over rows of the result
+*/
+typedef struct XbinCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  FILE *fptr;                 /* used to scan file */
+  sqlite3_int64 row;          /* The rowid */
+  sqlite3_int64 iFirst;       /* Smallest rowid the scan may visit */
+  sqlite3_int64 iLast;        /* Largest rowid the scan may visit */
+  int bDesc;                  /* True to walk from iLast down to iFirst */
+  xbinData *aBlock;           /* Block of records read from the file */
+  sqlite3_int64 iBlock;       /* Rowid of aBlock[0] */
+  int nBlock;                 /* Number of valid records in aBlock */
+  xbinData *pData;            /* Record of the current row, 0 if not read yet */
+  sqlite3_uint64 mUsed;       /* Columns the statement reads (colUsed) */
+  struct XbinPred *aPred;     /* Predicates evaluated by the cursor */
+  int nPred;                  /* Number of entries in aPred[] */
+  int *aSel;                  /* Offsets in aBlock of the rows passing aPred */
+  int nSel;                   /* Number of entries in aSel[], -1 if stale */
+  int iSel;                   /* Entry of aSel[] for the current row */
+  sqlite3_int64 *aRowid;      /* Rows to visit, from an index, or 0 to scan */
+  sqlite3_int64 nRowid;       /* Number of entries in aRowid[] */
+  sqlite3_int64 iRowid;       /* Entry of aRowid[] for the current row */
+  double rSample;             /* Fraction of the blocks visited, 1.0 or more for all */
+  sqlite3_uint64 iSeed;       /* Picks the blocks of the sample */
+  int bSample;                /* True if rSample is from the sample column */
+  int bSeed;                  /* True if iSeed is from the seed column */
+  double *aDerived;           /* Derived columns of aBlock, XBIN_BLOCK_ROWS values each */
+  double *aReg;               /* Scratch registers of the expressions */
+  int nReg;                   /* Registers aReg[] has room for */
+  sqlite3_uint64 mDerived;    /* Derived columns computed in aDerived, by column bit */
+  double *aFilter;            /* Values of XBIN_PRED_EXPR conditions over a block */
+  char *zFilter;              /* Condition given to the filter column, if any */
+  XbinZipBlock aZip[XBIN_MAX_ZIP];  /* Records of the zipped files */
+  XbinParScan *pPar;          /* Threads of a parallel scan, once started */
+  int bPar;                   /* True if blocks come from pPar, see xbinParLoad() */
+} XbinCursor;
+
+/*
+** A predicate on one column, evaluated block-at-a-time by the cursor.
+** Comparisons, near() and in_box() all become XBIN_PRED_RANGE: the value
+** lies between rLo and rHi, bounds excluded if bLoOpen/bHiOpen.  NaN
+** (SQL NULL) values never pass, except for XBIN_PRED_NULL.  A condition
+** given to the filter column is an XBIN_PRED_EXPR on that column.
+*/
+typedef struct XbinPred {
+  int iCol;                   /* Column number, 1..XBIN_NCOL or a derived column */
+  int eType;                  /* XBIN_PRED_* */
+  double rLo, rHi;            /* XBIN_PRED_RANGE bounds, XBIN_PRED_NE value in rLo */
+  int bLoOpen, bHiOpen;
+  XbinExpr *pExpr;            /* XBIN_PRED_EXPR condition, owned by the cursor */
+} XbinPred;
+
+#define XBIN_PRED_RANGE    1  /* rLo <= value <= rHi */
+#define XBIN_PRED_NE       2  /* value != rLo */
+#define XBIN_PRED_NULL     3  /* value IS NULL */
+#define XBIN_PRED_NOTNULL  4  /* value IS NOT NULL */
+#define XBIN_PRED_FALSE    5  /* no row passes */
+#define XBIN_PRED_EXPR     6  /* pExpr is true */
+
+/*
+** Operators returned by xbinFindMethod() for the two-argument forms of
+** near() and in_box(), which xbinBestIndex() then sees as constraints.
+*/
+#define XBIN_OP_NEAR    (SQLITE_INDEX_CONSTRAINT_FUNCTION)
+#define XBIN_OP_INBOX   (SQLITE_INDEX_CONSTRAINT_FUNCTION + 1)
+
+/*
+** Bits of idxNum computed by xbinBestIndex().  The rest of the plan is
+** in idxStr, a list of comma terminated entries:
+**
+**    kN       the plan relies on column N being the next sort key level
+**    m        the planner had no sort key or grid metadata covering the
+**             whole file; xbinFilter() brings it up to date
+**    g        compute the rows selected by the cN:op range constraints on
+**             the axes of the grid the records form
+**    iN       look the cN:op range constraints on column N up in its index
+**    bN       answer the cN:op range constraints on column N, and on the
+**             other columns of bN entries, from their bitmap indexes
+**    lN       narrow the rows to those in the cN:op range constraints on
+**             column N, found from its learned index
+**    sN:op    constraint on sort key column N, resolved by binary search
+**    cN:op    constraint on column N evaluated by the cursor (row
+**             constraints set the bounds of the scan)
+**    zN:op    same as cN:op for IS NULL and IS NOT NULL, with no argv[]
+**    f        visit the blocks of a sample, of the fraction of them given
+**             by the sample column
+**    r        seed of the sample, from the seed column
+**    x        condition the rows must pass, from the filter column
+**    n:op     constraint on the file column of a union table
+**    uX       colUsed, the columns read by the statement, in hex
+**
+** sN:op, cN:op, n:op, f, r and x take the next argv[] value as their
+** right-hand side.
+** op is an SQLITE_INDEX_CONSTRAINT_* or XBIN_OP_* code.
+*/
+#define XBIN_IDX_DESC  0x01   /* Walk the rows in descending order */
+#define XBIN_IDX_ORDER 0x02   /* The ORDER BY is consumed, keep to the order of the rows */
+
+/* A constraint passed to xbinFilter(), decoded from idxStr and argv[] */
+typedef struct XbinCons {
+  char eKind;                 /* Letter of the idxStr entry */
+  int iCol;                   /* Column number, 0 for row */
+  int op;                     /* SQLITE_INDEX_CONSTRAINT_* or XBIN_OP_* code */
+  sqlite3_value *pVal;        /* Right-hand side, 0 for IS NULL and IS NOT NULL */
+} XbinCons;
+
+/*
+** Count the records in the file.  Any trailing partial record is ignored.
+*/
+static sqlite3_int64 xbinRowCount(FILE *fptr) {
+  sqlite3_int64 nByte;
+  if ( xbin_fseek(fptr, 0, SEEK_END) != 0 ) return 0;
+  nByte = xbin_ftell(fptr);
+  if ( nByte < 0 ) return 0;
+  return nByte / sizeof(xbinData);
+}
+
+/*
+** Read n records starting at rowid iStart into aRec[].  Return the
+** number of records read, less than n at the end of file.
+*/
+static sqlite3_int64 xbinReadRecords(
+  FILE *fptr,
+  sqlite3_int64 iStart, sqlite3_int64 n,
+  xbinData *aRec
+) {
+  if ( iStart < 1 || n <= 0 ) return 0;
+  if ( xbin_fseek(fptr, (iStart - 1) * (sqlite3_int64)sizeof(xbinData), SEEK_SET) != 0 ) return 0;
+  return (sqlite3_int64)fread(aRec, sizeof(xbinData), (size_t)n, fptr);
+}
+
+/*
+** Read record iRow into *p.  Return 0 if it is past the end of file.
+*/
+static int xbinReadRecord(FILE *fptr, sqlite3_int64 iRow, xbinData *p) {
+  return xbinReadRecords(fptr, iRow, 1, p) == 1;
+}
+
+/*
+** Ask the OS to start fetching records iStart..iStart+n-1 in the
+** background.  The kernel read-ahead only follows forward scans, so a
+** backward scan or a batch of lookups announces the blocks it will
+** want next by itself.
+*/
+static void xbinReadAhead(FILE *fptr, sqlite3_int64 iStart, sqlite3_int64 n) {
+#if defined(POSIX_FADV_WILLNEED)
+  if ( n > 0 && iStart > 0 ) {
+    posix_fadvise(fileno(fptr), (off_t)((iStart - 1) * sizeof(xbinData)),
+                  (off_t)(n * sizeof(xbinData)), POSIX_FADV_WILLNEED);
+  }
+#else
+  (void)fptr; (void)iStart; (void)n;
+#endif
+}
+
+/*
+** Read records iStart..iEnd in blocks of XBIN_BLOCK_ROWS and hand each
+** block to xBlock(pArg, iRow, aRec, nRec), iRow being the rowid of
+** aRec[0].  Stop early, returning its value, if xBlock does not return
+** SQLITE_OK.
+*/
+static int xbinForEachBlock(
+  FILE *fptr,
+  sqlite3_int64 iStart, sqlite3_int64 iEnd,
+  int (*xBlock)(void*, sqlite3_int64, const xbinData*, int),
+  void *pArg
+) {
+  xbinData *aRec;
+  int rc = SQLITE_OK;
+
+  if ( iStart > iEnd ) return SQLITE_OK;
+  aRec = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(xbinData) );
+  if ( aRec == 0 ) return SQLITE_NOMEM;
+  xbin_fseek(fptr, (iStart - 1) * (sqlite3_int64)sizeof(xbinData), SEEK_SET);
+  while ( rc == SQLITE_OK && iStart <= iEnd ) {
+    sqlite3_int64 n = iEnd - iStart + 1;
+    size_t nGot;
+    if ( n > XBIN_BLOCK_ROWS ) n = XBIN_BLOCK_ROWS;
+    nGot = fread(aRec, sizeof(xbinData), (size_t)n, fptr);
+    if ( nGot == 0 ) break;
+    rc = xBlock(pArg, iStart, aRec, (int)nGot);
+    iStart += nGot;
+  }
+  sqlite3_free(aRec);
+  return rc;
+}
+
+/*
+** Work handed to a thread of its own.  SQLite may be built single
+** threaded, so the work must not call into it: memory and files it
+** needs are set up by the calling thread.  xbinTaskStart() does the
+** work in the calling thread instead if no thread can be started, or
+** if the extension is built with XBIN_OMIT_THREADS.
+*/
+typedef struct XbinTask {
+  void (*xWork)(void*);       /* What to do */
+  void *pArg;                 /* Its argument */
+  int bThread;                /* True if running in a thread of its own */
+#ifndef XBIN_OMIT_THREADS
+# ifdef _WIN32
+  HANDLE hThread;
+# else
+  pthread_t tid;
+# endif
+#endif
+} XbinTask;
+
+#ifndef XBIN_OMIT_THREADS
+# ifdef _WIN32
+static DWORD WINAPI xbinTaskMain(LPVOID p) {
+  XbinTask *pTask = (XbinTask*)p;
+  pTask->xWork(pTask->pArg);
+  return 0;
+}
+# else
+static void *xbinTaskMain(void *p) {
+  XbinTask *pTask = (XbinTask*)p;
+  pTask->xWork(pTask->pArg);
+  return 0;
+}
+# endif
+#endif
+
+/*
+** Start a thread running xWork(pArg).  Return false, doing nothing, if
+** there is none to be had.
+*/
+static int xbinTaskSpawn(XbinTask *pTask, void (*xWork)(void*), void *pArg) {
+  pTask->xWork = xWork;
+  pTask->pArg = pArg;
+  pTask->bThread = 0;
+#ifndef XBIN_OMIT_THREADS
+# ifdef _WIN32
+  pTask->hThread = CreateThread(0, 0, xbinTaskMain, pTask, 0, 0);
+  pTask->bThread = (pTask->hThread != 0);
+# else
+  pTask->bThread = (pthread_create(&pTask->tid, 0, xbinTaskMain, pTask) == 0);
+# endif
+#endif
+  return pTask->bThread;
+}
+
+static void xbinTaskStart(XbinTask *pTask, void (*xWork)(void*), void *pArg) {
+  if ( !xbinTaskSpawn(pTask, xWork, pArg) ) xWork(pArg);
+}
+
+static void xbinTaskJoin(XbinTask *pTask) {
+  if ( !pTask->bThread ) return;
+#ifndef XBIN_OMIT_THREADS
+# ifdef _WIN32
+  WaitForSingleObject(pTask->hThread, INFINITE);
+  CloseHandle(pTask->hThread);
+# else
+  pthread_join(pTask->tid, 0);
+# endif
+#endif
+  pTask->bThread = 0;
+}
+
+/*
+** A lock and a condition for threads that stay around between pieces of
+** work to wait on: xbinParkWait() is called with the lock held, and
+** xbinParkWake() wakes every thread waiting.
+*/
+typedef struct XbinPark {
+#ifndef XBIN_OMIT_THREADS
+# ifdef _WIN32
+  CRITICAL_SECTION mutex;
+  CONDITION_VARIABLE cond;
+# else
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+# endif
+#else
+  int iUnused;
+#endif
+} XbinPark;
+
+#ifndef XBIN_OMIT_THREADS
+# ifdef _WIN32
+#  define xbinParkInit(p)   (InitializeCriticalSection(&(p)->mutex), InitializeConditionVariable(&(p)->cond))
+#  define xbinParkFree(p)   DeleteCriticalSection(&(p)->mutex)
+#  define xbinParkLock(p)   EnterCriticalSection(&(p)->mutex)
+#  define xbinParkUnlock(p) LeaveCriticalSection(&(p)->mutex)
+#  define xbinParkWait(p)   SleepConditionVariableCS(&(p)->cond, &(p)->mutex, INFINITE)
+#  define xbinParkWake(p)   WakeAllConditionVariable(&(p)->cond)
+# else
+#  define xbinParkInit(p)   (pthread_mutex_init(&(p)->mutex, 0), pthread_cond_init(&(p)->cond, 0))
+#  define xbinParkFree(p)   (pthread_cond_destroy(&(p)->cond), pthread_mutex_destroy(&(p)->mutex))
+#  define xbinParkLock(p)   pthread_mutex_lock(&(p)->mutex)
+#  define xbinParkUnlock(p) pthread_mutex_unlock(&(p)->mutex)
+#  define xbinParkWait(p)   pthread_cond_wait(&(p)->cond, &(p)->mutex)
+#  define xbinParkWake(p)   pthread_cond_broadcast(&(p)->cond)
+# endif
+#else
+# define xbinParkInit(p)
+# define xbinParkFree(p)
+# define xbinParkLock(p)
+# define xbinParkUnlock(p)
+# define xbinParkWait(p)
+# define xbinParkWake(p)
+#endif
+
+/*
+** Counters shared between threads without a lock: xbinAtomicGet()
+** acquires and xbinAtomicSet() releases, so what was written before the
+** counter is seen by the thread that reads the new value.
+*/
+#if defined(_MSC_VER)
+# define xbinAtomicGet(p)       InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0)
+# define xbinAtomicSet(p, v)    InterlockedExchange64((volatile LONG64*)(p), (v))
+# define xbinAtomicCas(p, o, n) (InterlockedCompareExchange64((volatile LONG64*)(p), (n), (o)) == (o))
+#else
+# define xbinAtomicGet(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define xbinAtomicSet(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# define xbinAtomicCas(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#endif
+
+/*
+** Number of threads worth running at once, at most XBIN_MAX_THREADS.
+*/
+static int xbinCpuCount(void) {
+  int n = 1;
+#ifndef XBIN_OMIT_THREADS
+# ifdef _WIN32
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  n = (int)si.dwNumberOfProcessors;
+# elif defined(_SC_NPROCESSORS_ONLN)
+  n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+# endif
+#endif
+  if ( n < 1 ) n = 1;
+  if ( n > XBIN_MAX_THREADS ) n = XBIN_MAX_THREADS;
+  return n;
+}
+
+/*
+** Look up a column by name.  Return its number, or 0 if there is none.
+*/
+static int xbinColumnIndex(const char *zName, int nName) {
+  int i;
+  for (i = 1; i <= XBIN_NCOL; i++) {
+    if ( sqlite3_strnicmp(zName, azXbinCol[i], nName) == 0
+      && azXbinCol[i][nName] == 0 ) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+/*
+** Parse a comma separated list of column names into aCol[].  Return the
+** number of columns, or -1 if a name is unknown or repeated.
+*/
+static int xbinParseColumns(const char *z, int *aCol) {
+  int n = 0;
+  while ( *z ) {
+    int nName;
+    int iCol;
+    int i;
+    while ( isspace((unsigned char)*z) || *z == ',' ) z++;
+    if ( *z == 0 ) break;
+    for (nName = 0; z[nName] && z[nName] != ',' && !isspace((unsigned char)z[nName]); nName++) {}
+    iCol = xbinColumnIndex(z, nName);
+    if ( iCol == 0 || n >= XBIN_NCOL ) return -1;
+    for (i = 0; i < n; i++) {
+      if ( aCol[i] == iCol ) return -1;
+    }
+    aCol[n++] = iCol;
+    z += nName;
+  }
+  return n;
+}
+
+/*
+** Sort key detection and verification.
+**
+** The file is in order of the key (k1, k2, ...) if, between any two
+** consecutive records, k1 does not decrease, k2 does not decrease while
+** k1 stays the same, and so on.  xbinSortBlock() walks a block checking
+** the first nKey columns of aKey[], shortening nKey at the first level
+** that breaks.  At the same time it drops from mCand the columns that
+** decrease while the whole key stays the same (these are the columns
+** that may extend the key) and from mConst the columns that change.
+*/
+typedef struct XbinSortCheck {
+  int nKey;                   /* Levels of aKey[] still in order */
+  int aKey[XBIN_NCOL];        /* Key being checked */
+  sqlite3_uint64 mCand;       /* Columns that could extend the key */
+  sqlite3_uint64 mConst;      /* Columns that did not change so far */
+  int bTie;                   /* Two records had the same whole key */
+  int bPrev;                  /* True once prev holds a record */
+  xbinData prev;              /* Record before the next one to check */
+} XbinSortCheck;
+
+static int xbinSortBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinSortCheck *p = (XbinSortCheck*)pArg;
+  const xbinData *pPrev = &p->prev;
+  int i;
+  (void)iRow;
+
+  for (i = 0; i < nRec; i++) {
+    const xbinData *pRec = &aRec[i];
+    if ( p->bPrev ) {
+      int iLvl;
+      int iCol;
+      for (iCol = 1; iCol <= XBIN_NCOL; iCol++) {
+        if ( (p->mConst & XBIN_COLBIT(iCol))
+          && XBIN_VALUE(pRec, iCol) != XBIN_VALUE(pPrev, iCol) ) {
+          p->mConst &= ~XBIN_COLBIT(iCol);
+        }
+      }
+      for (iLvl = 0; iLvl < p->nKey; iLvl++) {
+        float vPrev = XBIN_VALUE(pPrev, p->aKey[iLvl]);
+        float v = XBIN_VALUE(pRec, p->aKey[iLvl]);
+        if ( v > vPrev ) break;
+        if ( !(v == vPrev) ) {
+          p->nKey = iLvl;
+          p->mCand = 0;
+          break;
+        }
+      }
+      if ( iLvl == p->nKey ) p->bTie = 1;
+      if ( iLvl == p->nKey && p->mCand ) {
+        for (iCol = 1; iCol <= XBIN_NCOL; iCol++) {
+          if ( (p->mCand & XBIN_COLBIT(iCol))
+            && !(XBIN_VALUE(pRec, iCol) >= XBIN_VALUE(pPrev, iCol)) ) {
+            p->mCand &= ~XBIN_COLBIT(iCol);
+          }
+        }
+      }
+    }
+    pPrev = pRec;
+  }
+  if ( nRec > 0 ) {
+    p->prev = aRec[nRec - 1];
+    p->bPrev = 1;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Grid detection.
+**
+** Motor maps are written as nested loops over a few operating point
+** columns, e.g. iq stepping 0..7 inside id stepping 0..1000, so the
+** rowid of any point can be computed instead of searched for.  The
+** axes are given by the grid= argument or, failing that, taken from
+** the sort key.  xbinGridDetect() reads the origin, step and extent of
+** each axis from the first records; the file is a grid if every record
+** then holds the value xbinGridValue() computes for it.  The outermost
+** axis grows as the records go on; should it come back to its first
+** value instead, the file repeats the grid from there on.
+*/
+static float xbinGridValue(const XbinAxis *p, sqlite3_int64 t) {
+  return (float)(p->r0 + (double)t * p->rStep);
+}
+
+/*
+** Return 1 if record iRow, with values p, has its place in the grid.
+** The records must be checked in order, as the extent of the outermost
+** axis and the period are set on the way.
+*/
+static int xbinGridCheck(XbinGrid *g, sqlite3_int64 iRow, const xbinData *p) {
+  XbinAxis *pOut = &g->aAxis[0];
+  sqlite3_int64 iPos = iRow - 1;
+  int k;
+
+  if ( g->nPeriod ) {
+    iPos %= g->nPeriod;
+  } else if ( iPos >= pOut->n * pOut->nStride ) {
+    if ( XBIN_VALUE(p, pOut->iCol) == xbinGridValue(pOut, 0) ) {
+      g->nPeriod = iPos;
+      iPos = 0;
+    } else {
+      pOut->n++;
+    }
+  }
+  for (k = 0; k < g->nAxis; k++) {
+    const XbinAxis *pAx = &g->aAxis[k];
+    sqlite3_int64 t = iPos / pAx->nStride;
+    if ( k > 0 ) t %= pAx->n;
+    if ( !(XBIN_VALUE(p, pAx->iCol) == xbinGridValue(pAx, t)) ) return 0;
+  }
+  return 1;
+}
+
+static int xbinGridBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  int i;
+  for (i = 0; i < nRec; i++) {
+    if ( !xbinGridCheck((XbinGrid*)pArg, iRow + i, &aRec[i]) ) return SQLITE_DONE;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Set up *g as the grid over the nAxis columns of aCol[], outermost
+** first, from the first records of the file.  Every axis must take at
+** least two values.  Return 0 if the records cannot be such a grid.
+*/
+static int xbinGridDetect(FILE *fptr, int nAxis, const int *aCol, XbinGrid *g) {
+  sqlite3_int64 nStride = 1;
+  xbinData first, rec;
+  int k;
+
+  memset(g, 0, sizeof(*g));
+  if ( nAxis == 0 || !xbinReadRecord(fptr, 1, &first) ) return 0;
+  for (k = nAxis - 1; k >= 0; k--) {
+    XbinAxis *pAx = &g->aAxis[k];
+    float v0 = XBIN_VALUE(&first, aCol[k]);
+    sqlite3_int64 t;
+    pAx->iCol = aCol[k];
+    pAx->r0 = v0;
+    pAx->nStride = nStride;
+    if ( v0 != v0 || !xbinReadRecord(fptr, 1 + nStride, &rec) ) return 0;
+    pAx->rStep = (double)XBIN_VALUE(&rec, aCol[k]) - v0;
+    if ( !(pAx->rStep != 0.0) ) return 0;
+    if ( k == 0 ) {
+      /* Extended by xbinGridCheck() */
+      pAx->n = 1;
+      break;
+    }
+    for (t = 2; xbinReadRecord(fptr, 1 + t * nStride, &rec); t++) {
+      float v = XBIN_VALUE(&rec, aCol[k]);
+      if ( v == xbinGridValue(pAx, t) ) continue;
+      if ( v == v0 ) break;
+      return 0;
+    }
+    pAx->n = t;
+    nStride *= t;
+  }
+  g->nAxis = nAxis;
+  return 1;
+}
+
+/*
+** Set pTab->grid to the grid over the nAxis columns of aCol[] if all
+** the records of the file form one, or clear it.
+*/
+static int xbinGridVerify(XbinTable *pTab, int nAxis, const int *aCol) {
+  XbinGrid *g = &pTab->grid;
+  int rc;
+  if ( !xbinGridDetect(pTab->fptr, nAxis, aCol, g) ) return SQLITE_OK;
+  rc = xbinForEachBlock(pTab->fptr, 1, pTab->nRow, xbinGridBlock, g);
+  if ( rc != SQLITE_OK ) g->nAxis = 0;
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/*
+** Bring pTab->grid up to date with the records of the file, records
+** before iStart having been checked already.
+*/
+static int xbinGridRefresh(XbinTable *pTab, sqlite3_int64 iStart) {
+  XbinGrid *g = &pTab->grid;
+  int rc;
+
+  if ( iStart > 1 ) {
+    if ( g->nAxis == 0 ) return SQLITE_OK;
+    rc = xbinForEachBlock(pTab->fptr, iStart, pTab->nRow, xbinGridBlock, g);
+    if ( rc != SQLITE_DONE ) return rc;
+    /* The inner axes may have been cut short by the end of file */
+  }
+  g->nAxis = 0;
+  if ( pTab->nGridDecl > 0 ) {
+    rc = xbinGridVerify(pTab, pTab->nGridDecl, pTab->aGridDecl);
+  } else {
+    /* Try the sort key, then the levels of it below the first, ... */
+    int aCol[XBIN_NCOL];
+    int nCol = 0;
+    int i;
+    for (i = 0; i < pTab->nKey; i++) {
+      if ( (pTab->mConst & XBIN_COLBIT(pTab->aKey[i])) == 0 ) aCol[nCol++] = pTab->aKey[i];
+    }
+    rc = SQLITE_OK;
+    for (i = 0; i < nCol && rc == SQLITE_OK && g->nAxis == 0; i++) {
+      rc = xbinGridVerify(pTab, nCol - i, &aCol[i]);
+    }
+  }
+  if ( rc != SQLITE_OK ) return rc;
+  if ( g->nAxis == 0 ) memset(g, 0, sizeof(*g));
+  if ( g->nAxis == 0 && pTab->nGridDecl > 0 ) {
+    sqlite3_log(SQLITE_WARNING, "xbin: %s is not a regular grid over its grid= columns",
+                pTab->filename);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Parse the grid= line of the metadata sidecar into *g, leaving the
+** period alone.  Return the number of axes, or -1 if malformed.
+*/
+static int xbinGridParse(const char *z, XbinGrid *g) {
+  sqlite3_int64 nStride = 1;
+  int n = 0;
+  int k;
+
+  while ( *z ) {
+    XbinAxis *pAx;
+    char *zEnd;
+    int nName;
+    if ( *z == ',' ) z++;
+    if ( *z == 0 ) break;
+    for (nName = 0; z[nName] && z[nName] != ':'; nName++) {}
+    if ( n >= XBIN_NCOL || z[nName] != ':' ) return -1;
+    pAx = &g->aAxis[n++];
+    pAx->iCol = xbinColumnIndex(z, nName);
+    pAx->r0 = strtod(z + nName + 1, &zEnd);
+    if ( *zEnd != ':' ) return -1;
+    pAx->rStep = strtod(zEnd + 1, &zEnd);
+    if ( *zEnd != ':' ) return -1;
+    pAx->n = strtoll(zEnd + 1, &zEnd, 10);
+    if ( pAx->iCol == 0 || !(pAx->rStep != 0.0) || pAx->n < 1 ) return -1;
+    z = zEnd;
+  }
+  for (k = n - 1; k >= 0; k--) {
+    g->aAxis[k].nStride = nStride;
+    nStride *= g->aAxis[k].n;
+  }
+  g->nAxis = n;
+  return n;
+}
+
+/*
+** Find the cell of grid g around the point aX[] (one coordinate per
+** axis) in the first pass over the grid, for multilinear interpolation.
+** Set aRow[] to the rowids of its 2^nAxis corners and aW[] to their
+** weights, corner c being the upper neighbour on axis k if bit
+** nAxis-1-k of c is set.  Return 0 if the point is outside the grid.
+*/
+static int xbinGridCell(const XbinGrid *g, const double *aX, sqlite3_int64 *aRow, double *aW) {
+  sqlite3_int64 aLo[XBIN_NCOL];
+  double aFrac[XBIN_NCOL];
+  int nCorner = 1 << g->nAxis;
+  int c, k;
+
+  for (k = 0; k < g->nAxis; k++) {
+    const XbinAxis *pAx = &g->aAxis[k];
+    double t = (aX[k] - pAx->r0) / pAx->rStep;
+    double v0, v1;
+    sqlite3_int64 i;
+    if ( !(t > -1.0 && t < (double)pAx->n) ) return 0;
+    i = (sqlite3_int64)floor(t);
+    if ( i < 0 ) i = 0;
+    if ( i > pAx->n - 2 ) i = pAx->n - 2;
+    /* Settle on the float values actually stored */
+    while ( i > 0 && (xbinGridValue(pAx, i) - aX[k]) * pAx->rStep > 0.0 ) i--;
+    while ( i < pAx->n - 2 && (aX[k] - xbinGridValue(pAx, i + 1)) * pAx->rStep > 0.0 ) i++;
+    v0 = xbinGridValue(pAx, i);
+    v1 = xbinGridValue(pAx, i + 1);
+    aFrac[k] = (aX[k] - v0) / (v1 - v0);
+    if ( !(aFrac[k] >= 0.0 && aFrac[k] <= 1.0) ) return 0;
+    aLo[k] = i;
+  }
+  for (c = 0; c < nCorner; c++) {
+    aRow[c] = 1;
+    aW[c] = 1.0;
+    for (k = 0; k < g->nAxis; k++) {
+      int bUp = (c >> (g->nAxis - 1 - k)) & 1;
+      aRow[c] += (aLo[k] + bUp) * g->aAxis[k].nStride;
+      aW[c] *= bUp ? aFrac[k] : 1.0 - aFrac[k];
+    }
+  }
+  return 1;
+}
+
+/*
+** Name of the metadata sidecar of the table.  Free with sqlite3_free().
+*/
+static char *xbinMetaPath(XbinTable *pTab) {
+  return sqlite3_mprintf("%s.meta", pTab->filename);
+}
+
+/*
+** Sidecars are written to "<path>.tmp" and renamed over the old file
+** once complete, so another connection or process opening one sees
+** either the old sidecar or the new one, never part of it.
+*/
+static FILE *xbinSideOpen(const char *zPath, const char *zMode) {
+  char *zTmp = sqlite3_mprintf("%s.tmp", zPath);
+  FILE *f = zTmp ? fopen(zTmp, zMode) : 0;
+  sqlite3_free(zTmp);
+  return f;
+}
+
+/*
+** Close a sidecar opened by xbinSideOpen() and, if bOk is set and all
+** of it was written, move it into place.  Return true if it was.
+*/
+static int xbinSideClose(const char *zPath, FILE *f, int bOk) {
+  char *zTmp = sqlite3_mprintf("%s.tmp", zPath);
+
+  if ( fflush(f) != 0 || ferror(f) ) bOk = 0;
+  if ( fclose(f) != 0 ) bOk = 0;
+  if ( zTmp == 0 ) return 0;
+  if ( bOk ) {
+#ifdef _WIN32
+    bOk = MoveFileExA(zTmp, zPath, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bOk = rename(zTmp, zPath) == 0;
+#endif
+  }
+  if ( !bOk ) remove(zTmp);
+  sqlite3_free(zTmp);
+  return bOk;
+}
+
+/*
+** Load the metadata sidecar.  The metadata is dropped (nMetaRow is set
+** to 0) if the sidecar is missing or unreadable.
+**
+** The sidecar is a text file of "key=value" lines:
+**
+**    rows=N          records described by the rest of the file
+**    tail=HEX        bytes of record N
+**    decl=a,b,c      the sort= argument the metadata was made for
+**    sort=a,b        the records are in ascending order of (a, b)
+**    const=c,d       columns that hold the same value in every record
+**    gdecl=a,b       the grid= argument the metadata was made for
+**    grid=a:r0:step:n,b:r0:step:n
+**                    the records walk the grid with these axes
+**    period=N        and start it over every N records, if N is not 0
+*/
+static void xbinMetaLine(XbinTable *pTab, char *zLine, int *pbTail) {
+  char *zVal = strchr(zLine, '=');
+  int n = (int)strlen(zLine);
+  while ( n > 0 && isspace((unsigned char)zLine[n-1]) ) zLine[--n] = 0;
+  if ( zVal == 0 ) return;
+  *(zVal++) = 0;
+  if ( strcmp(zLine, "rows") == 0 ) {
+    pTab->nMetaRow = strtoll(zVal, 0, 10);
+  } else if ( strcmp(zLine, "tail") == 0 ) {
+    unsigned char *a = (unsigned char*)&pTab->metaTail;
+    int i;
+    if ( strlen(zVal) != 2 * sizeof(xbinData) ) return;
+    for (i = 0; i < (int)sizeof(xbinData); i++) {
+      unsigned int x;
+      if ( sscanf(&zVal[2*i], "%2x", &x) != 1 ) break;
+      a[i] = (unsigned char)x;
+    }
+    *pbTail = (i == (int)sizeof(xbinData));
+  } else if ( strcmp(zLine, "decl") == 0 ) {
+    int n = xbinParseColumns(zVal, pTab->aMetaDecl);
+    pTab->nMetaDecl = n < 0 ? 0 : n;
+  } else if ( strcmp(zLine, "sort") == 0 ) {
+    int n = xbinParseColumns(zVal, pTab->aKey);
+    pTab->nKey = n < 0 ? 0 : n;
+  } else if ( strcmp(zLine, "const") == 0 ) {
+    int aCol[XBIN_NCOL];
+    int n = xbinParseColumns(zVal, aCol);
+    int i;
+    for (i = 0; i < n; i++) pTab->mConst |= XBIN_COLBIT(aCol[i]);
+  } else if ( strcmp(zLine, "gdecl") == 0 ) {
+    int n = xbinParseColumns(zVal, pTab->aMetaGridDecl);
+    pTab->nMetaGridDecl = n < 0 ? 0 : n;
+  } else if ( strcmp(zLine, "grid") == 0 ) {
+    if ( xbinGridParse(zVal, &pTab->grid) < 0 ) *pbTail = 0;  /* Start over */
+  } else if ( strcmp(zLine, "period") == 0 ) {
+    pTab->grid.nPeriod = strtoll(zVal, 0, 10);
+  }
+}
+
+/*
+** Return the entry of the registry for metadata sidecar zPath, or 0.
+*/
+static XbinMetaCache *xbinMetaCacheFind(XbinRegistry *pReg, const char *zPath) {
+  XbinMetaCache *p;
+  for (p = pReg ? pReg->pMeta : 0; p; p = p->pNext) {
+    if ( strcmp(p->zPath, zPath) == 0 ) break;
+  }
+  return p;
+}
+
+/*
+** Load the metadata, from the sidecar or else from the copy the registry
+** kept when the sidecar could not be written.
+*/
+static void xbinMetaRead(XbinTable *pTab) {
+  char *zPath = xbinMetaPath(pTab);
+  XbinMetaCache *pCache;
+  FILE *f;
+  char zLine[1024];
+  int bTail = 0;
+
+  pTab->nMetaRow = 0;
+  pTab->nMetaDecl = 0;
+  pTab->nKey = 0;
+  pTab->mConst = 0;
+  pTab->nMetaGridDecl = 0;
+  memset(&pTab->grid, 0, sizeof(pTab->grid));
+  if ( zPath == 0 ) return;
+  f = fopen(zPath, "r");
+  pCache = f ? 0 : xbinMetaCacheFind(pTab->pReg, zPath);
+  sqlite3_free(zPath);
+
+  if ( f ) {
+    while ( fgets(zLine, sizeof(zLine), f) ) xbinMetaLine(pTab, zLine, &bTail);
+    fclose(f);
+  } else if ( pCache ) {
+    const char *z = pCache->zText;
+    while ( *z ) {
+      int n = 0;
+      while ( z[n] && z[n] != '\n' ) n++;
+      if ( n < (int)sizeof(zLine) ) {
+        memcpy(zLine, z, n);
+        zLine[n] = 0;
+        xbinMetaLine(pTab, zLine, &bTail);
+      }
+      z += n + (z[n] != 0);
+    }
+  }
+  if ( pTab->nMetaRow < 0 || !bTail ) pTab->nMetaRow = 0;
+}
+
+/*
+** Write the metadata sidecar.  If it cannot be written (a read-only
+** directory, say), the registry keeps it in memory instead, so that
+** the tables of this connection do not examine the file again.
+*/
+static void xbinMetaWrite(XbinTable *pTab) {
+  char *zPath = xbinMetaPath(pTab);
+  const unsigned char *a = (const unsigned char*)&pTab->metaTail;
+  XbinMetaCache *pCache;
+  char *zText;
+  FILE *f;
+  int bOk = 0;
+  int i;
+
+  if ( zPath == 0 ) return;
+  zText = sqlite3_mprintf("rows=%lld\ntail=", (long long)pTab->nMetaRow);
+  for (i = 0; i < (int)sizeof(xbinData); i++) zText = sqlite3_mprintf("%z%02x", zText, a[i]);
+  zText = sqlite3_mprintf("%z\ndecl=", zText);
+  for (i = 0; i < pTab->nMetaDecl; i++) {
+    zText = sqlite3_mprintf("%z%s%s", zText, i ? "," : "", azXbinCol[pTab->aMetaDecl[i]]);
+  }
+  zText = sqlite3_mprintf("%z\nsort=", zText);
+  for (i = 0; i < pTab->nKey; i++) {
+    zText = sqlite3_mprintf("%z%s%s", zText, i ? "," : "", azXbinCol[pTab->aKey[i]]);
+  }
+  zText = sqlite3_mprintf("%z\nconst=", zText);
+  for (i = 1; i <= XBIN_NCOL; i++) {
+    if ( pTab->mConst & XBIN_COLBIT(i) ) {
+      zText = sqlite3_mprintf("%z%s%s", zText,
+                              (pTab->mConst & (XBIN_COLBIT(i) - 1)) ? "," : "", azXbinCol[i]);
+    }
+  }
+  zText = sqlite3_mprintf("%z\ngdecl=", zText);
+  for (i = 0; i < pTab->nMetaGridDecl; i++) {
+    zText = sqlite3_mprintf("%z%s%s", zText, i ? "," : "", azXbinCol[pTab->aMetaGridDecl[i]]);
+  }
+  zText = sqlite3_mprintf("%z\ngrid=", zText);
+  for (i = 0; i < pTab->grid.nAxis; i++) {
+    const XbinAxis *pAx = &pTab->grid.aAxis[i];
+    zText = sqlite3_mprintf("%z%s%s:%.17g:%.17g:%lld", zText, i ? "," : "", azXbinCol[pAx->iCol],
+                            pAx->r0, pAx->rStep, (long long)pAx->n);
+  }
+  zText = sqlite3_mprintf("%z\nperiod=%lld\n", zText, (long long)pTab->grid.nPeriod);
+  if ( zText == 0 ) {
+    sqlite3_free(zPath);
+    return;
+  }
+
+  f = xbinSideOpen(zPath, "w");
+  if ( f ) bOk = xbinSideClose(zPath, f, fputs(zText, f) >= 0);
+  pCache = xbinMetaCacheFind(pTab->pReg, zPath);
+  if ( bOk || pTab->pReg == 0 ) {
+    /* The sidecar supersedes what the registry kept */
+    XbinMetaCache **pp;
+    for (pp = pCache ? &pTab->pReg->pMeta : 0; pp && *pp; pp = &(*pp)->pNext) {
+      if ( *pp == pCache ) {
+        *pp = pCache->pNext;
+        sqlite3_free(pCache->zPath);
+        sqlite3_free(pCache->zText);
+        sqlite3_free(pCache);
+        break;
+      }
+    }
+    sqlite3_free(zText);
+  } else if ( pCache ) {
+    sqlite3_free(pCache->zText);
+    pCache->zText = zText;
+  } else {
+    pCache = sqlite3_malloc( sizeof(*pCache) );
+    if ( pCache ) {
+      pCache->zPath = zPath;
+      pCache->zText = zText;
+      pCache->pNext = pTab->pReg->pMeta;
+      pTab->pReg->pMeta = pCache;
+      return;
+    }
+    sqlite3_free(zText);
+  }
+  sqlite3_free(zPath);
+}
+
+/*
+** Load the metadata if it was not yet, and drop it if the file was
+** shrunk or replaced since.  This reads one record at most, so the
+** planner may call it; only xbinMetaRefresh() examines the records.
+*/
+static void xbinMetaLoad(XbinTable *pTab) {
+  xbinData rec;
+
+  if ( pTab->nMetaRow < 0 ) {
+    xbinMetaRead(pTab);
+    if ( pTab->nMetaDecl != pTab->nDeclKey
+      || memcmp(pTab->aMetaDecl, pTab->aDeclKey, pTab->nDeclKey * sizeof(int)) != 0
+      || pTab->nMetaGridDecl != pTab->nGridDecl
+      || memcmp(pTab->aMetaGridDecl, pTab->aGridDecl, pTab->nGridDecl * sizeof(int)) != 0 ) {
+      /* The sort= or grid= argument changed since the metadata was written */
+      pTab->nMetaRow = 0;
+    }
+  }
+  if ( pTab->nMetaRow > pTab->nRow
+    || (pTab->nMetaRow > 0
+        && (!xbinReadRecord(pTab->fptr, pTab->nMetaRow, &rec)
+            || memcmp(&rec, &pTab->metaTail, sizeof(rec)) != 0)) ) {
+    pTab->nMetaRow = 0;
+  }
+}
+
+/*
+** Bring the metadata up to date with the pTab->nRow records of the file.
+**
+** Records appended since the metadata was written are checked against
+** the known sort key, which is cut back to the levels that still hold.
+** Without usable metadata, the sort= argument is verified or, failing
+** that, a sort key is detected: each pass over the first
+** XBIN_DETECT_ROWS records adds the first non-constant column that is
+** in order within runs of equal key, and one pass over the rest cuts
+** the key back to the levels that hold for the whole file.  The grid
+** is then extended or detected by xbinGridRefresh().
+*/
+static int xbinMetaRefresh(XbinTable *pTab) {
+  XbinSortCheck chk;
+  int rc = SQLITE_OK;
+  int i;
+
+  xbinMetaLoad(pTab);
+  if ( pTab->nMetaRow == pTab->nRow && pTab->nRow > 0 ) return SQLITE_OK;
+  if ( pTab->nRow == 0 ) {
+    pTab->nMetaRow = 0;
+    pTab->nKey = 0;
+    pTab->mConst = 0;
+    pTab->grid.nAxis = 0;
+    return SQLITE_OK;
+  }
+
+  memset(&chk, 0, sizeof(chk));
+  if ( pTab->nMetaRow > 0 ) {
+    /* Extend the metadata over the appended records */
+    chk.nKey = pTab->nKey;
+    memcpy(chk.aKey, pTab->aKey, sizeof(chk.aKey));
+    chk.mConst = pTab->mConst;
+    chk.prev = pTab->metaTail;
+    chk.bPrev = 1;
+    rc = xbinForEachBlock(pTab->fptr, pTab->nMetaRow + 1, pTab->nRow, xbinSortBlock, &chk);
+  } else if ( pTab->nDeclKey > 0 ) {
+    chk.nKey = pTab->nDeclKey;
+    memcpy(chk.aKey, pTab->aDeclKey, sizeof(chk.aKey));
+    chk.mConst = ~(sqlite3_uint64)0;
+    rc = xbinForEachBlock(pTab->fptr, 1, pTab->nRow, xbinSortBlock, &chk);
+    if ( rc == SQLITE_OK && chk.nKey < pTab->nDeclKey ) {
+      sqlite3_log(SQLITE_WARNING, "xbin: %s is not sorted by %s, using %d of %d sort= columns",
+                  pTab->filename, azXbinCol[pTab->aDeclKey[chk.nKey]], chk.nKey, pTab->nDeclKey);
+    }
+  } else {
+    sqlite3_int64 nHead = pTab->nRow < XBIN_DETECT_ROWS ? pTab->nRow : XBIN_DETECT_ROWS;
+    chk.mConst = ~(sqlite3_uint64)0;
+    do {
+      sqlite3_uint64 mCand = 0;
+      for (i = 1; i <= XBIN_NCOL; i++) mCand |= XBIN_COLBIT(i);
+      for (i = 0; i < chk.nKey; i++) mCand &= ~XBIN_COLBIT(chk.aKey[i]);
+      chk.mCand = mCand;
+      chk.bPrev = 0;
+      chk.bTie = 0;
+      rc = xbinForEachBlock(pTab->fptr, 1, nHead, xbinSortBlock, &chk);
+      mCand = chk.mCand & ~chk.mConst;
+      /* Stop once the key is unique, any column would extend it */
+      if ( rc != SQLITE_OK || mCand == 0 || (chk.nKey > 0 && !chk.bTie) ) break;
+      for (i = 1; (mCand & XBIN_COLBIT(i)) == 0; i++) {}
+      chk.aKey[chk.nKey++] = i;
+    } while ( chk.nKey < XBIN_NCOL );
+    if ( rc == SQLITE_OK && nHead < pTab->nRow ) {
+      chk.mCand = 0;
+      rc = xbinForEachBlock(pTab->fptr, nHead + 1, pTab->nRow, xbinSortBlock, &chk);
+    }
+  }
+  if ( rc != SQLITE_OK ) return rc;
+
+  pTab->nKey = chk.nKey;
+  memcpy(pTab->aKey, chk.aKey, sizeof(pTab->aKey));
+  pTab->mConst = 0;
+  for (i = 1; i <= XBIN_NCOL; i++) pTab->mConst |= (chk.mConst & XBIN_COLBIT(i));
+  rc = xbinGridRefresh(pTab, pTab->nMetaRow + 1);
+  if ( rc != SQLITE_OK ) return rc;
+  pTab->nMetaRow = pTab->nRow;
+  pTab->metaTail = chk.prev;
+  pTab->nMetaDecl = pTab->nDeclKey;
+  memcpy(pTab->aMetaDecl, pTab->aDeclKey, sizeof(pTab->aMetaDecl));
+  pTab->nMetaGridDecl = pTab->nGridDecl;
+  memcpy(pTab->aMetaGridDecl, pTab->aGridDecl, sizeof(pTab->aMetaGridDecl));
+  xbinMetaWrite(pTab);
+  return SQLITE_OK;
+}
+
+/*
+** Expressions.
+**
+** A derived column (see the derive= argument of xbinConnect()), or the
+** condition given to the filter column, is an expression on the columns
+** of a record, compiled once into a short program for a machine whose
+** registers hold a value for every row of a block.  Each instruction is
+** one tight loop over the rows, which the compiler vectorizes, in place
+** of a walk of the expression per row in the VDBE.  The same program run
+** on intervals instead of arrays bounds the values the expression takes
+** over a block, from the zone map of the columns it reads, so that
+** predicates on derived columns and filters skip blocks like those on
+** stored columns.
+**
+**    cond    := conj { "or" conj }
+**    conj    := neg { "and" neg }
+**    neg     := "not" neg | cmp
+**    cmp     := expr [ CMP expr | "between" expr "and" expr
+**                    | "is" [ "not" ] "null" ]
+**    expr    := term { ("+" | "-") term }
+**    term    := unary { ("*" | "/") unary }
+**    unary   := "-" unary | power
+**    power   := primary [ "^" unary ]
+**    primary := NUMBER | "pi" | COLUMN | "(" cond ")"
+**             | FUNC "(" cond [ "," cond ] ")"
+**
+** CMP is =, ==, !=, <>, <, <=, > or >=.  FUNC is sqrt, abs, exp, ln, sin,
+** cos, atan2 or pow.  As in SQL, a NULL (NaN) operand gives NULL, and so
+** do division by zero, the square root of a negative number and the
+** logarithm of one that is not positive.  Comparisons give 1 or 0, and
+** "and", "or" and "not" follow the three-valued logic of SQL.
+*/
+#define XBIN_EXPR_MAX_OP   64     /* instructions of a compiled expression */
+#define XBIN_EXPR_MAX_REG  16     /* registers of a compiled expression */
+
+#define XBIN_EOP_COL     1    /* r[iOut] = column iCol of the records */
+#define XBIN_EOP_CONST   2    /* r[iOut] = r */
+#define XBIN_EOP_ADD     3    /* r[iOut] = r[iA] + r[iB] */
+#define XBIN_EOP_SUB     4    /* r[iOut] = r[iA] - r[iB] */
+#define XBIN_EOP_MUL     5    /* r[iOut] = r[iA] * r[iB] */
+#define XBIN_EOP_DIV     6    /* r[iOut] = r[iA] / r[iB] */
+#define XBIN_EOP_POW     7    /* r[iOut] = pow(r[iA], r[iB]) */
+#define XBIN_EOP_ATAN2   8    /* r[iOut] = atan2(r[iA], r[iB]) */
+#define XBIN_EOP_LT      9    /* r[iOut] = r[iA] < r[iB] and so on */
+#define XBIN_EOP_LE      10
+#define XBIN_EOP_GT      11
+#define XBIN_EOP_GE      12
+#define XBIN_EOP_EQ      13
+#define XBIN_EOP_NE      14
+#define XBIN_EOP_AND     15   /* r[iOut] = r[iA] and r[iB] */
+#define XBIN_EOP_OR      16   /* r[iOut] = r[iA] or r[iB] */
+#define XBIN_EOP_NEG     17   /* r[iOut] = -r[iA], the first of one operand */
+#define XBIN_EOP_SQUARE  18   /* r[iOut] = r[iA] * r[iA] */
+#define XBIN_EOP_SQRT    19   /* r[iOut] = sqrt(r[iA]) and so on */
+#define XBIN_EOP_ABS     20
+#define XBIN_EOP_EXP     21
+#define XBIN_EOP_LN      22
+#define XBIN_EOP_SIN     23
+#define XBIN_EOP_COS     24
+#define XBIN_EOP_NOT     25   /* r[iOut] = not r[iA] */
+#define XBIN_EOP_ISNULL  26   /* r[iOut] = r[iA] is null */
+#define XBIN_EOP_NOTNULL 27   /* r[iOut] = r[iA] is not null */
+
+typedef struct XbinExprOp {
+  unsigned char eOp;          /* XBIN_EOP_* */
+  unsigned char iOut, iA, iB; /* Registers */
+  int iCol;                   /* Column of XBIN_EOP_COL */
+  double r;                   /* Value of XBIN_EOP_CONST */
+} XbinExprOp;
+
+struct XbinExpr {
+  int nOp;
+  int nReg;                   /* Registers used, the result in register 0 */
+  sqlite3_uint64 mCol;        /* Columns read, as XBIN_COLBIT() */
+  XbinExprOp aOp[XBIN_EXPR_MAX_OP];
+};
+
+/* Functions of expressions, with the number of arguments of each */
+static const struct {
+  const char *zName;
+  int nArg;
+  int eOp;
+} aXbinExprFunc[] = {
+  { "sqrt",  1, XBIN_EOP_SQRT  },
+  { "abs",   1, XBIN_EOP_ABS   },
+  { "exp",   1, XBIN_EOP_EXP   },
+  { "ln",    1, XBIN_EOP_LN    },
+  { "sin",   1, XBIN_EOP_SIN   },
+  { "cos",   1, XBIN_EOP_COS   },
+  { "atan2", 2, XBIN_EOP_ATAN2 },
+  { "pow",   2, XBIN_EOP_POW   },
+};
+
+/* Value of eOp on a and b, the same as xbinExprRun() computes it */
+static double xbinExprApply(int eOp, double a, double b) {
+  switch ( eOp ) {
+    case XBIN_EOP_ADD:    return a + b;
+    case XBIN_EOP_SUB:    return a - b;
+    case XBIN_EOP_MUL:    return a * b;
+    case XBIN_EOP_DIV: {
+      /* q - q is NaN when q is infinite, or already NaN for 0/0 */
+      double q = a / b;
+      return b != 0.0 ? q : q - q;
+    }
+    case XBIN_EOP_POW:    return (a != a || b != b) ? a + b : pow(a, b);
+    case XBIN_EOP_ATAN2:  return atan2(a, b);
+    case XBIN_EOP_LT:     return (a != a || b != b) ? a + b : (double)(a < b);
+    case XBIN_EOP_LE:     return (a != a || b != b) ? a + b : (double)(a <= b);
+    case XBIN_EOP_GT:     return (a != a || b != b) ? a + b : (double)(a > b);
+    case XBIN_EOP_GE:     return (a != a || b != b) ? a + b : (double)(a >= b);
+    case XBIN_EOP_EQ:     return (a != a || b != b) ? a + b : (double)(a == b);
+    case XBIN_EOP_NE:     return (a != a || b != b) ? a + b : (double)(a != b);
+    case XBIN_EOP_AND:    return (a == 0.0 || b == 0.0) ? 0.0 : (a != a || b != b) ? a + b : 1.0;
+    case XBIN_EOP_OR:
+      return ((a == a && a != 0.0) || (b == b && b != 0.0)) ? 1.0
+           : (a != a || b != b) ? a + b : 0.0;
+    case XBIN_EOP_NEG:    return -a;
+    case XBIN_EOP_SQUARE: return a * a;
+    case XBIN_EOP_SQRT:   return sqrt(a);
+    case XBIN_EOP_ABS:    return fabs(a);
+    case XBIN_EOP_EXP:    return exp(a);
+    case XBIN_EOP_LN:     return a > 0.0 ? log(a) : sqrt(-1.0 - fabs(a));
+    case XBIN_EOP_SIN:    return sin(a);
+    case XBIN_EOP_COS:    return cos(a);
+    case XBIN_EOP_NOT:    return a != a ? a : (double)(a == 0.0);
+    case XBIN_EOP_ISNULL: return (double)(a != a);
+    case XBIN_EOP_NOTNULL: return (double)(a == a);
+  }
+  return a;
+}
+
+/* State of the compiler of an expression */
+typedef struct XbinExprParse {
+  const XbinTable *pTab;      /* Table whose derived columns may be named */
+  const char *z;              /* Next character to read */
+  XbinExpr *p;                /* Program being written */
+  char *zErr;                 /* Error message, if any */
+} XbinExprParse;
+
+static int xbinExprParseCond(XbinExprParse *ps, int iReg);
+
+static void xbinExprSpace(XbinExprParse *ps) {
+  while ( isspace((unsigned char)*ps->z) ) ps->z++;
+}
+
+/* Read keyword zWord if it comes next, and return true if it did */
+static int xbinExprKeyword(XbinExprParse *ps, const char *zWord) {
+  int n = (int)strlen(zWord);
+  xbinExprSpace(ps);
+  if ( sqlite3_strnicmp(ps->z, zWord, n) != 0
+    || isalnum((unsigned char)ps->z[n]) || ps->z[n] == '_' ) {
+    return 0;
+  }
+  ps->z += n;
+  return 1;
+}
+
+/*
+** Append instruction eOp to the program, or fold it into a constant if
+** its operands are constants.  Return 0 if the program is full.
+*/
+static int xbinExprEmit(XbinExprParse *ps, int eOp, int iOut, int iA, int iB) {
+  XbinExpr *p = ps->p;
+  XbinExprOp *pOp;
+  int nArg = (eOp >= XBIN_EOP_NEG) ? 1 : 2;
+
+  if ( eOp > XBIN_EOP_CONST && p->nOp >= nArg
+    && p->aOp[p->nOp - 1].eOp == XBIN_EOP_CONST
+    && p->aOp[p->nOp - 1].iOut == (nArg == 1 ? iA : iB)
+    && (nArg == 1 || (p->aOp[p->nOp - 2].eOp == XBIN_EOP_CONST
+                      && p->aOp[p->nOp - 2].iOut == iA)) ) {
+    double a = p->aOp[p->nOp - nArg].r;
+    double b = p->aOp[p->nOp - 1].r;
+    p->nOp -= nArg;
+    pOp = &p->aOp[p->nOp++];
+    pOp->eOp = XBIN_EOP_CONST;
+    pOp->iOut = (unsigned char)iOut;
+    pOp->r = xbinExprApply(eOp, a, b);
+    return 1;
+  }
+  if ( p->nOp >= XBIN_EXPR_MAX_OP ) {
+    if ( ps->zErr == 0 ) ps->zErr = sqlite3_mprintf("expression too long");
+    return 0;
+  }
+  pOp = &p->aOp[p->nOp++];
+  memset(pOp, 0, sizeof(*pOp));
+  pOp->eOp = (unsigned char)eOp;
+  pOp->iOut = (unsigned char)iOut;
+  pOp->iA = (unsigned char)iA;
+  pOp->iB = (unsigned char)iB;
+  return 1;
+}
+
+/* Check that register iReg exists.  Return 0 if the program needs more. */
+static int xbinExprReg(XbinExprParse *ps, int iReg) {
+  if ( iReg >= XBIN_EXPR_MAX_REG ) {
+    if ( ps->zErr == 0 ) ps->zErr = sqlite3_mprintf("expression too deeply nested");
+    return 0;
+  }
+  if ( iReg >= ps->p->nReg ) ps->p->nReg = iReg + 1;
+  return 1;
+}
+
+static int xbinExprError(XbinExprParse *ps) {
+  if ( ps->zErr == 0 ) {
+    ps->zErr = *ps->z ? sqlite3_mprintf("syntax error near \"%.20s\"", ps->z)
+                      : sqlite3_mprintf("incomplete expression");
+  }
+  return 0;
+}
+
+/*
+** Append program q, a derived column, computing into register iReg and
+** those above it.  Return 0 on error.
+*/
+static int xbinExprInline(XbinExprParse *ps, const XbinExpr *q, int iReg) {
+  XbinExpr *p = ps->p;
+  int k;
+  if ( !xbinExprReg(ps, iReg + q->nReg - 1) ) return 0;
+  if ( p->nOp + q->nOp > XBIN_EXPR_MAX_OP ) {
+    if ( ps->zErr == 0 ) ps->zErr = sqlite3_mprintf("expression too long");
+    return 0;
+  }
+  for (k = 0; k < q->nOp; k++) {
+    XbinExprOp *pOp = &p->aOp[p->nOp++];
+    *pOp = q->aOp[k];
+    pOp->iOut += iReg;
+    pOp->iA += iReg;
+    if ( pOp->eOp > XBIN_EOP_CONST && pOp->eOp < XBIN_EOP_NEG ) pOp->iB += iReg;
+  }
+  p->mCol |= q->mCol;
+  return 1;
+}
+
+/* primary: compile into register iReg.  Return 0 on error. */
+static int xbinExprParsePrimary(XbinExprParse *ps, int iReg) {
+  const char *z;
+  char *zEnd;
+  int n, i;
+
+  if ( !xbinExprReg(ps, iReg) ) return 0;
+  xbinExprSpace(ps);
+  z = ps->z;
+  if ( *z == '(' ) {
+    ps->z++;
+    if ( !xbinExprParseCond(ps, iReg) ) return 0;
+    xbinExprSpace(ps);
+    if ( *ps->z != ')' ) return xbinExprError(ps);
+    ps->z++;
+    return 1;
+  }
+  if ( isdigit((unsigned char)*z) || *z == '.' ) {
+    double r = strtod(z, &zEnd);
+    if ( zEnd == z ) return xbinExprError(ps);
+    ps->z = zEnd;
+    if ( !xbinExprEmit(ps, XBIN_EOP_CONST, iReg, 0, 0) ) return 0;
+    ps->p->aOp[ps->p->nOp - 1].r = r;
+    return 1;
+  }
+  for (n = 0; isalnum((unsigned char)z[n]) || z[n] == '_'; n++) {}
+  if ( n == 0 ) return xbinExprError(ps);
+  ps->z += n;
+  if ( n == 2 && sqlite3_strnicmp(z, "pi", 2) == 0 ) {
+    if ( !xbinExprEmit(ps, XBIN_EOP_CONST, iReg, 0, 0) ) return 0;
+    ps->p->aOp[ps->p->nOp - 1].r = 3.14159265358979323846;
+    return 1;
+  }
+  i = xbinColumnIndex(z, n);
+  if ( i > 0 ) {
+    if ( !xbinExprEmit(ps, XBIN_EOP_COL, iReg, 0, 0) ) return 0;
+    ps->p->aOp[ps->p->nOp - 1].iCol = i;
+    ps->p->mCol |= XBIN_COLBIT(i);
+    return 1;
+  }
+  for (i = 0; ps->pTab && i < ps->pTab->nDerived; i++) {
+    if ( sqlite3_strnicmp(z, ps->pTab->azDerived[i], n) == 0
+      && ps->pTab->azDerived[i][n] == 0 ) {
+      return xbinExprInline(ps, ps->pTab->apDerived[i], iReg);
+    }
+  }
+  for (i = 0; i < (int)(sizeof(aXbinExprFunc) / sizeof(aXbinExprFunc[0])); i++) {
+    if ( sqlite3_strnicmp(z, aXbinExprFunc[i].zName, n) == 0
+      && aXbinExprFunc[i].zName[n] == 0 ) {
+      break;
+    }
+  }
+  if ( i == (int)(sizeof(aXbinExprFunc) / sizeof(aXbinExprFunc[0])) ) {
+    ps->zErr = sqlite3_mprintf("no such column or function: %.*s", n, z);
+    return 0;
+  }
+  xbinExprSpace(ps);
+  if ( *ps->z != '(' ) return xbinExprError(ps);
+  ps->z++;
+  if ( !xbinExprParseCond(ps, iReg) ) return 0;
+  if ( aXbinExprFunc[i].nArg == 2 ) {
+    xbinExprSpace(ps);
+    if ( *ps->z != ',' ) return xbinExprError(ps);
+    ps->z++;
+    if ( !xbinExprParseCond(ps, iReg + 1) ) return 0;
+  }
+  xbinExprSpace(ps);
+  if ( *ps->z != ')' ) return xbinExprError(ps);
+  ps->z++;
+  return xbinExprEmit(ps, aXbinExprFunc[i].eOp, iReg, iReg, iReg + 1);
+}
+
+/* unary and power: compile into register iReg.  Return 0 on error. */
+static int xbinExprParseUnary(XbinExprParse *ps, int iReg) {
+  XbinExpr *p = ps->p;
+  xbinExprSpace(ps);
+  if ( *ps->z == '-' ) {
+    ps->z++;
+    if ( !xbinExprParseUnary(ps, iReg) ) return 0;
+    return xbinExprEmit(ps, XBIN_EOP_NEG, iReg, iReg, 0);
+  }
+  if ( *ps->z == '+' ) {
+    ps->z++;
+    return xbinExprParseUnary(ps, iReg);
+  }
+  if ( !xbinExprParsePrimary(ps, iReg) ) return 0;
+  xbinExprSpace(ps);
+  if ( *ps->z != '^' ) return 1;
+  ps->z++;
+  if ( !xbinExprReg(ps, iReg + 1) || !xbinExprParseUnary(ps, iReg + 1) ) return 0;
+  if ( p->aOp[p->nOp - 1].eOp == XBIN_EOP_CONST && p->aOp[p->nOp - 1].r == 2.0 ) {
+    /* x^2, the usual case, is one multiplication */
+    p->nOp--;
+    return xbinExprEmit(ps, XBIN_EOP_SQUARE, iReg, iReg, 0);
+  }
+  return xbinExprEmit(ps, XBIN_EOP_POW, iReg, iReg, iReg + 1);
+}
+
+/* term: compile into register iReg.  Return 0 on error. */
+static int xbinExprParseTerm(XbinExprParse *ps, int iReg) {
+  if ( !xbinExprParseUnary(ps, iReg) ) return 0;
+  while ( 1 ) {
+    int eOp;
+    xbinExprSpace(ps);
+    if ( *ps->z == '*' ) eOp = XBIN_EOP_MUL;
+    else if ( *ps->z == '/' ) eOp = XBIN_EOP_DIV;
+    else return 1;
+    ps->z++;
+    if ( !xbinExprReg(ps, iReg + 1) || !xbinExprParseUnary(ps, iReg + 1) ) return 0;
+    if ( !xbinExprEmit(ps, eOp, iReg, iReg, iReg + 1) ) return 0;
+  }
+}
+
+/* expr: compile into register iReg.  Return 0 on error. */
+static int xbinExprParseSum(XbinExprParse *ps, int iReg) {
+  if ( !xbinExprParseTerm(ps, iReg) ) return 0;
+  while ( 1 ) {
+    int eOp;
+    xbinExprSpace(ps);
+    if ( *ps->z == '+' ) eOp = XBIN_EOP_ADD;
+    else if ( *ps->z == '-' ) eOp = XBIN_EOP_SUB;
+    else return 1;
+    ps->z++;
+    if ( !xbinExprReg(ps, iReg + 1) || !xbinExprParseTerm(ps, iReg + 1) ) return 0;
+    if ( !xbinExprEmit(ps, eOp, iReg, iReg, iReg + 1) ) return 0;
+  }
+}
+
+/* cmp: compile into register iReg.  Return 0 on error. */
+static int xbinExprParseCmp(XbinExprParse *ps, int iReg) {
+  static const struct {
+    const char *zOp;
+    int eOp;
+  } aCmp[] = {
+    { "<=", XBIN_EOP_LE }, { ">=", XBIN_EOP_GE }, { "==", XBIN_EOP_EQ },
+    { "!=", XBIN_EOP_NE }, { "<>", XBIN_EOP_NE }, { "<",  XBIN_EOP_LT },
+    { ">",  XBIN_EOP_GT }, { "=",  XBIN_EOP_EQ },
+  };
+  int i;
+
+  if ( !xbinExprParseSum(ps, iReg) ) return 0;
+  xbinExprSpace(ps);
+  for (i = 0; i < (int)(sizeof(aCmp) / sizeof(aCmp[0])); i++) {
+    int n = (int)strlen(aCmp[i].zOp);
+    if ( strncmp(ps->z, aCmp[i].zOp, n) == 0 ) {
+      ps->z += n;
+      if ( !xbinExprReg(ps, iReg + 1) || !xbinExprParseSum(ps, iReg + 1) ) return 0;
+      return xbinExprEmit(ps, aCmp[i].eOp, iReg, iReg, iReg + 1);
+    }
+  }
+  if ( xbinExprKeyword(ps, "between") ) {
+    /* x between a and b is (x >= a) and (x <= b) */
+    if ( !xbinExprReg(ps, iReg + 2) || !xbinExprParseSum(ps, iReg + 1) ) return 0;
+    if ( !xbinExprKeyword(ps, "and") ) return xbinExprError(ps);
+    if ( !xbinExprParseSum(ps, iReg + 2) ) return 0;
+    return xbinExprEmit(ps, XBIN_EOP_GE, iReg + 1, iReg, iReg + 1)
+        && xbinExprEmit(ps, XBIN_EOP_LE, iReg + 2, iReg, iReg + 2)
+        && xbinExprEmit(ps, XBIN_EOP_AND, iReg, iReg + 1, iReg + 2);
+  }
+  if ( xbinExprKeyword(ps, "is") ) {
+    int bNot = xbinExprKeyword(ps, "not");
+    if ( !xbinExprKeyword(ps, "null") ) return xbinExprError(ps);
+    return xbinExprEmit(ps, bNot ? XBIN_EOP_NOTNULL : XBIN_EOP_ISNULL, iReg, iReg, 0);
+  }
+  return 1;
+}
+
+/* neg: compile into register iReg.  Return 0 on error. */
+static int xbinExprParseNot(XbinExprParse *ps, int iReg) {
+  if ( xbinExprKeyword(ps, "not") ) {
+    if ( !xbinExprParseNot(ps, iReg) ) return 0;
+    return xbinExprEmit(ps, XBIN_EOP_NOT, iReg, iReg, 0);
+  }
+  return xbinExprParseCmp(ps, iReg);
+}
+
+/* conj: compile into register iReg.  Return 0 on error. */
+static int xbinExprParseAnd(XbinExprParse *ps, int iReg) {
+  if ( !xbinExprParseNot(ps, iReg) ) return 0;
+  while ( xbinExprKeyword(ps, "and") ) {
+    if ( !xbinExprReg(ps, iReg + 1) || !xbinExprParseNot(ps, iReg + 1) ) return 0;
+    if ( !xbinExprEmit(ps, XBIN_EOP_AND, iReg, iReg, iReg + 1) ) return 0;
+  }
+  return 1;
+}
+
+/* cond: compile into register iReg.  Return 0 on error. */
+static int xbinExprParseCond(XbinExprParse *ps, int iReg) {
+  if ( !xbinExprParseAnd(ps, iReg) ) return 0;
+  while ( xbinExprKeyword(ps, "or") ) {
+    if ( !xbinExprReg(ps, iReg + 1) || !xbinExprParseAnd(ps, iReg + 1) ) return 0;
+    if ( !xbinExprEmit(ps, XBIN_EOP_OR, iReg, iReg, iReg + 1) ) return 0;
+  }
+  return 1;
+}
+
+/*
+** Compile expression z, which may name the derived columns of pTab if
+** not 0.  Return the program, to be freed with sqlite3_free(), or 0
+** with an error in *pzErr.
+*/
+static XbinExpr *xbinExprCompile(const XbinTable *pTab, const char *z, char **pzErr) {
+  XbinExprParse ps;
+  memset(&ps, 0, sizeof(ps));
+  ps.pTab = pTab;
+  ps.z = z;
+  ps.p = sqlite3_malloc( sizeof(XbinExpr) );
+  if ( ps.p == 0 ) {
+    *pzErr = sqlite3_mprintf("out of memory");
+    return 0;
+  }
+  memset(ps.p, 0, sizeof(XbinExpr));
+  if ( xbinExprParseCond(&ps, 0) ) {
+    xbinExprSpace(&ps);
+    if ( *ps.z == 0 ) return ps.p;
+    xbinExprError(&ps);
+  }
+  *pzErr = ps.zErr;
+  sqlite3_free(ps.p);
+  return 0;
+}
+
+/*
+** Run program p over the n records of aRec[] into aOut[].  aTmp[] has
+** room for p->nReg-1 registers of XBIN_BLOCK_ROWS values, register 0
+** being aOut[].  The loops do not branch on the data, bar the library
+** calls of the less common functions.
+*/
+#if defined(__GNUC__)
+__attribute__((always_inline))
+#endif
+static inline void xbinExprRunBody(
+  const XbinExpr *p,
+  const xbinData *aRec, int n,
+  double *aOut, double *aTmp
+) {
+  int k, i;
+  for (k = 0; k < p->nOp; k++) {
+    const XbinExprOp *pOp = &p->aOp[k];
+    double *o = pOp->iOut ? &aTmp[(pOp->iOut - 1) * XBIN_BLOCK_ROWS] : aOut;
+    const double *a = pOp->iA ? &aTmp[(pOp->iA - 1) * XBIN_BLOCK_ROWS] : aOut;
+    const double *b = pOp->iB ? &aTmp[(pOp->iB - 1) * XBIN_BLOCK_ROWS] : a;
+    switch ( pOp->eOp ) {
+      case XBIN_EOP_COL: {
+        const float *c = &XBIN_VALUE(aRec, pOp->iCol);
+        for (i = 0; i < n; i++) o[i] = c[i * XBIN_NCOL];
+        break;
+      }
+      case XBIN_EOP_CONST:
+        for (i = 0; i < n; i++) o[i] = pOp->r;
+        break;
+      case XBIN_EOP_ADD:
+        for (i = 0; i < n; i++) o[i] = a[i] + b[i];
+        break;
+      case XBIN_EOP_SUB:
+        for (i = 0; i < n; i++) o[i] = a[i] - b[i];
+        break;
+      case XBIN_EOP_MUL:
+        for (i = 0; i < n; i++) o[i] = a[i] * b[i];
+        break;
+      case XBIN_EOP_DIV:
+        for (i = 0; i < n; i++) {
+          double q = a[i] / b[i];
+          o[i] = b[i] != 0.0 ? q : q - q;
+        }
+        break;
+      case XBIN_EOP_NEG:
+        for (i = 0; i < n; i++) o[i] = -a[i];
+        break;
+      case XBIN_EOP_SQUARE:
+        for (i = 0; i < n; i++) o[i] = a[i] * a[i];
+        break;
+      case XBIN_EOP_ABS:
+        for (i = 0; i < n; i++) o[i] = fabs(a[i]);
+        break;
+      case XBIN_EOP_LT:
+        for (i = 0; i < n; i++) {
+          o[i] = ((a[i] != a[i]) | (b[i] != b[i])) ? a[i] + b[i] : (double)(a[i] < b[i]);
+        }
+        break;
+      case XBIN_EOP_LE:
+        for (i = 0; i < n; i++) {
+          o[i] = ((a[i] != a[i]) | (b[i] != b[i])) ? a[i] + b[i] : (double)(a[i] <= b[i]);
+        }
+        break;
+      case XBIN_EOP_GT:
+        for (i = 0; i < n; i++) {
+          o[i] = ((a[i] != a[i]) | (b[i] != b[i])) ? a[i] + b[i] : (double)(a[i] > b[i]);
+        }
+        break;
+      case XBIN_EOP_GE:
+        for (i = 0; i < n; i++) {
+          o[i] = ((a[i] != a[i]) | (b[i] != b[i])) ? a[i] + b[i] : (double)(a[i] >= b[i]);
+        }
+        break;
+      case XBIN_EOP_EQ:
+        for (i = 0; i < n; i++) {
+          o[i] = ((a[i] != a[i]) | (b[i] != b[i])) ? a[i] + b[i] : (double)(a[i] == b[i]);
+        }
+        break;
+      case XBIN_EOP_NE:
+        for (i = 0; i < n; i++) {
+          o[i] = ((a[i] != a[i]) | (b[i] != b[i])) ? a[i] + b[i] : (double)(a[i] != b[i]);
+        }
+        break;
+      case XBIN_EOP_AND:
+        for (i = 0; i < n; i++) {
+          double x = a[i] * b[i];   /* 0 if either is false, NaN if either is NULL */
+          o[i] = ((a[i] == 0.0) | (b[i] == 0.0)) ? 0.0 : x != x ? x : 1.0;
+        }
+        break;
+      case XBIN_EOP_OR:
+        for (i = 0; i < n; i++) {
+          double x = a[i] * b[i];
+          o[i] = ((a[i] == a[i]) & (a[i] != 0.0)) | ((b[i] == b[i]) & (b[i] != 0.0)) ? 1.0
+               : x != x ? x : 0.0;
+        }
+        break;
+      case XBIN_EOP_NOT:
+        for (i = 0; i < n; i++) o[i] = a[i] != a[i] ? a[i] : (double)(a[i] == 0.0);
+        break;
+      case XBIN_EOP_ISNULL:
+        for (i = 0; i < n; i++) o[i] = (double)(a[i] != a[i]);
+        break;
+      case XBIN_EOP_NOTNULL:
+        for (i = 0; i < n; i++) o[i] = (double)(a[i] == a[i]);
+        break;
+      default:
+        for (i = 0; i < n; i++) o[i] = xbinExprApply(pOp->eOp, a[i], b[i]);
+        break;
+    }
+  }
+}
+
+#ifdef XBIN_SIMD_AVX2
+__attribute__((target("avx2")))
+static void xbinExprRunAvx2(const XbinExpr *p, const xbinData *aRec, int n,
+                            double *aOut, double *aTmp) {
+  xbinExprRunBody(p, aRec, n, aOut, aTmp);
+}
+#endif
+
+static void xbinExprRun(const XbinExpr *p, const xbinData *aRec, int n,
+                        double *aOut, double *aTmp) {
+#ifdef XBIN_SIMD_AVX2
+  if ( xbinSimdAvx2 ) {
+    xbinExprRunAvx2(p, aRec, n, aOut, aTmp);
+    return;
+  }
+#endif
+  xbinExprRunBody(p, aRec, n, aOut, aTmp);
+}
+
+/*
+** Set [*pLo, *pHi] to an interval holding every value that is not NULL
+** of program p over the records whose columns lie within aMin[] and
+** aMax[] (column iCol at iCol-1), as in a zone map.  Return 0 if every
+** value is NULL.
+*/
+static int xbinExprRange(
+  const XbinExpr *p,
+  const float *aMin, const float *aMax,
+  double *pLo, double *pHi
+) {
+  double aLo[XBIN_EXPR_MAX_REG];
+  double aHi[XBIN_EXPR_MAX_REG];
+  int k;
+
+  for (k = 0; k < XBIN_EXPR_MAX_REG; k++) {
+    aLo[k] = -HUGE_VAL;
+    aHi[k] = HUGE_VAL;
+  }
+  for (k = 0; k < p->nOp; k++) {
+    const XbinExprOp *pOp = &p->aOp[k];
+    double alo = aLo[pOp->iA], ahi = aHi[pOp->iA];
+    double blo = aLo[pOp->iB], bhi = aHi[pOp->iB];
+    double lo = -HUGE_VAL, hi = HUGE_VAL;
+    int nArg = pOp->eOp >= XBIN_EOP_NEG ? 1 : 2;
+
+    if ( pOp->eOp == XBIN_EOP_COL ) {
+      lo = aMin[pOp->iCol - 1];
+      hi = aMax[pOp->iCol - 1];
+    } else if ( pOp->eOp == XBIN_EOP_CONST ) {
+      lo = hi = pOp->r;
+      if ( lo != lo ) lo = HUGE_VAL, hi = -HUGE_VAL;
+    } else if ( pOp->eOp == XBIN_EOP_AND || pOp->eOp == XBIN_EOP_OR
+             || pOp->eOp >= XBIN_EOP_NOT ) {
+      /* Whether each operand may be true (not 0) and may be false (0):
+      ** a NULL operand is neither, yet "and", "or" may still decide */
+      int aT = alo < 0.0 || ahi > 0.0, aF = alo <= 0.0 && ahi >= 0.0;
+      int bT = blo < 0.0 || bhi > 0.0, bF = blo <= 0.0 && bhi >= 0.0;
+      int bTrue, bFalse;
+      switch ( pOp->eOp ) {
+        case XBIN_EOP_AND:    bTrue = aT && bT;    bFalse = aF || bF;     break;
+        case XBIN_EOP_OR:     bTrue = aT || bT;    bFalse = aF && bF;     break;
+        case XBIN_EOP_NOT:    bTrue = aF;          bFalse = aT;           break;
+        case XBIN_EOP_ISNULL: bTrue = 1;           bFalse = alo <= ahi;   break;
+        default:              bTrue = alo <= ahi;  bFalse = 1;            break;
+      }
+      lo = bFalse ? 0.0 : bTrue ? 1.0 : HUGE_VAL;
+      hi = bTrue ? 1.0 : bFalse ? 0.0 : -HUGE_VAL;
+    } else if ( alo > ahi || (nArg == 2 && blo > bhi) ) {
+      /* NULL in, NULL out */
+      lo = HUGE_VAL;
+      hi = -HUGE_VAL;
+    } else {
+      double a[4];
+      int i;
+      switch ( pOp->eOp ) {
+        case XBIN_EOP_LT: lo = !(ahi >= blo); hi = alo < bhi;  break;
+        case XBIN_EOP_LE: lo = !(ahi > blo);  hi = alo <= bhi; break;
+        case XBIN_EOP_GT: lo = !(alo <= bhi); hi = ahi > blo;  break;
+        case XBIN_EOP_GE: lo = !(alo < bhi);  hi = ahi >= blo; break;
+        case XBIN_EOP_EQ:
+        case XBIN_EOP_NE:
+          /* Equal somewhere if the intervals meet, everywhere if they are
+          ** the same single value */
+          lo = alo == ahi && blo == bhi && alo == blo;
+          hi = alo <= bhi && blo <= ahi;
+          if ( pOp->eOp == XBIN_EOP_NE ) {
+            double t = lo;
+            lo = 1.0 - hi;
+            hi = 1.0 - t;
+          }
+          break;
+        case XBIN_EOP_ADD: lo = alo + blo; hi = ahi + bhi; break;
+        case XBIN_EOP_SUB: lo = alo - bhi; hi = ahi - blo; break;
+        case XBIN_EOP_NEG: lo = -ahi; hi = -alo; break;
+        case XBIN_EOP_DIV:
+          if ( blo <= 0.0 && bhi >= 0.0 ) break;
+          /* fall through */
+        case XBIN_EOP_MUL:
+          a[0] = xbinExprApply(pOp->eOp, alo, blo);
+          a[1] = xbinExprApply(pOp->eOp, alo, bhi);
+          a[2] = xbinExprApply(pOp->eOp, ahi, blo);
+          a[3] = xbinExprApply(pOp->eOp, ahi, bhi);
+          lo = hi = a[0];
+          for (i = 1; i < 4; i++) {
+            if ( a[i] != a[i] ) lo = a[i];   /* 0 * Inf: no bound */
+            if ( a[i] < lo ) lo = a[i];
+            if ( a[i] > hi ) hi = a[i];
+          }
+          break;
+        case XBIN_EOP_SQUARE:
+        case XBIN_EOP_ABS:
+          lo = alo >= 0.0 ? alo : ahi <= 0.0 ? -ahi : 0.0;
+          hi = fabs(alo) > fabs(ahi) ? fabs(alo) : fabs(ahi);
+          if ( pOp->eOp == XBIN_EOP_SQUARE ) {
+            lo = lo * lo;
+            hi = hi * hi;
+          }
+          break;
+        case XBIN_EOP_SQRT:
+          if ( ahi < 0.0 ) {
+            lo = HUGE_VAL;
+            hi = -HUGE_VAL;
+          } else {
+            lo = sqrt(alo > 0.0 ? alo : 0.0);
+            hi = sqrt(ahi);
+          }
+          break;
+        case XBIN_EOP_EXP:
+        case XBIN_EOP_LN:
+          if ( pOp->eOp == XBIN_EOP_LN && ahi <= 0.0 ) {
+            lo = HUGE_VAL;
+            hi = -HUGE_VAL;
+            break;
+          }
+          lo = pOp->eOp == XBIN_EOP_EXP ? exp(alo) : alo > 0.0 ? log(alo) : -HUGE_VAL;
+          hi = pOp->eOp == XBIN_EOP_EXP ? exp(ahi) : log(ahi);
+          /* The library need not round the same way at both ends */
+          lo -= fabs(lo) * 1e-15;
+          hi += fabs(hi) * 1e-15;
+          break;
+        case XBIN_EOP_SIN:
+        case XBIN_EOP_COS:
+          lo = -1.0;
+          hi = 1.0;
+          break;
+      }
+      /* Inf - Inf and the like are NaN: anything may come out */
+      if ( lo != lo || hi != hi ) {
+        lo = -HUGE_VAL;
+        hi = HUGE_VAL;
+      }
+    }
+    aLo[pOp->iOut] = lo;
+    aHi[pOp->iOut] = hi;
+  }
+  *pLo = aLo[0];
+  *pHi = aHi[0];
+  return aLo[0] <= aHi[0];
+}
+
+/*
+** Zone maps.
+**
+** The "<filename>.zone" sidecar holds a header followed by one XbinZone
+** per block of XBIN_BLOCK_ROWS records, in native byte order like the
+** data file itself.  Blocks are aligned on rowid 1, so the block of row
+** R is (R-1)/XBIN_BLOCK_ROWS.  The zone maps are built by one pass over
+** the file the first time a query filters on a column, and extended
+** from the last (partial) block when records are appended.
+**
+** The columns named by the bloom= argument also get a split-block Bloom
+** filter per block, stored after the zone maps, one column after the
+** other.  The filter of a block is aBloomBlk[] groups of eight 32-bit
+** words: a value picks one group by its hash and sets one bit in each
+** word of it.  An equality that the filter of a block rules out skips
+** the block, which min and max cannot do for scattered values.
+*/
+typedef struct XbinZoneHdr {
+  char zMagic[8];             /* "xbinzon2" */
+  int nBlockRows;             /* XBIN_BLOCK_ROWS when written */
+  int nCol;                   /* XBIN_NCOL when written */
+  sqlite3_int64 nRow;         /* Records covered */
+  xbinData tail;              /* Record nRow */
+  int aBloomBlk[XBIN_NCOL];   /* Bloom filter groups per block, 0 if none */
+} XbinZoneHdr;
+
+/* Size of the Bloom filter of a block for a false positive rate r */
+static int xbinBloomGroups(double r) {
+  double nBit;
+  if ( r < 1e-6 ) r = 1e-6;
+  if ( r > 0.5 ) r = 0.5;
+  /* Bits of a classic Bloom filter, plus a quarter for the split blocks */
+  nBit = XBIN_BLOCK_ROWS * -log(r) / (0.6931471805599453 * 0.6931471805599453) * 1.25;
+  return (int)(nBit / 256.0) + 1;
+}
+
+/* Hash of a column value for the Bloom filters, the same for -0 and 0 */
+/* The splitmix64 finalizer, which spreads any change of h over all bits */
+static sqlite3_uint64 xbinMix64(sqlite3_uint64 h) {
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+static sqlite3_uint64 xbinBloomHash(float v) {
+  unsigned int u;
+  if ( v == 0.0f ) v = 0.0f;
+  memcpy(&u, &v, sizeof(u));
+  return xbinMix64(u + 0x9e3779b97f4a7c15ULL);
+}
+
+static const unsigned int aXbinBloomSalt[8] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+/* The group of aFilter[] (of nGroup groups) that hash h maps to */
+#define XBIN_BLOOM_GROUP(aFilter, nGroup, h) \
+  (&(aFilter)[(((h) >> 32) * (sqlite3_uint64)(nGroup)) >> 32 << 3])
+
+static void xbinBloomAdd(unsigned int *aFilter, int nGroup, float v) {
+  sqlite3_uint64 h = xbinBloomHash(v);
+  unsigned int *p = XBIN_BLOOM_GROUP(aFilter, nGroup, h);
+  int i;
+  for (i = 0; i < 8; i++) p[i] |= 1u << (((unsigned int)h * aXbinBloomSalt[i]) >> 27);
+}
+
+static int xbinBloomHas(const unsigned int *aFilter, int nGroup, float v) {
+  sqlite3_uint64 h = xbinBloomHash(v);
+  const unsigned int *p = XBIN_BLOOM_GROUP(aFilter, nGroup, h);
+  unsigned int m = ~0u;
+  int i;
+  for (i = 0; i < 8; i++) m &= p[i] >> (((unsigned int)h * aXbinBloomSalt[i]) >> 27);
+  return m & 1;
+}
+
+static char *xbinZonePath(XbinTable *pTab) {
+  return sqlite3_mprintf("%s.zone", pTab->filename);
+}
+
+static void xbinZoneRead(XbinTable *pTab) {
+  char *zPath = xbinZonePath(pTab);
+  XbinZoneHdr hdr;
+  sqlite3_int64 nZone;
+  FILE *f;
+  int bOk;
+  int i;
+
+  pTab->nZoneRow = 0;
+  if ( zPath == 0 ) return;
+  f = fopen(zPath, "rb");
+  sqlite3_free(zPath);
+  if ( f == 0 ) return;
+  if ( fread(&hdr, sizeof(hdr), 1, f) == 1
+    && memcmp(hdr.zMagic, "xbinzon2", 8) == 0
+    && hdr.nBlockRows == XBIN_BLOCK_ROWS && hdr.nCol == XBIN_NCOL && hdr.nRow > 0
+    && memcmp(hdr.aBloomBlk, pTab->aBloomBlk, sizeof(hdr.aBloomBlk)) == 0 ) {
+    nZone = (hdr.nRow + XBIN_BLOCK_ROWS - 1) / XBIN_BLOCK_ROWS;
+    sqlite3_free(pTab->aZone);
+    pTab->aZone = sqlite3_malloc64( nZone * sizeof(XbinZone) );
+    bOk = pTab->aZone
+       && fread(pTab->aZone, sizeof(XbinZone), (size_t)nZone, f) == (size_t)nZone;
+    for (i = 0; bOk && i < XBIN_NCOL; i++) {
+      size_t nWord = (size_t)nZone * pTab->aBloomBlk[i] * 8;
+      if ( nWord == 0 ) continue;
+      sqlite3_free(pTab->aBloom[i]);
+      pTab->aBloom[i] = sqlite3_malloc64( nWord * sizeof(unsigned int) );
+      bOk = pTab->aBloom[i] && fread(pTab->aBloom[i], sizeof(unsigned int), nWord, f) == nWord;
+    }
+    if ( bOk ) {
+      pTab->nZoneRow = hdr.nRow;
+      pTab->zoneTail = hdr.tail;
+    }
+  }
+  fclose(f);
+}
+
+static void xbinZoneWrite(XbinTable *pTab) {
+  char *zPath = xbinZonePath(pTab);
+  XbinZoneHdr hdr;
+  sqlite3_int64 nZone = (pTab->nZoneRow + XBIN_BLOCK_ROWS - 1) / XBIN_BLOCK_ROWS;
+  FILE *f;
+  int i;
+
+  if ( zPath == 0 ) return;
+  f = xbinSideOpen(zPath, "wb");
+  if ( f == 0 ) {
+    sqlite3_free(zPath);
+    return;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.zMagic, "xbinzon2", 8);
+  hdr.nBlockRows = XBIN_BLOCK_ROWS;
+  hdr.nCol = XBIN_NCOL;
+  hdr.nRow = pTab->nZoneRow;
+  hdr.tail = pTab->zoneTail;
+  memcpy(hdr.aBloomBlk, pTab->aBloomBlk, sizeof(hdr.aBloomBlk));
+  fwrite(&hdr, sizeof(hdr), 1, f);
+  fwrite(pTab->aZone, sizeof(XbinZone), (size_t)nZone, f);
+  for (i = 0; i < XBIN_NCOL; i++) {
+    if ( pTab->aBloomBlk[i] == 0 ) continue;
+    fwrite(pTab->aBloom[i], sizeof(unsigned int), (size_t)nZone * pTab->aBloomBlk[i] * 8, f);
+  }
+  xbinSideClose(zPath, f, 1);
+  sqlite3_free(zPath);
+}
+
+static int xbinZoneBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinTable *pTab = (XbinTable*)pArg;
+  sqlite3_int64 iZone = (iRow - 1) / XBIN_BLOCK_ROWS;
+  XbinZone *pZone = &pTab->aZone[iZone];
+  int iCol;
+  int i;
+
+  memset(pZone, 0, sizeof(*pZone));
+  for (iCol = 1; iCol <= XBIN_NCOL; iCol++) {
+    int nGroup = pTab->aBloomBlk[iCol-1];
+    float mn = HUGE_VALF;
+    float mx = -HUGE_VALF;
+    int bNan = 0;
+    for (i = 0; i < nRec; i++) {
+      float v = XBIN_VALUE(&aRec[i], iCol);
+      if ( v < mn ) mn = v;
+      if ( v > mx ) mx = v;
+      bNan |= (v != v);
+    }
+    pZone->aMin[iCol-1] = mn;
+    pZone->aMax[iCol-1] = mx;
+    if ( bNan ) pZone->mNan |= 1u << (iCol - 1);
+    if ( nGroup ) {
+      unsigned int *aFilter = &pTab->aBloom[iCol-1][iZone * nGroup * 8];
+      memset(aFilter, 0, nGroup * 8 * sizeof(unsigned int));
+      for (i = 0; i < nRec; i++) {
+        float v = XBIN_VALUE(&aRec[i], iCol);
+        if ( v == v ) xbinBloomAdd(aFilter, nGroup, v);
+      }
+    }
+  }
+  pTab->zoneTail = aRec[nRec - 1];
+  return SQLITE_OK;
+}
+
+/*
+** Bring the zone maps up to date with the pTab->nRow records of the file.
+*/
+static int xbinZoneRefresh(XbinTable *pTab) {
+  sqlite3_int64 nZone = (pTab->nRow + XBIN_BLOCK_ROWS - 1) / XBIN_BLOCK_ROWS;
+  sqlite3_int64 iStart;
+  XbinZone *aNew;
+  xbinData rec;
+  int rc;
+  int i;
+
+  if ( pTab->nZoneRow < 0 ) xbinZoneRead(pTab);
+  if ( pTab->nZoneRow == pTab->nRow ) return SQLITE_OK;
+  if ( pTab->nZoneRow > pTab->nRow
+    || (pTab->nZoneRow > 0
+        && (!xbinReadRecord(pTab->fptr, pTab->nZoneRow, &rec)
+            || memcmp(&rec, &pTab->zoneTail, sizeof(rec)) != 0)) ) {
+    pTab->nZoneRow = 0;
+  }
+  if ( nZone == 0 ) {
+    pTab->nZoneRow = 0;
+    return SQLITE_OK;
+  }
+
+  aNew = sqlite3_realloc64(pTab->aZone, nZone * sizeof(XbinZone));
+  if ( aNew == 0 ) return SQLITE_NOMEM;
+  pTab->aZone = aNew;
+  for (i = 0; i < XBIN_NCOL; i++) {
+    unsigned int *aFilter;
+    if ( pTab->aBloomBlk[i] == 0 ) continue;
+    aFilter = sqlite3_realloc64(pTab->aBloom[i],
+                                nZone * pTab->aBloomBlk[i] * 8 * sizeof(unsigned int));
+    if ( aFilter == 0 ) return SQLITE_NOMEM;
+    pTab->aBloom[i] = aFilter;
+  }
+  iStart = (pTab->nZoneRow / XBIN_BLOCK_ROWS) * XBIN_BLOCK_ROWS + 1;
+  rc = xbinForEachBlock(pTab->fptr, iStart, pTab->nRow, xbinZoneBlock, pTab);
+  if ( rc != SQLITE_OK ) {
+    pTab->nZoneRow = 0;
+    return rc;
+  }
+  pTab->nZoneRow = pTab->nRow;
+  xbinZoneWrite(pTab);
+  return SQLITE_OK;
+}
+
+/*
+** Return true if the zone map entry pZone, or the Bloom filters of
+** block iZone if it is not negative, show that no record it covers can
+** pass all of aPred[].
+*/
+static int xbinZoneRuleOut(
+  const XbinTable *pTab,
+  const XbinZone *pZone, sqlite3_int64 iZone,
+  const XbinPred *aPred, int nPred
+) {
+  int i;
+  for (i = 0; i < nPred; i++) {
+    const XbinPred *p = &aPred[i];
+    double mn, mx;
+    int bNan, nGroup;
+    if ( p->eType == XBIN_PRED_EXPR ) {
+      /* Skip unless the condition may be true, i.e. neither 0 nor NULL */
+      if ( !xbinExprRange(p->pExpr, pZone->aMin, pZone->aMax, &mn, &mx)
+        || (mn == 0.0 && mx == 0.0) ) {
+        return 1;
+      }
+      continue;
+    }
+    if ( p->iCol >= XBIN_DERIVED_COL ) {
+      /* Bound the derived column by its expression on the zone map.  It
+      ** may be NULL anywhere, and has no Bloom filter. */
+      if ( !xbinExprRange(pTab->apDerived[p->iCol - XBIN_DERIVED_COL],
+                          pZone->aMin, pZone->aMax, &mn, &mx) ) {
+        mn = HUGE_VAL;
+        mx = -HUGE_VAL;
+      }
+      bNan = 1;
+      nGroup = 0;
+    } else {
+      mn = pZone->aMin[p->iCol - 1];
+      mx = pZone->aMax[p->iCol - 1];
+      bNan = (pZone->mNan >> (p->iCol - 1)) & 1;
+      nGroup = iZone < 0 ? 0 : pTab->aBloomBlk[p->iCol - 1];
+    }
+    switch ( p->eType ) {
+      case XBIN_PRED_RANGE:
+        if ( mn > mx ) return 1;
+        if ( p->bLoOpen ? mx <= p->rLo : mx < p->rLo ) return 1;
+        if ( p->bHiOpen ? mn >= p->rHi : mn > p->rHi ) return 1;
+        if ( nGroup && p->rLo == p->rHi && !p->bLoOpen && !p->bHiOpen ) {
+          /* An equality: only a float can match, and only if in the filter */
+          float v = (float)p->rLo;
+          if ( (double)v != p->rLo ) return 1;
+          if ( !xbinBloomHas(&pTab->aBloom[p->iCol - 1][iZone * nGroup * 8], nGroup, v) ) return 1;
+        }
+        break;
+      case XBIN_PRED_NE:
+        if ( mn > mx || (mn == mx && mn == p->rLo) ) return 1;
+        break;
+      case XBIN_PRED_NULL:
+        if ( !bNan ) return 1;
+        break;
+      case XBIN_PRED_NOTNULL:
+        if ( mn > mx ) return 1;
+        break;
+      default:
+        return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+** Return true if the zone map entry of block iZone, or the Bloom
+** filters of the block, show that no record of it can pass all of
+** aPred[].
+*/
+static int xbinZoneSkip(XbinTable *pTab, sqlite3_int64 iZone, const XbinPred *aPred, int nPred) {
+  return xbinZoneRuleOut(pTab, &pTab->aZone[iZone], iZone, aPred, nPred);
+}
+
+/*
+** Secondary indexes.
+**
+** xbin_create_index(TABLE, COLUMN) writes "<filename>.<column>.idx": an
+** XbinIdxHdr followed by one XbinIdxEntry per record, in order of value
+** and then of rowid.  Records where the column is NULL are left out.
+** The rows holding a range of values are found by two binary searches
+** over the sidecar, then visited in rowid order.  Records appended to
+** the file are sorted and merged into the index the next time it is
+** used.
+*/
+typedef struct XbinIdxEntry {
+  float v;                    /* Value of the column */
+  unsigned int pad;
+  sqlite3_int64 iRow;         /* Row holding it */
+} XbinIdxEntry;
+
+#define XBIN_IDX_LT(p, q) \
+  ((p)->v < (q)->v || ((p)->v == (q)->v && (p)->iRow < (q)->iRow))
+
+static int xbinIdxEntryCmp(const void *a, const void *b) {
+  const XbinIdxEntry *p = (const XbinIdxEntry*)a;
+  const XbinIdxEntry *q = (const XbinIdxEntry*)b;
+  if ( XBIN_IDX_LT(p, q) ) return -1;
+  return XBIN_IDX_LT(q, p);
+}
+
+static int xbinRowidCmp(const void *a, const void *b) {
+  sqlite3_int64 x = *(const sqlite3_int64*)a;
+  sqlite3_int64 y = *(const sqlite3_int64*)b;
+  return (x > y) - (x < y);
+}
+
+/* One run to sort, or two adjacent runs to merge */
+typedef struct XbinSortJob {
+  XbinIdxEntry *a;            /* The run, or the first of the two */
+  sqlite3_int64 n;            /* Entries in it */
+  sqlite3_int64 n2;           /* Entries in the second run, from a[n] on */
+  XbinIdxEntry *aOut;         /* Where to merge them, 0 to sort a[] in place */
+} XbinSortJob;
+
+static void xbinSortWork(void *pArg) {
+  XbinSortJob *pJob = (XbinSortJob*)pArg;
+  const XbinIdxEntry *p = pJob->a;
+  const XbinIdxEntry *pEnd = p + pJob->n;
+  const XbinIdxEntry *q = pEnd;
+  const XbinIdxEntry *qEnd = q + pJob->n2;
+  XbinIdxEntry *pOut = pJob->aOut;
+
+  if ( pOut == 0 ) {
+    qsort(pJob->a, (size_t)pJob->n, sizeof(XbinIdxEntry), xbinIdxEntryCmp);
+    return;
+  }
+  while ( p < pEnd && q < qEnd ) {
+    *(pOut++) = XBIN_IDX_LT(q, p) ? *(q++) : *(p++);
+  }
+  while ( p < pEnd ) *(pOut++) = *(p++);
+  while ( q < qEnd ) *(pOut++) = *(q++);
+}
+
+/*
+** Sort a[0..n-1], using aTmp[] of the same size as scratch space.  The
+** array is cut into one run per CPU, the runs are sorted by as many
+** threads, then merged two by two, the merges of a pass each in its own
+** thread.
+*/
+static void xbinIndexSort(XbinIdxEntry *a, XbinIdxEntry *aTmp, sqlite3_int64 n) {
+  XbinSortJob aJob[XBIN_MAX_THREADS];
+  XbinTask aTask[XBIN_MAX_THREADS];
+  sqlite3_int64 aRun[XBIN_MAX_THREADS + 1];   /* Run i is a[aRun[i]..aRun[i+1]-1] */
+  XbinIdxEntry *aSrc = a;
+  XbinIdxEntry *aDst = aTmp;
+  int nRun = xbinCpuCount();
+  int i;
+
+  if ( n / XBIN_SORT_RUN < nRun ) nRun = (int)(n / XBIN_SORT_RUN);
+  if ( nRun < 1 ) nRun = 1;
+  for (i = 0; i <= nRun; i++) aRun[i] = n * i / nRun;
+  for (i = 0; i < nRun; i++) {
+    aJob[i].a = a + aRun[i];
+    aJob[i].n = aRun[i+1] - aRun[i];
+    aJob[i].n2 = 0;
+    aJob[i].aOut = 0;
+    xbinTaskStart(&aTask[i], xbinSortWork, &aJob[i]);
+  }
+  for (i = 0; i < nRun; i++) xbinTaskJoin(&aTask[i]);
+
+  while ( nRun > 1 ) {
+    XbinIdxEntry *aSwap;
+    int nJob = 0;
+    for (i = 0; i < nRun; i += 2) {
+      XbinSortJob *pJob = &aJob[nJob];
+      pJob->a = aSrc + aRun[i];
+      pJob->n = aRun[i+1] - aRun[i];
+      pJob->n2 = (i + 1 < nRun) ? aRun[i+2] - aRun[i+1] : 0;
+      pJob->aOut = aDst + aRun[i];
+      aRun[nJob] = aRun[i];
+      xbinTaskStart(&aTask[nJob], xbinSortWork, pJob);
+      nJob++;
+    }
+    for (i = 0; i < nJob; i++) xbinTaskJoin(&aTask[i]);
+    aRun[nJob] = n;
+    nRun = nJob;
+    aSwap = aSrc;
+    aSrc = aDst;
+    aDst = aSwap;
+  }
+  if ( aSrc != a ) memcpy(a, aSrc, n * sizeof(XbinIdxEntry));
+}
+
+static char *xbinIndexPath(XbinTable *pTab, int iCol) {
+  return sqlite3_mprintf("%s.%s.idx", pTab->filename, azXbinCol[iCol]);
+}
+
+static int xbinIndexReadHdr(FILE *f, int iCol, XbinIdxHdr *pHdr) {
+  return fread(pHdr, sizeof(*pHdr), 1, f) == 1
+      && memcmp(pHdr->zMagic, "xbinidx1", 8) == 0
+      && pHdr->iCol == iCol
+      && pHdr->nEntry >= 0 && pHdr->nEntry <= pHdr->nRow;
+}
+
+/* Entries of the index being built, collected by xbinIndexBlock() */
+typedef struct XbinIdxBuild {
+  int iCol;
+  XbinIdxEntry *a;
+  sqlite3_int64 n;
+  xbinData tail;              /* Last record seen */
+} XbinIdxBuild;
+
+static int xbinIndexBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinIdxBuild *p = (XbinIdxBuild*)pArg;
+  int i;
+  for (i = 0; i < nRec; i++) {
+    float v = XBIN_VALUE(&aRec[i], p->iCol);
+    if ( v != v ) continue;
+    p->a[p->n].v = v;
+    p->a[p->n].pad = 0;
+    p->a[p->n].iRow = iRow + i;
+    p->n++;
+  }
+  p->tail = aRec[nRec - 1];
+  return SQLITE_OK;
+}
+
+/*
+** Bring the index on column iCol up to date with the pTab->nRow records
+** of the file: merge in the records appended since it was written, or
+** build it again from all records if bRebuild is set or the file was
+** shrunk or replaced.  Return SQLITE_NOTFOUND if the column has no
+** index and bRebuild is not set.
+*/
+static int xbinIndexRefresh(XbinTable *pTab, int iCol, int bRebuild) {
+  XbinIdxHdr hdr;
+  XbinIdxBuild bld;
+  XbinIdxEntry *aTmp;
+  sqlite3_int64 iStart = 1;
+  sqlite3_int64 nOld = 0;
+  sqlite3_int64 i;
+  char *zPath;
+  FILE *f;
+  xbinData rec;
+  int rc;
+
+  zPath = xbinIndexPath(pTab, iCol);
+  if ( zPath == 0 ) return SQLITE_NOMEM;
+  f = fopen(zPath, "rb");
+  if ( f && !xbinIndexReadHdr(f, iCol, &hdr) ) {
+    fclose(f);
+    f = 0;
+  }
+  if ( f == 0 && !bRebuild ) {
+    sqlite3_free(zPath);
+    pTab->mIndex &= ~XBIN_COLBIT(iCol);
+    return SQLITE_NOTFOUND;
+  }
+  if ( f && !bRebuild && hdr.nRow <= pTab->nRow
+    && (hdr.nRow == 0
+        || (xbinReadRecord(pTab->fptr, hdr.nRow, &rec)
+            && memcmp(&rec, &hdr.tail, sizeof(rec)) == 0)) ) {
+    if ( hdr.nRow == pTab->nRow ) {
+      fclose(f);
+      sqlite3_free(zPath);
+      pTab->aIdx[iCol-1] = hdr;
+      pTab->mIndex |= XBIN_COLBIT(iCol);
+      return SQLITE_OK;
+    }
+    nOld = hdr.nEntry;
+    iStart = hdr.nRow + 1;
+  }
+
+  /* There is at most one entry per record */
+  memset(&bld, 0, sizeof(bld));
+  bld.iCol = iCol;
+  bld.a = sqlite3_malloc64( (pTab->nRow + 1) * sizeof(XbinIdxEntry) );
+  aTmp = sqlite3_malloc64( (pTab->nRow + 1) * sizeof(XbinIdxEntry) );
+  if ( bld.a == 0 || aTmp == 0 ) {
+    if ( f ) fclose(f);
+    sqlite3_free(zPath);
+    sqlite3_free(bld.a);
+    sqlite3_free(aTmp);
+    return SQLITE_NOMEM;
+  }
+  if ( nOld > 0 && fread(bld.a, sizeof(XbinIdxEntry), (size_t)nOld, f) != (size_t)nOld ) {
+    nOld = 0;
+    iStart = 1;
+  }
+  if ( f ) fclose(f);
+  bld.n = nOld;
+  if ( iStart > 1 ) bld.tail = hdr.tail;
+
+  rc = xbinForEachBlock(pTab->fptr, iStart, pTab->nRow, xbinIndexBlock, &bld);
+  if ( rc == SQLITE_OK ) {
+    xbinIndexSort(bld.a + nOld, aTmp, bld.n - nOld);
+    if ( nOld > 0 && bld.n > nOld ) {
+      XbinSortJob job;
+      job.a = bld.a;
+      job.n = nOld;
+      job.n2 = bld.n - nOld;
+      job.aOut = aTmp;
+      xbinSortWork(&job);
+      memcpy(bld.a, aTmp, bld.n * sizeof(XbinIdxEntry));
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.zMagic, "xbinidx1", 8);
+    hdr.iCol = iCol;
+    hdr.nRow = pTab->nRow;
+    hdr.nEntry = bld.n;
+    hdr.tail = bld.tail;
+    for (i = 0; i < bld.n; i++) {
+      hdr.nDistinct += (i == 0 || bld.a[i].v != bld.a[i-1].v);
+    }
+    f = xbinSideOpen(zPath, "wb");
+    if ( f == 0 ) {
+      rc = SQLITE_CANTOPEN;
+    } else {
+      int bOk = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+             && fwrite(bld.a, sizeof(XbinIdxEntry), (size_t)bld.n, f) == (size_t)bld.n;
+      if ( !xbinSideClose(zPath, f, bOk) ) rc = SQLITE_IOERR;
+    }
+  }
+  sqlite3_free(zPath);
+  sqlite3_free(bld.a);
+  sqlite3_free(aTmp);
+  if ( rc == SQLITE_OK ) {
+    pTab->aIdx[iCol-1] = hdr;
+    pTab->mIndex |= XBIN_COLBIT(iCol);
+  }
+  return rc;
+}
+
+static int xbinIndexEntry(FILE *f, sqlite3_int64 i, XbinIdxEntry *p) {
+  sqlite3_int64 iOff = sizeof(XbinIdxHdr) + i * (sqlite3_int64)sizeof(XbinIdxEntry);
+  return xbin_fseek(f, iOff, SEEK_SET) == 0 && fread(p, sizeof(*p), 1, f) == 1;
+}
+
+/*
+** Look up the rows where the value of column p->iCol is within the
+** range of predicate p.  If there are no more than nMax of them, put
+** those between iFirst and iLast into a new array at *paRow, in rowid
+** order, and return how many.  Otherwise, or if the index cannot be
+** read, return -1.
+*/
+static sqlite3_int64 xbinIndexLookup(
+  XbinTable *pTab,
+  const XbinPred *p,
+  sqlite3_int64 iFirst, sqlite3_int64 iLast,
+  sqlite3_int64 nMax,
+  sqlite3_int64 **paRow
+) {
+  sqlite3_int64 nEntry = pTab->aIdx[p->iCol - 1].nEntry;
+  sqlite3_int64 lo, hi, iEnd;
+  sqlite3_int64 nRow = 0;
+  sqlite3_int64 *aRow;
+  XbinIdxEntry *aBuf;
+  XbinIdxEntry e;
+  char *zPath;
+  FILE *f;
+
+  *paRow = 0;
+  zPath = xbinIndexPath(pTab, p->iCol);
+  f = zPath ? fopen(zPath, "rb") : 0;
+  sqlite3_free(zPath);
+  if ( f == 0 ) return -1;
+
+  /* First entry that is not below the range */
+  lo = 0;
+  hi = nEntry;
+  while ( lo < hi ) {
+    sqlite3_int64 mid = lo + (hi - lo) / 2;
+    if ( !xbinIndexEntry(f, mid, &e) ) { fclose(f); return -1; }
+    if ( p->bLoOpen ? e.v <= p->rLo : e.v < p->rLo ) lo = mid + 1; else hi = mid;
+  }
+  /* First entry that is above the range */
+  iEnd = lo;
+  hi = nEntry;
+  while ( iEnd < hi ) {
+    sqlite3_int64 mid = iEnd + (hi - iEnd) / 2;
+    if ( !xbinIndexEntry(f, mid, &e) ) { fclose(f); return -1; }
+    if ( p->bHiOpen ? e.v >= p->rHi : e.v > p->rHi ) hi = mid; else iEnd = mid + 1;
+  }
+  if ( iEnd - lo > nMax ) {
+    fclose(f);
+    return -1;
+  }
+
+  aRow = sqlite3_malloc64( (iEnd - lo + 1) * sizeof(sqlite3_int64) );
+  aBuf = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(XbinIdxEntry) );
+  if ( aRow == 0 || aBuf == 0 ) {
+    fclose(f);
+    sqlite3_free(aRow);
+    sqlite3_free(aBuf);
+    return -1;
+  }
+  while ( lo < iEnd ) {
+    sqlite3_int64 n = iEnd - lo;
+    sqlite3_int64 i;
+    if ( n > XBIN_BLOCK_ROWS ) n = XBIN_BLOCK_ROWS;
+    if ( !xbinIndexEntry(f, lo, &aBuf[0])
+      || (n > 1 && fread(&aBuf[1], sizeof(XbinIdxEntry), (size_t)(n - 1), f) != (size_t)(n - 1)) ) {
+      fclose(f);
+      sqlite3_free(aRow);
+      sqlite3_free(aBuf);
+      return -1;
+    }
+    for (i = 0; i < n; i++) {
+      if ( aBuf[i].iRow >= iFirst && aBuf[i].iRow <= iLast ) aRow[nRow++] = aBuf[i].iRow;
+    }
+    lo += n;
+  }
+  fclose(f);
+  sqlite3_free(aBuf);
+  qsort(aRow, (size_t)nRow, sizeof(sqlite3_int64), xbinRowidCmp);
+  *paRow = aRow;
+  return nRow;
+}
+
+/*
+** Bitmap indexes.
+**
+** xbin_create_index(TABLE, COLUMN, 'bitmap') keeps, for each distinct
+** value of a column that has few of them, the set of rows holding it.
+** The sets are stored the roaring way: rows are grouped in chunks of
+** XBIN_BM_CHUNK, and the rows of a value in one chunk are an array of
+** 16-bit offsets while there are at most XBIN_BM_ARRAY_MAX of them, a
+** bitmap of the whole chunk beyond that.  Rows are only ever appended,
+** so only the last chunk of a value grows.  Constraints on bitmap
+** columns are answered one chunk at a time, OR-ing the sets of the
+** values selected on each column and AND-ing the columns.
+**
+** A bitmap index is loaded whole when first used.  The sidecar
+** "<filename>.<column>.bm" holds an XbinBmHdr, then for each value in
+** ascending order its value and number of chunks, each chunk being its
+** number and row count followed by its array or bitmap.
+*/
+#define XBIN_BM_CHUNK       65536
+#define XBIN_BM_WORDS       (XBIN_BM_CHUNK / 64)
+#define XBIN_BM_ARRAY_MAX   4096
+#define XBIN_BM_MAX_VALUES  4096
+
+/* Number of the lowest set bit of w, which is not 0 */
+#if defined(__GNUC__)
+# define xbinCtz64(w) __builtin_ctzll(w)
+#else
+static int xbinCtz64(sqlite3_uint64 w) {
+  int n = 0;
+  while ( (w & 0xff) == 0 ) { w >>= 8; n += 8; }
+  while ( (w & 1) == 0 ) { w >>= 1; n++; }
+  return n;
+}
+#endif
+
+typedef struct XbinBmChunk {
+  unsigned int iKey;          /* Chunk number: rows iKey*XBIN_BM_CHUNK+1 and up */
+  unsigned int nCard;         /* Rows of the value in the chunk */
+  unsigned int nAlloc;        /* Entries allocated in aArray */
+  unsigned short *aArray;     /* Offsets of the rows, if nCard <= XBIN_BM_ARRAY_MAX */
+  sqlite3_uint64 *aBits;      /* Bitmap of the rows, otherwise */
+} XbinBmChunk;
+
+typedef struct XbinBmValue {
+  float v;                    /* The value */
+  int nChunk;                 /* Chunks holding it, in ascending order */
+  int nChunkAlloc;
+  XbinBmChunk *aChunk;
+} XbinBmValue;
+
+struct XbinBitmap {
+  sqlite3_int64 nRow;         /* Records covered */
+  xbinData tail;              /* Record nRow */
+  int nValue;                 /* Distinct values, ascending in aValue[] */
+  int nValueAlloc;
+  XbinBmValue *aValue;
+};
+
+typedef struct XbinBmHdr {
+  char zMagic[8];             /* "xbinbm01" */
+  int iCol;                   /* Column indexed */
+  int nValue;                 /* Distinct values */
+  sqlite3_int64 nRow;         /* Records covered */
+  xbinData tail;              /* Record nRow */
+} XbinBmHdr;
+
+static void xbinBmFree(XbinBitmap *p) {
+  int i, j;
+  if ( p == 0 ) return;
+  for (i = 0; i < p->nValue; i++) {
+    for (j = 0; j < p->aValue[i].nChunk; j++) {
+      sqlite3_free(p->aValue[i].aChunk[j].aArray);
+      sqlite3_free(p->aValue[i].aChunk[j].aBits);
+    }
+    sqlite3_free(p->aValue[i].aChunk);
+  }
+  sqlite3_free(p->aValue);
+  sqlite3_free(p);
+}
+
+/* Index in p->aValue[] of the first value that is not below v */
+static int xbinBmFind(const XbinBitmap *p, double v) {
+  int lo = 0;
+  int hi = p->nValue;
+  while ( lo < hi ) {
+    int mid = (lo + hi) / 2;
+    if ( p->aValue[mid].v < v ) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+/*
+** Record that row iRow, which comes after every row already in p, holds
+** value v.  Return SQLITE_FULL if that makes too many distinct values.
+*/
+static int xbinBmAdd(XbinBitmap *p, float v, sqlite3_int64 iRow) {
+  unsigned int iKey = (unsigned int)((iRow - 1) / XBIN_BM_CHUNK);
+  unsigned int iOff = (unsigned int)((iRow - 1) % XBIN_BM_CHUNK);
+  int k = xbinBmFind(p, v);
+  XbinBmValue *pVal;
+  XbinBmChunk *pChunk;
+
+  if ( k == p->nValue || p->aValue[k].v != v ) {
+    if ( p->nValue >= XBIN_BM_MAX_VALUES ) return SQLITE_FULL;
+    if ( p->nValue == p->nValueAlloc ) {
+      int nNew = p->nValueAlloc ? p->nValueAlloc * 2 : 16;
+      XbinBmValue *aNew = sqlite3_realloc(p->aValue, nNew * sizeof(XbinBmValue));
+      if ( aNew == 0 ) return SQLITE_NOMEM;
+      p->aValue = aNew;
+      p->nValueAlloc = nNew;
+    }
+    memmove(&p->aValue[k+1], &p->aValue[k], (p->nValue - k) * sizeof(XbinBmValue));
+    memset(&p->aValue[k], 0, sizeof(XbinBmValue));
+    p->aValue[k].v = v;
+    p->nValue++;
+  }
+  pVal = &p->aValue[k];
+
+  if ( pVal->nChunk == 0 || pVal->aChunk[pVal->nChunk-1].iKey != iKey ) {
+    if ( pVal->nChunk == pVal->nChunkAlloc ) {
+      int nNew = pVal->nChunkAlloc ? pVal->nChunkAlloc * 2 : 4;
+      XbinBmChunk *aNew = sqlite3_realloc(pVal->aChunk, nNew * sizeof(XbinBmChunk));
+      if ( aNew == 0 ) return SQLITE_NOMEM;
+      pVal->aChunk = aNew;
+      pVal->nChunkAlloc = nNew;
+    }
+    memset(&pVal->aChunk[pVal->nChunk], 0, sizeof(XbinBmChunk));
+    pVal->aChunk[pVal->nChunk].iKey = iKey;
+    pVal->nChunk++;
+  }
+  pChunk = &pVal->aChunk[pVal->nChunk-1];
+
+  if ( pChunk->nCard < XBIN_BM_ARRAY_MAX ) {
+    if ( pChunk->nCard == pChunk->nAlloc ) {
+      unsigned int nNew = pChunk->nAlloc ? pChunk->nAlloc * 2 : 16;
+      unsigned short *aNew = sqlite3_realloc(pChunk->aArray, nNew * sizeof(unsigned short));
+      if ( aNew == 0 ) return SQLITE_NOMEM;
+      pChunk->aArray = aNew;
+      pChunk->nAlloc = nNew;
+    }
+    pChunk->aArray[pChunk->nCard++] = (unsigned short)iOff;
+    return SQLITE_OK;
+  }
+  if ( pChunk->aBits == 0 ) {
+    /* The array is full, switch to a bitmap */
+    unsigned int i;
+    pChunk->aBits = sqlite3_malloc( XBIN_BM_WORDS * sizeof(sqlite3_uint64) );
+    if ( pChunk->aBits == 0 ) return SQLITE_NOMEM;
+    memset(pChunk->aBits, 0, XBIN_BM_WORDS * sizeof(sqlite3_uint64));
+    for (i = 0; i < pChunk->nCard; i++) {
+      pChunk->aBits[pChunk->aArray[i] >> 6] |= ((sqlite3_uint64)1) << (pChunk->aArray[i] & 63);
+    }
+    sqlite3_free(pChunk->aArray);
+    pChunk->aArray = 0;
+    pChunk->nAlloc = 0;
+  }
+  pChunk->aBits[iOff >> 6] |= ((sqlite3_uint64)1) << (iOff & 63);
+  pChunk->nCard++;
+  return SQLITE_OK;
+}
+
+typedef struct XbinBmBuild {
+  XbinBitmap *p;
+  int iCol;
+} XbinBmBuild;
+
+static int xbinBmBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinBmBuild *pBld = (XbinBmBuild*)pArg;
+  int rc = SQLITE_OK;
+  int i;
+  for (i = 0; i < nRec && rc == SQLITE_OK; i++) {
+    float v = XBIN_VALUE(&aRec[i], pBld->iCol);
+    if ( v == v ) rc = xbinBmAdd(pBld->p, v, iRow + i);
+  }
+  pBld->p->tail = aRec[nRec - 1];
+  pBld->p->nRow = iRow + nRec - 1;
+  return rc;
+}
+
+static char *xbinBmPath(XbinTable *pTab, int iCol) {
+  return sqlite3_mprintf("%s.%s.bm", pTab->filename, azXbinCol[iCol]);
+}
+
+static int xbinBmReadHdr(FILE *f, int iCol, XbinBmHdr *pHdr) {
+  return fread(pHdr, sizeof(*pHdr), 1, f) == 1
+      && memcmp(pHdr->zMagic, "xbinbm01", 8) == 0
+      && pHdr->iCol == iCol
+      && pHdr->nValue >= 0 && pHdr->nValue <= XBIN_BM_MAX_VALUES;
+}
+
+/*
+** Load the bitmap index on column iCol.  Return 0 if there is none or
+** it cannot be read.
+*/
+static XbinBitmap *xbinBmRead(XbinTable *pTab, int iCol) {
+  char *zPath = xbinBmPath(pTab, iCol);
+  XbinBitmap *p = 0;
+  XbinBmHdr hdr;
+  FILE *f;
+  int bOk = 0;
+  int i, j;
+
+  f = zPath ? fopen(zPath, "rb") : 0;
+  sqlite3_free(zPath);
+  if ( f == 0 ) return 0;
+  if ( xbinBmReadHdr(f, iCol, &hdr) ) {
+    p = sqlite3_malloc( sizeof(*p) );
+    if ( p ) {
+      memset(p, 0, sizeof(*p));
+      p->aValue = sqlite3_malloc( (hdr.nValue + 1) * sizeof(XbinBmValue) );
+      if ( p->aValue ) memset(p->aValue, 0, (hdr.nValue + 1) * sizeof(XbinBmValue));
+    }
+    bOk = (p && p->aValue);
+    if ( bOk ) {
+      p->nRow = hdr.nRow;
+      p->tail = hdr.tail;
+      p->nValueAlloc = hdr.nValue + 1;
+    }
+    for (i = 0; bOk && i < hdr.nValue; i++) {
+      XbinBmValue *pVal = &p->aValue[i];
+      int nChunk;
+      p->nValue++;
+      if ( fread(&pVal->v, sizeof(float), 1, f) != 1
+        || fread(&nChunk, sizeof(int), 1, f) != 1 || nChunk < 0 ) {
+        bOk = 0;
+        break;
+      }
+      pVal->aChunk = sqlite3_malloc( (nChunk + 1) * sizeof(XbinBmChunk) );
+      if ( pVal->aChunk == 0 ) { bOk = 0; break; }
+      pVal->nChunkAlloc = nChunk + 1;
+      for (j = 0; bOk && j < nChunk; j++) {
+        XbinBmChunk *pChunk = &pVal->aChunk[j];
+        unsigned int a[2];
+        memset(pChunk, 0, sizeof(*pChunk));
+        pVal->nChunk++;
+        if ( fread(a, sizeof(a), 1, f) != 1 || a[1] == 0 || a[1] > XBIN_BM_CHUNK ) {
+          bOk = 0;
+          break;
+        }
+        pChunk->iKey = a[0];
+        pChunk->nCard = a[1];
+        if ( pChunk->nCard <= XBIN_BM_ARRAY_MAX ) {
+          pChunk->nAlloc = pChunk->nCard;
+          pChunk->aArray = sqlite3_malloc( pChunk->nCard * sizeof(unsigned short) );
+          bOk = pChunk->aArray
+             && fread(pChunk->aArray, sizeof(unsigned short), pChunk->nCard, f) == pChunk->nCard;
+        } else {
+          pChunk->aBits = sqlite3_malloc( XBIN_BM_WORDS * sizeof(sqlite3_uint64) );
+          bOk = pChunk->aBits
+             && fread(pChunk->aBits, sizeof(sqlite3_uint64), XBIN_BM_WORDS, f) == XBIN_BM_WORDS;
+        }
+      }
+    }
+  }
+  fclose(f);
+  if ( !bOk ) {
+    xbinBmFree(p);
+    return 0;
+  }
+  return p;
+}
+
+static int xbinBmWrite(XbinTable *pTab, int iCol, const XbinBitmap *p) {
+  char *zPath = xbinBmPath(pTab, iCol);
+  XbinBmHdr hdr;
+  FILE *f;
+  int bOk;
+  int i, j;
+
+  if ( zPath == 0 ) return SQLITE_NOMEM;
+  f = xbinSideOpen(zPath, "wb");
+  if ( f == 0 ) {
+    sqlite3_free(zPath);
+    return SQLITE_CANTOPEN;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.zMagic, "xbinbm01", 8);
+  hdr.iCol = iCol;
+  hdr.nValue = p->nValue;
+  hdr.nRow = p->nRow;
+  hdr.tail = p->tail;
+  bOk = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+  for (i = 0; bOk && i < p->nValue; i++) {
+    const XbinBmValue *pVal = &p->aValue[i];
+    bOk = fwrite(&pVal->v, sizeof(float), 1, f) == 1
+       && fwrite(&pVal->nChunk, sizeof(int), 1, f) == 1;
+    for (j = 0; bOk && j < pVal->nChunk; j++) {
+      const XbinBmChunk *pChunk = &pVal->aChunk[j];
+      unsigned int a[2];
+      a[0] = pChunk->iKey;
+      a[1] = pChunk->nCard;
+      bOk = fwrite(a, sizeof(a), 1, f) == 1;
+      if ( !bOk ) break;
+      if ( pChunk->aBits ) {
+        bOk = fwrite(pChunk->aBits, sizeof(sqlite3_uint64), XBIN_BM_WORDS, f) == XBIN_BM_WORDS;
+      } else {
+        bOk = fwrite(pChunk->aArray, sizeof(unsigned short), pChunk->nCard, f) == pChunk->nCard;
+      }
+    }
+  }
+  bOk = xbinSideClose(zPath, f, bOk);
+  sqlite3_free(zPath);
+  return bOk ? SQLITE_OK : SQLITE_IOERR;
+}
+
+/*
+** Bring the bitmap index on column iCol up to date with the pTab->nRow
+** records of the file, loading it first if needed.  The appended
+** records are added to it, or all of them if bRebuild is set or the
+** file was shrunk or replaced.  Return SQLITE_NOTFOUND if there is no
+** bitmap index on the column and bRebuild is not set, SQLITE_FULL if
+** the column has too many distinct values for one.
+*/
+static int xbinBmRefresh(XbinTable *pTab, int iCol, int bRebuild) {
+  XbinBitmap *p = pTab->apBm[iCol-1];
+  XbinBmBuild bld;
+  xbinData rec;
+  int rc;
+
+  if ( bRebuild ) {
+    xbinBmFree(p);
+    p = 0;
+  } else {
+    if ( p == 0 ) p = xbinBmRead(pTab, iCol);
+    if ( p == 0 ) {
+      pTab->apBm[iCol-1] = 0;
+      pTab->mBitmap &= ~XBIN_COLBIT(iCol);
+      return SQLITE_NOTFOUND;
+    }
+    if ( p->nRow == pTab->nRow ) {
+      pTab->apBm[iCol-1] = p;
+      return SQLITE_OK;
+    }
+    if ( p->nRow > pTab->nRow
+      || (p->nRow > 0
+          && (!xbinReadRecord(pTab->fptr, p->nRow, &rec)
+              || memcmp(&rec, &p->tail, sizeof(rec)) != 0)) ) {
+      xbinBmFree(p);
+      p = 0;
+    }
+  }
+  pTab->apBm[iCol-1] = 0;
+  if ( p == 0 ) {
+    p = sqlite3_malloc( sizeof(*p) );
+    if ( p == 0 ) return SQLITE_NOMEM;
+    memset(p, 0, sizeof(*p));
+  }
+
+  bld.p = p;
+  bld.iCol = iCol;
+  rc = xbinForEachBlock(pTab->fptr, p->nRow + 1, pTab->nRow, xbinBmBlock, &bld);
+  if ( rc == SQLITE_OK ) rc = xbinBmWrite(pTab, iCol, p);
+  if ( rc != SQLITE_OK ) {
+    xbinBmFree(p);
+    if ( rc == SQLITE_FULL ) {
+      char *zPath = xbinBmPath(pTab, iCol);
+      sqlite3_log(SQLITE_WARNING, "xbin: %s has more than %d distinct values of %s, "
+                  "dropping its bitmap index", pTab->filename, XBIN_BM_MAX_VALUES, azXbinCol[iCol]);
+      if ( zPath ) remove(zPath);
+      sqlite3_free(zPath);
+      pTab->mBitmap &= ~XBIN_COLBIT(iCol);
+    }
+    return rc;
+  }
+  pTab->apBm[iCol-1] = p;
+  pTab->mBitmap |= XBIN_COLBIT(iCol);
+  pTab->aBmValue[iCol-1] = p->nValue;
+  return SQLITE_OK;
+}
+
+/*
+** Set aBits[] to the rows of chunk iKey where column p->iCol is in the
+** range of predicate p, the OR of the sets of the values in the range.
+** Return 0, leaving aBits[] undefined, if there are none.
+*/
+static int xbinBmChunkOr(const XbinBitmap *pBm, const XbinPred *p, unsigned int iKey,
+                         sqlite3_uint64 *aBits) {
+  int bAny = 0;
+  int k;
+
+  for (k = xbinBmFind(pBm, p->rLo); k < pBm->nValue; k++) {
+    const XbinBmValue *pVal = &pBm->aValue[k];
+    const XbinBmChunk *pChunk;
+    int lo = 0;
+    int hi = pVal->nChunk;
+    if ( p->bLoOpen && pVal->v <= p->rLo ) continue;
+    if ( p->bHiOpen ? pVal->v >= p->rHi : pVal->v > p->rHi ) break;
+    while ( lo < hi ) {
+      int mid = (lo + hi) / 2;
+      if ( pVal->aChunk[mid].iKey < iKey ) lo = mid + 1; else hi = mid;
+    }
+    if ( lo == pVal->nChunk || pVal->aChunk[lo].iKey != iKey ) continue;
+    pChunk = &pVal->aChunk[lo];
+    if ( !bAny ) memset(aBits, 0, XBIN_BM_WORDS * sizeof(sqlite3_uint64));
+    bAny = 1;
+    if ( pChunk->aBits ) {
+      int i;
+      for (i = 0; i < XBIN_BM_WORDS; i++) aBits[i] |= pChunk->aBits[i];
+    } else {
+      unsigned int i;
+      for (i = 0; i < pChunk->nCard; i++) {
+        aBits[pChunk->aArray[i] >> 6] |= ((sqlite3_uint64)1) << (pChunk->aArray[i] & 63);
+      }
+    }
+  }
+  return bAny;
+}
+
+/*
+** Learned index.
+**
+** xbin_create_index(TABLE, COLUMN, 'learned') models the position of
+** each value of a column that never decreases from one record to the
+** next, such as a timestamp, by a piecewise-linear function of the
+** value.  The "<filename>.<column>.pla" sidecar holds a header and the
+** segments of the function: a segment starts at the first row of some
+** value kFirst and predicts the first row of each value v up to kLast
+** as iRow + rSlope*(v - kFirst), within XBIN_PLA_ERROR rows.  A value
+** between kFirst and kLast that is not in the column is predicted as
+** closely as the next one in it, so finding the first row of any value
+** takes a search among the segments, in memory, then one read of the
+** few rows around the prediction.
+**
+** The segments are made in one pass over the column by the shrinking
+** cone method: a segment grows while some slope keeps all its values
+** within bounds, and a value repeated in more than 2*XBIN_PLA_ERROR
+** records gets a segment of its own.  The last segment is left open,
+** with the range of slopes it may still take and the last value, which
+** is in no segment yet, in the header, so appended records pick up
+** where the pass stopped.  The index is dropped if they do not keep
+** the column in order, or hold NULL.
+*/
+#define XBIN_PLA_ERROR  32    /* most rows a prediction may be off by */
+
+typedef struct XbinPlaSeg {
+  float kFirst;               /* First value of the segment */
+  float kLast;                /* Last value of the segment */
+  double rSlope;              /* Rows per unit of value */
+  sqlite3_int64 iRow;         /* First row of kFirst */
+} XbinPlaSeg;
+
+typedef struct XbinPlaHdr {
+  char zMagic[8];             /* "xbinpla1" */
+  int iCol;                   /* Column modelled */
+  int nErr;                   /* XBIN_PLA_ERROR */
+  sqlite3_int64 nRow;         /* Records covered */
+  sqlite3_int64 nSeg;         /* Segments */
+  double rSlopeLo;            /* Slopes the last segment may still take, */
+  double rSlopeHi;            /* ... if bOpen */
+  sqlite3_int64 iKeyRow;      /* First row of kKey, 0 if there are no records */
+  float kKey;                 /* Last value, not in a segment yet */
+  int bOpen;                  /* True if the last segment may grow */
+  xbinData tail;              /* Record nRow */
+} XbinPlaHdr;
+
+struct XbinPla {
+  XbinPlaHdr hdr;
+  XbinPlaSeg *aSeg;           /* hdr.nSeg segments, in order of value */
+  sqlite3_int64 nAlloc;       /* Entries allocated in aSeg[] */
+};
+
+static void xbinPlaFree(XbinPla *p) {
+  if ( p == 0 ) return;
+  sqlite3_free(p->aSeg);
+  sqlite3_free(p);
+}
+
+static char *xbinPlaPath(XbinTable *pTab, int iCol) {
+  return sqlite3_mprintf("%s.%s.pla", pTab->filename, azXbinCol[iCol]);
+}
+
+static int xbinPlaReadHdr(FILE *f, int iCol, XbinPlaHdr *pHdr) {
+  return fread(pHdr, sizeof(*pHdr), 1, f) == 1
+      && memcmp(pHdr->zMagic, "xbinpla1", 8) == 0
+      && pHdr->iCol == iCol
+      && pHdr->nErr == XBIN_PLA_ERROR
+      && pHdr->nSeg >= 0 && pHdr->nSeg <= pHdr->nRow;
+}
+
+/*
+** Add value k, found in rows iFirst..iNext-1, to the model: to the last
+** segment if some slope keeps both iFirst and iNext within bounds of
+** the prediction for k, so that values between the last one and k are
+** predicted well too, or else to a new segment.
+*/
+static int xbinPlaAdd(XbinPla *p, float k, sqlite3_int64 iFirst, sqlite3_int64 iNext) {
+  XbinPlaHdr *pHdr = &p->hdr;
+  XbinPlaSeg *pSeg;
+
+  if ( pHdr->bOpen && iNext - iFirst <= 2 * XBIN_PLA_ERROR ) {
+    double dk, rLo, rHi;
+    pSeg = &p->aSeg[pHdr->nSeg - 1];
+    dk = (double)k - pSeg->kFirst;
+    rLo = (double)(iNext - XBIN_PLA_ERROR - pSeg->iRow) / dk;
+    rHi = (double)(iFirst + XBIN_PLA_ERROR - pSeg->iRow) / dk;
+    if ( rLo < pHdr->rSlopeLo ) rLo = pHdr->rSlopeLo;
+    if ( rHi > pHdr->rSlopeHi ) rHi = pHdr->rSlopeHi;
+    if ( dk < HUGE_VAL && rLo <= rHi ) {
+      pHdr->rSlopeLo = rLo;
+      pHdr->rSlopeHi = rHi;
+      pSeg->kLast = k;
+      pSeg->rSlope = rLo + (rHi - rLo) / 2.0;
+      return SQLITE_OK;
+    }
+  }
+
+  if ( pHdr->nSeg == p->nAlloc ) {
+    sqlite3_int64 nNew = p->nAlloc ? p->nAlloc * 2 : 64;
+    XbinPlaSeg *aNew = sqlite3_realloc64(p->aSeg, nNew * sizeof(XbinPlaSeg));
+    if ( aNew == 0 ) return SQLITE_NOMEM;
+    p->aSeg = aNew;
+    p->nAlloc = nNew;
+  }
+  pSeg = &p->aSeg[pHdr->nSeg++];
+  pSeg->kFirst = pSeg->kLast = k;
+  pSeg->rSlope = 0.0;
+  pSeg->iRow = iFirst;
+  /* Values just above k are predicted at iFirst, so the segment can
+  ** only grow if iNext is close enough to it */
+  pHdr->bOpen = (iNext - iFirst <= XBIN_PLA_ERROR) && k > -HUGE_VAL && k < HUGE_VAL;
+  pHdr->rSlopeLo = -HUGE_VAL;
+  pHdr->rSlopeHi = HUGE_VAL;
+  return SQLITE_OK;
+}
+
+/*
+** Add the values of a block to the model.  Return SQLITE_CONSTRAINT if
+** the column is out of order or NULL.
+*/
+static int xbinPlaBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinPla *p = (XbinPla*)pArg;
+  int i;
+  for (i = 0; i < nRec; i++) {
+    float v = XBIN_VALUE(&aRec[i], p->hdr.iCol);
+    if ( p->hdr.iKeyRow > 0 ) {
+      if ( !(v >= p->hdr.kKey) ) return SQLITE_CONSTRAINT;
+      if ( v == p->hdr.kKey ) continue;
+      if ( xbinPlaAdd(p, p->hdr.kKey, p->hdr.iKeyRow, iRow + i) != SQLITE_OK ) return SQLITE_NOMEM;
+    } else if ( v != v ) {
+      return SQLITE_CONSTRAINT;
+    }
+    p->hdr.kKey = v;
+    p->hdr.iKeyRow = iRow + i;
+  }
+  p->hdr.tail = aRec[nRec - 1];
+  return SQLITE_OK;
+}
+
+static XbinPla *xbinPlaRead(XbinTable *pTab, int iCol) {
+  char *zPath = xbinPlaPath(pTab, iCol);
+  XbinPla *p = 0;
+  FILE *f;
+  int bOk = 0;
+
+  f = zPath ? fopen(zPath, "rb") : 0;
+  sqlite3_free(zPath);
+  if ( f == 0 ) return 0;
+  p = sqlite3_malloc( sizeof(*p) );
+  if ( p ) {
+    memset(p, 0, sizeof(*p));
+    bOk = xbinPlaReadHdr(f, iCol, &p->hdr);
+  }
+  if ( bOk ) {
+    sqlite3_int64 n = p->hdr.nSeg;
+    p->aSeg = sqlite3_malloc64( (n + 1) * sizeof(XbinPlaSeg) );
+    p->nAlloc = n + 1;
+    bOk = p->aSeg && fread(p->aSeg, sizeof(XbinPlaSeg), (size_t)n, f) == (size_t)n;
+  }
+  fclose(f);
+  if ( !bOk ) {
+    xbinPlaFree(p);
+    return 0;
+  }
+  return p;
+}
+
+static int xbinPlaWrite(XbinTable *pTab, const XbinPla *p) {
+  char *zPath = xbinPlaPath(pTab, p->hdr.iCol);
+  sqlite3_int64 n = p->hdr.nSeg;
+  FILE *f;
+  int bOk;
+
+  if ( zPath == 0 ) return SQLITE_NOMEM;
+  f = xbinSideOpen(zPath, "wb");
+  if ( f == 0 ) {
+    sqlite3_free(zPath);
+    return SQLITE_CANTOPEN;
+  }
+  bOk = fwrite(&p->hdr, sizeof(p->hdr), 1, f) == 1
+     && fwrite(p->aSeg, sizeof(XbinPlaSeg), (size_t)n, f) == (size_t)n;
+  bOk = xbinSideClose(zPath, f, bOk);
+  sqlite3_free(zPath);
+  return bOk ? SQLITE_OK : SQLITE_IOERR;
+}
+
+/*
+** Bring the learned index on column iCol up to date with the pTab->nRow
+** records of the file, as xbinBmRefresh() does for a bitmap index.
+** Return SQLITE_NOTFOUND if there is none and bRebuild is not set, and
+** SQLITE_CONSTRAINT, dropping the index, if the column is not in order.
+*/
+static int xbinPlaRefresh(XbinTable *pTab, int iCol, int bRebuild) {
+  XbinPla *p = pTab->apPla[iCol-1];
+  xbinData rec;
+  int rc;
+
+  if ( bRebuild ) {
+    xbinPlaFree(p);
+    p = 0;
+  } else {
+    if ( p == 0 ) p = xbinPlaRead(pTab, iCol);
+    if ( p == 0 ) {
+      pTab->apPla[iCol-1] = 0;
+      pTab->mLearned &= ~XBIN_COLBIT(iCol);
+      return SQLITE_NOTFOUND;
+    }
+    if ( p->hdr.nRow == pTab->nRow ) {
+      pTab->apPla[iCol-1] = p;
+      return SQLITE_OK;
+    }
+    if ( p->hdr.nRow > pTab->nRow
+      || (p->hdr.nRow > 0
+          && (!xbinReadRecord(pTab->fptr, p->hdr.nRow, &rec)
+              || memcmp(&rec, &p->hdr.tail, sizeof(rec)) != 0)) ) {
+      xbinPlaFree(p);
+      p = 0;
+    }
+  }
+  pTab->apPla[iCol-1] = 0;
+  if ( p == 0 ) {
+    p = sqlite3_malloc( sizeof(*p) );
+    if ( p == 0 ) return SQLITE_NOMEM;
+    memset(p, 0, sizeof(*p));
+    memcpy(p->hdr.zMagic, "xbinpla1", 8);
+    p->hdr.iCol = iCol;
+    p->hdr.nErr = XBIN_PLA_ERROR;
+  }
+
+  rc = xbinForEachBlock(pTab->fptr, p->hdr.nRow + 1, pTab->nRow, xbinPlaBlock, p);
+  p->hdr.nRow = pTab->nRow;
+  if ( rc == SQLITE_OK ) rc = xbinPlaWrite(pTab, p);
+  if ( rc != SQLITE_OK ) {
+    xbinPlaFree(p);
+    if ( rc == SQLITE_CONSTRAINT ) {
+      char *zPath = xbinPlaPath(pTab, iCol);
+      sqlite3_log(SQLITE_WARNING, "xbin: %s is not in ascending order of %s, "
+                  "dropping its learned index", pTab->filename, azXbinCol[iCol]);
+      if ( zPath ) remove(zPath);
+      sqlite3_free(zPath);
+      pTab->mLearned &= ~XBIN_COLBIT(iCol);
+    }
+    return rc;
+  }
+  pTab->apPla[iCol-1] = p;
+  pTab->mLearned |= XBIN_COLBIT(iCol);
+  return SQLITE_OK;
+}
+
+/*
+** Return the first row of fptr, 1..nRow+1, where the column modelled by
+** p is at least r, or above it if bAfter.
+*/
+static sqlite3_int64 xbinPlaSearch(const XbinPla *p, FILE *fptr, double r, int bAfter) {
+  const XbinPlaHdr *pHdr = &p->hdr;
+  xbinData aRec[2 * XBIN_PLA_ERROR + 3];
+  sqlite3_int64 iNext;
+  sqlite3_int64 iLo, iHi;
+  sqlite3_int64 lo = 0;
+  sqlite3_int64 hi = pHdr->nSeg;
+  sqlite3_int64 n, i;
+  const XbinPlaSeg *pSeg;
+  double rPred;
+  float k;
+
+  /* The smallest float that the rows sought hold or exceed */
+  k = (float)r;
+  if ( bAfter ? (double)k <= r : (double)k < r ) k = nextafterf(k, HUGE_VALF);
+
+  if ( pHdr->iKeyRow == 0 ) return 1;
+  if ( k > pHdr->kKey ) return pHdr->nRow + 1;
+  if ( pHdr->nSeg == 0 || k > p->aSeg[pHdr->nSeg - 1].kLast ) return pHdr->iKeyRow;
+  while ( lo < hi ) {
+    sqlite3_int64 mid = lo + (hi - lo) / 2;
+    if ( p->aSeg[mid].kFirst <= k ) lo = mid + 1; else hi = mid;
+  }
+  if ( lo == 0 ) return 1;
+  pSeg = &p->aSeg[lo - 1];
+  iNext = lo < pHdr->nSeg ? p->aSeg[lo].iRow : pHdr->iKeyRow;
+  if ( k > pSeg->kLast ) return iNext;
+  if ( k == pSeg->kFirst ) return pSeg->iRow;
+
+  rPred = (double)pSeg->iRow + pSeg->rSlope * ((double)k - pSeg->kFirst);
+  iLo = pSeg->iRow;
+  iHi = iNext - 1;
+  if ( rPred - XBIN_PLA_ERROR - 1 > (double)iLo ) iLo = (sqlite3_int64)(rPred - XBIN_PLA_ERROR - 1);
+  if ( rPred + XBIN_PLA_ERROR + 1 < (double)iHi ) iHi = (sqlite3_int64)(rPred + XBIN_PLA_ERROR + 1);
+  if ( iLo > iHi ) iLo = iHi;
+  if ( iHi - iLo + 1 > (sqlite3_int64)(sizeof(aRec) / sizeof(aRec[0])) ) {
+    iHi = iLo + sizeof(aRec) / sizeof(aRec[0]) - 1;
+  }
+  n = xbinReadRecords(fptr, iLo, iHi - iLo + 1, aRec);
+  for (i = 0; i < n && XBIN_VALUE(&aRec[i], pHdr->iCol) < k; i++) {}
+  return iLo + i;
+}
+
+/*
+** Narrow [*piFirst, *piLast] to the rows where column pRange->iCol is
+** within the bounds of pRange, an XBIN_PRED_RANGE predicate, using its
+** learned index.  Return SQLITE_NOTFOUND, leaving them be, if there is
+** no usable index on the column.
+*/
+static int xbinPlaNarrow(
+  XbinTable *pTab,
+  FILE *fptr,
+  const XbinPred *pRange,
+  sqlite3_int64 *piFirst, sqlite3_int64 *piLast
+) {
+  XbinPla *p;
+  sqlite3_int64 iRow;
+  int rc;
+
+  if ( (pTab->mLearned & XBIN_COLBIT(pRange->iCol)) == 0 ) return SQLITE_NOTFOUND;
+  rc = xbinPlaRefresh(pTab, pRange->iCol, 0);
+  if ( rc == SQLITE_NOMEM ) return rc;
+  if ( rc != SQLITE_OK ) return SQLITE_NOTFOUND;
+  p = pTab->apPla[pRange->iCol - 1];
+  if ( pRange->rLo > -HUGE_VAL ) {
+    iRow = xbinPlaSearch(p, fptr, pRange->rLo, pRange->bLoOpen);
+    if ( iRow > *piFirst ) *piFirst = iRow;
+  }
+  if ( pRange->rHi < HUGE_VAL ) {
+    iRow = xbinPlaSearch(p, fptr, pRange->rHi, !pRange->bHiOpen) - 1;
+    if ( iRow < *piLast ) *piLast = iRow;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Find out which columns have a sorted, a bitmap or a learned index,
+** once per connection.
+*/
+static void xbinIndexProbe(XbinTable *pTab) {
+  int iCol;
+  if ( pTab->bIndexProbed ) return;
+  pTab->bIndexProbed = 1;
+  pTab->mIndex = 0;
+  pTab->mBitmap = 0;
+  pTab->mLearned = 0;
+  for (iCol = 1; iCol <= XBIN_NCOL; iCol++) {
+    char *zPath = xbinIndexPath(pTab, iCol);
+    FILE *f = zPath ? fopen(zPath, "rb") : 0;
+    XbinBmHdr hdr;
+    XbinPlaHdr plaHdr;
+    sqlite3_free(zPath);
+    if ( f ) {
+      if ( xbinIndexReadHdr(f, iCol, &pTab->aIdx[iCol-1]) ) {
+        pTab->mIndex |= XBIN_COLBIT(iCol);
+      }
+      fclose(f);
+    }
+    zPath = xbinBmPath(pTab, iCol);
+    f = zPath ? fopen(zPath, "rb") : 0;
+    sqlite3_free(zPath);
+    if ( f ) {
+      if ( xbinBmReadHdr(f, iCol, &hdr) ) {
+        pTab->mBitmap |= XBIN_COLBIT(iCol);
+        pTab->aBmValue[iCol-1] = hdr.nValue;
+      }
+      fclose(f);
+    }
+    zPath = xbinPlaPath(pTab, iCol);
+    f = zPath ? fopen(zPath, "rb") : 0;
+    sqlite3_free(zPath);
+    if ( f ) {
+      if ( xbinPlaReadHdr(f, iCol, &plaHdr) ) pTab->mLearned |= XBIN_COLBIT(iCol);
+      fclose(f);
+    }
+  }
+}
+
+/*
+** Rollup pyramids.
+**
+** xbin_downsample() (see below) reads the min, max, avg and count of a
+** column over a run of rows from the "<filename>.<column>.pyr" sidecar,
+** which the first call on the column builds.  The sidecar holds a
+** header and the buckets of a pyramid of levels.  Each bucket of level
+** 0 sums up 2^XBIN_PYR_SHIFT records, aligned on rowid 1.  Each bucket
+** of a higher level sums up two buckets of the level below it, and the
+** top level has a single bucket for the whole file.  Any run of rows is
+** then covered by at most two buckets per level, plus fewer than
+** 2^XBIN_PYR_SHIFT records at each end that are read from the file.
+** Appended records fill in the last buckets of every level, and the
+** sidecar is written again in full, as the zone maps are.
+*/
+#define XBIN_PYR_SHIFT   6     /* log2 of the records in a bucket of level 0 */
+#define XBIN_PYR_LEVELS  64
+
+typedef struct XbinRollup {
+  float rMin;                 /* Smallest value, +Inf if all are NULL */
+  float rMax;                 /* Largest value, -Inf if all are NULL */
+  sqlite3_int64 nValue;       /* Values that are not NULL */
+  double rSum;                /* Their sum */
+} XbinRollup;
+
+typedef struct XbinPyrHdr {
+  char zMagic[8];             /* "xbinpyr1" */
+  int iCol;                   /* Column summed up */
+  int nShift;                 /* XBIN_PYR_SHIFT */
+  sqlite3_int64 nRow;         /* Records covered */
+  xbinData tail;              /* Record nRow */
+} XbinPyrHdr;
+
+struct XbinPyr {
+  XbinPyrHdr hdr;
+  int nLevel;                 /* Levels, 0 if there are no records */
+  sqlite3_int64 aOff[XBIN_PYR_LEVELS + 1];  /* Level h is aBucket[aOff[h]..aOff[h+1]-1] */
+  XbinRollup *aBucket;        /* Buckets of every level, level 0 first */
+};
+
+static void xbinRollupInit(XbinRollup *p) {
+  p->rMin = HUGE_VALF;
+  p->rMax = -HUGE_VALF;
+  p->nValue = 0;
+  p->rSum = 0.0;
+}
+
+static void xbinRollupMerge(XbinRollup *p, const XbinRollup *q) {
+  if ( q->rMin < p->rMin ) p->rMin = q->rMin;
+  if ( q->rMax > p->rMax ) p->rMax = q->rMax;
+  p->nValue += q->nValue;
+  p->rSum += q->rSum;
+}
+
+static void xbinRollupAddScalar(XbinRollup *p, const xbinData *aRec, int nRec, int iCol) {
+  int i;
+  for (i = 0; i < nRec; i++) {
+    float v = XBIN_VALUE(&aRec[i], iCol);
+    if ( v != v ) continue;
+    if ( v < p->rMin ) p->rMin = v;
+    if ( v > p->rMax ) p->rMax = v;
+    p->nValue++;
+    p->rSum += v;
+  }
+}
+
+/*
+** The vector kernels below take the column from a few records at once.
+** min and max return their second operand when either one is NaN, so
+** NULLs drop out of them by coming first.  The sums are kept in double
+** precision, as the scalar loop does.
+*/
+#ifdef XBIN_SIMD_SSE2
+static void xbinRollupAddSse2(XbinRollup *p, const xbinData *aRec, int nRec, int iCol) {
+  const float *a = &XBIN_VALUE(aRec, iCol);
+  __m128 vMin = _mm_set1_ps(HUGE_VALF);
+  __m128 vMax = _mm_set1_ps(-HUGE_VALF);
+  __m128d vSumLo = _mm_setzero_pd();
+  __m128d vSumHi = _mm_setzero_pd();
+  float aMin[4], aMax[4];
+  double aSum[2];
+  XbinRollup r;
+  int i, j;
+
+  xbinRollupInit(&r);
+  for (i = 0; i + 4 <= nRec; i += 4) {
+    const float *q = &a[i * XBIN_NCOL];
+    __m128 v = _mm_setr_ps(q[0], q[XBIN_NCOL], q[2 * XBIN_NCOL], q[3 * XBIN_NCOL]);
+    __m128 m = _mm_cmpord_ps(v, v);
+    __m128 vSet = _mm_and_ps(v, m);
+    vMin = _mm_min_ps(v, vMin);
+    vMax = _mm_max_ps(v, vMax);
+    vSumLo = _mm_add_pd(vSumLo, _mm_cvtps_pd(vSet));
+    vSumHi = _mm_add_pd(vSumHi, _mm_cvtps_pd(_mm_movehl_ps(vSet, vSet)));
+    r.nValue += "\0\1\1\2\1\2\2\3\1\2\2\3\2\3\3\4"[_mm_movemask_ps(m)];
+  }
+  _mm_storeu_ps(aMin, vMin);
+  _mm_storeu_ps(aMax, vMax);
+  _mm_storeu_pd(aSum, _mm_add_pd(vSumLo, vSumHi));
+  for (j = 0; j < 4; j++) {
+    if ( aMin[j] < r.rMin ) r.rMin = aMin[j];
+    if ( aMax[j] > r.rMax ) r.rMax = aMax[j];
+  }
+  r.rSum = aSum[0] + aSum[1];
+  xbinRollupAddScalar(&r, &aRec[i], nRec - i, iCol);
+  xbinRollupMerge(p, &r);
+}
+#endif
+
+#ifdef XBIN_SIMD_AVX2
+__attribute__((target("avx2")))
+static void xbinRollupAddAvx2(XbinRollup *p, const xbinData *aRec, int nRec, int iCol) {
+  const float *a = &XBIN_VALUE(aRec, iCol);
+  const __m256i vIdx = _mm256_setr_epi32(0, XBIN_NCOL, 2 * XBIN_NCOL, 3 * XBIN_NCOL,
+                                         4 * XBIN_NCOL, 5 * XBIN_NCOL, 6 * XBIN_NCOL,
+                                         7 * XBIN_NCOL);
+  __m256 vMin = _mm256_set1_ps(HUGE_VALF);
+  __m256 vMax = _mm256_set1_ps(-HUGE_VALF);
+  __m256d vSumLo = _mm256_setzero_pd();
+  __m256d vSumHi = _mm256_setzero_pd();
+  float aMin[8], aMax[8];
+  double aSum[4];
+  XbinRollup r;
+  int i, j;
+
+  xbinRollupInit(&r);
+  for (i = 0; i + 8 <= nRec; i += 8) {
+    __m256 v = _mm256_i32gather_ps(&a[i * XBIN_NCOL], vIdx, 4);
+    __m256 m = _mm256_cmp_ps(v, v, _CMP_ORD_Q);
+    __m256 vSet = _mm256_and_ps(v, m);
+    vMin = _mm256_min_ps(v, vMin);
+    vMax = _mm256_max_ps(v, vMax);
+    vSumLo = _mm256_add_pd(vSumLo, _mm256_cvtps_pd(_mm256_castps256_ps128(vSet)));
+    vSumHi = _mm256_add_pd(vSumHi, _mm256_cvtps_pd(_mm256_extractf128_ps(vSet, 1)));
+    r.nValue += __builtin_popcount(_mm256_movemask_ps(m));
+  }
+  _mm256_storeu_ps(aMin, vMin);
+  _mm256_storeu_ps(aMax, vMax);
+  _mm256_storeu_pd(aSum, _mm256_add_pd(vSumLo, vSumHi));
+  for (j = 0; j < 8; j++) {
+    if ( aMin[j] < r.rMin ) r.rMin = aMin[j];
+    if ( aMax[j] > r.rMax ) r.rMax = aMax[j];
+  }
+  r.rSum = (aSum[0] + aSum[1]) + (aSum[2] + aSum[3]);
+  xbinRollupAddScalar(&r, &aRec[i], nRec - i, iCol);
+  xbinRollupMerge(p, &r);
+}
+#endif
+
+/* Add the values of column iCol of aRec[0..nRec-1] to *p */
+static void xbinRollupAdd(XbinRollup *p, const xbinData *aRec, int nRec, int iCol) {
+#ifdef XBIN_SIMD_AVX2
+  if ( xbinSimdAvx2 ) {
+    xbinRollupAddAvx2(p, aRec, nRec, iCol);
+    return;
+  }
+#endif
+#ifdef XBIN_SIMD_SSE2
+  xbinRollupAddSse2(p, aRec, nRec, iCol);
+#else
+  xbinRollupAddScalar(p, aRec, nRec, iCol);
+#endif
+}
+
+static void xbinPyrFree(XbinPyr *p) {
+  if ( p == 0 ) return;
+  sqlite3_free(p->aBucket);
+  sqlite3_free(p);
+}
+
+static char *xbinPyrPath(XbinTable *pTab, int iCol) {
+  return sqlite3_mprintf("%s.%s.pyr", pTab->filename, azXbinCol[iCol]);
+}
+
+/* Set p->nLevel and p->aOff[] for a pyramid over nRow records */
+static void xbinPyrLayout(XbinPyr *p, sqlite3_int64 nRow) {
+  sqlite3_int64 n = (nRow + (1 << XBIN_PYR_SHIFT) - 1) >> XBIN_PYR_SHIFT;
+  p->nLevel = 0;
+  p->aOff[0] = 0;
+  while ( n > 0 ) {
+    p->aOff[p->nLevel + 1] = p->aOff[p->nLevel] + n;
+    p->nLevel++;
+    if ( n == 1 ) break;
+    n = (n + 1) / 2;
+  }
+}
+
+/* Add the records of a block to the buckets of level 0 */
+static int xbinPyrBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinPyr *p = (XbinPyr*)pArg;
+  int i = 0;
+  while ( i < nRec ) {
+    sqlite3_int64 j = (iRow + i - 1) >> XBIN_PYR_SHIFT;
+    sqlite3_int64 n = ((j + 1) << XBIN_PYR_SHIFT) + 1 - (iRow + i);
+    if ( n > nRec - i ) n = nRec - i;
+    xbinRollupAdd(&p->aBucket[j], &aRec[i], (int)n, p->hdr.iCol);
+    i += (int)n;
+  }
+  p->hdr.tail = aRec[nRec - 1];
+  return SQLITE_OK;
+}
+
+static XbinPyr *xbinPyrRead(XbinTable *pTab, int iCol) {
+  char *zPath = xbinPyrPath(pTab, iCol);
+  XbinPyr *p = 0;
+  FILE *f;
+  int bOk = 0;
+
+  f = zPath ? fopen(zPath, "rb") : 0;
+  sqlite3_free(zPath);
+  if ( f == 0 ) return 0;
+  p = sqlite3_malloc( sizeof(*p) );
+  if ( p ) {
+    memset(p, 0, sizeof(*p));
+    bOk = fread(&p->hdr, sizeof(p->hdr), 1, f) == 1
+       && memcmp(p->hdr.zMagic, "xbinpyr1", 8) == 0
+       && p->hdr.iCol == iCol
+       && p->hdr.nShift == XBIN_PYR_SHIFT
+       && p->hdr.nRow >= 0 && p->hdr.nRow < XBIN_MAX_ROW;
+  }
+  if ( bOk ) {
+    sqlite3_int64 n;
+    xbinPyrLayout(p, p->hdr.nRow);
+    n = p->aOff[p->nLevel];
+    p->aBucket = sqlite3_malloc64( (n + 1) * sizeof(XbinRollup) );
+    bOk = p->aBucket && fread(p->aBucket, sizeof(XbinRollup), (size_t)n, f) == (size_t)n;
+  }
+  fclose(f);
+  if ( !bOk ) {
+    xbinPyrFree(p);
+    return 0;
+  }
+  return p;
+}
+
+static void xbinPyrWrite(XbinTable *pTab, const XbinPyr *p) {
+  char *zPath = xbinPyrPath(pTab, p->hdr.iCol);
+  FILE *f;
+
+  if ( zPath == 0 ) return;
+  f = xbinSideOpen(zPath, "wb");
+  if ( f == 0 ) {
+    sqlite3_free(zPath);
+    return;
+  }
+  fwrite(&p->hdr, sizeof(p->hdr), 1, f);
+  fwrite(p->aBucket, sizeof(XbinRollup), (size_t)p->aOff[p->nLevel], f);
+  xbinSideClose(zPath, f, 1);
+  sqlite3_free(zPath);
+}
+
+/*
+** Bring the pyramid of column iCol up to date with the pTab->nRow
+** records of the file.  If there is none, build it if bBuild is set,
+** or else return SQLITE_NOTFOUND.  The whole
+** buckets of the pyramid in memory or on disk are kept when its last
+** record is still in place, and the others are summed up again.
+*/
+static int xbinPyrRefresh(XbinTable *pTab, int iCol, int bBuild) {
+  XbinPyr *p = pTab->apPyr[iCol-1];
+  XbinPyr *pNew;
+  sqlite3_int64 nOld = 0;
+  sqlite3_int64 j;
+  xbinData rec;
+  int rc;
+  int h;
+
+  if ( p == 0 ) p = xbinPyrRead(pTab, iCol);
+  pTab->apPyr[iCol-1] = p;
+  if ( p == 0 && !bBuild ) return SQLITE_NOTFOUND;
+  if ( p && p->hdr.nRow == pTab->nRow ) return SQLITE_OK;
+  if ( p && p->hdr.nRow > 0 && p->hdr.nRow < pTab->nRow
+    && xbinReadRecord(pTab->fptr, p->hdr.nRow, &rec)
+    && memcmp(&rec, &p->hdr.tail, sizeof(rec)) == 0 ) {
+    nOld = p->hdr.nRow;
+  }
+
+  pNew = sqlite3_malloc( sizeof(*pNew) );
+  if ( pNew == 0 ) return SQLITE_NOMEM;
+  memset(pNew, 0, sizeof(*pNew));
+  memcpy(pNew->hdr.zMagic, "xbinpyr1", 8);
+  pNew->hdr.iCol = iCol;
+  pNew->hdr.nShift = XBIN_PYR_SHIFT;
+  pNew->hdr.nRow = pTab->nRow;
+  xbinPyrLayout(pNew, pTab->nRow);
+  pNew->aBucket = sqlite3_malloc64( (pNew->aOff[pNew->nLevel] + 1) * sizeof(XbinRollup) );
+  if ( pNew->aBucket == 0 ) {
+    xbinPyrFree(pNew);
+    return SQLITE_NOMEM;
+  }
+  for (h = 0; h < pNew->nLevel; h++) {
+    XbinRollup *a = &pNew->aBucket[pNew->aOff[h]];
+    sqlite3_int64 nKeep = nOld >> (XBIN_PYR_SHIFT + h);
+    if ( nKeep > 0 ) memcpy(a, &p->aBucket[p->aOff[h]], nKeep * sizeof(XbinRollup));
+    for (j = nKeep; j < pNew->aOff[h + 1] - pNew->aOff[h]; j++) xbinRollupInit(&a[j]);
+  }
+
+  /* Level 0 from the records, the levels above from the one below */
+  rc = xbinForEachBlock(pTab->fptr, ((nOld >> XBIN_PYR_SHIFT) << XBIN_PYR_SHIFT) + 1,
+                        pTab->nRow, xbinPyrBlock, pNew);
+  if ( rc != SQLITE_OK ) {
+    xbinPyrFree(pNew);
+    return rc;
+  }
+  for (h = 1; h < pNew->nLevel; h++) {
+    const XbinRollup *aDown = &pNew->aBucket[pNew->aOff[h - 1]];
+    sqlite3_int64 nDown = pNew->aOff[h] - pNew->aOff[h - 1];
+    XbinRollup *a = &pNew->aBucket[pNew->aOff[h]];
+    for (j = nOld >> (XBIN_PYR_SHIFT + h); j < pNew->aOff[h + 1] - pNew->aOff[h]; j++) {
+      xbinRollupMerge(&a[j], &aDown[2 * j]);
+      if ( 2 * j + 1 < nDown ) xbinRollupMerge(&a[j], &aDown[2 * j + 1]);
+    }
+  }
+  xbinPyrFree(p);
+  pTab->apPyr[iCol-1] = pNew;
+  xbinPyrWrite(pTab, pNew);
+  return SQLITE_OK;
+}
+
+/* Add the values of column iCol in rows iFirst..iLast of fptr to *pOut */
+static void xbinRollupRows(
+  FILE *fptr, int iCol,
+  sqlite3_int64 iFirst, sqlite3_int64 iLast,
+  XbinRollup *pOut
+) {
+  xbinData aRec[1 << XBIN_PYR_SHIFT];
+  while ( iFirst <= iLast ) {
+    sqlite3_int64 n = iLast - iFirst + 1;
+    if ( n > (1 << XBIN_PYR_SHIFT) ) n = 1 << XBIN_PYR_SHIFT;
+    n = xbinReadRecords(fptr, iFirst, n, aRec);
+    if ( n <= 0 ) break;
+    xbinRollupAdd(pOut, aRec, (int)n, iCol);
+    iFirst += n;
+  }
+}
+
+/*
+** Sum up rows iFirst..iLast, within the records covered by pyramid p,
+** into *pOut: the whole buckets of level 0 among them from the fewest
+** buckets of the pyramid that add up to them, the rows before and after
+** those from the file.
+*/
+static void xbinPyrRange(
+  const XbinPyr *p, FILE *fptr,
+  sqlite3_int64 iFirst, sqlite3_int64 iLast,
+  XbinRollup *pOut
+) {
+  sqlite3_int64 j0 = (iFirst + (1 << XBIN_PYR_SHIFT) - 2) >> XBIN_PYR_SHIFT;
+  sqlite3_int64 j1 = iLast >> XBIN_PYR_SHIFT;
+  int h;
+
+  xbinRollupInit(pOut);
+  if ( j0 >= j1 ) {
+    xbinRollupRows(fptr, p->hdr.iCol, iFirst, iLast, pOut);
+    return;
+  }
+  xbinRollupRows(fptr, p->hdr.iCol, iFirst, j0 << XBIN_PYR_SHIFT, pOut);
+  xbinRollupRows(fptr, p->hdr.iCol, (j1 << XBIN_PYR_SHIFT) + 1, iLast, pOut);
+  for (h = 0; j0 < j1; h++) {
+    const XbinRollup *a = &p->aBucket[p->aOff[h]];
+    if ( j0 & 1 ) xbinRollupMerge(pOut, &a[j0++]);
+    if ( j1 & 1 ) xbinRollupMerge(pOut, &a[--j1]);
+    j0 >>= 1;
+    j1 >>= 1;
+  }
+}
+
+/*
+** Column statistics.
+**
+** xbin_stats() (see below) returns the count, min, max, mean and
+** standard deviation of every column.  They are kept in the
+** "<filename>.stats" sidecar and in the table, and brought up to date
+** when the file grows: only the appended records are read, and their
+** statistics are merged into the ones kept.  The statistics are made
+** again from scratch if the last record covered has changed.  The
+** records are read by up to xbinCpuCount() threads, each with a file
+** handle of its own.
+*/
+#define XBIN_STATS_RUN  16    /* fewest blocks read by one thread */
+
+/* Header of the sidecar, followed by the XbinColStats of each column */
+typedef struct XbinStatsHdr {
+  char zMagic[8];             /* "xbinsta1" */
+  int nCol;                   /* XBIN_NCOL */
+  int pad;
+  sqlite3_int64 nRow;         /* Records covered */
+  xbinData tail;              /* Record nRow */
+} XbinStatsHdr;
+
+static void xbinColStatsInit(XbinColStats *p) {
+  p->nValue = 0;
+  p->rMin = HUGE_VAL;
+  p->rMax = -HUGE_VAL;
+  p->rMean = 0.0;
+  p->rM2 = 0.0;
+}
+
+/* Merge the statistics of q into p, by the pairwise formula of Chan et al. */
+static void xbinColStatsMerge(XbinColStats *p, const XbinColStats *q) {
+  sqlite3_int64 n = p->nValue + q->nValue;
+  double rDelta;
+  if ( q->nValue == 0 ) return;
+  if ( q->rMin < p->rMin ) p->rMin = q->rMin;
+  if ( q->rMax > p->rMax ) p->rMax = q->rMax;
+  rDelta = q->rMean - p->rMean;
+  if ( rDelta - rDelta != 0.0 ) {
+    /* An infinite value in p or q, which the differences would turn to NaN */
+    p->rMean = p->rMean * ((double)p->nValue / n) + q->rMean * ((double)q->nValue / n);
+  } else {
+    p->rMean += rDelta * ((double)q->nValue / n);
+  }
+  p->rM2 += q->rM2 + rDelta * rDelta * ((double)p->nValue * q->nValue / n);
+  p->nValue = n;
+}
+
+/* Statistics of rows iStart..iEnd, read by a thread of its own */
+typedef struct XbinStatsJob {
+  XbinTask task;
+  FILE *fptr;                 /* File handle of this thread */
+  xbinData *aRec;             /* Buffer of XBIN_BLOCK_ROWS records */
+  sqlite3_int64 iStart;       /* First row */
+  sqlite3_int64 iEnd;         /* Last row */
+  XbinColStats aStats[XBIN_NCOL];
+} XbinStatsJob;
+
+/*
+** Each block is summed up column by column with xbinRollupAdd(), then
+** read again, from the cache, for the squared differences from the
+** mean of the block.
+*/
+static void xbinStatsWork(void *pArg) {
+  XbinStatsJob *pJob = (XbinStatsJob*)pArg;
+  sqlite3_int64 iRow = pJob->iStart;
+  int iCol, i;
+
+  for (iCol = 0; iCol < XBIN_NCOL; iCol++) xbinColStatsInit(&pJob->aStats[iCol]);
+  if ( xbin_fseek(pJob->fptr, (iRow - 1) * (sqlite3_int64)sizeof(xbinData), SEEK_SET) != 0 ) {
+    return;
+  }
+  while ( iRow <= pJob->iEnd ) {
+    sqlite3_int64 n = pJob->iEnd - iRow + 1;
+    if ( n > XBIN_BLOCK_ROWS ) n = XBIN_BLOCK_ROWS;
+    n = (sqlite3_int64)fread(pJob->aRec, sizeof(xbinData), (size_t)n, pJob->fptr);
+    if ( n <= 0 ) break;
+    for (iCol = 1; iCol <= XBIN_NCOL; iCol++) {
+      XbinColStats blk;
+      XbinRollup r;
+      xbinRollupInit(&r);
+      xbinRollupAdd(&r, pJob->aRec, (int)n, iCol);
+      if ( r.nValue == 0 ) continue;
+      blk.nValue = r.nValue;
+      blk.rMin = r.rMin;
+      blk.rMax = r.rMax;
+      blk.rMean = r.rSum / r.nValue;
+      blk.rM2 = 0.0;
+      for (i = 0; i < n; i++) {
+        double v = XBIN_VALUE(&pJob->aRec[i], iCol);
+        if ( v == v ) blk.rM2 += (v - blk.rMean) * (v - blk.rMean);
+      }
+      xbinColStatsMerge(&pJob->aStats[iCol-1], &blk);
+    }
+    iRow += n;
+  }
+}
+
+static char *xbinStatsPath(XbinTable *pTab) {
+  return sqlite3_mprintf("%s.stats", pTab->filename);
+}
+
+static void xbinStatsRead(XbinTable *pTab) {
+  char *zPath = xbinStatsPath(pTab);
+  XbinStatsHdr hdr;
+  FILE *f;
+
+  pTab->nStatsRow = 0;
+  if ( zPath == 0 ) return;
+  f = fopen(zPath, "rb");
+  sqlite3_free(zPath);
+  if ( f == 0 ) return;
+  if ( fread(&hdr, sizeof(hdr), 1, f) == 1
+    && memcmp(hdr.zMagic, "xbinsta1", 8) == 0
+    && hdr.nCol == XBIN_NCOL && hdr.nRow > 0
+    && fread(pTab->aStats, sizeof(XbinColStats), XBIN_NCOL, f) == XBIN_NCOL ) {
+    pTab->nStatsRow = hdr.nRow;
+    pTab->statsTail = hdr.tail;
+  }
+  fclose(f);
+}
+
+static void xbinStatsWrite(XbinTable *pTab) {
+  char *zPath = xbinStatsPath(pTab);
+  XbinStatsHdr hdr;
+  FILE *f;
+
+  if ( zPath == 0 ) return;
+  f = xbinSideOpen(zPath, "wb");
+  if ( f == 0 ) {
+    sqlite3_free(zPath);
+    return;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.zMagic, "xbinsta1", 8);
+  hdr.nCol = XBIN_NCOL;
+  hdr.nRow = pTab->nStatsRow;
+  hdr.tail = pTab->statsTail;
+  fwrite(&hdr, sizeof(hdr), 1, f);
+  fwrite(pTab->aStats, sizeof(XbinColStats), XBIN_NCOL, f);
+  xbinSideClose(zPath, f, 1);
+  sqlite3_free(zPath);
+}
+
+/*
+** Bring the column statistics up to date with the pTab->nRow records of
+** the file.
+*/
+static int xbinStatsRefresh(XbinTable *pTab) {
+  XbinStatsJob aJob[XBIN_MAX_THREADS];
+  sqlite3_int64 iStart, nBlock;
+  xbinData rec;
+  int nJob = xbinCpuCount();
+  int rc = SQLITE_OK;
+  int i, iCol;
+
+  if ( pTab->nStatsRow < 0 ) xbinStatsRead(pTab);
+  if ( pTab->nStatsRow == pTab->nRow ) return SQLITE_OK;
+  if ( pTab->nStatsRow > pTab->nRow
+    || (pTab->nStatsRow > 0
+        && (!xbinReadRecord(pTab->fptr, pTab->nStatsRow, &rec)
+            || memcmp(&rec, &pTab->statsTail, sizeof(rec)) != 0)) ) {
+    pTab->nStatsRow = 0;
+  }
+  if ( pTab->nStatsRow == 0 ) {
+    for (iCol = 0; iCol < XBIN_NCOL; iCol++) xbinColStatsInit(&pTab->aStats[iCol]);
+  }
+  if ( pTab->nRow == 0 ) return SQLITE_OK;
+
+  /* Split the new records into runs of whole blocks, one per thread */
+  iStart = pTab->nStatsRow + 1;
+  nBlock = (pTab->nRow - iStart) / XBIN_BLOCK_ROWS + 1;
+  if ( nJob > nBlock / XBIN_STATS_RUN ) nJob = (int)(nBlock / XBIN_STATS_RUN);
+  if ( nJob < 1 ) nJob = 1;
+  memset(aJob, 0, sizeof(aJob));
+  for (i = 0; i < nJob; i++) {
+    aJob[i].iStart = iStart + (nBlock * i / nJob) * XBIN_BLOCK_ROWS;
+    aJob[i].iEnd = iStart + (nBlock * (i + 1) / nJob) * XBIN_BLOCK_ROWS - 1;
+    if ( aJob[i].iEnd > pTab->nRow ) aJob[i].iEnd = pTab->nRow;
+    aJob[i].aRec = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(xbinData) );
+    aJob[i].fptr = i == 0 ? pTab->fptr : fopen(pTab->filename, "rb");
+    if ( aJob[i].aRec == 0 ) rc = SQLITE_NOMEM;
+    if ( aJob[i].fptr == 0 ) rc = SQLITE_CANTOPEN;
+  }
+  if ( rc == SQLITE_OK ) {
+    for (i = 0; i < nJob; i++) xbinTaskStart(&aJob[i].task, xbinStatsWork, &aJob[i]);
+    for (i = 0; i < nJob; i++) xbinTaskJoin(&aJob[i].task);
+    for (i = 0; i < nJob; i++) {
+      for (iCol = 0; iCol < XBIN_NCOL; iCol++) {
+        xbinColStatsMerge(&pTab->aStats[iCol], &aJob[i].aStats[iCol]);
+      }
+    }
+  }
+  for (i = 0; i < nJob; i++) {
+    if ( i > 0 && aJob[i].fptr ) fclose(aJob[i].fptr);
+    sqlite3_free(aJob[i].aRec);
+  }
+  if ( rc != SQLITE_OK || !xbinReadRecord(pTab->fptr, pTab->nRow, &pTab->statsTail) ) {
+    pTab->nStatsRow = -1;
+    return rc != SQLITE_OK ? rc : SQLITE_IOERR;
+  }
+  pTab->nStatsRow = pTab->nRow;
+  xbinStatsWrite(pTab);
+  return SQLITE_OK;
+}
+
+/*
+** K-d tree.
+**
+** xbin_create_index(TABLE, 'id,iq,speed', 'kdtree') builds a k-d tree
+** over up to XBIN_NCOL columns in the "<filename>.kd" sidecar, which
+** xbin_knn() searches for the records nearest a point.  There is one
+** tree per table.  The sidecar holds a header, the rowid of every
+** record with no NULL in the columns, in tree order, their nDim
+** coordinates and, for every point, the dimension it splits.
+**
+** The tree is implicit.  The points [lo,hi) form a node: its median
+** point m = lo+(hi-lo)/2 splits them on dimension aSplit[m], those
+** before m having no greater a coordinate and those after it no smaller
+** one.  Nodes of XBIN_KD_LEAF points or fewer are not split.  The tree
+** is built by parallel threads, one per subtree below the first few
+** levels.  Records appended after it are searched one by one until they
+** are a quarter of the tree, which is then built again.
+*/
+typedef struct XbinKdHdr {
+  char zMagic[8];             /* "xbinkd01" */
+  int nDim;                   /* Columns in the tree */
+  int aCol[XBIN_NCOL];        /* The columns */
+  sqlite3_int64 nRow;         /* Records covered */
+  sqlite3_int64 nPoint;       /* Points, one per record with no NULL in aCol[] */
+  xbinData tail;              /* Record nRow */
+} XbinKdHdr;
+
+struct XbinKdTree {
+  XbinKdHdr hdr;
+  sqlite3_int64 *aRow;        /* Rowid of each point, in tree order */
+  float *aPt;                 /* hdr.nDim coordinates of each point */
+  unsigned char *aSplit;      /* Dimension split by each point */
+  sqlite3_int64 nAlloc;       /* Points allocated while building */
+};
+
+#define XBIN_KD_COORD(p, i, d)  ((p)->aPt[(i) * (p)->hdr.nDim + (d)])
+
+static void xbinKdFree(XbinKdTree *p) {
+  if ( p == 0 ) return;
+  sqlite3_free(p->aRow);
+  sqlite3_free(p->aPt);
+  sqlite3_free(p->aSplit);
+  sqlite3_free(p);
+}
+
+static char *xbinKdPath(XbinTable *pTab) {
+  return sqlite3_mprintf("%s.kd", pTab->filename);
+}
+
+/* Add the records of a block with no NULL in the columns to the tree */
+static int xbinKdBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinKdTree *p = (XbinKdTree*)pArg;
+  int nDim = p->hdr.nDim;
+  int i, d;
+  for (i = 0; i < nRec; i++) {
+    sqlite3_int64 n = p->hdr.nPoint;
+    for (d = 0; d < nDim; d++) {
+      float v = XBIN_VALUE(&aRec[i], p->hdr.aCol[d]);
+      if ( v != v ) break;
+    }
+    if ( d < nDim ) continue;
+    if ( n == p->nAlloc ) {
+      sqlite3_int64 nNew = p->nAlloc ? p->nAlloc * 2 : 4096;
+      sqlite3_int64 *aRow = sqlite3_realloc64(p->aRow, nNew * sizeof(sqlite3_int64));
+      float *aPt;
+      if ( aRow == 0 ) return SQLITE_NOMEM;
+      p->aRow = aRow;
+      aPt = sqlite3_realloc64(p->aPt, nNew * nDim * sizeof(float));
+      if ( aPt == 0 ) return SQLITE_NOMEM;
+      p->aPt = aPt;
+      p->nAlloc = nNew;
+    }
+    p->aRow[n] = iRow + i;
+    for (d = 0; d < nDim; d++) XBIN_KD_COORD(p, n, d) = XBIN_VALUE(&aRec[i], p->hdr.aCol[d]);
+    p->hdr.nPoint++;
+  }
+  return SQLITE_OK;
+}
+
+static void xbinKdSwap(XbinKdTree *p, sqlite3_int64 i, sqlite3_int64 j) {
+  sqlite3_int64 iRow = p->aRow[i];
+  int d;
+  p->aRow[i] = p->aRow[j];
+  p->aRow[j] = iRow;
+  for (d = 0; d < p->hdr.nDim; d++) {
+    float v = XBIN_KD_COORD(p, i, d);
+    XBIN_KD_COORD(p, i, d) = XBIN_KD_COORD(p, j, d);
+    XBIN_KD_COORD(p, j, d) = v;
+  }
+}
+
+/*
+** Split the node of points [lo,hi) on the dimension they spread the
+** most over: move its median to m, points with no greater a coordinate
+** before it and points with no smaller one after it.
+*/
+static void xbinKdSplit(XbinKdTree *p, sqlite3_int64 lo, sqlite3_int64 hi) {
+  sqlite3_int64 m = lo + (hi - lo) / 2;
+  double rBest = -1.0;
+  int dBest = 0;
+  int d;
+
+  for (d = 0; d < p->hdr.nDim; d++) {
+    float vMin = XBIN_KD_COORD(p, lo, d);
+    float vMax = vMin;
+    sqlite3_int64 i;
+    for (i = lo + 1; i < hi; i++) {
+      float v = XBIN_KD_COORD(p, i, d);
+      if ( v < vMin ) vMin = v;
+      if ( v > vMax ) vMax = v;
+    }
+    if ( (double)vMax - vMin > rBest ) {
+      rBest = (double)vMax - vMin;
+      dBest = d;
+    }
+  }
+  p->aSplit[m] = (unsigned char)dBest;
+
+  /* Quickselect */
+  while ( hi - lo > 1 ) {
+    float a = XBIN_KD_COORD(p, lo, dBest);
+    float b = XBIN_KD_COORD(p, lo + (hi - lo) / 2, dBest);
+    float c = XBIN_KD_COORD(p, hi - 1, dBest);
+    float vPivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+    sqlite3_int64 i = lo;
+    sqlite3_int64 j = hi - 1;
+    while ( i <= j ) {
+      while ( XBIN_KD_COORD(p, i, dBest) < vPivot ) i++;
+      while ( XBIN_KD_COORD(p, j, dBest) > vPivot ) j--;
+      if ( i <= j ) xbinKdSwap(p, i++, j--);
+    }
+    if ( m <= j ) {
+      hi = j + 1;
+    } else if ( m >= i ) {
+      lo = i;
+    } else {
+      break;
+    }
+  }
+}
+
+static void xbinKdBuildNode(XbinKdTree *p, sqlite3_int64 lo, sqlite3_int64 hi) {
+  while ( hi - lo > XBIN_KD_LEAF ) {
+    sqlite3_int64 m = lo + (hi - lo) / 2;
+    xbinKdSplit(p, lo, hi);
+    xbinKdBuildNode(p, lo, m);
+    lo = m + 1;
+  }
+}
+
+/* A subtree built by a thread of its own */
+typedef struct XbinKdJob {
+  XbinKdTree *p;
+  sqlite3_int64 lo, hi;
+  XbinTask task;
+} XbinKdJob;
+
+static void xbinKdWork(void *pArg) {
+  XbinKdJob *pJob = (XbinKdJob*)pArg;
+  xbinKdBuildNode(pJob->p, pJob->lo, pJob->hi);
+}
+
+/*
+** Arrange the points of p as a k-d tree.  The top levels are split here
+** until there is a subtree per thread, and the subtrees are then built
+** in parallel.
+*/
+static int xbinKdBuild(XbinKdTree *p) {
+  XbinKdJob aJob[XBIN_MAX_THREADS];
+  int nThread = xbinCpuCount();
+  int nJob = 1;
+  int i;
+
+  p->aSplit = sqlite3_malloc64( p->hdr.nPoint + 1 );
+  if ( p->aSplit == 0 ) return SQLITE_NOMEM;
+  memset(p->aSplit, 0, p->hdr.nPoint + 1);
+  if ( p->hdr.nPoint < (sqlite3_int64)XBIN_SORT_RUN * 2 ) nThread = 1;
+  aJob[0].p = p;
+  aJob[0].lo = 0;
+  aJob[0].hi = p->hdr.nPoint;
+  while ( nJob < nThread ) {
+    /* Split the largest subtree in two */
+    int iBig = 0;
+    sqlite3_int64 m;
+    for (i = 1; i < nJob; i++) {
+      if ( aJob[i].hi - aJob[i].lo > aJob[iBig].hi - aJob[iBig].lo ) iBig = i;
+    }
+    if ( aJob[iBig].hi - aJob[iBig].lo <= XBIN_KD_LEAF ) break;
+    xbinKdSplit(p, aJob[iBig].lo, aJob[iBig].hi);
+    m = aJob[iBig].lo + (aJob[iBig].hi - aJob[iBig].lo) / 2;
+    aJob[nJob].p = p;
+    aJob[nJob].lo = m + 1;
+    aJob[nJob].hi = aJob[iBig].hi;
+    aJob[iBig].hi = m;
+    nJob++;
+  }
+  for (i = 0; i < nJob; i++) xbinTaskStart(&aJob[i].task, xbinKdWork, &aJob[i]);
+  for (i = 0; i < nJob; i++) xbinTaskJoin(&aJob[i].task);
+  return SQLITE_OK;
+}
+
+static XbinKdTree *xbinKdRead(XbinTable *pTab) {
+  char *zPath = xbinKdPath(pTab);
+  XbinKdTree *p = 0;
+  FILE *f;
+  int bOk = 0;
+
+  f = zPath ? fopen(zPath, "rb") : 0;
+  sqlite3_free(zPath);
+  if ( f == 0 ) return 0;
+  p = sqlite3_malloc( sizeof(*p) );
+  if ( p ) {
+    memset(p, 0, sizeof(*p));
+    bOk = fread(&p->hdr, sizeof(p->hdr), 1, f) == 1
+       && memcmp(p->hdr.zMagic, "xbinkd01", 8) == 0
+       && p->hdr.nDim >= 1 && p->hdr.nDim <= XBIN_NCOL
+       && p->hdr.nPoint >= 0 && p->hdr.nPoint <= p->hdr.nRow;
+  }
+  if ( bOk ) {
+    sqlite3_int64 n = p->hdr.nPoint;
+    p->aRow = sqlite3_malloc64( (n + 1) * sizeof(sqlite3_int64) );
+    p->aPt = sqlite3_malloc64( (n + 1) * p->hdr.nDim * sizeof(float) );
+    p->aSplit = sqlite3_malloc64( n + 1 );
+    bOk = p->aRow && p->aPt && p->aSplit
+       && fread(p->aRow, sizeof(sqlite3_int64), (size_t)n, f) == (size_t)n
+       && fread(p->aPt, sizeof(float) * p->hdr.nDim, (size_t)n, f) == (size_t)n
+       && fread(p->aSplit, 1, (size_t)n, f) == (size_t)n;
+  }
+  fclose(f);
+  if ( !bOk ) {
+    xbinKdFree(p);
+    return 0;
+  }
+  return p;
+}
+
+static int xbinKdWrite(XbinTable *pTab, const XbinKdTree *p) {
+  char *zPath = xbinKdPath(pTab);
+  sqlite3_int64 n = p->hdr.nPoint;
+  FILE *f;
+  int bOk;
+
+  if ( zPath == 0 ) return SQLITE_NOMEM;
+  f = xbinSideOpen(zPath, "wb");
+  if ( f == 0 ) {
+    sqlite3_free(zPath);
+    return SQLITE_CANTOPEN;
+  }
+  bOk = fwrite(&p->hdr, sizeof(p->hdr), 1, f) == 1
+     && fwrite(p->aRow, sizeof(sqlite3_int64), (size_t)n, f) == (size_t)n
+     && fwrite(p->aPt, sizeof(float) * p->hdr.nDim, (size_t)n, f) == (size_t)n
+     && fwrite(p->aSplit, 1, (size_t)n, f) == (size_t)n;
+  bOk = xbinSideClose(zPath, f, bOk);
+  sqlite3_free(zPath);
+  return bOk ? SQLITE_OK : SQLITE_IOERR;
+}
+
+/*
+** Make sure pTab->pKd is a k-d tree over the nDim columns of aCol[]
+** (or, if nDim is 0, over the columns of the existing tree) that covers
+** most of the pTab->nRow records of the file, building it if bRebuild
+** is set, or if it is missing records of the file other than a few
+** appended ones.  Return SQLITE_NOTFOUND if there is no tree and nDim
+** is 0.
+*/
+static int xbinKdRefresh(XbinTable *pTab, int nDim, const int *aCol, int bRebuild) {
+  XbinKdTree *p = pTab->pKd;
+  int aDim[XBIN_NCOL];
+  xbinData rec;
+  int rc;
+
+  if ( p == 0 && !bRebuild ) p = xbinKdRead(pTab);
+  pTab->pKd = 0;
+  if ( nDim == 0 ) {
+    if ( p == 0 ) return SQLITE_NOTFOUND;
+    nDim = p->hdr.nDim;
+    aCol = p->hdr.aCol;
+  }
+  memcpy(aDim, aCol, nDim * sizeof(int));
+  if ( p && !bRebuild
+    && p->hdr.nDim == nDim && memcmp(p->hdr.aCol, aDim, nDim * sizeof(int)) == 0
+    && p->hdr.nRow <= pTab->nRow
+    && (pTab->nRow - p->hdr.nRow) * 4 <= p->hdr.nRow + XBIN_BLOCK_ROWS
+    && (p->hdr.nRow == 0
+        || (xbinReadRecord(pTab->fptr, p->hdr.nRow, &rec)
+            && memcmp(&rec, &p->hdr.tail, sizeof(rec)) == 0)) ) {
+    pTab->pKd = p;
+    return SQLITE_OK;
+  }
+  xbinKdFree(p);
+
+  p = sqlite3_malloc( sizeof(*p) );
+  if ( p == 0 ) return SQLITE_NOMEM;
+  memset(p, 0, sizeof(*p));
+  memcpy(p->hdr.zMagic, "xbinkd01", 8);
+  p->hdr.nDim = nDim;
+  memcpy(p->hdr.aCol, aDim, nDim * sizeof(int));
+  p->hdr.nRow = pTab->nRow;
+  if ( pTab->nRow > 0 && !xbinReadRecord(pTab->fptr, pTab->nRow, &p->hdr.tail) ) {
+    xbinKdFree(p);
+    return SQLITE_IOERR;
+  }
+  rc = xbinForEachBlock(pTab->fptr, 1, pTab->nRow, xbinKdBlock, p);
+  if ( rc == SQLITE_OK ) rc = xbinKdBuild(p);
+  if ( rc == SQLITE_OK ) rc = xbinKdWrite(pTab, p);
+  if ( rc != SQLITE_OK ) {
+    xbinKdFree(p);
+    return rc;
+  }
+  pTab->pKd = p;
+  return SQLITE_OK;
+}
+
+/*
+** The k nearest points found so far, a max-heap on (distance, rowid)
+** so that ties go to the lower rowid.
+*/
+typedef struct XbinKnn {
+  const XbinKdTree *p;        /* Tree searched */
+  double aQ[XBIN_NCOL];       /* Query point */
+  int k;                      /* Points wanted */
+  int n;                      /* Points in aD[] and aRow[] */
+  double *aD;                 /* Squared distance of each */
+  sqlite3_int64 *aRow;        /* Rowid of each */
+} XbinKnn;
+
+#define XBIN_KNN_LT(p, i, d, r) \
+  ((p)->aD[i] < (d) || ((p)->aD[i] == (d) && (p)->aRow[i] < (r)))
+
+static void xbinKnnAdd(XbinKnn *p, double d, sqlite3_int64 iRow) {
+  int i;
+  if ( p->n < p->k ) {
+    /* Sift up */
+    for (i = p->n++; i > 0 && XBIN_KNN_LT(p, (i - 1) / 2, d, iRow); i = (i - 1) / 2) {
+      p->aD[i] = p->aD[(i - 1) / 2];
+      p->aRow[i] = p->aRow[(i - 1) / 2];
+    }
+  } else {
+    /* Replace the farthest point, if this one is nearer, and sift down */
+    if ( !(d < p->aD[0] || (d == p->aD[0] && iRow < p->aRow[0])) ) return;
+    for (i = 0; 2 * i + 1 < p->n; ) {
+      int c = 2 * i + 1;
+      if ( c + 1 < p->n && XBIN_KNN_LT(p, c, p->aD[c+1], p->aRow[c+1]) ) c++;
+      if ( XBIN_KNN_LT(p, c, d, iRow) ) break;
+      p->aD[i] = p->aD[c];
+      p->aRow[i] = p->aRow[c];
+      i = c;
+    }
+  }
+  p->aD[i] = d;
+  p->aRow[i] = iRow;
+}
+
+static void xbinKnnSearch(XbinKnn *pKnn, sqlite3_int64 lo, sqlite3_int64 hi) {
+  const XbinKdTree *p = pKnn->p;
+  int nDim = p->hdr.nDim;
+  while ( hi - lo > XBIN_KD_LEAF ) {
+    sqlite3_int64 m = lo + (hi - lo) / 2;
+    int dSplit = p->aSplit[m];
+    double rDiff = pKnn->aQ[dSplit] - XBIN_KD_COORD(p, m, dSplit);
+    double d = 0.0;
+    int i;
+    for (i = 0; i < nDim; i++) {
+      double x = pKnn->aQ[i] - XBIN_KD_COORD(p, m, i);
+      d += x * x;
+    }
+    xbinKnnAdd(pKnn, d, p->aRow[m]);
+    /* The near side first, then the far side if it may hold closer points */
+    if ( rDiff < 0.0 ) {
+      xbinKnnSearch(pKnn, lo, m);
+      if ( pKnn->n == pKnn->k && rDiff * rDiff > pKnn->aD[0] ) return;
+      lo = m + 1;
+    } else {
+      xbinKnnSearch(pKnn, m + 1, hi);
+      if ( pKnn->n == pKnn->k && rDiff * rDiff > pKnn->aD[0] ) return;
+      hi = m;
+    }
+  }
+  for (; lo < hi; lo++) {
+    double d = 0.0;
+    int i;
+    for (i = 0; i < nDim; i++) {
+      double x = pKnn->aQ[i] - XBIN_KD_COORD(p, lo, i);
+      d += x * x;
+    }
+    if ( pKnn->n < pKnn->k || d <= pKnn->aD[0] ) xbinKnnAdd(pKnn, d, p->aRow[lo]);
+  }
+}
+
+/* Check the records appended since the tree was built one by one */
+static int xbinKnnBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinKnn *pKnn = (XbinKnn*)pArg;
+  const XbinKdHdr *pHdr = &pKnn->p->hdr;
+  int i, d;
+  for (i = 0; i < nRec; i++) {
+    double r = 0.0;
+    for (d = 0; d < pHdr->nDim; d++) {
+      double x = pKnn->aQ[d] - XBIN_VALUE(&aRec[i], pHdr->aCol[d]);
+      r += x * x;
+    }
+    if ( r == r ) xbinKnnAdd(pKnn, r, iRow + i);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** If zArg is "zKey=value", return value with any quotes around it
+** removed, in memory obtained from sqlite3_malloc().  Otherwise 0.
+*/
+static char *xbinArgValue(const char *zArg, const char *zKey) {
+  int nKey = (int)strlen(zKey);
+  char *zVal;
+  int n;
+
+  while ( isspace((unsigned char)*zArg) ) zArg++;
+  if ( sqlite3_strnicmp(zArg, zKey, nKey) != 0 ) return 0;
+  zArg += nKey;
+  while ( isspace((unsigned char)*zArg) ) zArg++;
+  if ( *zArg != '=' ) return 0;
+  zArg++;
+  while ( isspace((unsigned char)*zArg) ) zArg++;
+  zVal = sqlite3_mprintf("%s", zArg);
+  if ( zVal == 0 ) return 0;
+  n = (int)strlen(zVal);
+  while ( n > 0 && isspace((unsigned char)zVal[n-1]) ) zVal[--n] = 0;
+  if ( n >= 2 && (zVal[0] == '\'' || zVal[0] == '"') && zVal[n-1] == zVal[0] ) {
+    memmove(zVal, zVal + 1, n - 2);
+    zVal[n-2] = 0;
+  }
+  return zVal;
+}
+
+/*
+** Parse the bloom= argument, a comma separated list of "column" or
+** "column:rate" entries, rate being the false positive rate wanted
+** (XBIN_BLOOM_RATE if not given).  Set the filter size of each column
+** in aBloomBlk[].  Return 0 on success, -1 if the list is malformed.
+*/
+static int xbinParseBloom(const char *z, int *aBloomBlk) {
+  while ( *z ) {
+    double r = XBIN_BLOOM_RATE;
+    int nName;
+    int iCol;
+    while ( isspace((unsigned char)*z) || *z == ',' ) z++;
+    if ( *z == 0 ) break;
+    for (nName = 0; z[nName] && z[nName] != ',' && z[nName] != ':'
+                    && !isspace((unsigned char)z[nName]); nName++) {}
+    iCol = xbinColumnIndex(z, nName);
+    if ( iCol == 0 ) return -1;
+    z += nName;
+    while ( isspace((unsigned char)*z) ) z++;
+    if ( *z == ':' ) {
+      char *zEnd;
+      r = strtod(z + 1, &zEnd);
+      if ( zEnd == z + 1 || !(r > 0.0 && r < 1.0) ) return -1;
+      z = zEnd;
+    }
+    aBloomBlk[iCol-1] = xbinBloomGroups(r);
+  }
+  return 0;
+}
+
+/*
+** Parse a derive= argument, "name: expression", and append the column
+** to those of pTab.  Return 0 on success, or -1 with an error in *pzErr.
+*/
+static int xbinParseDerived(XbinTable *pTab, const char *z, char **pzErr) {
+  const char *zColon = strchr(z, ':');
+  char *zExprErr = 0;
+  XbinExpr *pExpr;
+  int nName, i;
+
+  while ( isspace((unsigned char)*z) ) z++;
+  for (nName = 0; isalnum((unsigned char)z[nName]) || z[nName] == '_'; nName++) {}
+  if ( nName == 0 || zColon == 0 || zColon < z + nName ) {
+    *pzErr = sqlite3_mprintf("xbin: expected name: expression in derive=%s", z);
+    return -1;
+  }
+  for (i = nName; z + i < zColon; i++) {
+    if ( !isspace((unsigned char)z[i]) ) {
+      *pzErr = sqlite3_mprintf("xbin: expected name: expression in derive=%s", z);
+      return -1;
+    }
+  }
+  if ( pTab->nDerived >= XBIN_MAX_DERIVED ) {
+    *pzErr = sqlite3_mprintf("xbin: more than %d derive= arguments", XBIN_MAX_DERIVED);
+    return -1;
+  }
+  for (i = 0; i <= XBIN_NCOL + pTab->nDerived; i++) {
+    const char *zCol = i <= XBIN_NCOL ? azXbinCol[i] : pTab->azDerived[i - XBIN_NCOL - 1];
+    if ( sqlite3_strnicmp(z, zCol, nName) == 0 && zCol[nName] == 0 ) break;
+  }
+  if ( i <= XBIN_NCOL + pTab->nDerived
+    || (nName == 6 && sqlite3_strnicmp(z, "sample", 6) == 0)
+    || (nName == 4 && sqlite3_strnicmp(z, "seed", 4) == 0)
+    || (nName == 6 && sqlite3_strnicmp(z, "filter", 6) == 0) ) {
+    *pzErr = sqlite3_mprintf("xbin: duplicate column name in derive=%s", z);
+    return -1;
+  }
+  pExpr = xbinExprCompile(pTab, zColon + 1, &zExprErr);
+  if ( pExpr == 0 ) {
+    *pzErr = sqlite3_mprintf("xbin: %s in derive=%s", zExprErr, z);
+    sqlite3_free(zExprErr);
+    return -1;
+  }
+  pTab->azDerived[pTab->nDerived] = sqlite3_mprintf("%.*s", nName, z);
+  pTab->apDerived[pTab->nDerived] = pExpr;
+  pTab->nDerived++;
+  return 0;
+}
+
+/*
+** Parse a zip= argument, "name:filename", and open the file, whose
+** records line up with those of the table.  Return 0 on success, or -1
+** with an error in *pzErr.
+*/
+static int xbinParseZip(XbinTable *pTab, const char *z, char **pzErr) {
+  const char *zColon = strchr(z, ':');
+  int nName, i;
+
+  while ( isspace((unsigned char)*z) ) z++;
+  for (nName = 0; isalnum((unsigned char)z[nName]) || z[nName] == '_'; nName++) {}
+  if ( nName == 0 || zColon != z + nName || zColon[1] == 0 ) {
+    *pzErr = sqlite3_mprintf("xbin: expected name:filename in zip=%s", z);
+    return -1;
+  }
+  if ( pTab->nZip >= XBIN_MAX_ZIP ) {
+    *pzErr = sqlite3_mprintf("xbin: more than %d zip= arguments", XBIN_MAX_ZIP);
+    return -1;
+  }
+  for (i = 0; i < pTab->nZip; i++) {
+    if ( sqlite3_strnicmp(z, pTab->azZip[i], nName) == 0 && pTab->azZip[i][nName] == 0 ) {
+      *pzErr = sqlite3_mprintf("xbin: duplicate name in zip=%s", z);
+      return -1;
+    }
+  }
+  pTab->apZip[pTab->nZip] = fopen(zColon + 1, "rb");
+  if ( pTab->apZip[pTab->nZip] == 0 ) {
+    *pzErr = sqlite3_mprintf("xbin: cannot open %s", zColon + 1);
+    return -1;
+  }
+  pTab->azZip[pTab->nZip] = sqlite3_mprintf("%.*s", nName, z);
+  pTab->nZip++;
+  return 0;
+}
+
+/* Close the zipped files of pTab */
+static void xbinZipFree(XbinTable *pTab) {
+  int i;
+  for (i = 0; i < pTab->nZip; i++) {
+    fclose(pTab->apZip[i]);
+    sqlite3_free(pTab->azZip[i]);
+  }
+  pTab->nZip = 0;
+}
+
+/* Free the derived columns of pTab */
+static void xbinDerivedFree(XbinTable *pTab) {
+  int i;
+  for (i = 0; i < pTab->nDerived; i++) {
+    sqlite3_free(pTab->azDerived[i]);
+    sqlite3_free(pTab->apDerived[i]);
+  }
+  pTab->nDerived = 0;
+}
+
+/* qsort() comparison of two file names, by bytes like SQLite's BINARY */
+static int xbinNameCmp(const void *a, const void *b) {
+  return strcmp(*(const char *const*)a, *(const char *const*)b);
+}
+
+/*
+** Expand the pattern of a glob= argument into the files of a union
+** table, sorted by name so that their order is that of "order by file",
+** and estimate the records of the table from their sizes.  A pattern
+** matching no file makes an empty table.
+*/
+static int xbinGlobFiles(XbinTable *pTab, const char *zPattern, char **pzErr) {
+#ifdef _WIN32
+  (void)pTab;
+  (void)zPattern;
+  *pzErr = sqlite3_mprintf("xbin: glob= is not supported on this platform");
+  return SQLITE_ERROR;
+#else
+  glob_t g;
+  size_t n;
+  size_t i;
+  int rc = glob(zPattern, 0, 0, &g);
+
+  if ( rc == GLOB_NOMATCH ) {
+    globfree(&g);
+    return SQLITE_OK;
+  }
+  if ( rc != 0 ) {
+    *pzErr = sqlite3_mprintf("xbin: cannot expand glob='%s'", zPattern);
+    return SQLITE_ERROR;
+  }
+  n = g.gl_pathc;
+  pTab->azFile = sqlite3_malloc64( n * sizeof(char*) );
+  pTab->aFile = sqlite3_malloc64( n * sizeof(XbinUnionFile) );
+  if ( pTab->azFile == 0 || pTab->aFile == 0 ) {
+    globfree(&g);
+    return SQLITE_NOMEM;
+  }
+  memset(pTab->aFile, 0, n * sizeof(XbinUnionFile));
+  for (i = 0; i < n; i++) {
+    struct stat st;
+    pTab->azFile[i] = sqlite3_mprintf("%s", g.gl_pathv[i]);
+    if ( pTab->azFile[i] == 0 ) break;
+    pTab->nFile++;
+    if ( stat(g.gl_pathv[i], &st) == 0 ) pTab->nRow += (sqlite3_int64)st.st_size / sizeof(xbinData);
+  }
+  globfree(&g);
+  if ( i < n ) return SQLITE_NOMEM;
+  qsort(pTab->azFile, pTab->nFile, sizeof(char*), xbinNameCmp);
+  return SQLITE_OK;
+#endif
+}
+
+/*
+** Free pTab and all it holds, once it is out of the registry.  The
+** tables over the files of a union are freed with it.
+*/
+static void xbinTableFree(XbinTable *pTab) {
+  int i;
+  if (pTab->fptr != NULL) {
+    fclose(pTab->fptr);
+  }
+  sqlite3_free( pTab->aZone );
+  for (i = 0; i < XBIN_NCOL; i++) {
+    xbinBmFree(pTab->apBm[i]);
+    xbinPlaFree(pTab->apPla[i]);
+    xbinPyrFree(pTab->apPyr[i]);
+    sqlite3_free(pTab->aBloom[i]);
+  }
+  xbinKdFree(pTab->pKd);
+  xbinDerivedFree(pTab);
+  xbinZipFree(pTab);
+  for (i = 0; i < pTab->nFile; i++) {
+    if ( pTab->aFile[i].pSub ) xbinTableFree(pTab->aFile[i].pSub);
+    sqlite3_free(pTab->azFile[i]);
+  }
+  sqlite3_free( pTab->azFile );
+  sqlite3_free( pTab->aFile );
+  sqlite3_free( pTab->aOpen );
+  sqlite3_free( pTab->zDb );
+  sqlite3_free( pTab->zName );
+  sqlite3_free( pTab->filename );
+  sqlite3_free(pTab);
+}
+
+/*
+** The xbinConnect() method is invoked to create a new
+** template virtual table.
+**
+** Think of this routine as the constructor for XbinTable objects.
+**
+** All this routine needs to do is:
+**
+**    (1) Allocate the XbinTable object and initialize all fields.
+**
+**    (2) Tell SQLite (via the sqlite3_declare_vtab() interface) what the
+**        result set of queries against the virtual table will look like.
+*/
+static int xbinConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinTable *pTab;
+  char *zSchema;
+  char *zGlob;
+  int rc;
+  int i;
+  const char *filename = argv[3];
+  if ( argc < 4 ) return SQLITE_ERROR;
+
+  pTab = sqlite3_malloc( sizeof(*pTab) );
+  *ppVtab = (sqlite3_vtab*)pTab;
+  if ( pTab == 0 ) return SQLITE_NOMEM;
+  memset(pTab, 0, sizeof(*pTab));
+  pTab->nMetaRow = -1;
+  pTab->nZoneRow = -1;
+  pTab->nStatsRow = -1;
+
+  pTab->filename = sqlite3_mprintf( "%s", filename );
+
+  zGlob = xbinArgValue(filename, "glob");
+  if ( zGlob ) {
+    /* A union of files, see xbinUnionStart() */
+    pTab->bUnion = 1;
+    rc = xbinGlobFiles(pTab, zGlob, pzErr);
+    sqlite3_free(zGlob);
+    if ( rc != SQLITE_OK ) {
+      xbinTableFree(pTab);
+      return rc;
+    }
+  }
+
+  for (i = 4; i < argc; i++) {
+    char *zVal = xbinArgValue(argv[i], "threads");
+    if ( zVal ) {
+      char *zEnd;
+      long n = strtol(zVal, &zEnd, 10);
+      int bBad = (zEnd == zVal || *zEnd != 0 || n < 0);
+      sqlite3_free(zVal);
+      if ( bBad ) {
+        *pzErr = sqlite3_mprintf("xbin: bad thread count in %s", argv[i]);
+        xbinTableFree(pTab);
+        return SQLITE_ERROR;
+      }
+      if ( n > XBIN_MAX_THREADS ) {
+        *pzErr = sqlite3_mprintf("xbin: %s is more than the %d threads a scan can use",
+                                 argv[i], XBIN_MAX_THREADS);
+        xbinTableFree(pTab);
+        return SQLITE_ERROR;
+      }
+      pTab->nThread = n == 0 ? xbinCpuCount() : (int)n;
+      continue;
+    }
+    if ( pTab->bUnion ) {
+      *pzErr = sqlite3_mprintf("xbin: %s cannot be used with glob=", argv[i]);
+      xbinTableFree(pTab);
+      return SQLITE_ERROR;
+    }
+    zVal = xbinArgValue(argv[i], "sort");
+    if ( zVal ) {
+      pTab->nDeclKey = xbinParseColumns(zVal, pTab->aDeclKey);
+      sqlite3_free(zVal);
+      if ( pTab->nDeclKey < 0 ) {
+        *pzErr = sqlite3_mprintf("xbin: bad column list in %s", argv[i]);
+        xbinDerivedFree(pTab);
+        xbinZipFree(pTab);
+        sqlite3_free( pTab->filename );
+        sqlite3_free( pTab );
+        return SQLITE_ERROR;
+      }
+      continue;
+    }
+    zVal = xbinArgValue(argv[i], "grid");
+    if ( zVal ) {
+      pTab->nGridDecl = xbinParseColumns(zVal, pTab->aGridDecl);
+      sqlite3_free(zVal);
+      if ( pTab->nGridDecl < 0 ) {
+        *pzErr = sqlite3_mprintf("xbin: bad column list in %s", argv[i]);
+        xbinDerivedFree(pTab);
+        xbinZipFree(pTab);
+        sqlite3_free( pTab->filename );
+        sqlite3_free( pTab );
+        return SQLITE_ERROR;
+      }
+      continue;
+    }
+    zVal = xbinArgValue(argv[i], "bloom");
+    if ( zVal ) {
+      int rcBloom = xbinParseBloom(zVal, pTab->aBloomBlk);
+      sqlite3_free(zVal);
+      if ( rcBloom < 0 ) {
+        *pzErr = sqlite3_mprintf("xbin: bad column:rate list in %s", argv[i]);
+        xbinDerivedFree(pTab);
+        xbinZipFree(pTab);
+        sqlite3_free( pTab->filename );
+        sqlite3_free( pTab );
+        return SQLITE_ERROR;
+      }
+      continue;
+    }
+    zVal = xbinArgValue(argv[i], "derive");
+    if ( zVal ) {
+      int rcDerived = xbinParseDerived(pTab, zVal, pzErr);
+      sqlite3_free(zVal);
+      if ( rcDerived < 0 ) {
+        xbinDerivedFree(pTab);
+        xbinZipFree(pTab);
+        sqlite3_free( pTab->filename );
+        sqlite3_free( pTab );
+        return SQLITE_ERROR;
+      }
+      continue;
+    }
+    zVal = xbinArgValue(argv[i], "zip");
+    if ( zVal ) {
+      int rcZip = xbinParseZip(pTab, zVal, pzErr);
+      sqlite3_free(zVal);
+      if ( rcZip < 0 ) {
+        xbinDerivedFree(pTab);
+        xbinZipFree(pTab);
+        sqlite3_free( pTab->filename );
+        sqlite3_free( pTab );
+        return SQLITE_ERROR;
+      }
+      continue;
+    }
+    *pzErr = sqlite3_mprintf("xbin: unknown argument %s", argv[i]);
+    xbinDerivedFree(pTab);
+    xbinZipFree(pTab);
+    sqlite3_free( pTab->filename );
+    sqlite3_free( pTab );
+    return SQLITE_ERROR;
+  }
+
+  zSchema = sqlite3_mprintf("CREATE TABLE x(row INTEGER PRIMARY KEY, " XBIN_DATA_SCHEMA ", "
+                            "sample HIDDEN, seed HIDDEN, filter HIDDEN%s",
+                            pTab->bUnion ? ", file HIDDEN" : "");
+  for (i = 0; zSchema && i < pTab->nDerived; i++) {
+    zSchema = sqlite3_mprintf("%z, \"%w\" REAL", zSchema, pTab->azDerived[i]);
+  }
+  pTab->iZipCol = pTab->bUnion ? XBIN_FILE_COL + 1 : XBIN_DERIVED_COL + pTab->nDerived;
+  if ( pTab->iZipCol + pTab->nZip * XBIN_NCOL > 64 ) {
+    /* Column masks are 64 bits wide */
+    *pzErr = sqlite3_mprintf("xbin: too many derived and zipped columns");
+    sqlite3_free(zSchema);
+    zSchema = 0;
+  }
+  for (i = 0; zSchema && i < pTab->nZip * XBIN_NCOL; i++) {
+    zSchema = sqlite3_mprintf("%z, \"%w_%w\" REAL", zSchema,
+                              pTab->azZip[i / XBIN_NCOL], azXbinCol[i % XBIN_NCOL + 1]);
+  }
+  if ( zSchema ) zSchema = sqlite3_mprintf("%z)", zSchema);
+  rc = zSchema ? sqlite3_declare_vtab(db, zSchema) : SQLITE_ERROR;
+  sqlite3_free(zSchema);
+
+  if ( rc != SQLITE_OK ) {
+    xbinTableFree(pTab);
+    return SQLITE_ERROR;
+  }
+
+  if ( !pTab->bUnion ) pTab->fptr = fopen( pTab->filename, "r+b" );
+  if ( pTab->fptr == NULL && !pTab->bUnion ) {
+    *pzErr = sqlite3_mprintf("==> Database File Not Found!");
+    xbinDerivedFree(pTab);
+    xbinZipFree(pTab);
+    sqlite3_free( pTab->filename );
+    sqlite3_free( pTab );
+    return SQLITE_ERROR;
+  }
+
+  pTab->zDb = sqlite3_mprintf("%s", argv[1]);
+  pTab->zName = sqlite3_mprintf("%s", argv[2]);
+  pTab->pReg = (XbinRegistry*)pAux;
+  pTab->pNext = pTab->pReg->pFirst;
+  pTab->pReg->pFirst = pTab;
+
+  return rc;
+}
+
+/*
+** This method is the destructor for XbinTable objects.
+*/
+static int xbinDisconnect(sqlite3_vtab *pVtab) {
+  XbinTable *pTab = (XbinTable*)pVtab;
+  XbinTable **pp;
+  for (pp = &pTab->pReg->pFirst; *pp; pp = &(*pp)->pNext) {
+    if ( *pp == pTab ) {
+      *pp = pTab->pNext;
+      break;
+    }
+  }
+  xbinTableFree(pTab);
+  return SQLITE_OK;
+}
+
+/*
+** Keep the name in the registry in step with ALTER TABLE ... RENAME.
+*/
+static int xbinRename(sqlite3_vtab *pVtab, const char *zNew) {
+  XbinTable *pTab = (XbinTable*)pVtab;
+  char *zName = sqlite3_mprintf("%s", zNew);
+  if ( zName == 0 ) return SQLITE_NOMEM;
+  sqlite3_free( pTab->zName );
+  pTab->zName = zName;
+  return SQLITE_OK;
+}
+
+/*
+** Return true if schema zDb has a table or view called zName.
+*/
+static int xbinSchemaHas(sqlite3 *db, const char *zDb, const char *zName) {
+  sqlite3_stmt *pStmt = 0;
+  char *zSql = sqlite3_mprintf("SELECT 1 FROM \"%w\".sqlite_master WHERE type IN ('table', 'view')"
+                               " AND name = %Q COLLATE NOCASE", zDb, zName);
+  int bHas = 0;
+  if ( zSql && sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0) == SQLITE_OK ) {
+    bHas = (sqlite3_step(pStmt) == SQLITE_ROW);
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+  return bHas;
+}
+
+/*
+** Return the schema that SQLite finds the unqualified table zName in:
+** temp, main, then the attached databases in the order of PRAGMA
+** database_list.  Return 0 if there is none.  Free with sqlite3_free().
+*/
+static char *xbinSchemaOf(sqlite3 *db, const char *zName) {
+  sqlite3_stmt *pList = 0;
+  char *zDb = 0;
+  if ( xbinSchemaHas(db, "temp", zName) ) return sqlite3_mprintf("temp");
+  if ( sqlite3_prepare_v2(db, "PRAGMA database_list", -1, &pList, 0) != SQLITE_OK ) return 0;
+  while ( zDb == 0 && sqlite3_step(pList) == SQLITE_ROW ) {
+    const char *zSchema = (const char*)sqlite3_column_text(pList, 1);
+    if ( zSchema == 0 || sqlite3_stricmp(zSchema, "temp") == 0 ) continue;
+    if ( xbinSchemaHas(db, zSchema, zName) ) zDb = sqlite3_mprintf("%s", zSchema);
+  }
+  sqlite3_finalize(pList);
+  return zDb;
+}
+
+/*
+** Search the registry for the table called zName, which may be
+** qualified with the schema name.  An unqualified name means the table
+** SQLite would find, so two attached databases may have a table of
+** the same name.
+*/
+static XbinTable *xbinLookupTable(XbinRegistry *pReg, const char *zName) {
+  const char *zDot = strchr(zName, '.');
+  char *zDb = 0;
+  int nDb;
+  XbinTable *pTab;
+
+  if ( zDot ) {
+    nDb = (int)(zDot - zName);
+    zDb = sqlite3_mprintf("%.*s", nDb, zName);
+    zName = zDot + 1;
+  } else {
+    /* Only look the schema up if the registry has the name at all */
+    for (pTab = pReg->pFirst; pTab; pTab = pTab->pNext) {
+      if ( sqlite3_stricmp(pTab->zName, zName) == 0 ) break;
+    }
+    if ( pTab ) zDb = xbinSchemaOf(pReg->db, zName);
+  }
+  if ( zDb == 0 ) return 0;
+  for (pTab = pReg->pFirst; pTab; pTab = pTab->pNext) {
+    if ( sqlite3_stricmp(pTab->zDb, zDb) == 0 && sqlite3_stricmp(pTab->zName, zName) == 0 ) break;
+  }
+  sqlite3_free(zDb);
+  return pTab;
+}
+
+/*
+** Find the xbin table called zName.  SQLite connects a virtual table
+** the first time a statement refers to it, so a table that is not in
+** the registry yet is connected by preparing a query on it.  Return 0
+** and leave an error in *pzErr if there is no such xbin table.
+*/
+static XbinTable *xbinFindTable(XbinRegistry *pReg, const char *zName, char **pzErr) {
+  XbinTable *pTab;
+  if ( zName == 0 ) {
+    *pzErr = sqlite3_mprintf("xbin: missing table name");
+    return 0;
+  }
+  pTab = xbinLookupTable(pReg, zName);
+  if ( pTab == 0 ) {
+    const char *zDot = strchr(zName, '.');
+    sqlite3_stmt *pStmt = 0;
+    char *zSql;
+    if ( zDot ) {
+      zSql = sqlite3_mprintf("SELECT 1 FROM \"%.*w\".\"%w\" LIMIT 0",
+                             (int)(zDot - zName), zName, zDot + 1);
+    } else {
+      zSql = sqlite3_mprintf("SELECT 1 FROM \"%w\" LIMIT 0", zName);
+    }
+    if ( zSql ) {
+      sqlite3_prepare_v2(pReg->db, zSql, -1, &pStmt, 0);
+      sqlite3_finalize(pStmt);
+      sqlite3_free(zSql);
+    }
+    pTab = xbinLookupTable(pReg, zName);
+  }
+  if ( pTab == 0 ) {
+    *pzErr = sqlite3_mprintf("xbin: no such xbin table: %s", zName);
+  } else if ( pTab->bUnion ) {
+    *pzErr = sqlite3_mprintf("xbin: %s is a glob= union, not one file", zName);
+    pTab = 0;
+  }
+  return pTab;
+}
+
+static int xbinFuncDisconnect(sqlite3_vtab *pVtab) {
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+/* The methods of union tables, which those of xbin tables hand over to */
+static int xbinUnionBestIndex(XbinTable *pTab, sqlite3_index_info *pIdxInfo);
+static int xbinUnionOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur);
+static int xbinUnionClose(sqlite3_vtab_cursor *cur);
+static int xbinUnionFilter(sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr,
+                           int argc, sqlite3_value **argv);
+static int xbinUnionNext(sqlite3_vtab_cursor *cur);
+static int xbinUnionEof(sqlite3_vtab_cursor *cur);
+static int xbinUnionColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i);
+static int xbinUnionRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid);
+
+/* Parallel scans, see xbinParStart() */
+static void xbinParFree(XbinCursor *pCur);
+
+/* True if cur is a cursor on a union table */
+#define XBIN_IS_UNION(cur)  (((XbinTable*)(cur)->pVtab)->bUnion)
+
+/*
+** Constructor for a new XbinCursor object.
+*/
+static int xbinOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinTable   *pTab = (XbinTable*) p;
+  XbinCursor  *pCur;
+
+  if ( pTab->bUnion ) return xbinUnionOpen(p, cur);
+
+  pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) {
+    return SQLITE_NOMEM;
+  }
+  memset(pCur, 0, sizeof(*pCur));
+  pCur->aBlock = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(xbinData) );
+  pCur->aSel = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(int) );
+  if ( pTab->nDerived > 0 ) {
+    int nReg = 1;
+    int i;
+    for (i = 0; i < pTab->nDerived; i++) {
+      if ( pTab->apDerived[i]->nReg > nReg ) nReg = pTab->apDerived[i]->nReg;
+    }
+    pCur->aDerived = sqlite3_malloc( pTab->nDerived * XBIN_BLOCK_ROWS * sizeof(double) );
+    pCur->aReg = sqlite3_malloc( nReg * XBIN_BLOCK_ROWS * sizeof(double) );
+    pCur->nReg = nReg;
+  }
+  if ( pCur->aBlock == 0 || pCur->aSel == 0
+    || (pTab->nDerived > 0 && (pCur->aDerived == 0 || pCur->aReg == 0)) ) {
+    sqlite3_free(pCur->aBlock);
+    sqlite3_free(pCur->aSel);
+    sqlite3_free(pCur->aDerived);
+    sqlite3_free(pCur->aReg);
+    sqlite3_free(pCur);
+    return SQLITE_NOMEM;
+  }
+
+  pCur->fptr = pTab->fptr;
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+/*
+** Free the predicates of the cursor, and the conditions they own.
+*/
+static void xbinPredReset(XbinCursor *pCur) {
+  int i;
+  for (i = 0; i < pCur->nPred; i++) sqlite3_free(pCur->aPred[i].pExpr);
+  sqlite3_free(pCur->aPred);
+  pCur->aPred = 0;
+  pCur->nPred = 0;
+  sqlite3_free(pCur->zFilter);
+  pCur->zFilter = 0;
+}
+
+/*
+** Destructor for a XbinCursor.
+*/
+static int xbinClose(sqlite3_vtab_cursor *cur) {
+  XbinCursor *pCur = (XbinCursor*)cur;
+  int i;
+  if ( XBIN_IS_UNION(cur) ) return xbinUnionClose(cur);
+  xbinParFree(pCur);
+  xbinPredReset(pCur);
+  for (i = 0; i < XBIN_MAX_ZIP; i++) sqlite3_free(pCur->aZip[i].a);
+  sqlite3_free(pCur->aBlock);
+  sqlite3_free(pCur->aSel);
+  sqlite3_free(pCur->aRowid);
+  sqlite3_free(pCur->aDerived);
+  sqlite3_free(pCur->aReg);
+  sqlite3_free(pCur->aFilter);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+/*
+** Sampled scans.
+**
+** "where sample = F" reads a fraction F of the blocks of XBIN_BLOCK_ROWS
+** records that the zone maps use, so that a 1% sample costs about 1% of
+** the I/O of a scan.  The blocks are stratified: the file is cut into
+** strata of 1/F blocks and one block is picked in each, by a hash of
+** the stratum number and the seed.  The last stratum is cut short by the
+** end of the file and its block picked among those there are, so any
+** file that is not empty yields a block.  The seed is random unless
+** given by "seed = N", which picks the same blocks every time.  Every
+** access path keeps to the records of the picked blocks.
+*/
+static sqlite3_int64 xbinSampleStart(const XbinCursor *pCur, sqlite3_int64 j) {
+  return (sqlite3_int64)ceil((double)j / pCur->rSample);
+}
+
+/* The block picked in stratum j */
+static sqlite3_int64 xbinSamplePick(const XbinCursor *pCur, sqlite3_int64 j) {
+  const XbinTable *pTab = (const XbinTable*)pCur->base.pVtab;
+  sqlite3_int64 nZone = (pTab->nRow + XBIN_BLOCK_ROWS - 1) / XBIN_BLOCK_ROWS;
+  sqlite3_int64 iStart = xbinSampleStart(pCur, j);
+  sqlite3_int64 n = xbinSampleStart(pCur, j + 1) - iStart;
+  sqlite3_uint64 h = xbinMix64(pCur->iSeed ^ ((sqlite3_uint64)j * 0x9e3779b97f4a7c15ULL));
+  if ( iStart + n > nZone ) n = nZone - iStart;
+  return iStart + (sqlite3_int64)(h % (sqlite3_uint64)(n > 0 ? n : 1));
+}
+
+/*
+** Return the first block of the sample at or after block iZone (at or
+** before it for a descending scan, -1 if there is none).
+*/
+static sqlite3_int64 xbinSampleNext(const XbinCursor *pCur, sqlite3_int64 iZone) {
+  sqlite3_int64 j = (sqlite3_int64)((double)iZone * pCur->rSample);
+  sqlite3_int64 iPick;
+  while ( j > 0 && xbinSampleStart(pCur, j) > iZone ) j--;
+  while ( xbinSampleStart(pCur, j + 1) <= iZone ) j++;
+  iPick = xbinSamplePick(pCur, j);
+  if ( pCur->bDesc ) {
+    if ( iPick <= iZone ) return iPick;
+    return j > 0 ? xbinSamplePick(pCur, j - 1) : -1;
+  }
+  return iPick >= iZone ? iPick : xbinSamplePick(pCur, j + 1);
+}
+
+/*
+** Move pCur->row, if its block is not in the sample, to the nearest row
+** of the next block that is.
+*/
+static void xbinSampleSeek(XbinCursor *pCur) {
+  sqlite3_int64 iZone;
+  sqlite3_int64 iPick;
+  if ( pCur->row < pCur->iFirst || pCur->row > pCur->iLast ) return;
+  iZone = (pCur->row - 1) / XBIN_BLOCK_ROWS;
+  iPick = xbinSampleNext(pCur, iZone);
+  if ( iPick != iZone ) {
+    pCur->row = pCur->bDesc ? (iPick + 1) * XBIN_BLOCK_ROWS : iPick * XBIN_BLOCK_ROWS + 1;
+  }
+}
+
+/*
+** Load the block of records that holds pCur->row.  Blocks are the
+** aligned XBIN_BLOCK_ROWS records of the zone maps: a forward scan reads
+** from row to the end of its block, a backward scan from the start of
+** the block to row, both clipped to the bounds of the scan.
+**
+** A lookup of a single row reads the aligned window of XBIN_PROBE_ROWS
+** records around it instead.  The block stays in the cursor between
+** calls to xbinFilter(), so the probes of a join that land near each
+** other are served without touching the file.  So do the rows of an
+** index lookup, which also announce the window a few rows down the list.
+*/
+static int xbinLoadBlock(XbinCursor *pCur) {
+  sqlite3_int64 iStart;
+  sqlite3_int64 n;
+  sqlite3_int64 nGot;
+
+  pCur->mDerived = 0;
+  if ( pCur->iFirst == pCur->iLast || pCur->aRowid ) {
+    if ( pCur->aRowid ) {
+      sqlite3_int64 k = pCur->iRowid + (pCur->bDesc ? -XBIN_LIST_AHEAD : XBIN_LIST_AHEAD);
+      if ( k >= 0 && k < pCur->nRowid ) {
+        sqlite3_int64 iNext = pCur->aRowid[k];
+        xbinReadAhead(pCur->fptr, iNext - (iNext - 1) % XBIN_PROBE_ROWS, XBIN_PROBE_ROWS);
+      }
+    }
+    iStart = pCur->row - (pCur->row - 1) % XBIN_PROBE_ROWS;
+    nGot = xbinReadRecords(pCur->fptr, iStart, XBIN_PROBE_ROWS, pCur->aBlock);
+    pCur->iBlock = iStart;
+    pCur->nBlock = (int)nGot;
+    if ( pCur->row >= iStart + nGot ) pCur->iLast = pCur->row - 1;
+    return SQLITE_OK;
+  }
+  if ( pCur->bDesc ) {
+    iStart = pCur->row - (pCur->row - 1) % XBIN_BLOCK_ROWS;
+    if ( iStart < pCur->iFirst ) iStart = pCur->iFirst;
+    n = pCur->row - iStart + 1;
+  } else {
+    iStart = pCur->row;
+    n = XBIN_BLOCK_ROWS - (pCur->row - 1) % XBIN_BLOCK_ROWS;
+    if ( n > pCur->iLast - iStart + 1 ) n = pCur->iLast - iStart + 1;
+  }
+
+  nGot = xbinReadRecords(pCur->fptr, iStart, n, pCur->aBlock);
+  pCur->iBlock = iStart;
+  pCur->nBlock = (int)nGot;
+  if ( nGot < n ) {
+    /* The file was truncated under us.  Stop at what could be read. */
+    if ( pCur->bDesc ) {
+      pCur->iFirst = pCur->row + 1;
+    } else {
+      pCur->iLast = iStart + nGot - 1;
+    }
+    return SQLITE_OK;
+  }
+
+  if ( pCur->nPred > 0 ) {
+    /* The next block may well be skipped, do not prefetch it blindly */
+  } else if ( pCur->rSample < 1.0 ) {
+    /* Prefetch the next block of the sample instead */
+    sqlite3_int64 iZone = (iStart - 1) / XBIN_BLOCK_ROWS + (pCur->bDesc ? -1 : 1);
+    sqlite3_int64 iPick = iZone >= 0 ? xbinSampleNext(pCur, iZone) : -1;
+    if ( iPick >= 0 ) xbinReadAhead(pCur->fptr, iPick * XBIN_BLOCK_ROWS + 1, XBIN_BLOCK_ROWS);
+  } else if ( pCur->bDesc ) {
+    sqlite3_int64 iNext = iStart - XBIN_BLOCK_ROWS;
+    if ( iNext < pCur->iFirst ) iNext = pCur->iFirst;
+    xbinReadAhead(pCur->fptr, iNext, iStart - iNext);
+  } else {
+    sqlite3_int64 iNext = iStart + n;
+    sqlite3_int64 nNext = pCur->iLast - iNext + 1;
+    if ( nNext > XBIN_BLOCK_ROWS ) nNext = XBIN_BLOCK_ROWS;
+    xbinReadAhead(pCur->fptr, iNext, nNext);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Point pCur->pData at the record for pCur->row, reading a new block
+** when the row is outside the buffered one.
+*/
+static int xbinFetch( XbinCursor *pCur ) {
+  int rc = SQLITE_OK;
+  if ( pCur->row < pCur->iFirst || pCur->row > pCur->iLast ) return SQLITE_OK;
+  if ( pCur->row < pCur->iBlock || pCur->row >= pCur->iBlock + pCur->nBlock ) {
+    rc = xbinLoadBlock(pCur);
+    if ( rc != SQLITE_OK
+      || pCur->row < pCur->iBlock || pCur->row >= pCur->iBlock + pCur->nBlock ) {
+      return rc;
+    }
+  }
+  pCur->pData = &pCur->aBlock[pCur->row - pCur->iBlock];
+  return rc;
+}
+
+/*
+** Move to pCur->row.  The record is only read if the statement uses a
+** column stored in it: count(*), or a query on row alone, walks the
+** row numbers without any I/O.
+*/
+static int xbin_get_line( XbinCursor *pCur ) {
+  pCur->pData = 0;
+  if ( (pCur->mUsed & XBIN_DATA_COLS) == 0 ) return SQLITE_OK;
+  return xbinFetch(pCur);
+}
+
+/*
+** Keep in aSel[0..nSel-1] the offsets of aRec[] that pass predicate p,
+** and return how many are left.  The loops do not branch on the data.
+*/
+static int xbinPredSelect(const XbinPred *p, const xbinData *aRec, int *aSel, int nSel) {
+  const float *a = (const float*)aRec + (p->iCol - 1);
+  double lo = p->rLo;
+  double hi = p->rHi;
+  int k = 0;
+  int i;
+
+  switch ( p->eType ) {
+    case XBIN_PRED_RANGE:
+      if ( !p->bLoOpen && !p->bHiOpen ) {
+        for (i = 0; i < nSel; i++) {
+          double v = a[aSel[i] * XBIN_NCOL];
+          aSel[k] = aSel[i];
+          k += (v >= lo) & (v <= hi);
+        }
+      } else {
+        for (i = 0; i < nSel; i++) {
+          double v = a[aSel[i] * XBIN_NCOL];
+          aSel[k] = aSel[i];
+          k += (p->bLoOpen ? v > lo : v >= lo) & (p->bHiOpen ? v < hi : v <= hi);
+        }
+      }
+      break;
+    case XBIN_PRED_NE:
+      for (i = 0; i < nSel; i++) {
+        double v = a[aSel[i] * XBIN_NCOL];
+        aSel[k] = aSel[i];
+        k += (v < lo) | (v > lo);
+      }
+      break;
+    case XBIN_PRED_NULL:
+      for (i = 0; i < nSel; i++) {
+        float v = a[aSel[i] * XBIN_NCOL];
+        aSel[k] = aSel[i];
+        k += (v != v);
+      }
+      break;
+    case XBIN_PRED_NOTNULL:
+      for (i = 0; i < nSel; i++) {
+        float v = a[aSel[i] * XBIN_NCOL];
+        aSel[k] = aSel[i];
+        k += (v == v);
+      }
+      break;
+  }
+  return k;
+}
+
+/*
+** Same as xbinPredSelect() for values computed into a[], one per record
+** of the block, rather than read from the records.
+*/
+static int xbinPredSelectValues(const XbinPred *p, const double *a, int *aSel, int nSel) {
+  double lo = p->rLo;
+  double hi = p->rHi;
+  int k = 0;
+  int i;
+
+  for (i = 0; i < nSel; i++) {
+    double v = a[aSel[i]];
+    aSel[k] = aSel[i];
+    switch ( p->eType ) {
+      case XBIN_PRED_RANGE:
+        k += (p->bLoOpen ? v > lo : v >= lo) & (p->bHiOpen ? v < hi : v <= hi);
+        break;
+      case XBIN_PRED_NE:
+        k += (v < lo) | (v > lo);
+        break;
+      case XBIN_PRED_NULL:
+        k += (v != v);
+        break;
+      case XBIN_PRED_NOTNULL:
+        k += (v == v);
+        break;
+    }
+  }
+  return k;
+}
+
+/*
+** Return the values of derived column iCol for the records of the
+** current block, computing them the first time they are asked for.
+*/
+static const double *xbinDerivedValues(XbinCursor *pCur, int iCol) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  double *a = &pCur->aDerived[(iCol - XBIN_DERIVED_COL) * XBIN_BLOCK_ROWS];
+  if ( (pCur->mDerived & XBIN_COLBIT(iCol)) == 0 ) {
+    xbinExprRun(pTab->apDerived[iCol - XBIN_DERIVED_COL], pCur->aBlock, pCur->nBlock,
+                a, pCur->aReg);
+    pCur->mDerived |= XBIN_COLBIT(iCol);
+  }
+  return a;
+}
+
+/*
+** Keep in aSel[0..nSel-1] the rows of aRec[] for which condition p is
+** true, that is neither NULL nor 0.  aOut[] and aReg[] are the room
+** xbinExprRun() needs.
+*/
+static int xbinExprSelect(
+  const XbinExpr *p,
+  const xbinData *aRec,
+  int *aSel, int nSel,
+  double *aOut, double *aReg
+) {
+  /* Evaluate the condition from the first row left to the last */
+  int iOff = nSel > 0 ? aSel[0] : 0;
+  int k = 0;
+  int i;
+  if ( nSel == 0 ) return 0;
+  xbinExprRun(p, &aRec[iOff], aSel[nSel - 1] - iOff + 1, aOut, aReg);
+  for (i = 0; i < nSel; i++) {
+    double v = aOut[aSel[i] - iOff];
+    aSel[k] = aSel[i];
+    k += (v == v) & (v != 0.0);
+  }
+  return k;
+}
+
+/* Keep in aSel[0..nSel-1] the rows of the current block passing p */
+static int xbinPredSelectBlock(XbinCursor *pCur, const XbinPred *p, int *aSel, int nSel) {
+  if ( p->eType == XBIN_PRED_EXPR ) {
+    return xbinExprSelect(p->pExpr, pCur->aBlock, aSel, nSel, pCur->aFilter, pCur->aReg);
+  }
+  if ( p->iCol >= XBIN_DERIVED_COL ) {
+    return xbinPredSelectValues(p, xbinDerivedValues(pCur, p->iCol), aSel, nSel);
+  }
+  return xbinPredSelect(p, pCur->aBlock, aSel, nSel);
+}
+
+/*
+** Fill aSel[] with the rows of the current block that are within the
+** bounds of the scan and pass every predicate.
+*/
+static void xbinSelect(XbinCursor *pCur) {
+  sqlite3_int64 iLo = pCur->iFirst > pCur->iBlock ? pCur->iFirst : pCur->iBlock;
+  sqlite3_int64 iHi = pCur->iBlock + pCur->nBlock - 1;
+  int nSel = 0;
+  int i;
+
+  if ( iHi > pCur->iLast ) iHi = pCur->iLast;
+  for (i = (int)(iLo - pCur->iBlock); i <= (int)(iHi - pCur->iBlock); i++) {
+    pCur->aSel[nSel++] = i;
+  }
+  for (i = 0; i < pCur->nPred && nSel > 0; i++) {
+    nSel = xbinPredSelectBlock(pCur, &pCur->aPred[i], pCur->aSel, nSel);
+  }
+  pCur->nSel = nSel;
+}
+
+/*
+** Parallel scans.
+**
+** With threads=N, a scan of many blocks is read and filtered by a pool
+** of N threads started with the cursor and parked between scans.  The
+** cursor queues the blocks the zone maps leave in a ring of
+** N * XBIN_PAR_BLOCKS slots: iPut, the tail, only moves forward in the
+** cursor thread, and the threads claim the slot at iTake, the head, by
+** compare-and-swap.  Each thread reads its block with a file handle of
+** its own, fills in the rows passing the predicates and marks the slot
+** done.  The cursor hands the blocks out in rowid order if the plan
+** consumes an ORDER BY, and otherwise in the order they are done, by
+** swapping buffers instead of copying, and queues another block in the
+** slot.  The threads see no SQLite object: the cursor makes all
+** allocations and zone map checks itself.
+*/
+typedef struct XbinParSlot {
+  sqlite3_int64 iDone;        /* Position read into the slot, plus 1 (atomic) */
+  sqlite3_int64 iZone;        /* Block to read */
+  sqlite3_int64 iBlock;       /* Rowid of aRec[0] */
+  int nBlock;                 /* Records read into aRec[] */
+  int nSel;                   /* Entries of aSel[] */
+  int bHanded;                /* True once handed to the cursor */
+  xbinData *aRec;             /* The records, XBIN_BLOCK_ROWS of room */
+  int *aSel;                  /* Offsets in aRec of the rows passing the predicates */
+} XbinParSlot;
+
+typedef struct XbinParJob {
+  XbinTask task;
+  XbinParScan *pScan;         /* Scan the thread belongs to */
+  XbinCursor sub;             /* Scratch cursor of the thread, sharing aPred */
+} XbinParJob;
+
+struct XbinParScan {
+  sqlite3_int64 iTake;        /* Next position for a thread to read (atomic) */
+  sqlite3_int64 iPut;         /* Positions queued so far (atomic) */
+  sqlite3_int64 iLow;         /* Oldest position not handed out */
+  sqlite3_int64 iZone;        /* Next block to queue */
+  int bRun;                   /* True once the blocks of the scan are being queued */
+  int bOrder;                 /* True to hand the blocks out in rowid order */
+  int bQuit;                  /* Set to make the threads return */
+  const XbinPred *aPred;      /* Predicates of the scan, for the threads */
+  int nPred;
+  sqlite3_int64 iFirst;       /* Bounds of the scan, for the threads */
+  sqlite3_int64 iLast;
+  int nSlot;                  /* Slots of the ring */
+  XbinParSlot *aSlot;
+  XbinPark work;              /* Where idle threads wait for a block */
+  XbinPark done;              /* Where the cursor waits for one to be done */
+  int nJob;                   /* Threads running */
+  XbinParJob aJob[XBIN_MAX_THREADS];
+};
+
+/* Read and filter the block at position i of the ring */
+static void xbinParRead(XbinParScan *p, XbinCursor *pSub, sqlite3_int64 i) {
+  XbinParSlot *s = &p->aSlot[i % p->nSlot];
+  sqlite3_int64 iStart = s->iZone * XBIN_BLOCK_ROWS + 1;
+  sqlite3_int64 iEnd = iStart + XBIN_BLOCK_ROWS - 1;
+
+  if ( iStart < p->iFirst ) iStart = p->iFirst;
+  if ( iEnd > p->iLast ) iEnd = p->iLast;
+  s->iBlock = iStart;
+  s->nBlock = (int)xbinReadRecords(pSub->fptr, iStart, iEnd - iStart + 1, s->aRec);
+  pSub->aPred = (XbinPred*)p->aPred;
+  pSub->nPred = p->nPred;
+  pSub->iFirst = p->iFirst;
+  pSub->iLast = p->iLast;
+  pSub->aBlock = s->aRec;
+  pSub->aSel = s->aSel;
+  pSub->iBlock = s->iBlock;
+  pSub->nBlock = s->nBlock;
+  pSub->mDerived = 0;
+  xbinSelect(pSub);
+  s->nSel = pSub->nSel;
+  xbinAtomicSet(&s->iDone, i + 1);
+  xbinParkLock(&p->done);
+  xbinParkWake(&p->done);
+  xbinParkUnlock(&p->done);
+}
+
+static void xbinParWork(void *pArg) {
+  XbinParJob *pJob = (XbinParJob*)pArg;
+  XbinParScan *p = pJob->pScan;
+
+  for (;;) {
+    sqlite3_int64 i = xbinAtomicGet(&p->iTake);
+    int bQuit;
+    if ( i < xbinAtomicGet(&p->iPut) ) {
+      if ( xbinAtomicCas(&p->iTake, i, i + 1) ) xbinParRead(p, &pJob->sub, i);
+      continue;
+    }
+    xbinParkLock(&p->work);
+    while ( !p->bQuit && xbinAtomicGet(&p->iTake) >= xbinAtomicGet(&p->iPut) ) {
+      xbinParkWait(&p->work);
+    }
+    bQuit = p->bQuit;
+    xbinParkUnlock(&p->work);
+    if ( bQuit ) return;
+  }
+}
+
+/*
+** Take back the blocks queued and not yet claimed, wait for the threads
+** to be done with the others, and drop the blocks not handed out.  The
+** threads stay parked for the next scan.
+*/
+static void xbinParStop(XbinCursor *pCur) {
+  XbinParScan *p = pCur->pPar;
+  sqlite3_int64 iTake;
+  sqlite3_int64 i;
+
+  if ( p == 0 || !p->bRun ) return;
+  do {
+    iTake = xbinAtomicGet(&p->iTake);
+  } while ( iTake < p->iPut && !xbinAtomicCas(&p->iTake, iTake, p->iPut) );
+  xbinParkLock(&p->done);
+  for (i = p->iLow; i < iTake; i++) {
+    while ( xbinAtomicGet(&p->aSlot[i % p->nSlot].iDone) != i + 1 ) xbinParkWait(&p->done);
+  }
+  xbinParkUnlock(&p->done);
+  p->iLow = p->iPut;
+  p->bRun = 0;
+}
+
+static void xbinParFree(XbinCursor *pCur) {
+  XbinParScan *p = pCur->pPar;
+  int i;
+  if ( p == 0 ) return;
+  xbinParStop(pCur);
+  xbinParkLock(&p->work);
+  p->bQuit = 1;
+  xbinParkWake(&p->work);
+  xbinParkUnlock(&p->work);
+  for (i = 0; i < p->nJob; i++) xbinTaskJoin(&p->aJob[i].task);
+  xbinParkFree(&p->work);
+  xbinParkFree(&p->done);
+  for (i = 0; p->aSlot && i < p->nSlot; i++) {
+    sqlite3_free(p->aSlot[i].aRec);
+    sqlite3_free(p->aSlot[i].aSel);
+  }
+  sqlite3_free(p->aSlot);
+  for (i = 0; i < XBIN_MAX_THREADS; i++) {
+    if ( p->aJob[i].sub.fptr ) fclose(p->aJob[i].sub.fptr);
+    sqlite3_free(p->aJob[i].sub.aDerived);
+    sqlite3_free(p->aJob[i].sub.aReg);
+    sqlite3_free(p->aJob[i].sub.aFilter);
+  }
+  sqlite3_free(p);
+  pCur->pPar = 0;
+}
+
+/*
+** Start the pool of nJob threads of the cursor, the first time, and make
+** the scan read its blocks from them, in rowid order if bOrder is set.
+** If no thread can be started, the scan reads the blocks itself.
+*/
+static int xbinParStart(XbinCursor *pCur, int nJob, int bOrder) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  XbinParScan *p = pCur->pPar;
+  int i;
+
+  if ( p == 0 ) {
+    p = sqlite3_malloc( sizeof(*p) );
+    if ( p == 0 ) return SQLITE_NOMEM;
+    memset(p, 0, sizeof(*p));
+    pCur->pPar = p;
+    xbinParkInit(&p->work);
+    xbinParkInit(&p->done);
+    p->nSlot = nJob * XBIN_PAR_BLOCKS;
+    p->aSlot = sqlite3_malloc( p->nSlot * sizeof(XbinParSlot) );
+    if ( p->aSlot == 0 ) return SQLITE_NOMEM;
+    memset(p->aSlot, 0, p->nSlot * sizeof(XbinParSlot));
+    for (i = 0; i < p->nSlot; i++) {
+      p->aSlot[i].aRec = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(xbinData) );
+      p->aSlot[i].aSel = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(int) );
+      if ( p->aSlot[i].aRec == 0 || p->aSlot[i].aSel == 0 ) return SQLITE_NOMEM;
+    }
+    for (i = 0; i < nJob; i++) {
+      XbinCursor *pSub = &p->aJob[i].sub;
+      pSub->base.pVtab = &pTab->base;
+      pSub->fptr = fopen(pTab->filename, "rb");
+      if ( pSub->fptr == 0 ) return SQLITE_CANTOPEN;
+      if ( pTab->nDerived > 0 ) {
+        pSub->aDerived = sqlite3_malloc( pTab->nDerived * XBIN_BLOCK_ROWS * sizeof(double) );
+        if ( pSub->aDerived == 0 ) return SQLITE_NOMEM;
+      }
+    }
+    for (i = 0; i < nJob; i++) {
+      p->aJob[i].pScan = p;
+      if ( !xbinTaskSpawn(&p->aJob[i].task, xbinParWork, &p->aJob[i]) ) break;
+      p->nJob++;
+    }
+  }
+  if ( p->nJob == 0 ) return SQLITE_OK;
+
+  /* Scratch space for the predicates of this scan */
+  for (i = 0; i < p->nJob; i++) {
+    XbinCursor *pSub = &p->aJob[i].sub;
+    if ( pCur->nReg > pSub->nReg ) {
+      double *aReg = sqlite3_realloc64(pSub->aReg,
+                                       (sqlite3_uint64)pCur->nReg * XBIN_BLOCK_ROWS * sizeof(double));
+      if ( aReg == 0 ) return SQLITE_NOMEM;
+      pSub->aReg = aReg;
+      pSub->nReg = pCur->nReg;
+    }
+    if ( pCur->aFilter && pSub->aFilter == 0 ) {
+      pSub->aFilter = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(double) );
+      if ( pSub->aFilter == 0 ) return SQLITE_NOMEM;
+    }
+  }
+  p->bOrder = bOrder;
+  pCur->bPar = 1;
+  return SQLITE_OK;
+}
+
+/*
+** Queue the blocks from p->iZone on (down from it for a descending
+** scan) that are within the bounds of the cursor and not ruled out by
+** the zone maps, as long as there are free slots.
+*/
+static void xbinParQueue(XbinCursor *pCur) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  XbinParScan *p = pCur->pPar;
+  sqlite3_int64 iZoneLo = (pCur->iFirst - 1) / XBIN_BLOCK_ROWS;
+  sqlite3_int64 iZoneHi = (pCur->iLast - 1) / XBIN_BLOCK_ROWS;
+  sqlite3_int64 nZone = pTab->nZoneRow / XBIN_BLOCK_ROWS;
+  sqlite3_int64 iPut = p->iPut;
+
+  /* Free the slots handed out, up to the oldest one still in use */
+  while ( p->iLow < iPut && p->aSlot[p->iLow % p->nSlot].bHanded ) p->iLow++;
+  while ( iPut - p->iLow < p->nSlot && p->iZone >= iZoneLo && p->iZone <= iZoneHi ) {
+    if ( pCur->nPred == 0 || p->iZone >= nZone
+      || !xbinZoneSkip(pTab, p->iZone, pCur->aPred, pCur->nPred) ) {
+      XbinParSlot *s = &p->aSlot[iPut % p->nSlot];
+      s->iZone = p->iZone;
+      s->bHanded = 0;
+      iPut++;
+    }
+    p->iZone += pCur->bDesc ? -1 : 1;
+  }
+  if ( iPut > p->iPut ) {
+    xbinAtomicSet(&p->iPut, iPut);
+    xbinParkLock(&p->work);
+    xbinParkWake(&p->work);
+    xbinParkUnlock(&p->work);
+  }
+}
+
+/*
+** Return the slot of the next block queued by xbinParQueue() to hand
+** out, waiting for it to be read if need be, or 0 if there is none.
+*/
+static XbinParSlot *xbinParNext(XbinParScan *p) {
+  XbinParSlot *s = 0;
+
+  if ( p->iLow >= p->iPut ) return 0;
+  xbinParkLock(&p->done);
+  for (;;) {
+    sqlite3_int64 i = p->iLow;
+    do {
+      XbinParSlot *t = &p->aSlot[i % p->nSlot];
+      if ( !t->bHanded && xbinAtomicGet(&t->iDone) == i + 1 ) s = t;
+    } while ( s == 0 && !p->bOrder && ++i < p->iPut );
+    if ( s ) break;
+    xbinParkWait(&p->done);
+  }
+  xbinParkUnlock(&p->done);
+  s->bHanded = 1;
+  return s;
+}
+
+/*
+** Load the next block of a parallel scan, and the rows of it passing
+** the predicates, into the cursor.  The cursor is moved to the block,
+** or past the end of the scan once all the blocks have been loaded.
+*/
+static int xbinParLoad(XbinCursor *pCur) {
+  XbinParScan *p = pCur->pPar;
+  XbinParSlot *s;
+  xbinData *aRec;
+  int *aSel;
+
+  if ( !p->bRun ) {
+    p->aPred = pCur->aPred;
+    p->nPred = pCur->nPred;
+    p->iFirst = pCur->iFirst;
+    p->iLast = pCur->iLast;
+    p->iZone = (pCur->row - 1) / XBIN_BLOCK_ROWS;
+    p->bRun = 1;
+  }
+  xbinParQueue(pCur);
+  s = xbinParNext(p);
+  if ( s == 0 ) {
+    pCur->row = pCur->bDesc ? pCur->iFirst - 1 : pCur->iLast + 1;
+    return SQLITE_OK;
+  }
+  aRec = pCur->aBlock;
+  aSel = pCur->aSel;
+  pCur->aBlock = s->aRec;
+  pCur->aSel = s->aSel;
+  s->aRec = aRec;
+  s->aSel = aSel;
+  pCur->iBlock = s->iBlock;
+  pCur->nBlock = s->nBlock;
+  pCur->nSel = s->nSel;
+  pCur->mDerived = 0;
+  pCur->row = pCur->iBlock;
+  xbinParQueue(pCur);
+  return SQLITE_OK;
+}
+
+/*
+** Move a parallel scan to the next row passing the predicates, taking
+** the blocks as they come from xbinParLoad().
+*/
+static int xbinParMatch(XbinCursor *pCur) {
+  pCur->pData = 0;
+  for (;;) {
+    int rc = xbinParLoad(pCur);
+    if ( rc != SQLITE_OK ) return rc;
+    if ( pCur->row < pCur->iFirst || pCur->row > pCur->iLast ) return SQLITE_OK;
+    if ( pCur->nSel > 0 ) break;
+  }
+  pCur->iSel = pCur->bDesc ? pCur->nSel - 1 : 0;
+  pCur->row = pCur->iBlock + pCur->aSel[pCur->iSel];
+  pCur->pData = &pCur->aBlock[pCur->aSel[pCur->iSel]];
+  return SQLITE_OK;
+}
+
+/*
+** Move the cursor to the first row passing the predicates at or after
+** pCur->row (at or before it for a descending scan).  Blocks that the
+** zone maps rule out are skipped without being read; the others are
+** read and filtered as a whole.
+*/
+static int xbinSeekMatch(XbinCursor *pCur) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  int rc = SQLITE_OK;
+
+  if ( pCur->bPar ) return xbinParMatch(pCur);
+  pCur->pData = 0;
+  while ( pCur->row >= pCur->iFirst && pCur->row <= pCur->iLast ) {
+    sqlite3_int64 off;
+    int k;
+    if ( pCur->nSel < 0
+      || pCur->row < pCur->iBlock || pCur->row >= pCur->iBlock + pCur->nBlock ) {
+      sqlite3_int64 iZone = (pCur->row - 1) / XBIN_BLOCK_ROWS;
+      if ( pCur->rSample < 1.0 ) {
+        sqlite3_int64 iRow = pCur->row;
+        xbinSampleSeek(pCur);
+        if ( pCur->row != iRow ) continue;
+      }
+      if ( (pCur->row < pCur->iBlock || pCur->row >= pCur->iBlock + pCur->nBlock)
+        && iZone < (pTab->nZoneRow / XBIN_BLOCK_ROWS)
+        && xbinZoneSkip(pTab, iZone, pCur->aPred, pCur->nPred) ) {
+        pCur->row = pCur->bDesc ? iZone * XBIN_BLOCK_ROWS : (iZone + 1) * XBIN_BLOCK_ROWS + 1;
+        continue;
+      }
+      rc = xbinFetch(pCur);
+      if ( rc != SQLITE_OK ) return rc;
+      if ( pCur->row < pCur->iFirst || pCur->row > pCur->iLast ) break;
+      xbinSelect(pCur);
+    }
+
+    off = pCur->row - pCur->iBlock;
+    if ( pCur->bDesc ) {
+      for (k = pCur->nSel - 1; k >= 0 && pCur->aSel[k] > off; k--) {}
+      if ( k < 0 ) {
+        pCur->row = pCur->iBlock - 1;
+        continue;
+      }
+    } else {
+      for (k = 0; k < pCur->nSel && pCur->aSel[k] < off; k++) {}
+      if ( k >= pCur->nSel ) {
+        pCur->row = pCur->iBlock + pCur->nBlock;
+        continue;
+      }
+    }
+    pCur->iSel = k;
+    pCur->row = pCur->iBlock + pCur->aSel[k];
+    pCur->pData = &pCur->aBlock[pCur->aSel[k]];
+    break;
+  }
+  return rc;
+}
+
+/*
+** Move the cursor to the first row of aRowid[] at or after entry
+** pCur->iRowid (at or before it for a descending scan) that passes the
+** predicates.  Past the end of the list, the cursor is left at EOF.
+*/
+static int xbinListMatch(XbinCursor *pCur) {
+  pCur->pData = 0;
+  while ( pCur->iRowid >= 0 && pCur->iRowid < pCur->nRowid ) {
+    int aSel[1];
+    int i;
+    int rc;
+    pCur->row = pCur->aRowid[pCur->iRowid];
+    if ( pCur->rSample < 1.0
+      && xbinSampleNext(pCur, (pCur->row - 1) / XBIN_BLOCK_ROWS) != (pCur->row - 1) / XBIN_BLOCK_ROWS ) {
+      pCur->iRowid += pCur->bDesc ? -1 : 1;
+      continue;
+    }
+    if ( pCur->nPred == 0 ) return xbin_get_line(pCur);
+    rc = xbinFetch(pCur);
+    if ( rc != SQLITE_OK ) return rc;
+    if ( pCur->pData ) {
+      aSel[0] = (int)(pCur->pData - pCur->aBlock);
+      for (i = 0; i < pCur->nPred; i++) {
+        if ( xbinPredSelectBlock(pCur, &pCur->aPred[i], aSel, 1) == 0 ) break;
+      }
+      if ( i == pCur->nPred ) return SQLITE_OK;
+      pCur->pData = 0;
+    }
+    pCur->iRowid += pCur->bDesc ? -1 : 1;
+  }
+  pCur->row = pCur->bDesc ? pCur->iFirst - 1 : pCur->iLast + 1;
+  return SQLITE_OK;
+}
+
+/*
+** Advance a XbinCursor to its next row of output.
+*/
+static int xbinNext(sqlite3_vtab_cursor *cur) {
+  XbinCursor *pCur = (XbinCursor*)cur;
+  if ( XBIN_IS_UNION(cur) ) return xbinUnionNext(cur);
+  if ( pCur->aRowid ) {
+    pCur->iRowid += pCur->bDesc ? -1 : 1;
+    return xbinListMatch(pCur);
+  }
+  if ( pCur->nPred > 0 || pCur->bPar ) {
+    int k = pCur->iSel + (pCur->bDesc ? -1 : 1);
+    if ( k >= 0 && k < pCur->nSel ) {
+      pCur->iSel = k;
+      pCur->row = pCur->iBlock + pCur->aSel[k];
+      pCur->pData = &pCur->aBlock[pCur->aSel[k]];
+      return SQLITE_OK;
+    }
+    pCur->row = pCur->bDesc ? pCur->iBlock - 1 : pCur->iBlock + pCur->nBlock;
+    return xbinSeekMatch(pCur);
+  }
+  pCur->row += pCur->bDesc ? -1 : 1;
+  if ( pCur->rSample < 1.0 ) xbinSampleSeek(pCur);
+  return xbin_get_line(pCur);
+}
+
+/*
+** Point *ppRec at the record of zipped file iZip for pCur->row, or at 0
+** if the file is shorter than that.  The records are read a block at a
+** time, the same rows as the block of the table when it is loaded so
+** that all the files move in step, and only once a column of the file
+** is asked for.
+*/
+static int xbinZipFetch(XbinCursor *pCur, int iZip, const xbinData **ppRec) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  XbinZipBlock *pZip = &pCur->aZip[iZip];
+  sqlite3_int64 iRow = pCur->row;
+
+  if ( iRow < pZip->iBlock || iRow >= pZip->iBlock + pZip->nBlock ) {
+    sqlite3_int64 iStart;
+    sqlite3_int64 n;
+    int bScan = 0;
+    if ( pZip->a == 0 ) {
+      pZip->a = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(xbinData) );
+      if ( pZip->a == 0 ) return SQLITE_NOMEM;
+    }
+    if ( iRow >= pCur->iBlock && iRow < pCur->iBlock + pCur->nBlock ) {
+      iStart = pCur->iBlock;
+      n = pCur->nBlock;
+      bScan = (pCur->iFirst != pCur->iLast && pCur->aRowid == 0);
+    } else if ( pCur->iFirst == pCur->iLast || pCur->aRowid ) {
+      iStart = iRow - (iRow - 1) % XBIN_PROBE_ROWS;
+      n = XBIN_PROBE_ROWS;
+    } else {
+      iStart = iRow - (iRow - 1) % XBIN_BLOCK_ROWS;
+      n = XBIN_BLOCK_ROWS;
+      bScan = 1;
+    }
+    pZip->iBlock = iStart;
+    pZip->nBlock = (int)xbinReadRecords(pTab->apZip[iZip], iStart, n, pZip->a);
+    if ( bScan && pCur->nPred == 0 && pCur->rSample >= 1.0 ) {
+      /* Announce the next block, as xbinLoadBlock() does for the table */
+      if ( pCur->bDesc ) {
+        sqlite3_int64 iNext = iStart - XBIN_BLOCK_ROWS;
+        if ( iNext < pCur->iFirst ) iNext = pCur->iFirst;
+        xbinReadAhead(pTab->apZip[iZip], iNext, iStart - iNext);
+      } else {
+        sqlite3_int64 iNext = iStart + n;
+        sqlite3_int64 nNext = pCur->iLast - iNext + 1;
+        if ( nNext > XBIN_BLOCK_ROWS ) nNext = XBIN_BLOCK_ROWS;
+        xbinReadAhead(pTab->apZip[iZip], iNext, nNext);
+      }
+    }
+  }
+  *ppRec = (iRow >= pZip->iBlock && iRow < pZip->iBlock + pZip->nBlock)
+         ? &pZip->a[iRow - pZip->iBlock] : 0;
+  return SQLITE_OK;
+}
+
+/*
+** Return values of columns for the row at which the XbinCursor
+** is currently pointing.
+*/
+static int xbinColumn(
+  sqlite3_vtab_cursor *cur,   /* The cursor */
+  sqlite3_context *ctx,       /* First argument to sqlite3_result_...() */
+  int i                       /* Which column to return */
+) {
+  XbinCursor *pCur = (XbinCursor*)cur;
+  if ( XBIN_IS_UNION(cur) ) return xbinUnionColumn(cur, ctx, i);
+  if (i == 0) {
+    sqlite3_result_int64(ctx, pCur->row);
+    return SQLITE_OK;
+  }
+  if ( i == XBIN_SAMPLE_COL ) {
+    if ( pCur->bSample ) sqlite3_result_double(ctx, pCur->rSample);
+    return SQLITE_OK;
+  }
+  if ( i == XBIN_SEED_COL ) {
+    if ( pCur->bSeed ) sqlite3_result_int64(ctx, (sqlite3_int64)pCur->iSeed);
+    return SQLITE_OK;
+  }
+  if ( i == XBIN_FILTER_COL ) {
+    if ( pCur->zFilter ) sqlite3_result_text(ctx, pCur->zFilter, -1, SQLITE_TRANSIENT);
+    return SQLITE_OK;
+  }
+  if ( i >= ((XbinTable*)cur->pVtab)->iZipCol ) {
+    /* A zipped file, read without the record of the table */
+    int iOff = i - ((XbinTable*)cur->pVtab)->iZipCol;
+    const xbinData *pRec = 0;
+    int rc = xbinZipFetch(pCur, iOff / XBIN_NCOL, &pRec);
+    if ( rc != SQLITE_OK ) return rc;
+    if ( pRec ) sqlite3_result_double(ctx, XBIN_VALUE(pRec, iOff % XBIN_NCOL + 1));
+    return SQLITE_OK;
+  }
+  if ( pCur->pData == 0 ) {
+    /* Not in colUsed after all */
+    int rc = xbinFetch(pCur);
+    if ( rc != SQLITE_OK ) return rc;
+    if ( pCur->pData == 0 ) return SQLITE_OK;
+  }
+  if ( i >= XBIN_DERIVED_COL ) {
+    const double *a = xbinDerivedValues(pCur, i);
+    sqlite3_result_double(ctx, a[pCur->pData - pCur->aBlock]);
+    return SQLITE_OK;
+  }
+  float *start = (float *) pCur->pData;
+  sqlite3_result_double(ctx, (double)start[i - 1]);
+  return SQLITE_OK;
+}
+
+/*
+** Return the rowid for the current row, just same as the row number.
+*/
+static int xbinRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  if ( XBIN_IS_UNION(cur) ) return xbinUnionRowid(cur, pRowid);
+  *pRowid = ((XbinCursor*)cur)->row;
+  return SQLITE_OK;
+}
+
+/*
+** Return TRUE if the cursor has been moved off of the last
+** row of output.
+*/
+static int xbinEof(sqlite3_vtab_cursor *cur) {
+  XbinCursor* pCur = (XbinCursor*) cur;
+  if ( XBIN_IS_UNION(cur) ) return xbinUnionEof(cur);
+  return pCur->row < pCur->iFirst || pCur->row > pCur->iLast;
+}
+
+/*
+** Convert the right-hand side of a constraint on row into an integer
+** bound.  op is the SQLITE_INDEX_CONSTRAINT_* code of the constraint.
+** Values that are not whole numbers are rounded toward the side that
+** keeps the comparison exact, e.g. "row > 4.5" becomes "row >= 5".
+** Return 0 if no row can satisfy the constraint.
+*/
+static int xbinRowBound(sqlite3_value *pVal, int op, sqlite3_int64 *piRow) {
+  double r;
+  sqlite3_int64 i;
+
+  switch ( sqlite3_value_numeric_type(pVal) ) {
+    case SQLITE_INTEGER:
+      i = sqlite3_value_int64(pVal);
+      if ( op == SQLITE_INDEX_CONSTRAINT_GT ) i++;
+      if ( op == SQLITE_INDEX_CONSTRAINT_LT ) i--;
+      *piRow = i;
+      return 1;
+    case SQLITE_FLOAT:
+      r = sqlite3_value_double(pVal);
+      if ( r > 9.0e18 ) r = 9.0e18;
+      if ( r < -9.0e18 ) r = -9.0e18;
+      i = (sqlite3_int64)r;
+      if ( (double)i == r ) {
+        if ( op == SQLITE_INDEX_CONSTRAINT_GT ) i++;
+        if ( op == SQLITE_INDEX_CONSTRAINT_LT ) i--;
+      } else {
+        if ( op == SQLITE_INDEX_CONSTRAINT_EQ ) return 0;
+        if ( r > 0.0 && (op == SQLITE_INDEX_CONSTRAINT_GT || op == SQLITE_INDEX_CONSTRAINT_GE) ) i++;
+        if ( r < 0.0 && (op == SQLITE_INDEX_CONSTRAINT_LT || op == SQLITE_INDEX_CONSTRAINT_LE) ) i--;
+      }
+      *piRow = i;
+      return 1;
+    case SQLITE_NULL:
+      return 0;
+    default:
+      /* TEXT and BLOB sort after every number */
+      if ( op == SQLITE_INDEX_CONSTRAINT_LT || op == SQLITE_INDEX_CONSTRAINT_LE ) {
+        *piRow = XBIN_MAX_ROW;
+        return 1;
+      }
+      return 0;
+  }
+}
+
+/*
+** Classify the right-hand side of a comparison with a REAL column:
+** return 1 and set *pr for a number, 2 for TEXT or BLOB (which sort
+** after every number) and 0 for NULL (which compares with nothing).
+*/
+static int xbinRealArg(sqlite3_value *pVal, double *pr) {
+  switch ( sqlite3_value_numeric_type(pVal) ) {
+    case SQLITE_INTEGER:
+    case SQLITE_FLOAT:
+      *pr = sqlite3_value_double(pVal);
+      return 1;
+    case SQLITE_NULL:
+      return 0;
+    default:
+      return 2;
+  }
+}
+
+/*
+** Compare the sort key prefix aCol[0..nCol-1] of record p with aVal[].
+*/
+static int xbinKeyCmp(const xbinData *p, int nCol, const int *aCol, const double *aVal) {
+  int i;
+  for (i = 0; i < nCol; i++) {
+    double v = XBIN_VALUE(p, aCol[i]);
+    if ( v < aVal[i] ) return -1;
+    if ( v > aVal[i] ) return 1;
+  }
+  return 0;
+}
+
+/*
+** Range of rows selected on the sort key of a file: the first nEq key
+** columns equal aEq[], and the next one, if bLo/bHi, is above rLo and
+** below rHi (or equal to them, unless bLoOpen/bHiOpen).
+*/
+typedef struct XbinKeyRange {
+  int nEq;                    /* Key columns constrained by = */
+  double aEq[XBIN_NCOL];      /* Their values */
+  int bLo, bLoOpen;           /* Lower bound on the next key column */
+  double rLo;
+  int bHi, bHiOpen;           /* Upper bound on the next key column */
+  double rHi;
+} XbinKeyRange;
+
+/*
+** Narrow [*piFirst, *piLast] to the rows of pRange with two binary
+** searches over the file, which must be sorted by pTab->aKey.
+*/
+static void xbinKeySearch(
+  XbinTable *pTab,
+  FILE *fptr,
+  const XbinKeyRange *pRange,
+  sqlite3_int64 *piFirst, sqlite3_int64 *piLast
+) {
+  int iCol = pTab->aKey[pRange->nEq];
+  sqlite3_int64 lo, hi;
+  xbinData rec;
+
+  /* First row that is not before the range */
+  lo = *piFirst;
+  hi = *piLast + 1;
+  while ( lo < hi ) {
+    sqlite3_int64 mid = lo + (hi - lo) / 2;
+    int bBefore;
+    int c;
+    if ( !xbinReadRecord(fptr, mid, &rec) ) { hi = mid; continue; }
+    c = xbinKeyCmp(&rec, pRange->nEq, pTab->aKey, pRange->aEq);
+    if ( c == 0 && pRange->bLo ) {
+      double v = XBIN_VALUE(&rec, iCol);
+      bBefore = pRange->bLoOpen ? v <= pRange->rLo : v < pRange->rLo;
+    } else {
+      bBefore = c < 0;
+    }
+    if ( bBefore ) lo = mid + 1; else hi = mid;
+  }
+  *piFirst = lo;
+
+  /* First row that is after the range */
+  hi = *piLast + 1;
+  while ( lo < hi ) {
+    sqlite3_int64 mid = lo + (hi - lo) / 2;
+    int bAfter;
+    int c;
+    if ( !xbinReadRecord(fptr, mid, &rec) ) { hi = mid; continue; }
+    c = xbinKeyCmp(&rec, pRange->nEq, pTab->aKey, pRange->aEq);
+    if ( c == 0 && pRange->bHi ) {
+      double v = XBIN_VALUE(&rec, iCol);
+      bAfter = pRange->bHiOpen ? v >= pRange->rHi : v > pRange->rHi;
+    } else {
+      bAfter = c > 0;
+    }
+    if ( bAfter ) hi = mid; else lo = mid + 1;
+  }
+  *piLast = lo - 1;
+}
+
+/*
+** Decode idxStr into aCons[] and *pmUsed (the columns the statement
+** reads), and check that the sort key levels it relies on still hold.
+** Return the number of constraints, or a negative SQLite error code:
+** -SQLITE_SCHEMA, which makes SQLite prepare the statement again, if
+** the file stopped being sorted the way the plan assumed.  aCons[] must
+** have room for one entry per comma in idxStr.
+*/
+static int xbinDecodePlan(
+  XbinTable *pTab,
+  const char *idxStr,
+  int argc, sqlite3_value **argv,
+  XbinCons *aCons,
+  sqlite3_uint64 *pmUsed
+) {
+  const char *z = idxStr ? idxStr : "";
+  int nCons = 0;
+  int nArg = 0;
+  int nKey = 0;
+
+  *pmUsed = ~(sqlite3_uint64)0;
+  while ( *z ) {
+    char c = *(z++);
+    int iCol;
+    if ( c == 'u' ) {
+      *pmUsed = (sqlite3_uint64)strtoull(z, (char**)&z, 16);
+      if ( *z == ',' ) z++;
+      continue;
+    }
+    if ( c == 'm' ) {
+      if ( *z == ',' ) z++;
+      continue;
+    }
+    iCol = (int)strtol(z, (char**)&z, 10);
+    if ( c == 'k' ) {
+      if ( nKey >= pTab->nKey || pTab->aKey[nKey] != iCol ) {
+        sqlite3_free(pTab->base.zErrMsg);
+        pTab->base.zErrMsg = sqlite3_mprintf("xbin: sort order of %s changed", pTab->filename);
+        return -SQLITE_SCHEMA;
+      }
+      nKey++;
+    } else if ( c == 'i' || c == 'b' || c == 'g' || c == 'l' ) {
+      aCons[nCons].eKind = c;
+      aCons[nCons].iCol = iCol;
+      aCons[nCons].op = 0;
+      aCons[nCons].pVal = 0;
+      nCons++;
+    } else if ( c == 'f' || c == 'r' || c == 'x' ) {
+      if ( nArg >= argc ) return -SQLITE_INTERNAL;
+      aCons[nCons].eKind = c;
+      aCons[nCons].iCol = (c == 'x') ? XBIN_FILTER_COL : 0;
+      aCons[nCons].op = SQLITE_INDEX_CONSTRAINT_EQ;
+      aCons[nCons].pVal = argv[nArg++];
+      nCons++;
+    } else if ( (c == 'c' || c == 's' || c == 'z' || c == 'n') && *z == ':' ) {
+      aCons[nCons].eKind = c;
+      aCons[nCons].iCol = (c == 'n') ? XBIN_FILE_COL : iCol;
+      aCons[nCons].op = (int)strtol(z + 1, (char**)&z, 10);
+      aCons[nCons].pVal = 0;
+      if ( c != 'z' ) {
+        if ( nArg >= argc ) return -SQLITE_INTERNAL;
+        aCons[nCons].pVal = argv[nArg++];
+      }
+      nCons++;
+    } else {
+      return -SQLITE_INTERNAL;
+    }
+    if ( *z == ',' ) z++;
+  }
+  return nArg == argc ? nCons : -SQLITE_INTERNAL;
+}
+
+/*
+** Parse the second argument of near() or in_box(), two numbers separated
+** by a comma or spaces, into *pr1 and *pr2.  Return 1 on success, 0 if
+** the argument is NULL and -1 if it is malformed.
+*/
+static int xbinSpecArg(sqlite3_value *pVal, double *pr1, double *pr2) {
+  const char *z;
+  char *zEnd;
+  if ( sqlite3_value_type(pVal) == SQLITE_NULL ) return 0;
+  z = (const char*)sqlite3_value_text(pVal);
+  if ( z == 0 ) return -1;
+  *pr1 = strtod(z, &zEnd);
+  if ( zEnd == z ) return -1;
+  z = zEnd;
+  while ( isspace((unsigned char)*z) ) z++;
+  if ( *z == ',' ) z++;
+  *pr2 = strtod(z, &zEnd);
+  if ( zEnd == z ) return -1;
+  z = zEnd;
+  while ( isspace((unsigned char)*z) ) z++;
+  return *z == 0 ? 1 : -1;
+}
+
+/*
+** Turn a constraint on a data column into the predicate *p.  Return
+** SQLITE_ERROR, leaving a message in *pzErr, for a malformed near() or
+** in_box() argument.
+*/
+static int xbinMakePred(const XbinCons *pCons, XbinPred *p, char **pzErr) {
+  double r = 0.0;
+  double r2 = 0.0;
+  int eArg = 1;
+
+  memset(p, 0, sizeof(*p));
+  p->iCol = pCons->iCol;
+  p->eType = XBIN_PRED_RANGE;
+  p->rLo = -HUGE_VAL;
+  p->rHi = HUGE_VAL;
+  if ( pCons->op == XBIN_OP_NEAR || pCons->op == XBIN_OP_INBOX ) {
+    eArg = xbinSpecArg(pCons->pVal, &r, &r2);
+    if ( eArg < 0 ) {
+      *pzErr = sqlite3_mprintf("%s(): expected '%s' as second argument",
+                               pCons->op == XBIN_OP_NEAR ? "near" : "in_box",
+                               pCons->op == XBIN_OP_NEAR ? "center,tolerance" : "low,high");
+      return SQLITE_ERROR;
+    }
+  } else if ( pCons->pVal ) {
+    eArg = xbinRealArg(pCons->pVal, &r);
+  }
+
+  /* NULL on the right compares with nothing */
+  if ( eArg == 0 ) {
+    p->eType = XBIN_PRED_FALSE;
+    return SQLITE_OK;
+  }
+  switch ( pCons->op ) {
+    case SQLITE_INDEX_CONSTRAINT_EQ:
+      if ( eArg == 2 ) p->eType = XBIN_PRED_FALSE;
+      p->rLo = p->rHi = r;
+      break;
+    case SQLITE_INDEX_CONSTRAINT_GT:
+    case SQLITE_INDEX_CONSTRAINT_GE:
+      if ( eArg == 2 ) p->eType = XBIN_PRED_FALSE;
+      p->rLo = r;
+      p->bLoOpen = (pCons->op == SQLITE_INDEX_CONSTRAINT_GT);
+      break;
+    case SQLITE_INDEX_CONSTRAINT_LT:
+    case SQLITE_INDEX_CONSTRAINT_LE:
+      /* Every number is below TEXT and BLOB values */
+      if ( eArg == 2 ) p->eType = XBIN_PRED_NOTNULL;
+      p->rHi = r;
+      p->bHiOpen = (pCons->op == SQLITE_INDEX_CONSTRAINT_LT);
+      break;
+    case SQLITE_INDEX_CONSTRAINT_NE:
+      p->eType = eArg == 2 ? XBIN_PRED_NOTNULL : XBIN_PRED_NE;
+      p->rLo = r;
+      break;
+    case SQLITE_INDEX_CONSTRAINT_ISNULL:
+      p->eType = XBIN_PRED_NULL;
+      break;
+    case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
+      p->eType = XBIN_PRED_NOTNULL;
+      break;
+    case XBIN_OP_NEAR:
+      /* near(col, 'c,tol') is c-tol <= col <= c+tol */
+      if ( r2 < 0.0 ) p->eType = XBIN_PRED_FALSE;
+      p->rLo = r - r2;
+      p->rHi = r + r2;
+      break;
+    case XBIN_OP_INBOX:
+      if ( r2 < r ) p->eType = XBIN_PRED_FALSE;
+      p->rLo = r;
+      p->rHi = r2;
+      break;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Set *pRange to the intersection of the range predicates on column
+** iCol.  Return 0 if there are none.
+*/
+static int xbinPredRange(const XbinCursor *pCur, int iCol, XbinPred *pRange) {
+  int bRange = 0;
+  int i;
+  memset(pRange, 0, sizeof(*pRange));
+  pRange->iCol = iCol;
+  pRange->eType = XBIN_PRED_RANGE;
+  pRange->rLo = -HUGE_VAL;
+  pRange->rHi = HUGE_VAL;
+  for (i = 0; i < pCur->nPred; i++) {
+    const XbinPred *p = &pCur->aPred[i];
+    if ( p->iCol != iCol || p->eType != XBIN_PRED_RANGE ) continue;
+    bRange = 1;
+    if ( p->rLo > pRange->rLo || (p->rLo == pRange->rLo && p->bLoOpen) ) {
+      pRange->rLo = p->rLo;
+      pRange->bLoOpen = p->bLoOpen;
+    }
+    if ( p->rHi < pRange->rHi || (p->rHi == pRange->rHi && p->bHiOpen) ) {
+      pRange->rHi = p->rHi;
+      pRange->bHiOpen = p->bHiOpen;
+    }
+  }
+  return bRange;
+}
+
+/*
+** Return mCol with the columns that the derived columns of mCol are
+** computed from.
+*/
+static sqlite3_uint64 xbinDerivedInputs(const XbinTable *pTab, sqlite3_uint64 mCol) {
+  int i;
+  for (i = 0; i < pTab->nDerived; i++) {
+    if ( mCol & XBIN_COLBIT(XBIN_DERIVED_COL + i) ) mCol |= pTab->apDerived[i]->mCol;
+  }
+  return mCol;
+}
+
+/*
+** Remove the range predicates on the columns of mCol, which the rows
+** listed from an index all pass.  A column left with no predicate is
+** no longer read, unless the statement asks for it.
+*/
+static void xbinPredDrop(XbinCursor *pCur, sqlite3_uint64 mCol) {
+  sqlite3_uint64 mKeep = 0;
+  int n = 0;
+  int i;
+  for (i = 0; i < pCur->nPred; i++) {
+    XbinPred *p = &pCur->aPred[i];
+    if ( (mCol & XBIN_COLBIT(p->iCol)) && p->eType == XBIN_PRED_RANGE ) continue;
+    mKeep |= XBIN_COLBIT(p->iCol) | (p->pExpr ? p->pExpr->mCol : 0);
+    pCur->aPred[n++] = *p;
+  }
+  pCur->nPred = n;
+  pCur->mUsed &= ~(mCol & ~mKeep);
+  pCur->mUsed = xbinDerivedInputs((XbinTable*)pCur->base.pVtab, pCur->mUsed);
+}
+
+/*
+** Most rows an index may list: beyond that, fetching them one window
+** at a time costs more than scanning the rows between iFirst and iLast.
+** Rows that need not be read at all cost next to nothing.
+*/
+static sqlite3_int64 xbinListMax(const XbinCursor *pCur, sqlite3_uint64 mCol) {
+  sqlite3_int64 nScan = pCur->iLast - pCur->iFirst + 1;
+  int i;
+  if ( (pCur->mUsed & XBIN_DATA_COLS & ~mCol) == 0 ) {
+    for (i = 0; i < pCur->nPred; i++) {
+      const XbinPred *p = &pCur->aPred[i];
+      if ( !(mCol & XBIN_COLBIT(p->iCol)) || p->eType != XBIN_PRED_RANGE ) break;
+    }
+    if ( i == pCur->nPred ) return nScan;
+  }
+  return nScan / XBIN_INDEX_COST;
+}
+
+/*
+** Try to list the rows to visit from the index on column iCol, which
+** the plan chose for the range predicates on that column.  The list
+** is only made if few enough rows match for the lookups to beat a scan
+** of the rows between iFirst and iLast; otherwise, or if the index has
+** gone, pCur->aRowid is left at 0 and the rows are scanned.
+*/
+static int xbinIndexScan(XbinCursor *pCur, int iCol) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  XbinPred range;
+  int rc;
+
+  if ( !xbinPredRange(pCur, iCol, &range) ) return SQLITE_OK;
+  rc = xbinIndexRefresh(pTab, iCol, 0);
+  if ( rc == SQLITE_NOMEM ) return rc;
+  if ( rc != SQLITE_OK ) return SQLITE_OK;
+  pCur->nRowid = xbinIndexLookup(pTab, &range, pCur->iFirst, pCur->iLast,
+                                 xbinListMax(pCur, XBIN_COLBIT(iCol)), &pCur->aRowid);
+  if ( pCur->nRowid < 0 ) {
+    pCur->nRowid = 0;
+    return SQLITE_OK;
+  }
+  xbinPredDrop(pCur, XBIN_COLBIT(iCol));
+  return SQLITE_OK;
+}
+
+/*
+** Narrow the rows to visit to those where the columns of mCol are in
+** the range predicates on them, found from their learned indexes, and
+** drop those predicates, which all the rows then pass.  A column whose
+** index has gone keeps its predicates.
+*/
+static int xbinLearnedScan(XbinCursor *pCur, sqlite3_uint64 mCol) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  XbinPred range;
+  int iCol;
+  for (iCol = 1; iCol <= XBIN_NCOL; iCol++) {
+    int rc;
+    if ( (mCol & XBIN_COLBIT(iCol)) == 0 || !xbinPredRange(pCur, iCol, &range) ) continue;
+    rc = xbinPlaNarrow(pTab, pCur->fptr, &range, &pCur->iFirst, &pCur->iLast);
+    if ( rc == SQLITE_NOMEM ) return rc;
+    if ( rc == SQLITE_OK ) xbinPredDrop(pCur, XBIN_COLBIT(iCol));
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Try to list the rows to visit from the bitmap indexes on the columns
+** of mCol, as xbinIndexScan() does for a sorted index.
+*/
+static int xbinBitmapScan(XbinCursor *pCur, sqlite3_uint64 mCol) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  XbinPred aRange[XBIN_NCOL];
+  XbinBitmap *apBm[XBIN_NCOL];
+  sqlite3_uint64 *aBits = 0;
+  sqlite3_uint64 *aCol = 0;
+  sqlite3_int64 *aRow = 0;
+  sqlite3_int64 nRow = 0;
+  sqlite3_int64 nAlloc = 0;
+  sqlite3_int64 nMax;
+  unsigned int iKey, iLastKey;
+  int nCol = 0;
+  int rc = SQLITE_OK;
+  int i, j;
+
+  for (i = 1; i <= XBIN_NCOL; i++) {
+    if ( (mCol & XBIN_COLBIT(i)) == 0 ) continue;
+    if ( !xbinPredRange(pCur, i, &aRange[nCol]) ) continue;
+    rc = xbinBmRefresh(pTab, i, 0);
+    if ( rc == SQLITE_NOMEM ) return rc;
+    if ( rc != SQLITE_OK ) {
+      mCol &= ~XBIN_COLBIT(i);
+      rc = SQLITE_OK;
+      continue;
+    }
+    apBm[nCol++] = pTab->apBm[i-1];
+  }
+  if ( nCol == 0 ) return SQLITE_OK;
+  nMax = xbinListMax(pCur, mCol);
+
+  aBits = sqlite3_malloc( XBIN_BM_WORDS * sizeof(sqlite3_uint64) );
+  aCol = sqlite3_malloc( XBIN_BM_WORDS * sizeof(sqlite3_uint64) );
+  if ( aBits == 0 || aCol == 0 ) rc = SQLITE_NOMEM;
+  iKey = (unsigned int)((pCur->iFirst - 1) / XBIN_BM_CHUNK);
+  iLastKey = (unsigned int)((pCur->iLast - 1) / XBIN_BM_CHUNK);
+  for (; rc == SQLITE_OK && iKey <= iLastKey; iKey++) {
+    sqlite3_int64 iBase = (sqlite3_int64)iKey * XBIN_BM_CHUNK + 1;
+    int bAny = xbinBmChunkOr(apBm[0], &aRange[0], iKey, aBits);
+    for (i = 1; i < nCol && bAny; i++) {
+      if ( !xbinBmChunkOr(apBm[i], &aRange[i], iKey, aCol) ) {
+        bAny = 0;
+        break;
+      }
+      for (j = 0; j < XBIN_BM_WORDS; j++) aBits[j] &= aCol[j];
+    }
+    if ( !bAny ) continue;
+    for (j = 0; j < XBIN_BM_WORDS; j++) {
+      sqlite3_uint64 w = aBits[j];
+      while ( w ) {
+        sqlite3_int64 iRow = iBase + j * 64 + xbinCtz64(w);
+        w &= w - 1;
+        if ( iRow < pCur->iFirst || iRow > pCur->iLast ) continue;
+        if ( nRow >= nMax ) {
+          rc = SQLITE_DONE;
+          break;
+        }
+        if ( nRow == nAlloc ) {
+          sqlite3_int64 *aNew;
+          nAlloc = nAlloc ? nAlloc * 2 : 1024;
+          aNew = sqlite3_realloc64(aRow, nAlloc * sizeof(sqlite3_int64));
+          if ( aNew == 0 ) {
+            rc = SQLITE_NOMEM;
+            break;
+          }
+          aRow = aNew;
+        }
+        aRow[nRow++] = iRow;
+      }
+      if ( rc != SQLITE_OK ) break;
+    }
+  }
+  sqlite3_free(aBits);
+  sqlite3_free(aCol);
+  if ( rc == SQLITE_OK && aRow == 0 ) {
+    aRow = sqlite3_malloc( sizeof(sqlite3_int64) );
+    if ( aRow == 0 ) rc = SQLITE_NOMEM;
+  }
+  if ( rc != SQLITE_OK ) {
+    /* SQLITE_DONE: too many rows, scan them instead */
+    sqlite3_free(aRow);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+  }
+  pCur->aRowid = aRow;
+  pCur->nRowid = nRow;
+  xbinPredDrop(pCur, mCol);
+  return SQLITE_OK;
+}
+
+/* True if value number t of axis p passes the range predicate pRange */
+static int xbinGridPass(const XbinAxis *p, sqlite3_int64 t, const XbinPred *pRange) {
+  double v = xbinGridValue(p, t);
+  return (pRange->bLoOpen ? v > pRange->rLo : v >= pRange->rLo)
+      && (pRange->bHiOpen ? v < pRange->rHi : v <= pRange->rHi);
+}
+
+/*
+** Set *piLo and *piHi to the first and last value number of axis p
+** that passes the range predicate pRange (*piLo > *piHi if none does).
+** The values are monotone in their number, so those passing are
+** contiguous.  They are rounded to float, so the numbers estimated in
+** double are widened by the rounding error, then narrowed down on the
+** actual values.
+*/
+static void xbinGridSpan(const XbinAxis *p, const XbinPred *pRange,
+                         sqlite3_int64 *piLo, sqlite3_int64 *piHi) {
+  double rSlop = (fabs(p->r0) + fabs(p->rStep) * (double)p->n) * FLT_EPSILON / fabs(p->rStep) + 1.0;
+  double a = (pRange->rLo - p->r0) / p->rStep;
+  double b = (pRange->rHi - p->r0) / p->rStep;
+  double lo = (a < b ? a : b) - rSlop;
+  double hi = (a < b ? b : a) + rSlop;
+  sqlite3_int64 iLo, iHi;
+
+  if ( !(lo > 0.0) ) lo = 0.0;
+  if ( !(hi < (double)(p->n - 1)) ) hi = (double)(p->n - 1);
+  iLo = (sqlite3_int64)floor(lo);
+  iHi = (sqlite3_int64)ceil(hi);
+  while ( iLo <= iHi && !xbinGridPass(p, iLo, pRange) ) iLo++;
+  while ( iHi >= iLo && !xbinGridPass(p, iHi, pRange) ) iHi--;
+  *piLo = iLo;
+  *piHi = iHi;
+}
+
+/*
+** Try to list the rows to visit from the grid the records form, for
+** the plan that constrains each of its axes.  The rowid of a point is
+** computed from its value numbers, in each pass over the grid, so the
+** list costs nothing to make; it is only used if few enough rows match
+** for the lookups to beat a scan, as for xbinIndexScan().
+*/
+static int xbinGridScan(XbinCursor *pCur) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  const XbinGrid *g = &pTab->grid;
+  sqlite3_int64 aLo[XBIN_NCOL], aHi[XBIN_NCOL], aT[XBIN_NCOL];
+  sqlite3_uint64 mAxis = 0;
+  sqlite3_int64 nCell = 1;
+  sqlite3_int64 nPeriod, iPeriod, iLastPeriod;
+  sqlite3_int64 *aRow;
+  sqlite3_int64 nRow = 0;
+  int k;
+
+  if ( g->nAxis == 0 ) return SQLITE_OK;
+  for (k = 0; k < g->nAxis; k++) {
+    XbinPred range;
+    xbinPredRange(pCur, g->aAxis[k].iCol, &range);
+    xbinGridSpan(&g->aAxis[k], &range, &aLo[k], &aHi[k]);
+    nCell *= (aLo[k] <= aHi[k]) ? aHi[k] - aLo[k] + 1 : 0;
+    mAxis |= XBIN_COLBIT(g->aAxis[k].iCol);
+  }
+  nPeriod = g->nPeriod ? g->nPeriod : g->aAxis[0].n * g->aAxis[0].nStride;
+  iPeriod = (pCur->iFirst - 1) / nPeriod;
+  iLastPeriod = (pCur->iLast - 1) / nPeriod;
+  if ( nCell * (iLastPeriod - iPeriod + 1) > xbinListMax(pCur, mAxis) ) return SQLITE_OK;
+
+  aRow = sqlite3_malloc64( (nCell * (iLastPeriod - iPeriod + 1) + 1) * sizeof(sqlite3_int64) );
+  if ( aRow == 0 ) return SQLITE_NOMEM;
+  for (; nCell > 0 && iPeriod <= iLastPeriod; iPeriod++) {
+    memcpy(aT, aLo, g->nAxis * sizeof(sqlite3_int64));
+    for (;;) {
+      sqlite3_int64 iRow = 1 + iPeriod * nPeriod;
+      for (k = 0; k < g->nAxis; k++) iRow += aT[k] * g->aAxis[k].nStride;
+      if ( iRow >= pCur->iFirst && iRow <= pCur->iLast ) aRow[nRow++] = iRow;
+      for (k = g->nAxis - 1; k >= 0 && aT[k] == aHi[k]; k--) aT[k] = aLo[k];
+      if ( k < 0 ) break;
+      aT[k]++;
+    }
+  }
+  pCur->aRowid = aRow;
+  pCur->nRowid = nRow;
+  xbinPredDrop(pCur, mAxis);
+  return SQLITE_OK;
+}
+
+/*
+** Compile the condition given to the filter column into predicate p,
+** and make room in the cursor to evaluate it a block at a time.  A NULL
+** condition passes no row.
+*/
+static int xbinFilterPred(XbinCursor *pCur, const XbinCons *pCons, XbinPred *p) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  const char *z = (const char*)sqlite3_value_text(pCons->pVal);
+  char *zErr = 0;
+
+  memset(p, 0, sizeof(*p));
+  p->iCol = XBIN_FILTER_COL;
+  p->eType = XBIN_PRED_FALSE;
+  if ( sqlite3_value_type(pCons->pVal) == SQLITE_NULL ) return SQLITE_OK;
+  if ( z == 0 ) return SQLITE_NOMEM;
+  p->pExpr = xbinExprCompile(pTab, z, &zErr);
+  if ( p->pExpr == 0 ) {
+    sqlite3_free(pTab->base.zErrMsg);
+    pTab->base.zErrMsg = sqlite3_mprintf("xbin: %s in filter '%s'", zErr, z);
+    sqlite3_free(zErr);
+    return SQLITE_ERROR;
+  }
+  p->eType = XBIN_PRED_EXPR;
+  pCur->mUsed |= p->pExpr->mCol;
+  if ( pCur->zFilter == 0 ) pCur->zFilter = sqlite3_mprintf("%s", z);
+  if ( pCur->aFilter == 0 ) pCur->aFilter = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(double) );
+  if ( pCur->zFilter == 0 || pCur->aFilter == 0 ) return SQLITE_NOMEM;
+  if ( p->pExpr->nReg > pCur->nReg ) {
+    double *aReg = sqlite3_realloc64(pCur->aReg,
+                                     (sqlite3_uint64)p->pExpr->nReg * XBIN_BLOCK_ROWS * sizeof(double));
+    if ( aReg == 0 ) return SQLITE_NOMEM;
+    pCur->aReg = aReg;
+    pCur->nReg = p->pExpr->nReg;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** This method is called to "rewind" the XbinCursor object back
+** to the first row of output.  This method is always called at least
+** once prior to any call to xbinColumn() or xbinRowid() or
+** xbinEof().
+*/
+static int xbinFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinCursor *pCur = (XbinCursor *)pVtabCursor;
+  XbinTable *pTab = (XbinTable *)pVtabCursor->pVtab;
+  XbinCons *aCons = 0;
+  XbinKeyRange range;
+  int nCons;
+  int iIdxCol = 0;
+  sqlite3_uint64 mBitmap = 0;
+  sqlite3_uint64 mLearned = 0;
+  int bGrid = 0;
+  int bKey = 0;
+  int bEmpty = 0;
+  int rc = SQLITE_OK;
+  int i;
+
+  if ( pTab->bUnion ) return xbinUnionFilter(pVtabCursor, idxNum, idxStr, argc, argv);
+  xbinParStop(pCur);
+  pCur->bPar = 0;
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  if ( idxStr && (strchr(idxStr, 'k') || strchr(idxStr, 'g') || strchr(idxStr, 'm')) ) {
+    /* Bring the metadata up to date for a plan made on the sort key
+    ** or grid, which needs it to succeed, and for the plans to come of
+    ** a statement the planner had no metadata for ('m') */
+    rc = xbinMetaRefresh(pTab);
+    if ( rc != SQLITE_OK ) {
+      if ( strchr(idxStr, 'k') || strchr(idxStr, 'g') ) return rc;
+      rc = SQLITE_OK;
+    }
+  }
+  for (nCons = 0, i = 0; idxStr && idxStr[i]; i++) nCons += (idxStr[i] == ',');
+  if ( nCons > 0 ) {
+    aCons = sqlite3_malloc( nCons * sizeof(XbinCons) );
+    if ( aCons == 0 ) return SQLITE_NOMEM;
+  }
+  nCons = xbinDecodePlan(pTab, idxStr, argc, argv, aCons, &pCur->mUsed);
+  if ( nCons < 0 ) {
+    sqlite3_free(aCons);
+    return -nCons;
+  }
+  pCur->mUsed = xbinDerivedInputs(pTab, pCur->mUsed);
+
+  pCur->iFirst = 1;
+  pCur->iLast = pTab->nRow;
+  pCur->bDesc = (idxNum & XBIN_IDX_DESC) != 0;
+  pCur->rSample = 1.0;
+  pCur->bSample = 0;
+  pCur->bSeed = 0;
+  pCur->nSel = -1;
+  xbinPredReset(pCur);
+  sqlite3_free(pCur->aRowid);
+  pCur->aRowid = 0;
+  memset(&range, 0, sizeof(range));
+
+  for (i = 0; i < nCons && rc == SQLITE_OK; i++) {
+    XbinCons *p = &aCons[i];
+    sqlite3_int64 iRow;
+    double r = 0.0;
+    int eArg;
+    int iLvl;
+
+    if ( p->eKind == 'i' ) {
+      iIdxCol = p->iCol;
+      continue;
+    }
+    if ( p->eKind == 'b' ) {
+      mBitmap |= XBIN_COLBIT(p->iCol);
+      continue;
+    }
+    if ( p->eKind == 'g' ) {
+      bGrid = 1;
+      continue;
+    }
+    if ( p->eKind == 'l' ) {
+      mLearned |= XBIN_COLBIT(p->iCol);
+      continue;
+    }
+    if ( p->eKind == 'f' ) {
+      if ( xbinRealArg(p->pVal, &pCur->rSample) != 1 || !(pCur->rSample > 0.0) ) bEmpty = 1;
+      pCur->bSample = 1;
+      continue;
+    }
+    if ( p->eKind == 'r' ) {
+      if ( sqlite3_value_numeric_type(p->pVal) != SQLITE_INTEGER ) bEmpty = 1;
+      pCur->iSeed = (sqlite3_uint64)sqlite3_value_int64(p->pVal);
+      pCur->bSeed = 1;
+      continue;
+    }
+    if ( p->iCol == 0 ) {
+      if ( !xbinRowBound(p->pVal, p->op, &iRow) ) {
+        bEmpty = 1;
+      } else {
+        if ( p->op == SQLITE_INDEX_CONSTRAINT_EQ || p->op == SQLITE_INDEX_CONSTRAINT_GT
+          || p->op == SQLITE_INDEX_CONSTRAINT_GE ) {
+          if ( iRow > pCur->iFirst ) pCur->iFirst = iRow;
+        }
+        if ( p->op == SQLITE_INDEX_CONSTRAINT_EQ || p->op == SQLITE_INDEX_CONSTRAINT_LT
+          || p->op == SQLITE_INDEX_CONSTRAINT_LE ) {
+          if ( iRow < pCur->iLast ) pCur->iLast = iRow;
+        }
+      }
+      continue;
+    }
+
+    if ( p->eKind != 's' ) {
+      /* A predicate evaluated by the cursor */
+      if ( pCur->aPred == 0 ) {
+        pCur->aPred = sqlite3_malloc( nCons * sizeof(XbinPred) );
+        if ( pCur->aPred == 0 ) {
+          rc = SQLITE_NOMEM;
+          break;
+        }
+      }
+      if ( p->eKind == 'x' ) {
+        rc = xbinFilterPred(pCur, p, &pCur->aPred[pCur->nPred]);
+      } else {
+        rc = xbinMakePred(p, &pCur->aPred[pCur->nPred], &pTab->base.zErrMsg);
+      }
+      if ( pCur->aPred[pCur->nPred].eType == XBIN_PRED_FALSE ) bEmpty = 1;
+      pCur->nPred++;
+      continue;
+    }
+
+    /* A constraint on the sort key */
+    for (iLvl = 0; pTab->aKey[iLvl] != p->iCol; iLvl++) {}
+    bKey = 1;
+    eArg = xbinRealArg(p->pVal, &r);
+    switch ( p->op ) {
+      case SQLITE_INDEX_CONSTRAINT_EQ:
+        if ( eArg != 1 ) bEmpty = 1;
+        range.aEq[iLvl] = r;
+        if ( iLvl >= range.nEq ) range.nEq = iLvl + 1;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_GT:
+      case SQLITE_INDEX_CONSTRAINT_GE:
+        if ( eArg != 1 ) { bEmpty = 1; break; }
+        range.bLo = 1;
+        range.rLo = r;
+        range.bLoOpen = (p->op == SQLITE_INDEX_CONSTRAINT_GT);
+        break;
+      default:
+        if ( eArg == 0 ) bEmpty = 1;
+        if ( eArg != 1 ) break;
+        range.bHi = 1;
+        range.rHi = r;
+        range.bHiOpen = (p->op == SQLITE_INDEX_CONSTRAINT_LT);
+        break;
+    }
+  }
+  sqlite3_free(aCons);
+  if ( rc != SQLITE_OK ) return rc;
+  if ( pCur->bSample && !pCur->bSeed ) sqlite3_randomness(sizeof(pCur->iSeed), &pCur->iSeed);
+
+  if ( bEmpty ) {
+    pCur->iFirst = 1;
+    pCur->iLast = 0;
+  } else if ( bKey && pCur->iFirst <= pCur->iLast ) {
+    /* A learned index on the first key column narrows the binary
+    ** searches down to a few rows, or does without them if the
+    ** constraints are all on that column */
+    XbinPred lead;
+    memset(&lead, 0, sizeof(lead));
+    lead.iCol = pTab->aKey[0];
+    lead.eType = XBIN_PRED_RANGE;
+    lead.rLo = range.nEq ? range.aEq[0] : range.bLo ? range.rLo : -HUGE_VAL;
+    lead.rHi = range.nEq ? range.aEq[0] : range.bHi ? range.rHi : HUGE_VAL;
+    lead.bLoOpen = !range.nEq && range.bLoOpen;
+    lead.bHiOpen = !range.nEq && range.bHiOpen;
+    rc = xbinPlaNarrow(pTab, pCur->fptr, &lead, &pCur->iFirst, &pCur->iLast);
+    if ( rc == SQLITE_NOMEM ) return rc;
+    if ( rc != SQLITE_OK || range.nEq + (range.bLo || range.bHi) > 1 ) {
+      xbinKeySearch(pTab, pCur->fptr, &range, &pCur->iFirst, &pCur->iLast);
+    }
+    rc = SQLITE_OK;
+  }
+  if ( mLearned && pCur->nPred > 0 && pCur->iFirst <= pCur->iLast ) {
+    rc = xbinLearnedScan(pCur, mLearned);
+    if ( rc != SQLITE_OK ) return rc;
+  }
+
+  pCur->row = pCur->bDesc ? pCur->iLast : pCur->iFirst;
+  if ( (iIdxCol || mBitmap || bGrid) && pCur->nPred > 0 && pCur->iFirst <= pCur->iLast ) {
+    if ( bGrid ) {
+      rc = xbinGridScan(pCur);
+    } else {
+      rc = mBitmap ? xbinBitmapScan(pCur, mBitmap) : xbinIndexScan(pCur, iIdxCol);
+    }
+    if ( rc != SQLITE_OK ) return rc;
+    if ( pCur->aRowid ) {
+      pCur->iRowid = pCur->bDesc ? pCur->nRowid - 1 : 0;
+      return xbinListMatch(pCur);
+    }
+  }
+  if ( pCur->nPred > 0 && pCur->iFirst < pCur->iLast ) {
+    rc = xbinZoneRefresh(pTab);
+    if ( rc != SQLITE_OK ) return rc;
+  }
+  if ( pTab->nThread > 1 && pCur->rSample >= 1.0
+    && pCur->iLast - pCur->iFirst >= 2 * XBIN_BLOCK_ROWS
+    && (pCur->nPred > 0 || (pCur->mUsed & XBIN_DATA_COLS)) ) {
+    /* Worth reading and filtering the blocks in parallel */
+    rc = xbinParStart(pCur, pTab->nThread, (idxNum & XBIN_IDX_ORDER) != 0);
+    if ( rc != SQLITE_OK ) return rc;
+  }
+  if ( pCur->nPred > 0 || pCur->bPar ) return xbinSeekMatch(pCur);
+  if ( pCur->rSample < 1.0 ) xbinSampleSeek(pCur);
+  return xbin_get_line(pCur);
+}
+
+/*
+** Narrow the rows of a cursor that xbinFilter() has started to those
+** from iFirst to iLast, and move it to the first of them that passes
+** its predicates.  For scans that are not driven by a list of rowids.
+*/
+static int xbinClipRows(XbinCursor *pCur, sqlite3_int64 iFirst, sqlite3_int64 iLast) {
+  if ( iFirst <= pCur->iFirst && iLast >= pCur->iLast ) return SQLITE_OK;
+  xbinParStop(pCur);
+  if ( iFirst > pCur->iFirst ) pCur->iFirst = iFirst;
+  if ( iLast < pCur->iLast ) pCur->iLast = iLast;
+  pCur->row = pCur->bDesc ? pCur->iLast : pCur->iFirst;
+  pCur->nSel = -1;
+  if ( pCur->nPred > 0 || pCur->bPar ) return xbinSeekMatch(pCur);
+  if ( pCur->rSample < 1.0 ) xbinSampleSeek(pCur);
+  return xbin_get_line(pCur);
+}
+
+/*
+** Find a usable constraint on column iCol with operator op1 or op2.
+** Return its index in pIdxInfo->aConstraint[], or -1.
+*/
+static int xbinFindCons(sqlite3_index_info *pIdxInfo, int iCol, int op1, int op2) {
+  int i;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if ( !pCons->usable ) continue;
+    if ( pCons->iColumn != iCol && !(iCol == 0 && pCons->iColumn < 0) ) continue;
+    if ( pCons->op == op1 || pCons->op == op2 ) return i;
+  }
+  return -1;
+}
+
+/*
+** SQLite will invoke this method one or more times while planning a query
+** that uses the virtual table.  This routine needs to create
+** a query plan for each invocation and compute an estimated cost for that
+** plan.
+**
+** Constraints on row, and constraints on the sort key of the file that
+** select a contiguous range of rows (= on a prefix of the key, then a
+** range on the next key column), are handed to xbinFilter().  So are
+** comparisons on the other columns and the near() and in_box()
+** functions, which the cursor evaluates a block at a time after
+** skipping the blocks ruled out by the zone maps.  If one of those
+** columns has an index, looking its range up and fetching the matching
+** rows may be cheaper than the scan; the cost of each is estimated and
+** xbinFilter() checks the actual number of matches.  An ORDER BY is
+** consumed when it follows row or the sort key, in either direction.
+*/
+static int xbinBestIndex(
+  sqlite3_vtab *tab,
+  sqlite3_index_info *pIdxInfo
+) {
+  XbinTable *pTab = (XbinTable*)tab;
+  char *zPlan = 0;
+  int idxNum = 0;
+  int nArg = 0;
+  int nKeyUsed = 0;
+  int bRowEq = 0;
+  int nSearch = 0;
+  int idxCol = 0;
+  int bGrid = 0;
+  double nGridRow = 0.0;
+  sqlite3_uint64 mBitmap = 0;
+  double rBitmap = 1.0;
+  sqlite3_uint64 mRange = 0;
+  sqlite3_uint64 mFixed = 0;
+  sqlite3_uint64 mLearned = 0;
+  double rLearned = 1.0;
+  double aIdxFrac[XBIN_DERIVED_COL + XBIN_MAX_DERIVED];
+  double nRow;
+  double nScan;
+  int bData;
+  int bMeta;
+  int nKey;
+  int i;
+
+  if ( pTab->bUnion ) return xbinUnionBestIndex(pTab, pIdxInfo);
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  nRow = pTab->nRow > 0 ? (double)pTab->nRow : 1.0;
+  nScan = nRow;
+  for (i = 0; i < XBIN_DERIVED_COL + XBIN_MAX_DERIVED; i++) aIdxFrac[i] = 1.0;
+
+  /* The indexes are only looked at when a data column is involved */
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    int iCol = pIdxInfo->aConstraint[i].iColumn;
+    if ( iCol > 0 && iCol <= XBIN_NCOL ) break;
+  }
+  bData = i < pIdxInfo->nConstraint
+    || (pIdxInfo->nOrderBy > 0 && pIdxInfo->aOrderBy[0].iColumn > 0);
+  if ( bData ) {
+    xbinIndexProbe(pTab);
+    xbinMetaLoad(pTab);
+  }
+
+  /* The sort key and grid are only relied on while they cover every
+  ** record.  Planning reads none: without metadata for them all, the
+  ** plan is marked 'm' and xbinFilter() finds the sort key and grid,
+  ** or extends them over appended records, for the plans to come */
+  bMeta = (pTab->nMetaRow == pTab->nRow);
+  nKey = bMeta ? pTab->nKey : 0;
+
+  /* Constraints on row */
+  {
+    static const int aRowOp[][2] = {
+      { SQLITE_INDEX_CONSTRAINT_EQ, SQLITE_INDEX_CONSTRAINT_EQ },
+      { SQLITE_INDEX_CONSTRAINT_GT, SQLITE_INDEX_CONSTRAINT_GE },
+      { SQLITE_INDEX_CONSTRAINT_LT, SQLITE_INDEX_CONSTRAINT_LE },
+    };
+    for (i = 0; i < 3; i++) {
+      int j = xbinFindCons(pIdxInfo, 0, aRowOp[i][0], aRowOp[i][1]);
+      if ( j < 0 ) continue;
+      pIdxInfo->aConstraintUsage[j].argvIndex = ++nArg;
+      pIdxInfo->aConstraintUsage[j].omit = 1;
+      zPlan = sqlite3_mprintf("%zc0:%d,", zPlan, pIdxInfo->aConstraint[j].op);
+      if ( i == 0 ) {
+        bRowEq = 1;
+      } else {
+        nRow /= 4.0;
+        nScan /= 4.0;
+      }
+    }
+  }
+
+  /* sample = F and seed = N are arguments rather than constraints: the
+  ** plan must have them.  F is not known yet, 1% is a fair guess. */
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if ( pCons->iColumn >= XBIN_SAMPLE_COL && pCons->iColumn <= XBIN_FILTER_COL
+      && pCons->op == SQLITE_INDEX_CONSTRAINT_EQ && !pCons->usable ) {
+      sqlite3_free(zPlan);
+      return SQLITE_CONSTRAINT;
+    }
+  }
+  for (i = XBIN_SAMPLE_COL; i <= XBIN_SEED_COL; i++) {
+    int j = xbinFindCons(pIdxInfo, i, SQLITE_INDEX_CONSTRAINT_EQ, SQLITE_INDEX_CONSTRAINT_EQ);
+    if ( j < 0 ) continue;
+    pIdxInfo->aConstraintUsage[j].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[j].omit = 1;
+    zPlan = sqlite3_mprintf("%z%s,", zPlan, i == XBIN_SAMPLE_COL ? "f" : "r");
+    if ( i == XBIN_SAMPLE_COL ) {
+      nRow /= 100.0;
+      nScan /= 100.0;
+    }
+  }
+
+  /* Constraints on every axis of the grid select rows that can be
+  ** computed, which beats searching the sort key for them */
+  if ( bMeta && pTab->grid.nAxis > 0 && !bRowEq ) {
+    const XbinGrid *g = &pTab->grid;
+    nGridRow = g->nPeriod ? nRow / (double)g->nPeriod + 1.0 : 1.0;
+    for (i = 0; i < g->nAxis; i++) {
+      int iCol = g->aAxis[i].iCol;
+      if ( xbinFindCons(pIdxInfo, iCol, SQLITE_INDEX_CONSTRAINT_EQ, SQLITE_INDEX_CONSTRAINT_EQ) >= 0 ) {
+        continue;
+      }
+      if ( xbinFindCons(pIdxInfo, iCol, SQLITE_INDEX_CONSTRAINT_GT, SQLITE_INDEX_CONSTRAINT_GE) >= 0
+        || xbinFindCons(pIdxInfo, iCol, SQLITE_INDEX_CONSTRAINT_LT, SQLITE_INDEX_CONSTRAINT_LE) >= 0 ) {
+        nGridRow *= (double)g->aAxis[i].n / 4.0;
+      } else if ( xbinFindCons(pIdxInfo, iCol, XBIN_OP_NEAR, XBIN_OP_INBOX) >= 0 ) {
+        nGridRow *= (double)g->aAxis[i].n / 16.0;
+      } else {
+        break;
+      }
+    }
+    bGrid = (i == g->nAxis);
+  }
+
+  /* Constraints on the sort key */
+  for (nKeyUsed = 0; nKeyUsed < nKey && !bRowEq && !bGrid; nKeyUsed++) {
+    int iCol = pTab->aKey[nKeyUsed];
+    int j = xbinFindCons(pIdxInfo, iCol, SQLITE_INDEX_CONSTRAINT_EQ, SQLITE_INDEX_CONSTRAINT_EQ);
+    int jLo, jHi;
+    if ( j >= 0 ) {
+      pIdxInfo->aConstraintUsage[j].argvIndex = ++nArg;
+      pIdxInfo->aConstraintUsage[j].omit = 1;
+      zPlan = sqlite3_mprintf("%zs%d:%d,", zPlan, iCol, SQLITE_INDEX_CONSTRAINT_EQ);
+      mFixed |= XBIN_COLBIT(iCol);
+      nRow /= 10.0;
+      nScan /= 10.0;
+      nSearch++;
+      continue;
+    }
+    jLo = xbinFindCons(pIdxInfo, iCol, SQLITE_INDEX_CONSTRAINT_GT, SQLITE_INDEX_CONSTRAINT_GE);
+    jHi = xbinFindCons(pIdxInfo, iCol, SQLITE_INDEX_CONSTRAINT_LT, SQLITE_INDEX_CONSTRAINT_LE);
+    if ( jLo >= 0 ) {
+      pIdxInfo->aConstraintUsage[jLo].argvIndex = ++nArg;
+      pIdxInfo->aConstraintUsage[jLo].omit = 1;
+      zPlan = sqlite3_mprintf("%zs%d:%d,", zPlan, iCol, pIdxInfo->aConstraint[jLo].op);
+      nRow /= 4.0;
+      nScan /= 4.0;
+    }
+    if ( jHi >= 0 ) {
+      pIdxInfo->aConstraintUsage[jHi].argvIndex = ++nArg;
+      pIdxInfo->aConstraintUsage[jHi].omit = 1;
+      zPlan = sqlite3_mprintf("%zs%d:%d,", zPlan, iCol, pIdxInfo->aConstraint[jHi].op);
+      nRow /= 4.0;
+      nScan /= 4.0;
+    }
+    if ( jLo >= 0 || jHi >= 0 ) {
+      nKeyUsed++;
+      nSearch++;
+    }
+    break;
+  }
+
+  /* Every other constraint on a data or derived column is evaluated by
+  ** the cursor */
+  for (i = 0; i < pIdxInfo->nConstraint && !bRowEq; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if ( !pCons->usable || pCons->iColumn <= 0 ) continue;
+    if ( pCons->iColumn > XBIN_NCOL && pCons->iColumn < XBIN_DERIVED_COL ) continue;
+    if ( pCons->iColumn >= pTab->iZipCol ) continue;
+    if ( pIdxInfo->aConstraintUsage[i].argvIndex > 0 ) continue;
+    if ( (pTab->mLearned & XBIN_COLBIT(pCons->iColumn))
+      && (pCons->op == SQLITE_INDEX_CONSTRAINT_EQ || pCons->op == SQLITE_INDEX_CONSTRAINT_GT
+          || pCons->op == SQLITE_INDEX_CONSTRAINT_GE || pCons->op == SQLITE_INDEX_CONSTRAINT_LT
+          || pCons->op == SQLITE_INDEX_CONSTRAINT_LE || pCons->op == XBIN_OP_NEAR
+          || pCons->op == XBIN_OP_INBOX) ) {
+      /* The rows in range are found from the learned index, like those
+      ** of a sort key range, and all of them match */
+      rLearned /= pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ? 10.0
+                : pCons->op >= XBIN_OP_NEAR ? 16.0 : 4.0;
+      nRow /= pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ? 10.0 : 3.0;
+      mLearned |= XBIN_COLBIT(pCons->iColumn);
+      pIdxInfo->aConstraintUsage[i].argvIndex = ++nArg;
+      pIdxInfo->aConstraintUsage[i].omit = 1;
+      zPlan = sqlite3_mprintf("%zc%d:%d,", zPlan, pCons->iColumn, pCons->op);
+      continue;
+    }
+    switch ( pCons->op ) {
+      case SQLITE_INDEX_CONSTRAINT_EQ:
+        nRow /= 10.0;
+        if ( (pTab->mIndex | pTab->mBitmap) & XBIN_COLBIT(pCons->iColumn) ) {
+          sqlite3_int64 nDistinct = (pTab->mIndex & XBIN_COLBIT(pCons->iColumn))
+              ? pTab->aIdx[pCons->iColumn - 1].nDistinct
+              : pTab->aBmValue[pCons->iColumn - 1];
+          aIdxFrac[pCons->iColumn] /= nDistinct > 0 ? (double)nDistinct : 10.0;
+        }
+        break;
+      case SQLITE_INDEX_CONSTRAINT_GT:
+      case SQLITE_INDEX_CONSTRAINT_GE:
+      case SQLITE_INDEX_CONSTRAINT_LT:
+      case SQLITE_INDEX_CONSTRAINT_LE:
+        nRow /= 3.0;
+        aIdxFrac[pCons->iColumn] /= 4.0;
+        break;
+      case XBIN_OP_NEAR:
+      case XBIN_OP_INBOX:
+        nRow /= 3.0;
+        aIdxFrac[pCons->iColumn] /= 16.0;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_NE:
+      case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
+        break;
+      case SQLITE_INDEX_CONSTRAINT_ISNULL:
+        nRow /= 100.0;
+        zPlan = sqlite3_mprintf("%zz%d:%d,", zPlan, pCons->iColumn, pCons->op);
+        pIdxInfo->aConstraintUsage[i].omit = 1;
+        continue;
+      default:
+        continue;
+    }
+    if ( pCons->op != SQLITE_INDEX_CONSTRAINT_NE && pCons->op != SQLITE_INDEX_CONSTRAINT_ISNOTNULL ) {
+      mRange |= XBIN_COLBIT(pCons->iColumn);
+    }
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_ISNOTNULL ) {
+      zPlan = sqlite3_mprintf("%zz%d:%d,", zPlan, pCons->iColumn, pCons->op);
+    } else {
+      pIdxInfo->aConstraintUsage[i].argvIndex = ++nArg;
+      zPlan = sqlite3_mprintf("%zc%d:%d,", zPlan, pCons->iColumn, pCons->op);
+    }
+    pIdxInfo->aConstraintUsage[i].omit = 1;
+  }
+
+  /* Conditions given to the filter column, evaluated last */
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if ( !pCons->usable || pCons->iColumn != XBIN_FILTER_COL
+      || pCons->op != SQLITE_INDEX_CONSTRAINT_EQ ) {
+      continue;
+    }
+    pIdxInfo->aConstraintUsage[i].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[i].omit = 1;
+    zPlan = sqlite3_mprintf("%zx,", zPlan);
+    nRow /= 3.0;
+  }
+
+  /* Rows found from learned indexes are all that is left to scan */
+  if ( mLearned ) {
+    nScan *= rLearned;
+    for (i = 1; i <= XBIN_NCOL; i++) {
+      if ( mLearned & XBIN_COLBIT(i) ) {
+        zPlan = sqlite3_mprintf("%zl%d,", zPlan, i);
+        nSearch++;
+      }
+    }
+  }
+
+  /* Rows computed from the grid against a scan of nScan rows */
+  if ( bGrid ) {
+    double nCost = 1.0 + nGridRow * XBIN_INDEX_COST;
+    if ( nCost < nScan ) {
+      nScan = nCost;
+      if ( nGridRow < nRow ) nRow = nGridRow;
+    } else {
+      bGrid = 0;
+    }
+  }
+
+  /* Lookups in an index against a scan of nScan rows */
+  for (i = 1; i <= XBIN_NCOL && !bRowEq; i++) {
+    const XbinIdxHdr *pHdr = &pTab->aIdx[i - 1];
+    double nCost;
+    double n;
+    if ( (pTab->mIndex & XBIN_COLBIT(i)) == 0 || aIdxFrac[i] >= 1.0 ) continue;
+    nCost = 2.0 + (double)pHdr->nEntry * aIdxFrac[i] * XBIN_INDEX_COST;
+    for (n = (double)pHdr->nEntry; n > 1.0; n /= 2.0) nCost += 2.0;
+    if ( nCost < nScan ) {
+      nScan = nCost;
+      idxCol = i;
+      bGrid = 0;
+    }
+  }
+
+  /* Or the AND of the bitmap indexes of the constrained columns: a
+  ** pass over the chunks, then the matching rows, which are not even
+  ** read if the bitmaps answer all the statement needs */
+  for (i = 1; i <= XBIN_NCOL && !bRowEq; i++) {
+    if ( (pTab->mBitmap & mRange & XBIN_COLBIT(i)) ) {
+      mBitmap |= XBIN_COLBIT(i);
+      rBitmap *= aIdxFrac[i];
+    }
+  }
+  if ( mBitmap ) {
+    double nChunk = (double)(pTab->nRow / XBIN_BM_CHUNK + 1);
+    double nCost = 2.0;
+    int bFetch = (xbinDerivedInputs(pTab, pIdxInfo->colUsed) & XBIN_DATA_COLS & ~mBitmap) != 0;
+    for (i = 1; i <= XBIN_NCOL; i++) {
+      if ( mBitmap & XBIN_COLBIT(i) ) nCost += nChunk * 32.0;
+    }
+    nCost += (double)pTab->nRow * rBitmap * (bFetch ? XBIN_INDEX_COST : 1.0 / 16.0);
+    if ( nCost < nScan ) {
+      nScan = nCost;
+      idxCol = 0;
+      bGrid = 0;
+      for (i = 1; i <= XBIN_NCOL; i++) {
+        if ( mBitmap & XBIN_COLBIT(i) ) zPlan = sqlite3_mprintf("%zb%d,", zPlan, i);
+      }
+    }
+  }
+  if ( idxCol ) zPlan = sqlite3_mprintf("%zi%d,", zPlan, idxCol);
+  if ( bGrid ) zPlan = sqlite3_mprintf("%zg,", zPlan);
+  if ( bData && !bMeta && pTab->nRow > 0 ) zPlan = sqlite3_mprintf("%zm,", zPlan);
+
+  /* ORDER BY: row is unique, so the terms after it do not matter */
+  if ( pIdxInfo->nOrderBy > 0 ) {
+    int bDesc = pIdxInfo->aOrderBy[0].desc;
+    int iLvl = 0;
+    int bMatch = 1;
+    for (i = 0; i < pIdxInfo->nOrderBy && bMatch && !bRowEq; i++) {
+      int iCol = pIdxInfo->aOrderBy[i].iColumn;
+      if ( iCol <= 0 ) {
+        bMatch = (pIdxInfo->aOrderBy[i].desc == bDesc);
+        break;
+      }
+      if ( mFixed & XBIN_COLBIT(iCol) ) continue;
+      while ( iLvl < nKey && (mFixed & XBIN_COLBIT(pTab->aKey[iLvl])) ) iLvl++;
+      if ( iLvl < nKey && pTab->aKey[iLvl] == iCol
+        && pIdxInfo->aOrderBy[i].desc == bDesc ) {
+        iLvl++;
+      } else {
+        bMatch = 0;
+      }
+    }
+    if ( bMatch ) {
+      pIdxInfo->orderByConsumed = 1;
+      idxNum |= XBIN_IDX_ORDER;
+      if ( bDesc ) idxNum |= XBIN_IDX_DESC;
+      if ( iLvl > nKeyUsed ) nKeyUsed = iLvl;
+    }
+  }
+
+  /* Record the key levels the plan relies on ahead of the constraints,
+  ** and the columns the statement reads after them */
+  for (i = nKeyUsed - 1; i >= 0; i--) {
+    zPlan = sqlite3_mprintf("k%d,%z", pTab->aKey[i], zPlan);
+  }
+  zPlan = sqlite3_mprintf("%zu%llx,", zPlan, (unsigned long long)pIdxInfo->colUsed);
+  pIdxInfo->idxNum = idxNum;
+  pIdxInfo->idxStr = zPlan;
+  pIdxInfo->needToFreeIdxStr = 1;
+
+  if ( bRowEq ) {
+    pIdxInfo->estimatedRows = 1;
+    pIdxInfo->estimatedCost = 1.0;
+    pIdxInfo->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+    return SQLITE_OK;
+  }
+
+  if ( nRow < 1.0 ) nRow = 1.0;
+  if ( nScan < nRow ) nScan = nRow;
+  pIdxInfo->estimatedRows = (sqlite3_int64)nRow;
+  pIdxInfo->estimatedCost = nScan;
+  if ( nSearch ) {
+    /* Two binary searches of about log2(N) single record reads, or one
+    ** read of a few rows per bound for a learned index */
+    double nProbe = 2.0;
+    double n = (double)pTab->nRow;
+    if ( mLearned || (nKey > 0 && (pTab->mLearned & XBIN_COLBIT(pTab->aKey[0]))) ) {
+      n = 2 * XBIN_PLA_ERROR + 3;
+    }
+    for (; n > 1.0; n /= 2.0) nProbe += 2.0;
+    pIdxInfo->estimatedCost += nProbe;
+  }
+  return SQLITE_OK;
+}
+
+static int xbinUpdate(
+  sqlite3_vtab *vtab,
+  int argc, sqlite3_value **argv,
+  sqlite_int64 *rowid
+) {
+  XbinTable* pTab = (XbinTable*) vtab;
+  if ( pTab->bUnion ) {
+    sqlite3_free(pTab->base.zErrMsg);
+    pTab->base.zErrMsg = sqlite3_mprintf("xbin: %s is a glob= union, which is read-only",
+                                         pTab->zName);
+    return SQLITE_READONLY;
+  }
+  if ( pTab->nZip > 0 && argc > 1 ) {
+    /* Appending to the main file alone would put the zipped files out
+    ** of step with it */
+    sqlite3_free(pTab->base.zErrMsg);
+    pTab->base.zErrMsg = sqlite3_mprintf("xbin: %s has zip= files, insert into a table on "
+                                         "each file instead", pTab->zName);
+    return SQLITE_READONLY;
+  }
+  if (argc == 1) {
+    // argc = 1
+    // argv[0] ≠ NULL
+    // DELETE: The single row with rowid or PRIMARY KEY equal to argv[0] is deleted. No insert occurs.
+    sqlite3_free(pTab->base.zErrMsg);
+    pTab->base.zErrMsg = sqlite3_mprintf("Delete Error: delete is disabled by default.");
+    return SQLITE_ERROR;
+  } else if ((argc > 1) && (sqlite3_value_type(argv[0]) == SQLITE_NULL)) {
+    // argc > 1
+    // argv[0] = NULL
+    // INSERT: A new row is inserted with column values taken from argv[2] and following.
+    // In a rowid virtual table, if argv[1] is an SQL NULL, then a new unique rowid is generated automatically.
+    xbin_fseek(pTab->fptr, 0, SEEK_END);
+
+    xbinData data;
+    data.id = sqlite3_value_double(argv[3]);
+    data.iq = sqlite3_value_double(argv[4]);
+    data.speed = sqlite3_value_double(argv[5]);
+    data.torque = sqlite3_value_double(argv[6]);
+    data.Ld = sqlite3_value_double(argv[7]);
+    data.Lq = sqlite3_value_double(argv[8]);
+    data.Lambda = sqlite3_value_double(argv[9]);
+    data.Rs = sqlite3_value_double(argv[10]);
+    data.Temp = sqlite3_value_double(argv[11]);
+
+    fwrite(&data, sizeof(xbinData), 1, pTab->fptr);
+    fflush(pTab->fptr);
+    pTab->nRow++;
+    *rowid = pTab->nRow;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Union tables.
+**
+** "create virtual table runs using xbin(glob='/data/runs/run*.bin')" is
+** one read-only table over every file matching the pattern when it is
+** connected, in order of name.  Record N of file number I (from 0) has
+** rowid (I << XBIN_FILE_SHIFT) + N, so rowids grow with the files and a
+** file holds less than 2^32 records, and the hidden column file is the
+** name of the file.  A cursor reads the files one after the other, each
+** through an ordinary cursor on a table over that one file, which is
+** made the first time the file is visited and kept in a pool of at most
+** XBIN_UNION_POOL idle files.  Constraints on file and on row rule
+** files out before they are opened, and so do the zone maps of the
+** files that have been read by a cursor with predicates, summed up in
+** one XbinZone per file.
+*/
+typedef struct XbinUnionCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  XbinCursor *pInner;         /* Cursor on file iFile, 0 at EOF */
+  int iFile;                  /* File being read */
+  int iFileLo, iFileHi;       /* Files the rowid bounds leave */
+  int bDesc;                  /* True to read the files backward */
+  int bOrder;                 /* True if the rows must come in order */
+  sqlite3_int64 iFirst;       /* Smallest rowid the scan may visit */
+  sqlite3_int64 iLast;        /* Largest rowid the scan may visit */
+  char *zPlan;                /* idxStr of the cursors on the files */
+  sqlite3_value **apArg;      /* argv[] of the cursors on the files */
+  int nArg;                   /* Number of entries in apArg[] */
+  XbinPred *aPred;            /* Predicates that may rule a file out */
+  int nPred;                  /* Number of entries in aPred[] */
+  XbinCons *aName;            /* Constraints on the file column */
+  int nName;                  /* Number of entries in aName[] */
+} XbinUnionCursor;
+
+/*
+** Make *ppSub the table over file iFile of union pTab, opening the file
+** if it is not open already.  *ppSub is 0 if the file went away since
+** the table was connected.  Each successful call must be matched by a
+** call to xbinUnionRelease().
+*/
+static int xbinUnionAcquire(XbinTable *pTab, int iFile, XbinTable **ppSub) {
+  XbinUnionFile *pF = &pTab->aFile[iFile];
+  XbinTable *pSub = pF->pSub;
+
+  *ppSub = 0;
+  if ( pSub == 0 ) {
+    int *aOpen;
+    if ( pTab->nOpen >= XBIN_UNION_POOL ) {
+      /* Close the file of the pool that was used least recently */
+      int iOld = -1;
+      int i;
+      for (i = 0; i < pTab->nOpen; i++) {
+        const XbinUnionFile *q = &pTab->aFile[pTab->aOpen[i]];
+        if ( q->nRef == 0 && (iOld < 0 || q->iUse < pTab->aFile[pTab->aOpen[iOld]].iUse) ) {
+          iOld = i;
+        }
+      }
+      if ( iOld >= 0 ) {
+        XbinUnionFile *q = &pTab->aFile[pTab->aOpen[iOld]];
+        xbinTableFree(q->pSub);
+        q->pSub = 0;
+        pTab->aOpen[iOld] = pTab->aOpen[--pTab->nOpen];
+      }
+    }
+    aOpen = sqlite3_realloc64(pTab->aOpen, (pTab->nOpen + 1) * sizeof(int));
+    if ( aOpen == 0 ) return SQLITE_NOMEM;
+    pTab->aOpen = aOpen;
+    pSub = sqlite3_malloc( sizeof(*pSub) );
+    if ( pSub == 0 ) return SQLITE_NOMEM;
+    memset(pSub, 0, sizeof(*pSub));
+    pSub->nMetaRow = -1;
+    pSub->nZoneRow = -1;
+    pSub->nStatsRow = -1;
+    pSub->iZipCol = XBIN_DERIVED_COL;
+    pSub->nThread = pTab->nThread;
+    pSub->filename = sqlite3_mprintf("%s", pTab->azFile[iFile]);
+    if ( pSub->filename == 0 ) {
+      sqlite3_free(pSub);
+      return SQLITE_NOMEM;
+    }
+    pSub->fptr = fopen(pSub->filename, "rb");
+    if ( pSub->fptr == 0 ) {
+      xbinTableFree(pSub);
+      return SQLITE_OK;
+    }
+    pF->pSub = pSub;
+    pTab->aOpen[pTab->nOpen++] = iFile;
+  }
+  pF->nRef++;
+  pF->iUse = ++pTab->iUseClock;
+  *ppSub = pSub;
+  return SQLITE_OK;
+}
+
+/* Let file iFile of union pTab be closed again */
+static void xbinUnionRelease(XbinTable *pTab, int iFile) {
+  pTab->aFile[iFile].nRef--;
+}
+
+/*
+** Sum the zone map of pSub, which covers the whole file, up into the
+** summary of file pF.  pSt is the state of the file before the zone
+** map was brought up to date.
+*/
+static void xbinUnionSummary(XbinUnionFile *pF, const XbinTable *pSub, const struct stat *pSt) {
+  sqlite3_int64 nZone = (pSub->nRow + XBIN_BLOCK_ROWS - 1) / XBIN_BLOCK_ROWS;
+  sqlite3_int64 i;
+  int j;
+
+  if ( pSub->nRow == 0 || pSub->nZoneRow != pSub->nRow ) return;
+  pF->sum = pSub->aZone[0];
+  for (i = 1; i < nZone; i++) {
+    const XbinZone *pZone = &pSub->aZone[i];
+    for (j = 0; j < XBIN_NCOL; j++) {
+      if ( pZone->aMin[j] < pF->sum.aMin[j] ) pF->sum.aMin[j] = pZone->aMin[j];
+      if ( pZone->aMax[j] > pF->sum.aMax[j] ) pF->sum.aMax[j] = pZone->aMax[j];
+    }
+    pF->sum.mNan |= pZone->mNan;
+  }
+  pF->nSumSize = (sqlite3_int64)pSt->st_size;
+  pF->iSumTime = (sqlite3_int64)pSt->st_mtime;
+  pF->bSum = 1;
+}
+
+/* Return true if file zFile passes the constraints on the file column */
+static int xbinUnionNameMatch(const XbinUnionCursor *pCur, const char *zFile) {
+  int i;
+  for (i = 0; i < pCur->nName; i++) {
+    const char *z = (const char*)sqlite3_value_text(pCur->aName[i].pVal);
+    switch ( pCur->aName[i].op ) {
+      case SQLITE_INDEX_CONSTRAINT_EQ:
+        if ( sqlite3_value_type(pCur->aName[i].pVal) != SQLITE_TEXT || strcmp(z, zFile) != 0 ) {
+          return 0;
+        }
+        break;
+      case SQLITE_INDEX_CONSTRAINT_GLOB:
+        if ( z == 0 || sqlite3_strglob(z, zFile) != 0 ) return 0;
+        break;
+      default:
+        if ( z == 0 || sqlite3_strlike(z, zFile, 0) != 0 ) return 0;
+        break;
+    }
+  }
+  return 1;
+}
+
+/* Close the cursor on the current file, if any */
+static void xbinUnionStop(XbinUnionCursor *pCur) {
+  if ( pCur->pInner ) {
+    xbinClose(&pCur->pInner->base);
+    xbinUnionRelease((XbinTable*)pCur->base.pVtab, pCur->iFile);
+    pCur->pInner = 0;
+  }
+}
+
+/*
+** Start reading file pCur->iFile, unless the file column, the rowid
+** bounds or the summary of its zone map rule it out, in which case
+** pCur->pInner is left 0.
+*/
+static int xbinUnionStart(XbinUnionCursor *pCur) {
+  XbinTable *pTab = (XbinTable*)pCur->base.pVtab;
+  XbinUnionFile *pF = &pTab->aFile[pCur->iFile];
+  const char *zFile = pTab->azFile[pCur->iFile];
+  sqlite3_int64 iBase = (sqlite3_int64)pCur->iFile << XBIN_FILE_SHIFT;
+  sqlite3_vtab_cursor *pSubCur = 0;
+  XbinTable *pSub;
+  struct stat st;
+  int rc;
+
+  if ( !xbinUnionNameMatch(pCur, zFile) ) return SQLITE_OK;
+  if ( stat(zFile, &st) != 0 ) return SQLITE_OK;
+  if ( pF->bSum && (pF->nSumSize != (sqlite3_int64)st.st_size
+                    || pF->iSumTime != (sqlite3_int64)st.st_mtime) ) {
+    pF->bSum = 0;
+  }
+  if ( pF->bSum && xbinZoneRuleOut(pTab, &pF->sum, -1, pCur->aPred, pCur->nPred) ) {
+    return SQLITE_OK;
+  }
+
+  rc = xbinUnionAcquire(pTab, pCur->iFile, &pSub);
+  if ( rc != SQLITE_OK || pSub == 0 ) return rc;
+  pSub->nRow = xbinRowCount(pSub->fptr);
+  if ( pSub->nRow >= ((sqlite3_int64)1 << XBIN_FILE_SHIFT) ) {
+    xbinUnionRelease(pTab, pCur->iFile);
+    sqlite3_free(pTab->base.zErrMsg);
+    pTab->base.zErrMsg = sqlite3_mprintf("xbin: %s has too many records for a union", zFile);
+    return SQLITE_ERROR;
+  }
+  if ( !pF->bSum && pCur->nPred > 0 ) {
+    /* The cursor would bring the zone map up to date anyway */
+    rc = xbinZoneRefresh(pSub);
+    if ( rc != SQLITE_OK ) {
+      xbinUnionRelease(pTab, pCur->iFile);
+      return rc;
+    }
+    xbinUnionSummary(pF, pSub, &st);
+    if ( pF->bSum && xbinZoneRuleOut(pTab, &pF->sum, -1, pCur->aPred, pCur->nPred) ) {
+      xbinUnionRelease(pTab, pCur->iFile);
+      return SQLITE_OK;
+    }
+  }
+
+  rc = xbinOpen(&pSub->base, &pSubCur);
+  if ( rc != SQLITE_OK ) {
+    xbinUnionRelease(pTab, pCur->iFile);
+    return rc;
+  }
+  pSubCur->pVtab = &pSub->base;
+  pCur->pInner = (XbinCursor*)pSubCur;
+  rc = xbinFilter(pSubCur, (pCur->bDesc ? XBIN_IDX_DESC : 0) | (pCur->bOrder ? XBIN_IDX_ORDER : 0),
+                  pCur->zPlan, pCur->nArg, pCur->apArg);
+  if ( rc == SQLITE_OK ) {
+    rc = xbinClipRows(pCur->pInner,
+                      pCur->iFirst > iBase ? pCur->iFirst - iBase : 1,
+                      pCur->iLast - iBase < XBIN_MAX_ROW ? pCur->iLast - iBase : XBIN_MAX_ROW);
+  }
+  if ( rc != SQLITE_OK && pSub->base.zErrMsg ) {
+    sqlite3_free(pTab->base.zErrMsg);
+    pTab->base.zErrMsg = pSub->base.zErrMsg;
+    pSub->base.zErrMsg = 0;
+  }
+  return rc;
+}
+
+/*
+** Move to the first row of file pCur->iFile or of the files after it
+** (before it for a descending scan), or to EOF.
+*/
+static int xbinUnionSeek(XbinUnionCursor *pCur) {
+  while ( pCur->iFile >= pCur->iFileLo && pCur->iFile <= pCur->iFileHi ) {
+    if ( pCur->pInner == 0 ) {
+      int rc = xbinUnionStart(pCur);
+      if ( rc != SQLITE_OK ) return rc;
+    }
+    if ( pCur->pInner && !xbinEof(&pCur->pInner->base) ) return SQLITE_OK;
+    xbinUnionStop(pCur);
+    pCur->iFile += pCur->bDesc ? -1 : 1;
+  }
+  return SQLITE_OK;
+}
+
+/* Free the plan of the cursor and close the file it reads */
+static void xbinUnionReset(XbinUnionCursor *pCur) {
+  int i;
+  xbinUnionStop(pCur);
+  for (i = 0; i < pCur->nArg; i++) sqlite3_value_free(pCur->apArg[i]);
+  for (i = 0; i < pCur->nPred; i++) sqlite3_free(pCur->aPred[i].pExpr);
+  for (i = 0; i < pCur->nName; i++) sqlite3_value_free(pCur->aName[i].pVal);
+  sqlite3_free(pCur->apArg);
+  sqlite3_free(pCur->aPred);
+  sqlite3_free(pCur->aName);
+  sqlite3_free(pCur->zPlan);
+  pCur->apArg = 0;
+  pCur->aPred = 0;
+  pCur->aName = 0;
+  pCur->zPlan = 0;
+  pCur->nArg = 0;
+  pCur->nPred = 0;
+  pCur->nName = 0;
+}
+
+static int xbinUnionOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinUnionCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  (void)p;
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static int xbinUnionClose(sqlite3_vtab_cursor *cur) {
+  xbinUnionReset((XbinUnionCursor*)cur);
+  sqlite3_free(cur);
+  return SQLITE_OK;
+}
+
+/*
+** Split the plan of xbinUnionBestIndex() into the bounds of the rowids,
+** the constraints on the file column, and the plan handed on to the
+** cursor of each file, with copies of its argv[] values.  The data
+** column and filter constraints are also kept as predicates that rule
+** out whole files.
+*/
+static int xbinUnionFilter(
+  sqlite3_vtab_cursor *cur,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinUnionCursor *pCur = (XbinUnionCursor*)cur;
+  XbinTable *pTab = (XbinTable*)cur->pVtab;
+  XbinCons *aCons = 0;
+  sqlite3_uint64 mUsed;
+  int nCons;
+  int bEmpty = 0;
+  int rc = SQLITE_OK;
+  int i;
+
+  xbinUnionReset(pCur);
+  for (nCons = 0, i = 0; idxStr && idxStr[i]; i++) nCons += (idxStr[i] == ',');
+  if ( nCons > 0 ) {
+    aCons = sqlite3_malloc( nCons * sizeof(XbinCons) );
+    pCur->aPred = sqlite3_malloc( nCons * sizeof(XbinPred) );
+    pCur->aName = sqlite3_malloc( nCons * sizeof(XbinCons) );
+    pCur->apArg = sqlite3_malloc( nCons * sizeof(sqlite3_value*) );
+    if ( aCons == 0 || pCur->aPred == 0 || pCur->aName == 0 || pCur->apArg == 0 ) {
+      sqlite3_free(aCons);
+      return SQLITE_NOMEM;
+    }
+  }
+  nCons = xbinDecodePlan(pTab, idxStr, argc, argv, aCons, &mUsed);
+  if ( nCons < 0 ) {
+    sqlite3_free(aCons);
+    return -nCons;
+  }
+
+  pCur->iFirst = 1;
+  pCur->iLast = XBIN_MAX_ROW;
+  pCur->bDesc = (idxNum & XBIN_IDX_DESC) != 0;
+  pCur->bOrder = (idxNum & XBIN_IDX_ORDER) != 0;
+  pCur->zPlan = sqlite3_mprintf("");
+  for (i = 0; i < nCons && rc == SQLITE_OK && pCur->zPlan; i++) {
+    XbinCons *p = &aCons[i];
+    sqlite3_int64 iRow;
+
+    if ( p->eKind == 'n' ) {
+      if ( sqlite3_value_type(p->pVal) == SQLITE_NULL ) bEmpty = 1;
+      pCur->aName[pCur->nName] = *p;
+      pCur->aName[pCur->nName].pVal = sqlite3_value_dup(p->pVal);
+      if ( pCur->aName[pCur->nName].pVal == 0 ) rc = SQLITE_NOMEM;
+      pCur->nName++;
+      continue;
+    }
+    if ( p->eKind == 'c' && p->iCol == 0 ) {
+      if ( !xbinRowBound(p->pVal, p->op, &iRow) ) {
+        bEmpty = 1;
+      } else {
+        if ( p->op == SQLITE_INDEX_CONSTRAINT_EQ || p->op == SQLITE_INDEX_CONSTRAINT_GT
+          || p->op == SQLITE_INDEX_CONSTRAINT_GE ) {
+          if ( iRow > pCur->iFirst ) pCur->iFirst = iRow;
+        }
+        if ( p->op == SQLITE_INDEX_CONSTRAINT_EQ || p->op == SQLITE_INDEX_CONSTRAINT_LT
+          || p->op == SQLITE_INDEX_CONSTRAINT_LE ) {
+          if ( iRow < pCur->iLast ) pCur->iLast = iRow;
+        }
+      }
+      continue;
+    }
+
+    /* Handed on to the cursor of each file */
+    if ( p->eKind == 'c' || p->eKind == 'z' ) {
+      pCur->zPlan = sqlite3_mprintf("%z%c%d:%d,", pCur->zPlan, p->eKind, p->iCol, p->op);
+    } else {
+      pCur->zPlan = sqlite3_mprintf("%z%c,", pCur->zPlan, p->eKind);
+    }
+    if ( p->pVal ) {
+      pCur->apArg[pCur->nArg] = sqlite3_value_dup(p->pVal);
+      if ( pCur->apArg[pCur->nArg] == 0 ) rc = SQLITE_NOMEM;
+      pCur->nArg++;
+    }
+    if ( p->eKind == 'x' ) {
+      XbinPred *q = &pCur->aPred[pCur->nPred];
+      const char *z = (const char*)sqlite3_value_text(p->pVal);
+      char *zErr = 0;
+      if ( sqlite3_value_type(p->pVal) == SQLITE_NULL ) {
+        bEmpty = 1;
+        continue;
+      }
+      if ( z == 0 ) {
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      memset(q, 0, sizeof(*q));
+      q->iCol = XBIN_FILTER_COL;
+      q->eType = XBIN_PRED_EXPR;
+      q->pExpr = xbinExprCompile(pTab, z, &zErr);
+      if ( q->pExpr == 0 ) {
+        sqlite3_free(pTab->base.zErrMsg);
+        pTab->base.zErrMsg = sqlite3_mprintf("xbin: %s in filter '%s'", zErr, z);
+        sqlite3_free(zErr);
+        rc = SQLITE_ERROR;
+        break;
+      }
+      pCur->nPred++;
+    } else if ( p->eKind == 'c' || p->eKind == 'z' ) {
+      rc = xbinMakePred(p, &pCur->aPred[pCur->nPred], &pTab->base.zErrMsg);
+      if ( pCur->aPred[pCur->nPred].eType == XBIN_PRED_FALSE ) bEmpty = 1;
+      pCur->nPred++;
+    }
+  }
+  sqlite3_free(aCons);
+  if ( pCur->zPlan ) {
+    mUsed &= ~XBIN_COLBIT(XBIN_FILE_COL);
+    pCur->zPlan = sqlite3_mprintf("%zu%llx,", pCur->zPlan, (unsigned long long)mUsed);
+  }
+  if ( rc == SQLITE_OK && pCur->zPlan == 0 ) rc = SQLITE_NOMEM;
+  if ( rc != SQLITE_OK ) return rc;
+
+  /* Files that hold rows between the bounds */
+  pCur->iFileLo = (int)(pCur->iFirst < 1 ? 0 : pCur->iFirst >> XBIN_FILE_SHIFT);
+  pCur->iFileHi = pCur->iLast < 1 ? -1
+                : (pCur->iLast >> XBIN_FILE_SHIFT) < pTab->nFile
+                ? (int)(pCur->iLast >> XBIN_FILE_SHIFT) : pTab->nFile - 1;
+  if ( bEmpty ) pCur->iFileHi = -1;
+  pCur->iFile = pCur->bDesc ? pCur->iFileHi : pCur->iFileLo;
+  return xbinUnionSeek(pCur);
+}
+
+static int xbinUnionNext(sqlite3_vtab_cursor *cur) {
+  XbinUnionCursor *pCur = (XbinUnionCursor*)cur;
+  int rc = xbinNext(&pCur->pInner->base);
+  if ( rc != SQLITE_OK || !xbinEof(&pCur->pInner->base) ) return rc;
+  xbinUnionStop(pCur);
+  pCur->iFile += pCur->bDesc ? -1 : 1;
+  return xbinUnionSeek(pCur);
+}
+
+static int xbinUnionEof(sqlite3_vtab_cursor *cur) {
+  return ((XbinUnionCursor*)cur)->pInner == 0;
+}
+
+static int xbinUnionColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinUnionCursor *pCur = (XbinUnionCursor*)cur;
+  if ( i == 0 ) {
+    sqlite_int64 iRow;
+    xbinUnionRowid(cur, &iRow);
+    sqlite3_result_int64(ctx, iRow);
+    return SQLITE_OK;
+  }
+  if ( i == XBIN_FILE_COL ) {
+    const XbinTable *pTab = (XbinTable*)cur->pVtab;
+    sqlite3_result_text(ctx, pTab->azFile[pCur->iFile], -1, SQLITE_TRANSIENT);
+    return SQLITE_OK;
+  }
+  return xbinColumn(&pCur->pInner->base, ctx, i);
+}
+
+static int xbinUnionRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  XbinUnionCursor *pCur = (XbinUnionCursor*)cur;
+  *pRowid = ((sqlite3_int64)pCur->iFile << XBIN_FILE_SHIFT) + pCur->pInner->row;
+  return SQLITE_OK;
+}
+
+/*
+** Plan a query on a union table.  Constraints on row and on file pick
+** the files to read, and the others are evaluated by the cursor of each
+** file as they would be on a table over it alone.  Row order is file
+** order, so an ORDER BY on row, or on file then row, is consumed.
+*/
+static int xbinUnionBestIndex(XbinTable *pTab, sqlite3_index_info *pIdxInfo) {
+  char *zPlan = 0;
+  int idxNum = 0;
+  int nArg = 0;
+  int bRowEq = 0;
+  double nRow = pTab->nRow > 0 ? (double)pTab->nRow : 1.0;
+  double nFile = pTab->nFile > 0 ? (double)pTab->nFile : 1.0;
+  double nScan;
+  int i;
+
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if ( pCons->iColumn >= XBIN_SAMPLE_COL && pCons->iColumn <= XBIN_FILTER_COL
+      && pCons->op == SQLITE_INDEX_CONSTRAINT_EQ && !pCons->usable ) {
+      return SQLITE_CONSTRAINT;
+    }
+  }
+
+  /* Rows and files first, then the data columns */
+  nScan = nRow;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    int iCol = pCons->iColumn < 0 ? 0 : pCons->iColumn;
+    int op = pCons->op;
+    if ( !pCons->usable ) continue;
+    if ( iCol == 0 ) {
+      if ( op != SQLITE_INDEX_CONSTRAINT_EQ && op != SQLITE_INDEX_CONSTRAINT_GT
+        && op != SQLITE_INDEX_CONSTRAINT_GE && op != SQLITE_INDEX_CONSTRAINT_LT
+        && op != SQLITE_INDEX_CONSTRAINT_LE ) {
+        continue;
+      }
+      pIdxInfo->aConstraintUsage[i].argvIndex = ++nArg;
+      pIdxInfo->aConstraintUsage[i].omit = 1;
+      zPlan = sqlite3_mprintf("%zc0:%d,", zPlan, op);
+      if ( op == SQLITE_INDEX_CONSTRAINT_EQ ) {
+        bRowEq = 1;
+      } else {
+        nRow /= 4.0;
+        nScan /= 4.0;
+      }
+    } else if ( iCol == XBIN_FILE_COL ) {
+      if ( op != SQLITE_INDEX_CONSTRAINT_EQ && op != SQLITE_INDEX_CONSTRAINT_GLOB
+        && op != SQLITE_INDEX_CONSTRAINT_LIKE ) {
+        continue;
+      }
+      /* LIKE is checked again by SQLite, as its case rules may differ */
+      pIdxInfo->aConstraintUsage[i].argvIndex = ++nArg;
+      pIdxInfo->aConstraintUsage[i].omit = (op != SQLITE_INDEX_CONSTRAINT_LIKE);
+      zPlan = sqlite3_mprintf("%zn:%d,", zPlan, op);
+      nRow /= op == SQLITE_INDEX_CONSTRAINT_EQ ? nFile : 4.0;
+      nScan /= op == SQLITE_INDEX_CONSTRAINT_EQ ? nFile : 4.0;
+    }
+  }
+  for (i = 0; i < pIdxInfo->nConstraint && !bRowEq; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if ( !pCons->usable || pCons->iColumn <= 0 || pCons->iColumn > XBIN_NCOL ) continue;
+    switch ( pCons->op ) {
+      case SQLITE_INDEX_CONSTRAINT_EQ:
+        nRow /= 10.0;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_GT:
+      case SQLITE_INDEX_CONSTRAINT_GE:
+      case SQLITE_INDEX_CONSTRAINT_LT:
+      case SQLITE_INDEX_CONSTRAINT_LE:
+      case XBIN_OP_NEAR:
+      case XBIN_OP_INBOX:
+        nRow /= 3.0;
+        break;
+      case SQLITE_INDEX_CONSTRAINT_NE:
+      case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
+        break;
+      case SQLITE_INDEX_CONSTRAINT_ISNULL:
+        nRow /= 100.0;
+        break;
+      default:
+        continue;
+    }
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_ISNULL || pCons->op == SQLITE_INDEX_CONSTRAINT_ISNOTNULL ) {
+      zPlan = sqlite3_mprintf("%zz%d:%d,", zPlan, pCons->iColumn, pCons->op);
+    } else {
+      pIdxInfo->aConstraintUsage[i].argvIndex = ++nArg;
+      zPlan = sqlite3_mprintf("%zc%d:%d,", zPlan, pCons->iColumn, pCons->op);
+    }
+    pIdxInfo->aConstraintUsage[i].omit = 1;
+  }
+
+  /* sample, seed and filter, as for a table over one file */
+  for (i = XBIN_SAMPLE_COL; i <= XBIN_SEED_COL; i++) {
+    int j = xbinFindCons(pIdxInfo, i, SQLITE_INDEX_CONSTRAINT_EQ, SQLITE_INDEX_CONSTRAINT_EQ);
+    if ( j < 0 ) continue;
+    pIdxInfo->aConstraintUsage[j].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[j].omit = 1;
+    zPlan = sqlite3_mprintf("%z%s,", zPlan, i == XBIN_SAMPLE_COL ? "f" : "r");
+    if ( i == XBIN_SAMPLE_COL ) {
+      nRow /= 100.0;
+      nScan /= 100.0;
+    }
+  }
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if ( !pCons->usable || pCons->iColumn != XBIN_FILTER_COL
+      || pCons->op != SQLITE_INDEX_CONSTRAINT_EQ ) {
+      continue;
+    }
+    pIdxInfo->aConstraintUsage[i].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[i].omit = 1;
+    zPlan = sqlite3_mprintf("%zx,", zPlan);
+    nRow /= 3.0;
+  }
+
+  /* ORDER BY row, or file then row, in either direction */
+  if ( pIdxInfo->nOrderBy > 0 ) {
+    int bDesc = pIdxInfo->aOrderBy[0].desc;
+    int bMatch = 1;
+    for (i = 0; i < pIdxInfo->nOrderBy && bMatch; i++) {
+      int iCol = pIdxInfo->aOrderBy[i].iColumn;
+      bMatch = (iCol <= 0 || iCol == XBIN_FILE_COL) && pIdxInfo->aOrderBy[i].desc == bDesc;
+      if ( iCol <= 0 ) break;
+    }
+    if ( bMatch ) {
+      pIdxInfo->orderByConsumed = 1;
+      idxNum |= XBIN_IDX_ORDER;
+      if ( bDesc ) idxNum |= XBIN_IDX_DESC;
+    }
+  }
+
+  zPlan = sqlite3_mprintf("%zu%llx,", zPlan, (unsigned long long)pIdxInfo->colUsed);
+  pIdxInfo->idxNum = idxNum;
+  pIdxInfo->idxStr = zPlan;
+  pIdxInfo->needToFreeIdxStr = 1;
+  if ( bRowEq ) {
+    pIdxInfo->estimatedRows = 1;
+    pIdxInfo->estimatedCost = 1.0;
+    pIdxInfo->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+    return SQLITE_OK;
+  }
+  if ( nRow < 1.0 ) nRow = 1.0;
+  if ( nScan < nRow ) nScan = nRow;
+  pIdxInfo->estimatedRows = (sqlite3_int64)nRow;
+  pIdxInfo->estimatedCost = nScan + nFile;
+  return SQLITE_OK;
+}
+
+/*
+** near(X, C, TOL) is true if X is within TOL of C, i.e. abs(X-C) <= TOL.
+** near(X, 'C,TOL') is the same test in the two-argument form that
+** SQLite offers to xbinBestIndex() when X is a column of an xbin table.
+*/
+static void xbinNearFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  double x, c, tol;
+  if ( sqlite3_value_type(argv[0]) == SQLITE_NULL ) return;
+  if ( argc == 2 ) {
+    int eArg = xbinSpecArg(argv[1], &c, &tol);
+    if ( eArg == 0 ) return;
+    if ( eArg < 0 ) {
+      sqlite3_result_error(ctx, "near(): expected 'center,tolerance' as second argument", -1);
+      return;
+    }
+  } else {
+    if ( sqlite3_value_type(argv[1]) == SQLITE_NULL
+      || sqlite3_value_type(argv[2]) == SQLITE_NULL ) return;
+    c = sqlite3_value_double(argv[1]);
+    tol = sqlite3_value_double(argv[2]);
+  }
+  x = sqlite3_value_double(argv[0]);
+  sqlite3_result_int(ctx, x >= c - tol && x <= c + tol);
+}
+
+/*
+** in_box(X1, ..., Xn, LO1, HI1, ..., LOn, HIn) is true if every Xi lies
+** in [LOi, HIi].  in_box(X, 'LO,HI') is the one-column form that can be
+** pushed down; a box over several columns of an xbin table is written
+** as one in_box(col, 'lo,hi') per column.
+*/
+static void xbinInBoxFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  int n = argc / 3;
+  int i;
+  if ( argc == 2 ) {
+    double lo, hi, x;
+    int eArg;
+    if ( sqlite3_value_type(argv[0]) == SQLITE_NULL ) return;
+    eArg = xbinSpecArg(argv[1], &lo, &hi);
+    if ( eArg == 0 ) return;
+    if ( eArg < 0 ) {
+      sqlite3_result_error(ctx, "in_box(): expected 'low,high' as second argument", -1);
+      return;
+    }
+    x = sqlite3_value_double(argv[0]);
+    sqlite3_result_int(ctx, x >= lo && x <= hi);
+    return;
+  }
+  if ( argc == 0 || argc % 3 != 0 ) {
+    sqlite3_result_error(ctx, "in_box(): expected X1..Xn, LO1, HI1, ..., LOn, HIn", -1);
+    return;
+  }
+  for (i = 0; i < argc; i++) {
+    if ( sqlite3_value_type(argv[i]) == SQLITE_NULL ) return;
+  }
+  for (i = 0; i < n; i++) {
+    double x = sqlite3_value_double(argv[i]);
+    if ( x < sqlite3_value_double(argv[n + 2*i])
+      || x > sqlite3_value_double(argv[n + 2*i + 1]) ) {
+      sqlite3_result_int(ctx, 0);
+      return;
+    }
+  }
+  sqlite3_result_int(ctx, 1);
+}
+
+/*
+** xbin_create_index(TABLE, COLUMN) builds the sorted index on COLUMN of
+** the xbin table TABLE, or builds it again if there is one, and returns
+** the number of entries in it.  xbin_create_index(TABLE, COLUMN,
+** 'bitmap') does the same for a bitmap index, returning the number of
+** distinct values, and xbin_create_index(TABLE, COLUMN, 'learned') for
+** a learned index, returning the number of segments.  Statements
+** prepared from then on look COLUMN up in the index when that beats a
+** scan.  xbin_create_index(TABLE,
+** 'col1,col2,...', 'kdtree') builds the k-d tree of TABLE that
+** xbin_knn() searches, over those columns, and returns its number of
+** points.
+*/
+static void xbinCreateIndexFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinRegistry *pReg = (XbinRegistry*)sqlite3_user_data(ctx);
+  const char *zCol = (const char*)sqlite3_value_text(argv[1]);
+  const char *zKind = argc > 2 ? (const char*)sqlite3_value_text(argv[2]) : "sorted";
+  int eKind;
+  char *zErr = 0;
+  XbinTable *pTab;
+  int iCol;
+  int rc;
+
+  if ( zKind && sqlite3_stricmp(zKind, "sorted") == 0 ) {
+    eKind = 0;
+  } else if ( zKind && sqlite3_stricmp(zKind, "bitmap") == 0 ) {
+    eKind = 1;
+  } else if ( zKind && sqlite3_stricmp(zKind, "learned") == 0 ) {
+    eKind = 2;
+  } else if ( zKind && sqlite3_stricmp(zKind, "kdtree") == 0 ) {
+    eKind = -1;
+  } else {
+    sqlite3_result_error(ctx, "xbin_create_index: kind must be 'sorted', 'bitmap', "
+                         "'learned' or 'kdtree'", -1);
+    return;
+  }
+
+  pTab = xbinFindTable(pReg, (const char*)sqlite3_value_text(argv[0]), &zErr);
+  if ( pTab == 0 ) {
+    sqlite3_result_error(ctx, zErr, -1);
+    sqlite3_free(zErr);
+    return;
+  }
+  if ( eKind < 0 ) {
+    int aCol[XBIN_NCOL];
+    int nCol = zCol ? xbinParseColumns(zCol, aCol) : 0;
+    if ( nCol <= 0 ) {
+      zErr = sqlite3_mprintf("xbin_create_index: bad column list: %s", zCol ? zCol : "NULL");
+      sqlite3_result_error(ctx, zErr, -1);
+      sqlite3_free(zErr);
+      return;
+    }
+    pTab->nRow = xbinRowCount(pTab->fptr);
+    rc = xbinKdRefresh(pTab, nCol, aCol, 1);
+    if ( rc != SQLITE_OK ) {
+      zErr = sqlite3_mprintf("xbin_create_index: cannot write %s.kd", pTab->filename);
+      sqlite3_result_error(ctx, zErr, -1);
+      sqlite3_result_error_code(ctx, rc);
+      sqlite3_free(zErr);
+      return;
+    }
+    sqlite3_result_int64(ctx, pTab->pKd->hdr.nPoint);
+    return;
+  }
+  iCol = zCol ? xbinColumnIndex(zCol, (int)strlen(zCol)) : 0;
+  if ( iCol == 0 ) {
+    zErr = sqlite3_mprintf("xbin_create_index: no such column: %s", zCol ? zCol : "NULL");
+    sqlite3_result_error(ctx, zErr, -1);
+    sqlite3_free(zErr);
+    return;
+  }
+  xbinIndexProbe(pTab);
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  if ( eKind == 2 ) {
+    rc = xbinPlaRefresh(pTab, iCol, 1);
+  } else {
+    rc = eKind ? xbinBmRefresh(pTab, iCol, 1) : xbinIndexRefresh(pTab, iCol, 1);
+  }
+  if ( rc != SQLITE_OK ) {
+    if ( rc == SQLITE_FULL ) {
+      zErr = sqlite3_mprintf("xbin_create_index: %s has more than %d distinct values",
+                             azXbinCol[iCol], XBIN_BM_MAX_VALUES);
+    } else if ( rc == SQLITE_CONSTRAINT ) {
+      zErr = sqlite3_mprintf("xbin_create_index: %s is not in ascending order of %s",
+                             pTab->filename, azXbinCol[iCol]);
+    } else {
+      zErr = sqlite3_mprintf("xbin_create_index: cannot write %s.%s.%s", pTab->filename,
+                             azXbinCol[iCol], eKind == 2 ? "pla" : eKind ? "bm" : "idx");
+    }
+    sqlite3_result_error(ctx, zErr, -1);
+    if ( rc != SQLITE_FULL && rc != SQLITE_CONSTRAINT ) sqlite3_result_error_code(ctx, rc);
+    sqlite3_free(zErr);
+    return;
+  }
+  if ( eKind == 2 ) {
+    sqlite3_result_int64(ctx, pTab->apPla[iCol-1]->hdr.nSeg);
+  } else if ( eKind ) {
+    sqlite3_result_int64(ctx, pTab->aBmValue[iCol-1]);
+  } else {
+    sqlite3_result_int64(ctx, pTab->aIdx[iCol-1].nEntry);
+  }
+}
+
+/*
+** Find the xbin table named by pTabArg for xbin_interp() or
+** xbin_interp_batch(), with its grid up to date.  nArg is the number
+** of coordinates given, -1 if not known yet.  *ppTab, if not 0, is the
+** table an earlier call found for the same pTabArg.  Return SQLITE_ERROR
+** with an error message in *pzErr if the table is missing or not a grid
+** of nArg axes.
+*/
+static int xbinInterpGrid(
+  XbinRegistry *pReg,
+  sqlite3_value *pTabArg,
+  int nArg,
+  const char *zFunc,
+  XbinTable **ppTab,
+  char **pzErr
+) {
+  XbinTable *pTab = *ppTab;
+  int rc;
+  if ( pTab == 0 ) pTab = xbinFindTable(pReg, (const char*)sqlite3_value_text(pTabArg), pzErr);
+  *ppTab = 0;
+  if ( pTab == 0 ) return SQLITE_ERROR;
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  rc = xbinMetaRefresh(pTab);
+  if ( rc != SQLITE_OK ) return rc;
+  if ( pTab->grid.nAxis == 0 ) {
+    *pzErr = sqlite3_mprintf("%s: %s is not a regular grid, see the grid= argument",
+                             zFunc, pTab->zName);
+    return SQLITE_ERROR;
+  }
+  if ( nArg >= 0 && nArg != pTab->grid.nAxis ) {
+    *pzErr = sqlite3_mprintf("%s: %s is a grid over %d columns", zFunc, pTab->zName,
+                             pTab->grid.nAxis);
+    return SQLITE_ERROR;
+  }
+  *ppTab = pTab;
+  return SQLITE_OK;
+}
+
+/*
+** Interpolate column iCol from the corners of a cell found by
+** xbinGridCell(), aRow[] and aW[].  The corner records are read from
+** aRec[] if not 0, where rowids 0 in aRow[] are past the end of file,
+** or from the file otherwise.  Return 0 if a corner that has a weight
+** is missing or NULL there.
+*/
+static int xbinInterpValue(
+  XbinTable *pTab, int iCol,
+  const sqlite3_int64 *aRow, const double *aW, const xbinData *aRec,
+  double *pr
+) {
+  int nCorner = 1 << pTab->grid.nAxis;
+  double r = 0.0;
+  int c;
+  for (c = 0; c < nCorner; c++) {
+    xbinData rec;
+    float v;
+    if ( aW[c] == 0.0 ) continue;
+    if ( aRec ) {
+      if ( aRow[c] == 0 ) return 0;
+      rec = aRec[c];
+    } else if ( aRow[c] > pTab->nRow || !xbinReadRecord(pTab->fptr, aRow[c], &rec) ) {
+      return 0;
+    }
+    v = XBIN_VALUE(&rec, iCol);
+    if ( v != v ) return 0;
+    r += aW[c] * v;
+  }
+  *pr = r;
+  return 1;
+}
+
+/*
+** xbin_interp(TABLE, COLUMN, X1, X2, ...) returns the value of COLUMN at
+** the point (X1, X2, ...) of the grid that the records of TABLE form
+** (see xbinGridDetect()), one coordinate per axis, outermost first.  It
+** is the bilinear, trilinear, ... interpolation of the 4, 8, ... records
+** at the corners of the cell around the point, which are the only
+** records read.  The result is NULL outside the grid or if a corner
+** needed is NULL.
+*/
+static void xbinInterpFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinRegistry *pReg = (XbinRegistry*)sqlite3_user_data(ctx);
+  const char *zCol;
+  sqlite3_int64 aRow[1 << XBIN_NCOL];
+  double aW[1 << XBIN_NCOL];
+  double aX[XBIN_NCOL];
+  char *zErr = 0;
+  XbinTable *pTab;
+  double r;
+  int iCol;
+  int rc;
+  int i;
+
+  if ( argc < 3 ) {
+    sqlite3_result_error(ctx, "xbin_interp(): expected TABLE, COLUMN, X1, X2, ...", -1);
+    return;
+  }
+  /* The table named by a constant is only looked up for the first row */
+  pTab = (XbinTable*)sqlite3_get_auxdata(ctx, 0);
+  rc = xbinInterpGrid(pReg, argv[0], argc - 2, "xbin_interp", &pTab, &zErr);
+  if ( rc != SQLITE_OK ) {
+    if ( zErr ) sqlite3_result_error(ctx, zErr, -1);
+    if ( rc != SQLITE_ERROR ) sqlite3_result_error_code(ctx, rc);
+    sqlite3_free(zErr);
+    return;
+  }
+  sqlite3_set_auxdata(ctx, 0, pTab, 0);
+  zCol = (const char*)sqlite3_value_text(argv[1]);
+  iCol = zCol ? xbinColumnIndex(zCol, (int)strlen(zCol)) : 0;
+  if ( iCol == 0 ) {
+    zErr = sqlite3_mprintf("xbin_interp: no such column: %s", zCol ? zCol : "NULL");
+    sqlite3_result_error(ctx, zErr, -1);
+    sqlite3_free(zErr);
+    return;
+  }
+  for (i = 0; i < pTab->grid.nAxis; i++) {
+    if ( sqlite3_value_type(argv[2 + i]) == SQLITE_NULL ) return;
+    aX[i] = sqlite3_value_double(argv[2 + i]);
+  }
+  if ( xbinGridCell(&pTab->grid, aX, aRow, aW)
+    && xbinInterpValue(pTab, iCol, aRow, aW, 0, &r) ) {
+    sqlite3_result_double(ctx, r);
+  }
+}
+
+/*
+** Sketches.
+**
+** xbin_approx_distinct(X) estimates count(DISTINCT X) with a HyperLogLog
+** of 2^XBIN_HLL_BITS one-byte registers, about 1% off, and
+** xbin_quantile(X, P) the P-quantile of X (P from 0 to 1) with a KLL
+** sketch of a few times XBIN_KLL_K values, about 1% off in rank.  Their
+** memory does not grow with the input.  The aggregates collect values in
+** batches of XBIN_SKETCH_BATCH and update the sketch a batch at a time.
+**
+** Given a table and a column instead of X, as in
+** xbin_approx_distinct('log', 'speed') or xbin_quantile('log', 'speed',
+** 0.99), they are scalar functions that read the column of every record
+** of the file a block at a time and hand each block to the sketch as
+** one batch, with no row going through SQLite.
+*/
+#define XBIN_HLL_BITS      14     /* log2 of the registers of a HyperLogLog */
+#define XBIN_KLL_K         200    /* values kept by the top level of a KLL sketch */
+#define XBIN_KLL_LEVELS    60     /* levels of a KLL sketch, for 2^60 values */
+#define XBIN_SKETCH_BATCH  1024   /* values of an aggregate added at once */
+
+/* Number of leading zero bits of w, which is not 0 */
+#if defined(__GNUC__)
+# define xbinClz64(w) __builtin_clzll(w)
+#else
+static int xbinClz64(sqlite3_uint64 w) {
+  int n = 0;
+  while ( (w >> 56) == 0 ) { w <<= 8; n += 8; }
+  while ( (w >> 63) == 0 ) { w <<= 1; n++; }
+  return n;
+}
+#endif
+
+typedef struct XbinHll {
+  unsigned char aReg[1 << XBIN_HLL_BITS];
+} XbinHll;
+
+static void xbinHllAddHash(XbinHll *p, sqlite3_uint64 h) {
+  unsigned int i = (unsigned int)(h >> (64 - XBIN_HLL_BITS));
+  int nRank = xbinClz64((h << XBIN_HLL_BITS) | (1ULL << (XBIN_HLL_BITS - 1))) + 1;
+  if ( nRank > p->aReg[i] ) p->aReg[i] = (unsigned char)nRank;
+}
+
+/* Add a batch of numbers, NaN for NULL */
+static void xbinHllAdd(XbinHll *p, const double *a, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    double v = a[i];
+    sqlite3_uint64 u;
+    if ( v != v ) continue;
+    if ( v == 0.0 ) v = 0.0;
+    memcpy(&u, &v, sizeof(u));
+    xbinHllAddHash(p, xbinMix64(u + 0x9e3779b97f4a7c15ULL));
+  }
+}
+
+static sqlite3_int64 xbinHllCount(const XbinHll *p) {
+  double m = (double)(1 << XBIN_HLL_BITS);
+  double rSum = 0.0;
+  double r;
+  int nZero = 0;
+  int i;
+  for (i = 0; i < (1 << XBIN_HLL_BITS); i++) {
+    rSum += ldexp(1.0, -p->aReg[i]);
+    nZero += (p->aReg[i] == 0);
+  }
+  r = 0.7213 / (1.0 + 1.079 / m) * m * m / rSum;
+  if ( r <= 2.5 * m && nZero > 0 ) r = m * log(m / nZero);
+  return (sqlite3_int64)(r + 0.5);
+}
+
+/*
+** A KLL sketch: level h holds values standing for 2^h values each.  A
+** level that reaches its capacity is sorted and every other value of
+** it, starting at random with the first or the second, moves up a
+** level.  The top level holds up to XBIN_KLL_K values, each level below
+** two thirds of the one above it, and no less than two.
+*/
+typedef struct XbinKll {
+  double *aItem[XBIN_KLL_LEVELS];
+  int anItem[XBIN_KLL_LEVELS];
+  int anAlloc[XBIN_KLL_LEVELS];
+  int nLevel;
+  sqlite3_int64 nValue;       /* Values added */
+  double rMin, rMax;          /* Smallest and largest of them, kept exactly */
+  sqlite3_uint64 iRand;       /* State of the coin tosses */
+} XbinKll;
+
+static void xbinKllFree(XbinKll *p) {
+  int h;
+  for (h = 0; h < p->nLevel; h++) sqlite3_free(p->aItem[h]);
+  memset(p, 0, sizeof(*p));
+}
+
+static int xbinKllCap(const XbinKll *p, int h) {
+  int n = (int)(XBIN_KLL_K * pow(2.0 / 3.0, p->nLevel - 1 - h));
+  return n > 2 ? n : 2;
+}
+
+static int xbinKllReserve(XbinKll *p, int h, int n) {
+  if ( p->anItem[h] + n > p->anAlloc[h] ) {
+    int nNew = (p->anItem[h] + n) * 2;
+    double *aNew = sqlite3_realloc64(p->aItem[h], nNew * sizeof(double));
+    if ( aNew == 0 ) return SQLITE_NOMEM;
+    p->aItem[h] = aNew;
+    p->anAlloc[h] = nNew;
+  }
+  return SQLITE_OK;
+}
+
+static int xbinDoubleCmp(const void *a, const void *b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/* Add a batch of numbers, NaN for NULL */
+static int xbinKllAdd(XbinKll *p, const double *a, int n) {
+  int h, i;
+  if ( p->nLevel == 0 ) p->nLevel = 1;
+  if ( xbinKllReserve(p, 0, n) != SQLITE_OK ) return SQLITE_NOMEM;
+  for (i = 0; i < n; i++) {
+    double v = a[i];
+    if ( v != v ) continue;
+    if ( p->nValue++ == 0 ) p->rMin = p->rMax = v;
+    if ( v < p->rMin ) p->rMin = v;
+    if ( v > p->rMax ) p->rMax = v;
+    p->aItem[0][p->anItem[0]++] = v;
+  }
+  for (h = 0; h < p->nLevel; h++) {
+    double *aLvl;
+    int nLvl = p->anItem[h];
+    int nUp = nLvl / 2;
+    int iOff;
+    if ( nLvl < xbinKllCap(p, h) ) continue;
+    if ( h + 1 == p->nLevel ) {
+      if ( p->nLevel == XBIN_KLL_LEVELS ) break;
+      p->nLevel++;
+    }
+    if ( xbinKllReserve(p, h + 1, nUp) != SQLITE_OK ) return SQLITE_NOMEM;
+    aLvl = p->aItem[h];
+    qsort(aLvl, nLvl, sizeof(double), xbinDoubleCmp);
+    p->iRand = xbinMix64(p->iRand + 0x9e3779b97f4a7c15ULL);
+    iOff = (int)(p->iRand & 1);
+    for (i = 0; i < nUp; i++) {
+      p->aItem[h + 1][p->anItem[h + 1]++] = aLvl[2 * i + iOff];
+    }
+    /* An odd value out stays, the largest one */
+    if ( nLvl & 1 ) aLvl[0] = aLvl[nLvl - 1];
+    p->anItem[h] = nLvl & 1;
+  }
+  return SQLITE_OK;
+}
+
+/* Estimate the rP-quantile into *pr.  Return 0 if the sketch is empty. */
+static int xbinKllQuantile(const XbinKll *p, double rP, double *pr) {
+  struct { double v; double w; } *a;
+  double rTotal = 0.0;
+  double rSum = 0.0;
+  int n = 0;
+  int h, i;
+
+  if ( p->nValue == 0 ) return 0;
+  if ( rP == 0.0 || rP == 1.0 ) {
+    *pr = rP == 0.0 ? p->rMin : p->rMax;
+    return 1;
+  }
+  for (h = 0; h < p->nLevel; h++) n += p->anItem[h];
+  a = sqlite3_malloc64( n * sizeof(*a) );
+  if ( a == 0 ) return -1;
+  n = 0;
+  for (h = 0; h < p->nLevel; h++) {
+    for (i = 0; i < p->anItem[h]; i++) {
+      a[n].v = p->aItem[h][i];
+      a[n].w = ldexp(1.0, h);
+      rTotal += a[n].w;
+      n++;
+    }
+  }
+  qsort(a, n, sizeof(*a), xbinDoubleCmp);
+  for (i = 0; i < n - 1; i++) {
+    rSum += a[i].w;
+    if ( rSum >= rP * rTotal ) break;
+  }
+  *pr = a[i].v;
+  sqlite3_free(a);
+  return 1;
+}
+
+/* Aggregate context of xbin_approx_distinct() and xbin_quantile() */
+typedef struct XbinSketchCtx {
+  XbinHll *pHll;              /* xbin_approx_distinct() sketch */
+  XbinKll kll;                /* xbin_quantile() sketch */
+  double rP;                  /* The P of xbin_quantile() */
+  int nBuf;                   /* Values in aBuf[] */
+  double aBuf[XBIN_SKETCH_BATCH];
+} XbinSketchCtx;
+
+static int xbinSketchFlush(XbinSketchCtx *p) {
+  int rc = SQLITE_OK;
+  if ( p->pHll ) {
+    xbinHllAdd(p->pHll, p->aBuf, p->nBuf);
+  } else {
+    rc = xbinKllAdd(&p->kll, p->aBuf, p->nBuf);
+  }
+  p->nBuf = 0;
+  return rc;
+}
+
+static void xbinApproxDistinctStep(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinSketchCtx *p = sqlite3_aggregate_context(ctx, sizeof(*p));
+  (void)argc;
+  if ( p == 0 ) return;
+  if ( p->pHll == 0 ) {
+    p->pHll = sqlite3_malloc( sizeof(XbinHll) );
+    if ( p->pHll == 0 ) {
+      sqlite3_result_error_nomem(ctx);
+      return;
+    }
+    memset(p->pHll, 0, sizeof(XbinHll));
+  }
+  switch ( sqlite3_value_numeric_type(argv[0]) ) {
+    case SQLITE_NULL:
+      break;
+    case SQLITE_INTEGER:
+    case SQLITE_FLOAT:
+      p->aBuf[p->nBuf++] = sqlite3_value_double(argv[0]);
+      if ( p->nBuf == XBIN_SKETCH_BATCH ) xbinSketchFlush(p);
+      break;
+    default: {
+      /* Text and blobs are hashed as bytes, apart from the numbers */
+      const unsigned char *z = sqlite3_value_blob(argv[0]);
+      int n = sqlite3_value_bytes(argv[0]);
+      sqlite3_uint64 h = 0xcbf29ce484222325ULL;
+      int i;
+      for (i = 0; i < n; i++) h = (h ^ z[i]) * 0x100000001b3ULL;
+      xbinHllAddHash(p->pHll, xbinMix64(h));
+      break;
+    }
+  }
+}
+
+static void xbinApproxDistinctFinal(sqlite3_context *ctx) {
+  XbinSketchCtx *p = sqlite3_aggregate_context(ctx, 0);
+  if ( p == 0 || p->pHll == 0 ) {
+    sqlite3_result_int(ctx, 0);
+    return;
+  }
+  xbinSketchFlush(p);
+  sqlite3_result_int64(ctx, xbinHllCount(p->pHll));
+  sqlite3_free(p->pHll);
+}
+
+/*
+** Check the P argument of xbin_quantile() into *pr.  Return 0, with an
+** error set in ctx, if it is not a number from 0 to 1.
+*/
+static int xbinQuantileArg(sqlite3_context *ctx, sqlite3_value *pVal, double *pr) {
+  int eType = sqlite3_value_numeric_type(pVal);
+  if ( eType == SQLITE_INTEGER || eType == SQLITE_FLOAT ) {
+    *pr = sqlite3_value_double(pVal);
+    if ( *pr >= 0.0 && *pr <= 1.0 ) return 1;
+  }
+  sqlite3_result_error(ctx, "xbin_quantile: P must be a number from 0 to 1", -1);
+  return 0;
+}
+
+static void xbinQuantileStep(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinSketchCtx *p = sqlite3_aggregate_context(ctx, sizeof(*p));
+  double rP;
+  (void)argc;
+  if ( p == 0 ) return;
+  if ( !xbinQuantileArg(ctx, argv[1], &rP) ) return;
+  if ( p->kll.nLevel == 0 && p->nBuf == 0 ) {
+    p->rP = rP;
+  } else if ( rP != p->rP ) {
+    sqlite3_result_error(ctx, "xbin_quantile: P must be the same for every row", -1);
+    return;
+  }
+  switch ( sqlite3_value_numeric_type(argv[0]) ) {
+    case SQLITE_NULL:
+      break;
+    case SQLITE_INTEGER:
+    case SQLITE_FLOAT:
+      p->aBuf[p->nBuf++] = sqlite3_value_double(argv[0]);
+      if ( p->nBuf == XBIN_SKETCH_BATCH && xbinSketchFlush(p) != SQLITE_OK ) {
+        sqlite3_result_error_nomem(ctx);
+      }
+      break;
+    default:
+      sqlite3_result_error(ctx, "xbin_quantile: X must be a number", -1);
+      break;
+  }
+}
+
+static void xbinQuantileFinal(sqlite3_context *ctx) {
+  XbinSketchCtx *p = sqlite3_aggregate_context(ctx, 0);
+  double r;
+  int rc;
+  if ( p == 0 ) return;
+  if ( xbinSketchFlush(p) != SQLITE_OK ) {
+    sqlite3_result_error_nomem(ctx);
+  } else {
+    rc = xbinKllQuantile(&p->kll, p->rP, &r);
+    if ( rc > 0 ) sqlite3_result_double(ctx, r);
+    if ( rc < 0 ) sqlite3_result_error_nomem(ctx);
+  }
+  xbinKllFree(&p->kll);
+}
+
+/* State of a pass over a column of a file for a sketch */
+typedef struct XbinSketchScan {
+  int iCol;
+  XbinHll *pHll;              /* Sketch to add the values to, or ... */
+  XbinKll *pKll;              /* ... this one */
+  double aBuf[XBIN_BLOCK_ROWS];
+} XbinSketchScan;
+
+static int xbinSketchBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinSketchScan *p = (XbinSketchScan*)pArg;
+  int i;
+  (void)iRow;
+  for (i = 0; i < nRec; i++) p->aBuf[i] = XBIN_VALUE(&aRec[i], p->iCol);
+  if ( p->pHll ) {
+    xbinHllAdd(p->pHll, p->aBuf, nRec);
+    return SQLITE_OK;
+  }
+  return xbinKllAdd(p->pKll, p->aBuf, nRec);
+}
+
+/*
+** Feed column COLUMN of every record of xbin table TABLE, the first two
+** arguments of the table form of xbin_approx_distinct() or
+** xbin_quantile(), to pHll or pKll.  Return 0, with an error set in
+** ctx, on failure.
+*/
+static int xbinSketchTable(
+  sqlite3_context *ctx,
+  sqlite3_value **argv,
+  const char *zFunc,
+  XbinHll *pHll,
+  XbinKll *pKll
+) {
+  XbinRegistry *pReg = (XbinRegistry*)sqlite3_user_data(ctx);
+  const char *zCol = (const char*)sqlite3_value_text(argv[1]);
+  XbinSketchScan *pScan;
+  XbinTable *pTab;
+  char *zErr = 0;
+  int iCol;
+  int rc;
+
+  pTab = xbinFindTable(pReg, (const char*)sqlite3_value_text(argv[0]), &zErr);
+  if ( pTab == 0 ) {
+    sqlite3_result_error(ctx, zErr, -1);
+    sqlite3_free(zErr);
+    return 0;
+  }
+  iCol = zCol ? xbinColumnIndex(zCol, (int)strlen(zCol)) : 0;
+  if ( iCol == 0 ) {
+    zErr = sqlite3_mprintf("%s: no such column: %s", zFunc, zCol ? zCol : "NULL");
+    sqlite3_result_error(ctx, zErr, -1);
+    sqlite3_free(zErr);
+    return 0;
+  }
+  pScan = sqlite3_malloc( sizeof(*pScan) );
+  if ( pScan == 0 ) {
+    sqlite3_result_error_nomem(ctx);
+    return 0;
+  }
+  pScan->iCol = iCol;
+  pScan->pHll = pHll;
+  pScan->pKll = pKll;
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  rc = xbinForEachBlock(pTab->fptr, 1, pTab->nRow, xbinSketchBlock, pScan);
+  sqlite3_free(pScan);
+  if ( rc != SQLITE_OK ) {
+    sqlite3_result_error_code(ctx, rc);
+    return 0;
+  }
+  return 1;
+}
+
+static void xbinApproxDistinctFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinHll *pHll = sqlite3_malloc( sizeof(*pHll) );
+  (void)argc;
+  if ( pHll == 0 ) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+  memset(pHll, 0, sizeof(*pHll));
+  if ( xbinSketchTable(ctx, argv, "xbin_approx_distinct", pHll, 0) ) {
+    sqlite3_result_int64(ctx, xbinHllCount(pHll));
+  }
+  sqlite3_free(pHll);
+}
+
+static void xbinQuantileFunc(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinKll kll;
+  double rP, r;
+  (void)argc;
+  if ( !xbinQuantileArg(ctx, argv[2], &rP) ) return;
+  memset(&kll, 0, sizeof(kll));
+  if ( xbinSketchTable(ctx, argv, "xbin_quantile", 0, &kll) ) {
+    int rc = xbinKllQuantile(&kll, rP, &r);
+    if ( rc > 0 ) sqlite3_result_double(ctx, r);
+    if ( rc < 0 ) sqlite3_result_error_nomem(ctx);
+  }
+  xbinKllFree(&kll);
+}
+
+/*
+** Moving aggregates.
+**
+** xbin_movavg(X), xbin_movrms(X) and xbin_movmax(X) are window functions
+** over a sliding frame:
+**
+**    select row, xbin_movavg(torque) over w, xbin_movmax(torque) over w
+**      from log window w as (order by row rows 99 preceding);
+**
+** Each has an inverse step, so SQLite adds the row entering the frame
+** and takes out the one leaving it, O(1) a row, instead of running the
+** aggregate over the whole frame again for every row.  The sums are
+** compensated (Neumaier) and count the infinities apart, so taking a
+** value back out leaves the sum of the others, not the rounding left by
+** the ones gone.  The max is the head of a deque of the values that can
+** still become the max, decreasing from the head, each tagged with the
+** sequence number of its row so that the head leaves with its row.
+**
+** NULLs are left out, and a frame with no values gives NULL.
+*/
+
+/* Sum of the values in a moving frame */
+typedef struct XbinMovSum {
+  double rSum;                /* Sum of the finite values ... */
+  double rComp;               /* ... plus this compensation */
+  sqlite3_int64 nValue;       /* Values, NULLs left out */
+  sqlite3_int64 nPosInf;      /* Of which +Inf */
+  sqlite3_int64 nNegInf;      /* Of which -Inf */
+} XbinMovSum;
+
+/* Entry of an XbinMovMax deque */
+typedef struct XbinMovEntry {
+  double v;
+  sqlite3_int64 iSeq;         /* Sequence number of the row of v */
+} XbinMovEntry;
+
+/* Deque of the values of a moving frame that may yet be its max */
+typedef struct XbinMovMax {
+  XbinMovEntry *a;            /* Ring of nAlloc entries, a power of two */
+  int nAlloc;
+  int iHead;                  /* Entry of the max */
+  int nUsed;                  /* Entries from a[iHead] on */
+} XbinMovMax;
+
+/* Aggregate context of the window functions */
+typedef struct XbinMovCtx {
+  XbinMovSum sum;             /* xbin_movavg() and xbin_movrms() */
+  XbinMovMax max;             /* xbin_movmax() */
+  sqlite3_int64 nIn;          /* Rows stepped in so far */
+  sqlite3_int64 nOut;         /* Rows taken back out so far */
+} XbinMovCtx;
+
+/* Add v to p if iSign is 1, take it out if iSign is -1.  NaN is NULL. */
+static void xbinMovSumAdd(XbinMovSum *p, double v, int iSign) {
+  double t;
+  if ( v != v ) return;
+  p->nValue += iSign;
+  if ( v == HUGE_VAL ) {
+    p->nPosInf += iSign;
+  } else if ( v == -HUGE_VAL ) {
+    p->nNegInf += iSign;
+  } else if ( p->nValue == p->nPosInf + p->nNegInf ) {
+    /* The last finite value went out */
+    p->rSum = 0.0;
+    p->rComp = 0.0;
+  } else {
+    v = iSign > 0 ? v : -v;
+    t = p->rSum + v;
+    if ( fabs(p->rSum) >= fabs(v) ) {
+      p->rComp += (p->rSum - t) + v;
+    } else {
+      p->rComp += (v - t) + p->rSum;
+    }
+    p->rSum = t;
+  }
+}
+
+/*
+** Set *pr to the mean of the values in p, NaN if there are both +Inf
+** and -Inf.  Return 0 if there are no values.
+*/
+static int xbinMovSumMean(const XbinMovSum *p, double *pr) {
+  if ( p->nValue == 0 ) return 0;
+  if ( p->nPosInf || p->nNegInf ) {
+    *pr = (p->nPosInf ? HUGE_VAL : 0.0) - (p->nNegInf ? HUGE_VAL : 0.0);
+  } else {
+    *pr = (p->rSum + p->rComp) / p->nValue;
+  }
+  return 1;
+}
+
+/*
+** Add value v of the row numbered iSeq to the deque, dropping the
+** values behind it that it outlasts and is no less than.
+*/
+static int xbinMovMaxAdd(XbinMovMax *p, sqlite3_int64 iSeq, double v) {
+  int mask = p->nAlloc - 1;
+  if ( v != v ) return SQLITE_OK;
+  while ( p->nUsed > 0 && p->a[(p->iHead + p->nUsed - 1) & mask].v <= v ) p->nUsed--;
+  if ( p->nUsed == p->nAlloc ) {
+    int nNew = p->nAlloc ? p->nAlloc * 2 : 16;
+    XbinMovEntry *aNew = sqlite3_malloc64( nNew * sizeof(XbinMovEntry) );
+    int i;
+    if ( aNew == 0 ) return SQLITE_NOMEM;
+    for (i = 0; i < p->nUsed; i++) aNew[i] = p->a[(p->iHead + i) & mask];
+    sqlite3_free(p->a);
+    p->a = aNew;
+    p->nAlloc = nNew;
+    p->iHead = 0;
+    mask = nNew - 1;
+  }
+  p->a[(p->iHead + p->nUsed) & mask].v = v;
+  p->a[(p->iHead + p->nUsed) & mask].iSeq = iSeq;
+  p->nUsed++;
+  return SQLITE_OK;
+}
+
+/* Take the rows numbered up to iSeq out of the deque */
+static void xbinMovMaxRemove(XbinMovMax *p, sqlite3_int64 iSeq) {
+  while ( p->nUsed > 0 && p->a[p->iHead].iSeq <= iSeq ) {
+    p->iHead = (p->iHead + 1) & (p->nAlloc - 1);
+    p->nUsed--;
+  }
+}
+
+/* Set *pr to the max of the frame.  Return 0 if there are no values. */
+static int xbinMovMaxValue(const XbinMovMax *p, double *pr) {
+  if ( p->nUsed == 0 ) return 0;
+  *pr = p->a[p->iHead].v;
+  return 1;
+}
+
+/*
+** Read the argument of a moving aggregate into *pr.  Return 0 if it is
+** NULL, or if it is not a number, with an error set in ctx.
+*/
+static int xbinMovArg(sqlite3_context *ctx, sqlite3_value *pVal, double *pr) {
+  char *zErr;
+  switch ( sqlite3_value_numeric_type(pVal) ) {
+    case SQLITE_NULL:
+      return 0;
+    case SQLITE_INTEGER:
+    case SQLITE_FLOAT:
+      *pr = sqlite3_value_double(pVal);
+      return 1;
+  }
+  zErr = sqlite3_mprintf("%s: X must be a number", (const char*)sqlite3_user_data(ctx));
+  sqlite3_result_error(ctx, zErr ? zErr : "X must be a number", -1);
+  sqlite3_free(zErr);
+  return 0;
+}
+
+static void xbinMovAvgStep(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, sizeof(*p));
+  double v;
+  (void)argc;
+  if ( p && xbinMovArg(ctx, argv[0], &v) ) xbinMovSumAdd(&p->sum, v, 1);
+}
+
+static void xbinMovAvgInverse(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, sizeof(*p));
+  double v;
+  (void)argc;
+  if ( p && xbinMovArg(ctx, argv[0], &v) ) xbinMovSumAdd(&p->sum, v, -1);
+}
+
+static void xbinMovAvgValue(sqlite3_context *ctx) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, 0);
+  double r;
+  if ( p && xbinMovSumMean(&p->sum, &r) ) sqlite3_result_double(ctx, r);
+}
+
+static void xbinMovRmsStep(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, sizeof(*p));
+  double v;
+  (void)argc;
+  if ( p && xbinMovArg(ctx, argv[0], &v) ) xbinMovSumAdd(&p->sum, v * v, 1);
+}
+
+static void xbinMovRmsInverse(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, sizeof(*p));
+  double v;
+  (void)argc;
+  if ( p && xbinMovArg(ctx, argv[0], &v) ) xbinMovSumAdd(&p->sum, v * v, -1);
+}
+
+static void xbinMovRmsValue(sqlite3_context *ctx) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, 0);
+  double r;
+  if ( p && xbinMovSumMean(&p->sum, &r) ) sqlite3_result_double(ctx, sqrt(r));
+}
+
+static void xbinMovMaxStep(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, sizeof(*p));
+  double v;
+  (void)argc;
+  if ( p == 0 ) return;
+  if ( xbinMovArg(ctx, argv[0], &v) && xbinMovMaxAdd(&p->max, p->nIn, v) != SQLITE_OK ) {
+    sqlite3_result_error_nomem(ctx);
+  }
+  p->nIn++;
+}
+
+static void xbinMovMaxInverse(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, sizeof(*p));
+  (void)argc;
+  (void)argv;
+  if ( p ) xbinMovMaxRemove(&p->max, p->nOut++);
+}
+
+static void xbinMovMaxValueFunc(sqlite3_context *ctx) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, 0);
+  double r;
+  if ( p && xbinMovMaxValue(&p->max, &r) ) sqlite3_result_double(ctx, r);
+}
+
+static void xbinMovAvgFinal(sqlite3_context *ctx) {
+  xbinMovAvgValue(ctx);
+}
+
+static void xbinMovRmsFinal(sqlite3_context *ctx) {
+  xbinMovRmsValue(ctx);
+}
+
+static void xbinMovMaxFinal(sqlite3_context *ctx) {
+  XbinMovCtx *p = sqlite3_aggregate_context(ctx, 0);
+  double r;
+  if ( p == 0 ) return;
+  if ( xbinMovMaxValue(&p->max, &r) ) sqlite3_result_double(ctx, r);
+  sqlite3_free(p->max.a);
+}
+
+/*
+** Overload the two-argument near() and in_box() on the columns of xbin
+** tables.  The return values at or above SQLITE_INDEX_CONSTRAINT_FUNCTION
+** make SQLite offer "near(col, spec)" to xbinBestIndex() as a constraint.
+*/
+static int xbinFindMethod(
+  sqlite3_vtab *pVtab,
+  int nArg,
+  const char *zName,
+  void (**pxFunc)(sqlite3_context*,int,sqlite3_value**),
+  void **ppArg
+) {
+  if ( nArg != 2 ) return 0;
+  if ( sqlite3_stricmp(zName, "near") == 0 ) {
+    *pxFunc = xbinNearFunc;
+    *ppArg = 0;
+    return XBIN_OP_NEAR;
+  }
+  if ( sqlite3_stricmp(zName, "in_box") == 0 ) {
+    *pxFunc = xbinInBoxFunc;
+    *ppArg = 0;
+    return XBIN_OP_INBOX;
+  }
+  return 0;
+}
+
+/*
+** This following structure defines all the methods for the
+** virtual table.
+*/
+static sqlite3_module xbinModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ xbinConnect,
+  /* xConnect    */ xbinConnect,
+  /* xBestIndex  */ xbinBestIndex,
+  /* xDisconnect */ xbinDisconnect,
+  /* xDestroy    */ xbinDisconnect,
+  /* xOpen       */ xbinOpen,
+  /* xClose      */ xbinClose,
+  /* xFilter     */ xbinFilter,
+  /* xNext       */ xbinNext,
+  /* xEof        */ xbinEof,
+  /* xColumn     */ xbinColumn,
+  /* xRowid      */ xbinRowid,
+  /* xUpdate     */ xbinUpdate,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ xbinFindMethod,
+  /* xRename     */ xbinRename,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+
+/*
+** xbin_gather(TABLE, ROWS) is a table-valued function that returns the
+** records of the xbin table TABLE for a list of rowids:
+**
+**    select * from xbin_gather('xbin', '17,3,99000,17');
+**    select * from xbin_gather('xbin', (select group_concat(r) from picks));
+**
+** ROWS is a text list of integers (any non-digit separates them, so a
+** JSON array works too), a single integer, or a blob of native 64-bit
+** integers.  Records come back in the order of ROWS, repeated ids
+** included; ids past the end of the file are skipped.
+**
+** Rather than one seek and read per id, the ids are sorted, ids that
+** are close together are coalesced into one read of the records
+** between them, every read is announced to the OS before the first one
+** is issued, and the reads are done in file order.
+*/
+typedef struct XbinGatherCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  sqlite3_int64 *aReq;        /* Requested rowids, 0 once found missing */
+  xbinData *aRec;             /* Record for each entry of aReq[] */
+  int nReq;                   /* Number of entries in aReq[] */
+  int iReq;                   /* Current entry */
+  sqlite3_value *pTabArg;     /* TABLE argument, for the hidden column */
+  sqlite3_value *pRowsArg;    /* ROWS argument, for the hidden column */
+} XbinGatherCursor;
+
+#define XBIN_GATHER_TAB   (XBIN_NCOL + 1)   /* Hidden column TABLE */
+#define XBIN_GATHER_ROWS  (XBIN_NCOL + 2)   /* Hidden column ROWS */
+
+/* One requested rowid and its position in the request */
+typedef struct XbinGatherReq {
+  sqlite3_int64 iRow;
+  int iPos;
+} XbinGatherReq;
+
+static int xbinGatherReqCmp(const void *a, const void *b) {
+  const XbinGatherReq *p1 = (const XbinGatherReq*)a;
+  const XbinGatherReq *p2 = (const XbinGatherReq*)b;
+  if ( p1->iRow != p2->iRow ) return p1->iRow < p2->iRow ? -1 : 1;
+  return p1->iPos - p2->iPos;
+}
+
+static int xbinGatherConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinFuncTab *pGather;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db,
+                            "CREATE TABLE x(row INTEGER, " XBIN_DATA_SCHEMA ", tab HIDDEN, rows HIDDEN)"
+                           );
+  if ( rc != SQLITE_OK ) return rc;
+  pGather = sqlite3_malloc( sizeof(*pGather) );
+  *ppVtab = (sqlite3_vtab*)pGather;
+  if ( pGather == 0 ) return SQLITE_NOMEM;
+  memset(pGather, 0, sizeof(*pGather));
+  pGather->pReg = (XbinRegistry*)pAux;
+  return SQLITE_OK;
+}
+
+static int xbinGatherOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinGatherCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void xbinGatherReset(XbinGatherCursor *pCur) {
+  sqlite3_free(pCur->aReq);
+  sqlite3_free(pCur->aRec);
+  sqlite3_value_free(pCur->pTabArg);
+  sqlite3_value_free(pCur->pRowsArg);
+  pCur->aReq = 0;
+  pCur->aRec = 0;
+  pCur->pTabArg = 0;
+  pCur->pRowsArg = 0;
+  pCur->nReq = 0;
+  pCur->iReq = 0;
+}
+
+static int xbinGatherClose(sqlite3_vtab_cursor *cur) {
+  XbinGatherCursor *pCur = (XbinGatherCursor*)cur;
+  xbinGatherReset(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+/*
+** Parse the ROWS argument into a new array at *paRow.  Return the
+** number of ids, or -1 when out of memory.
+*/
+static int xbinGatherParse(sqlite3_value *pVal, sqlite3_int64 **paRow) {
+  sqlite3_int64 *aRow = 0;
+  int nRow = 0;
+
+  *paRow = 0;
+  switch ( sqlite3_value_type(pVal) ) {
+    case SQLITE_NULL:
+      return 0;
+    case SQLITE_BLOB: {
+      int nByte = sqlite3_value_bytes(pVal);
+      nRow = nByte / (int)sizeof(sqlite3_int64);
+      if ( nRow == 0 ) return 0;
+      aRow = sqlite3_malloc( nRow * sizeof(sqlite3_int64) );
+      if ( aRow == 0 ) return -1;
+      memcpy(aRow, sqlite3_value_blob(pVal), nRow * sizeof(sqlite3_int64));
+      break;
+    }
+    case SQLITE_TEXT: {
+      const char *z = (const char*)sqlite3_value_text(pVal);
+      int nAlloc = 0;
+      while ( z && *z ) {
+        char *zEnd;
+        sqlite3_int64 iRow;
+        if ( !isdigit((unsigned char)*z)
+          && !(*z == '-' && isdigit((unsigned char)z[1])) ) {
+          z++;
+          continue;
+        }
+        iRow = strtoll(z, &zEnd, 10);
+        z = zEnd;
+        if ( nRow >= nAlloc ) {
+          sqlite3_int64 *aNew;
+          nAlloc = nAlloc ? nAlloc * 2 : 64;
+          aNew = sqlite3_realloc(aRow, nAlloc * sizeof(sqlite3_int64));
+          if ( aNew == 0 ) {
+            sqlite3_free(aRow);
+            return -1;
+          }
+          aRow = aNew;
+        }
+        aRow[nRow++] = iRow;
+      }
+      break;
+    }
+    default:
+      aRow = sqlite3_malloc( sizeof(sqlite3_int64) );
+      if ( aRow == 0 ) return -1;
+      aRow[0] = sqlite3_value_int64(pVal);
+      nRow = 1;
+      break;
+  }
+  *paRow = aRow;
+  return nRow;
+}
+
+/*
+** Read the records of the nReq rowids of aReq[] into aRec[], setting
+** the entries of aReq[] past the end of file to 0.  Ids within
+** XBIN_GATHER_GAP of each other (and within XBIN_BLOCK_ROWS of the
+** first one) share one read.
+*/
+static int xbinGatherRows(XbinTable *pTab, sqlite3_int64 *aReq, xbinData *aRec, int nReq) {
+  XbinGatherReq *aSort;
+  xbinData *aBuf;
+  int nSort = 0;
+  int pass;
+  int i;
+
+  aSort = sqlite3_malloc( (nReq > 0 ? nReq : 1) * sizeof(XbinGatherReq) );
+  aBuf = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(xbinData) );
+  if ( aSort == 0 || aBuf == 0 ) {
+    sqlite3_free(aSort);
+    sqlite3_free(aBuf);
+    return SQLITE_NOMEM;
+  }
+  for (i = 0; i < nReq; i++) {
+    if ( aReq[i] < 1 || aReq[i] > pTab->nRow ) {
+      aReq[i] = 0;
+      continue;
+    }
+    aSort[nSort].iRow = aReq[i];
+    aSort[nSort].iPos = i;
+    nSort++;
+  }
+  qsort(aSort, nSort, sizeof(XbinGatherReq), xbinGatherReqCmp);
+
+  /* Pass 0 announces every read to the OS, pass 1 does them */
+  for (pass = 0; pass < 2; pass++) {
+    i = 0;
+    while ( i < nSort ) {
+      sqlite3_int64 iStart = aSort[i].iRow;
+      sqlite3_int64 nGot;
+      int j = i + 1;
+      while ( j < nSort
+           && aSort[j].iRow - aSort[j-1].iRow <= XBIN_GATHER_GAP
+           && aSort[j].iRow - iStart < XBIN_BLOCK_ROWS ) {
+        j++;
+      }
+      if ( pass == 0 ) {
+        xbinReadAhead(pTab->fptr, iStart, aSort[j-1].iRow - iStart + 1);
+      } else {
+        nGot = xbinReadRecords(pTab->fptr, iStart, aSort[j-1].iRow - iStart + 1, aBuf);
+        for (; i < j; i++) {
+          sqlite3_int64 k = aSort[i].iRow - iStart;
+          if ( k < nGot ) {
+            aRec[aSort[i].iPos] = aBuf[k];
+          } else {
+            aReq[aSort[i].iPos] = 0;
+          }
+        }
+      }
+      i = j;
+    }
+  }
+  sqlite3_free(aSort);
+  sqlite3_free(aBuf);
+  return SQLITE_OK;
+}
+
+static int xbinGatherNext(sqlite3_vtab_cursor *cur) {
+  XbinGatherCursor *pCur = (XbinGatherCursor*)cur;
+  do {
+    pCur->iReq++;
+  } while ( pCur->iReq < pCur->nReq && pCur->aReq[pCur->iReq] == 0 );
+  return SQLITE_OK;
+}
+
+static int xbinGatherFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinGatherCursor *pCur = (XbinGatherCursor*)pVtabCursor;
+  XbinRegistry *pReg = ((XbinFuncTab*)pVtabCursor->pVtab)->pReg;
+  XbinTable *pTab;
+  int rc;
+  (void)idxNum; (void)idxStr;
+
+  xbinGatherReset(pCur);
+  if ( argc != 2 ) return SQLITE_OK;
+  pTab = xbinFindTable(pReg, (const char*)sqlite3_value_text(argv[0]),
+                       &pVtabCursor->pVtab->zErrMsg);
+  if ( pTab == 0 ) return SQLITE_ERROR;
+  pCur->pTabArg = sqlite3_value_dup(argv[0]);
+  pCur->pRowsArg = sqlite3_value_dup(argv[1]);
+  pCur->nReq = xbinGatherParse(argv[1], &pCur->aReq);
+  if ( pCur->nReq < 0 ) {
+    pCur->nReq = 0;
+    return SQLITE_NOMEM;
+  }
+  if ( pCur->nReq == 0 ) return SQLITE_OK;
+  pCur->aRec = sqlite3_malloc( pCur->nReq * sizeof(xbinData) );
+  if ( pCur->aRec == 0 ) return SQLITE_NOMEM;
+
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  rc = xbinGatherRows(pTab, pCur->aReq, pCur->aRec, pCur->nReq);
+  if ( rc == SQLITE_OK && pCur->aReq[0] == 0 ) rc = xbinGatherNext(pVtabCursor);
+  return rc;
+}
+
+static int xbinGatherEof(sqlite3_vtab_cursor *cur) {
+  XbinGatherCursor *pCur = (XbinGatherCursor*)cur;
+  return pCur->iReq >= pCur->nReq;
+}
+
+static int xbinGatherColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinGatherCursor *pCur = (XbinGatherCursor*)cur;
+  if ( i == 0 ) {
+    sqlite3_result_int64(ctx, pCur->aReq[pCur->iReq]);
+  } else if ( i <= XBIN_NCOL ) {
+    sqlite3_result_double(ctx, (double)XBIN_VALUE(&pCur->aRec[pCur->iReq], i));
+  } else if ( i == XBIN_GATHER_TAB ) {
+    sqlite3_result_value(ctx, pCur->pTabArg);
+  } else {
+    sqlite3_result_value(ctx, pCur->pRowsArg);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** The rowid is the position in the ROWS list, counting from 1.
+*/
+static int xbinGatherRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  *pRowid = ((XbinGatherCursor*)cur)->iReq + 1;
+  return SQLITE_OK;
+}
+
+/*
+** Both TABLE and ROWS must be given with =.
+*/
+static int xbinGatherBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+  int aIdx[2] = { -1, -1 };
+  int i;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    int iCol = pCons->iColumn - XBIN_GATHER_TAB;
+    if ( iCol < 0 || iCol > 1 ) continue;
+    if ( !pCons->usable ) return SQLITE_CONSTRAINT;
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ) aIdx[iCol] = i;
+  }
+  if ( aIdx[0] < 0 || aIdx[1] < 0 ) {
+    sqlite3_free(tab->zErrMsg);
+    tab->zErrMsg = sqlite3_mprintf("xbin_gather: TABLE and ROWS arguments are required");
+    return SQLITE_ERROR;
+  }
+  for (i = 0; i < 2; i++) {
+    pIdxInfo->aConstraintUsage[aIdx[i]].argvIndex = i + 1;
+    pIdxInfo->aConstraintUsage[aIdx[i]].omit = 1;
+  }
+  pIdxInfo->estimatedCost = 100.0;
+  pIdxInfo->estimatedRows = 100;
+  return SQLITE_OK;
+}
+
+static sqlite3_module xbinGatherModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ xbinGatherConnect,
+  /* xBestIndex  */ xbinGatherBestIndex,
+  /* xDisconnect */ xbinFuncDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ xbinGatherOpen,
+  /* xClose      */ xbinGatherClose,
+  /* xFilter     */ xbinGatherFilter,
+  /* xNext       */ xbinGatherNext,
+  /* xEof        */ xbinGatherEof,
+  /* xColumn     */ xbinGatherColumn,
+  /* xRowid      */ xbinGatherRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+
+/*
+** xbin_knn(TABLE, K, X1, X2, ...) is a table-valued function that
+** returns the K records of the xbin table TABLE nearest the point
+** (X1, X2, ...), nearest first:
+**
+**    select xbin_create_index('xbin', 'id,iq,speed', 'kdtree');
+**    select x.* from xbin_knn('xbin', 5, 12, 3, 2000) k join xbin x using (row);
+**
+** The point has one coordinate per column of the k-d tree of TABLE
+** (see xbinKdRefresh()), in the order the columns were given when it was
+** built, and the distance is Euclidean over the raw column values.  Each
+** result row is the rowid of a record and its distance; records with a
+** NULL in one of the columns are never returned, and ties go to the
+** lower rowid.
+*/
+/* One record found */
+typedef struct XbinKnnHit {
+  double rDist;               /* Squared distance */
+  sqlite3_int64 iRow;         /* Rowid */
+} XbinKnnHit;
+
+typedef struct XbinKnnCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  XbinKnnHit *aHit;           /* Records found, nearest first */
+  int nHit;                   /* Number of entries in aHit[] */
+  int iHit;                   /* Current entry */
+  sqlite3_value *apArg[2 + XBIN_NCOL];  /* Arguments, for the hidden columns */
+} XbinKnnCursor;
+
+#define XBIN_KNN_TAB  2       /* Hidden column TABLE, then K, then X1.. */
+
+static int xbinKnnHitCmp(const void *a, const void *b) {
+  const XbinKnnHit *p1 = (const XbinKnnHit*)a;
+  const XbinKnnHit *p2 = (const XbinKnnHit*)b;
+  if ( p1->rDist != p2->rDist ) return p1->rDist < p2->rDist ? -1 : 1;
+  return p1->iRow < p2->iRow ? -1 : (p1->iRow > p2->iRow);
+}
+
+static int xbinKnnConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinFuncTab *pKnn;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db,
+                            "CREATE TABLE x(row INTEGER, distance REAL, tab HIDDEN, k HIDDEN, "
+                            "x1 HIDDEN, x2 HIDDEN, x3 HIDDEN, x4 HIDDEN, x5 HIDDEN, "
+                            "x6 HIDDEN, x7 HIDDEN, x8 HIDDEN, x9 HIDDEN)"
+                           );
+  if ( rc != SQLITE_OK ) return rc;
+  pKnn = sqlite3_malloc( sizeof(*pKnn) );
+  *ppVtab = (sqlite3_vtab*)pKnn;
+  if ( pKnn == 0 ) return SQLITE_NOMEM;
+  memset(pKnn, 0, sizeof(*pKnn));
+  pKnn->pReg = (XbinRegistry*)pAux;
+  return SQLITE_OK;
+}
+
+static int xbinKnnOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinKnnCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void xbinKnnReset(XbinKnnCursor *pCur) {
+  int i;
+  sqlite3_free(pCur->aHit);
+  for (i = 0; i < 2 + XBIN_NCOL; i++) {
+    sqlite3_value_free(pCur->apArg[i]);
+    pCur->apArg[i] = 0;
+  }
+  pCur->aHit = 0;
+  pCur->nHit = 0;
+  pCur->iHit = 0;
+}
+
+static int xbinKnnClose(sqlite3_vtab_cursor *cur) {
+  XbinKnnCursor *pCur = (XbinKnnCursor*)cur;
+  xbinKnnReset(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+static int xbinKnnNext(sqlite3_vtab_cursor *cur) {
+  ((XbinKnnCursor*)cur)->iHit++;
+  return SQLITE_OK;
+}
+
+/*
+** argv[] holds TABLE, K and the idxNum coordinates of the point.
+*/
+static int xbinKnnFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinKnnCursor *pCur = (XbinKnnCursor*)pVtabCursor;
+  sqlite3_vtab *pVtab = pVtabCursor->pVtab;
+  XbinRegistry *pReg = ((XbinFuncTab*)pVtab)->pReg;
+  XbinTable *pTab;
+  XbinKdTree *pKd;
+  XbinKnn knn;
+  sqlite3_int64 k;
+  int rc;
+  int i;
+  (void)idxNum; (void)idxStr;
+
+  xbinKnnReset(pCur);
+  if ( argc < 2 ) return SQLITE_OK;
+  for (i = 0; i < argc; i++) {
+    pCur->apArg[i] = sqlite3_value_dup(argv[i]);
+    if ( pCur->apArg[i] == 0 ) return SQLITE_NOMEM;
+  }
+  pTab = xbinFindTable(pReg, (const char*)sqlite3_value_text(argv[0]), &pVtab->zErrMsg);
+  if ( pTab == 0 ) return SQLITE_ERROR;
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  rc = xbinKdRefresh(pTab, 0, 0, 0);
+  if ( rc == SQLITE_NOTFOUND ) {
+    sqlite3_free(pVtab->zErrMsg);
+    pVtab->zErrMsg = sqlite3_mprintf("xbin_knn: no k-d tree on %s, "
+                                     "see xbin_create_index(TABLE, COLUMNS, 'kdtree')", pTab->zName);
+    return SQLITE_ERROR;
+  }
+  if ( rc != SQLITE_OK ) return rc;
+  pKd = pTab->pKd;
+  if ( argc - 2 != pKd->hdr.nDim ) {
+    sqlite3_free(pVtab->zErrMsg);
+    pVtab->zErrMsg = sqlite3_mprintf("xbin_knn: the k-d tree on %s has %d columns",
+                                     pTab->zName, pKd->hdr.nDim);
+    return SQLITE_ERROR;
+  }
+
+  memset(&knn, 0, sizeof(knn));
+  knn.p = pKd;
+  for (i = 0; i < pKd->hdr.nDim; i++) {
+    if ( sqlite3_value_type(argv[2 + i]) == SQLITE_NULL ) return SQLITE_OK;
+    knn.aQ[i] = sqlite3_value_double(argv[2 + i]);
+  }
+  k = sqlite3_value_int64(argv[1]);
+  if ( k > pKd->hdr.nPoint + (pTab->nRow - pKd->hdr.nRow) ) {
+    k = pKd->hdr.nPoint + (pTab->nRow - pKd->hdr.nRow);
+  }
+  if ( k <= 0 ) return SQLITE_OK;
+  if ( k > 0x7fffffff / (int)sizeof(XbinKnnHit) ) return SQLITE_TOOBIG;
+  knn.k = (int)k;
+  knn.aD = sqlite3_malloc64( k * sizeof(double) );
+  knn.aRow = sqlite3_malloc64( k * sizeof(sqlite3_int64) );
+  if ( knn.aD == 0 || knn.aRow == 0 ) {
+    rc = SQLITE_NOMEM;
+  } else {
+    xbinKnnSearch(&knn, 0, pKd->hdr.nPoint);
+    rc = xbinForEachBlock(pTab->fptr, pKd->hdr.nRow + 1, pTab->nRow, xbinKnnBlock, &knn);
+  }
+  if ( rc == SQLITE_OK ) {
+    pCur->aHit = sqlite3_malloc64( (knn.n + 1) * sizeof(XbinKnnHit) );
+    if ( pCur->aHit == 0 ) rc = SQLITE_NOMEM;
+  }
+  if ( rc == SQLITE_OK ) {
+    for (i = 0; i < knn.n; i++) {
+      pCur->aHit[i].rDist = knn.aD[i];
+      pCur->aHit[i].iRow = knn.aRow[i];
+    }
+    pCur->nHit = knn.n;
+    qsort(pCur->aHit, pCur->nHit, sizeof(XbinKnnHit), xbinKnnHitCmp);
+  }
+  sqlite3_free(knn.aD);
+  sqlite3_free(knn.aRow);
+  return rc;
+}
+
+static int xbinKnnEof(sqlite3_vtab_cursor *cur) {
+  XbinKnnCursor *pCur = (XbinKnnCursor*)cur;
+  return pCur->iHit >= pCur->nHit;
+}
+
+static int xbinKnnColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinKnnCursor *pCur = (XbinKnnCursor*)cur;
+  if ( i == 0 ) {
+    sqlite3_result_int64(ctx, pCur->aHit[pCur->iHit].iRow);
+  } else if ( i == 1 ) {
+    sqlite3_result_double(ctx, sqrt(pCur->aHit[pCur->iHit].rDist));
+  } else if ( pCur->apArg[i - XBIN_KNN_TAB] ) {
+    sqlite3_result_value(ctx, pCur->apArg[i - XBIN_KNN_TAB]);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** The rowid is the rank of the record, counting from 1.
+*/
+static int xbinKnnRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  *pRowid = ((XbinKnnCursor*)cur)->iHit + 1;
+  return SQLITE_OK;
+}
+
+/*
+** TABLE, K and the coordinates X1, X2, ... must be given with =.
+** idxNum is the number of coordinates.
+*/
+static int xbinKnnBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+  int aIdx[2 + XBIN_NCOL];
+  int n;
+  int i;
+  for (i = 0; i < 2 + XBIN_NCOL; i++) aIdx[i] = -1;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    int iArg = pCons->iColumn - XBIN_KNN_TAB;
+    if ( iArg < 0 ) continue;
+    if ( !pCons->usable ) return SQLITE_CONSTRAINT;
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ) aIdx[iArg] = i;
+  }
+  for (n = 0; n < 2 + XBIN_NCOL && aIdx[n] >= 0; n++) {
+    pIdxInfo->aConstraintUsage[aIdx[n]].argvIndex = n + 1;
+    pIdxInfo->aConstraintUsage[aIdx[n]].omit = 1;
+  }
+  if ( n < 3 ) {
+    sqlite3_free(tab->zErrMsg);
+    tab->zErrMsg = sqlite3_mprintf("xbin_knn: TABLE, K and a point are required");
+    return SQLITE_ERROR;
+  }
+  pIdxInfo->idxNum = n - 2;
+  pIdxInfo->estimatedCost = 100.0;
+  pIdxInfo->estimatedRows = 10;
+  return SQLITE_OK;
+}
+
+static sqlite3_module xbinKnnModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ xbinKnnConnect,
+  /* xBestIndex  */ xbinKnnBestIndex,
+  /* xDisconnect */ xbinFuncDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ xbinKnnOpen,
+  /* xClose      */ xbinKnnClose,
+  /* xFilter     */ xbinKnnFilter,
+  /* xNext       */ xbinKnnNext,
+  /* xEof        */ xbinKnnEof,
+  /* xColumn     */ xbinKnnColumn,
+  /* xRowid      */ xbinKnnRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+/*
+** xbin_interp_batch(TABLE, COLUMN, POINTS) is a table-valued function
+** that does what xbin_interp() does for many points at once:
+**
+**    select point, value from xbin_interp_batch('map', 'torque', '12.5,3.2 40,6.1');
+**
+** POINTS is a text list of numbers (separated by anything that cannot
+** be part of one), or a blob of native doubles, taken as points of as
+** many coordinates as the grid of TABLE has axes.  A row comes back for
+** each point, numbered from 1, with a NULL value if xbin_interp() would
+** return NULL.  The corner records of all the points are read together,
+** in file order, as xbin_gather() reads its rows.
+*/
+typedef struct XbinInterpCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  double *aVal;               /* Value at each point */
+  unsigned char *aNull;       /* True for points with a NULL value */
+  int nPoint;                 /* Number of points */
+  int iPoint;                 /* Current point */
+  sqlite3_value *apArg[3];    /* Arguments, for the hidden columns */
+} XbinInterpCursor;
+
+#define XBIN_INTERP_TAB  2    /* Hidden column TABLE, then COLUMN and POINTS */
+
+/*
+** Parse the POINTS argument into a new array at *pa.  Return the number
+** of values, or -1 when out of memory.
+*/
+static int xbinRealList(sqlite3_value *pVal, double **pa) {
+  double *a = 0;
+  int n = 0;
+
+  *pa = 0;
+  switch ( sqlite3_value_type(pVal) ) {
+    case SQLITE_NULL:
+      return 0;
+    case SQLITE_BLOB: {
+      n = sqlite3_value_bytes(pVal) / (int)sizeof(double);
+      if ( n == 0 ) return 0;
+      a = sqlite3_malloc( n * sizeof(double) );
+      if ( a == 0 ) return -1;
+      memcpy(a, sqlite3_value_blob(pVal), n * sizeof(double));
+      break;
+    }
+    case SQLITE_TEXT: {
+      const char *z = (const char*)sqlite3_value_text(pVal);
+      int nAlloc = 0;
+      while ( z && *z ) {
+        char *zEnd;
+        double r = strtod(z, &zEnd);
+        if ( zEnd == z || isalpha((unsigned char)*z) ) {
+          z++;
+          continue;
+        }
+        z = zEnd;
+        if ( n >= nAlloc ) {
+          double *aNew;
+          nAlloc = nAlloc ? nAlloc * 2 : 64;
+          aNew = sqlite3_realloc(a, nAlloc * sizeof(double));
+          if ( aNew == 0 ) {
+            sqlite3_free(a);
+            return -1;
+          }
+          a = aNew;
+        }
+        a[n++] = r;
+      }
+      break;
+    }
+    default:
+      a = sqlite3_malloc( sizeof(double) );
+      if ( a == 0 ) return -1;
+      a[0] = sqlite3_value_double(pVal);
+      n = 1;
+      break;
+  }
+  *pa = a;
+  return n;
+}
+
+static int xbinInterpConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinFuncTab *pInterp;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db,
+                            "CREATE TABLE x(point INTEGER, value REAL, "
+                            "tab HIDDEN, col HIDDEN, points HIDDEN)"
+                           );
+  if ( rc != SQLITE_OK ) return rc;
+  pInterp = sqlite3_malloc( sizeof(*pInterp) );
+  *ppVtab = (sqlite3_vtab*)pInterp;
+  if ( pInterp == 0 ) return SQLITE_NOMEM;
+  memset(pInterp, 0, sizeof(*pInterp));
+  pInterp->pReg = (XbinRegistry*)pAux;
+  return SQLITE_OK;
+}
+
+static int xbinInterpOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinInterpCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void xbinInterpReset(XbinInterpCursor *pCur) {
+  int i;
+  sqlite3_free(pCur->aVal);
+  sqlite3_free(pCur->aNull);
+  for (i = 0; i < 3; i++) {
+    sqlite3_value_free(pCur->apArg[i]);
+    pCur->apArg[i] = 0;
+  }
+  pCur->aVal = 0;
+  pCur->aNull = 0;
+  pCur->nPoint = 0;
+  pCur->iPoint = 0;
+}
+
+static int xbinInterpClose(sqlite3_vtab_cursor *cur) {
+  XbinInterpCursor *pCur = (XbinInterpCursor*)cur;
+  xbinInterpReset(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+static int xbinInterpNext(sqlite3_vtab_cursor *cur) {
+  ((XbinInterpCursor*)cur)->iPoint++;
+  return SQLITE_OK;
+}
+
+static int xbinInterpFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinInterpCursor *pCur = (XbinInterpCursor*)pVtabCursor;
+  sqlite3_vtab *pVtab = pVtabCursor->pVtab;
+  XbinTable *pTab = 0;
+  const char *zCol;
+  double *aX = 0;
+  sqlite3_int64 *aRow = 0;
+  double *aW = 0;
+  xbinData *aRec = 0;
+  int nCorner;
+  int nX;
+  int iCol;
+  int rc;
+  int i;
+  (void)idxNum; (void)idxStr;
+
+  xbinInterpReset(pCur);
+  if ( argc != 3 ) return SQLITE_OK;
+  for (i = 0; i < argc; i++) {
+    pCur->apArg[i] = sqlite3_value_dup(argv[i]);
+    if ( pCur->apArg[i] == 0 ) return SQLITE_NOMEM;
+  }
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = 0;
+  rc = xbinInterpGrid(((XbinFuncTab*)pVtab)->pReg, argv[0], -1, "xbin_interp_batch",
+                      &pTab, &pVtab->zErrMsg);
+  if ( rc != SQLITE_OK ) return rc;
+  zCol = (const char*)sqlite3_value_text(argv[1]);
+  iCol = zCol ? xbinColumnIndex(zCol, (int)strlen(zCol)) : 0;
+  if ( iCol == 0 ) {
+    pVtab->zErrMsg = sqlite3_mprintf("xbin_interp_batch: no such column: %s",
+                                     zCol ? zCol : "NULL");
+    return SQLITE_ERROR;
+  }
+  nX = xbinRealList(argv[2], &aX);
+  if ( nX < 0 ) return SQLITE_NOMEM;
+  if ( nX % pTab->grid.nAxis ) {
+    sqlite3_free(aX);
+    pVtab->zErrMsg = sqlite3_mprintf("xbin_interp_batch: %s is a grid over %d columns, "
+                                     "got %d coordinates", pTab->zName, pTab->grid.nAxis, nX);
+    return SQLITE_ERROR;
+  }
+  pCur->nPoint = nX / pTab->grid.nAxis;
+  nCorner = 1 << pTab->grid.nAxis;
+  if ( (sqlite3_int64)pCur->nPoint * nCorner > 0x7fffffff / (int)sizeof(xbinData) ) {
+    sqlite3_free(aX);
+    pCur->nPoint = 0;
+    return SQLITE_TOOBIG;
+  }
+
+  /* The corners of every point, 0 for the points outside the grid */
+  pCur->aVal = sqlite3_malloc( (pCur->nPoint + 1) * sizeof(double) );
+  pCur->aNull = sqlite3_malloc( pCur->nPoint + 1 );
+  aRow = sqlite3_malloc( (pCur->nPoint * nCorner + 1) * sizeof(sqlite3_int64) );
+  aW = sqlite3_malloc( (pCur->nPoint * nCorner + 1) * sizeof(double) );
+  aRec = sqlite3_malloc( (pCur->nPoint * nCorner + 1) * sizeof(xbinData) );
+  if ( pCur->aVal == 0 || pCur->aNull == 0 || aRow == 0 || aW == 0 || aRec == 0 ) {
+    rc = SQLITE_NOMEM;
+  } else {
+    for (i = 0; i < pCur->nPoint; i++) {
+      sqlite3_int64 *aCellRow = &aRow[i * nCorner];
+      if ( !xbinGridCell(&pTab->grid, &aX[i * pTab->grid.nAxis], aCellRow, &aW[i * nCorner]) ) {
+        memset(aCellRow, 0, nCorner * sizeof(sqlite3_int64));
+        pCur->aNull[i] = 1;
+      } else {
+        pCur->aNull[i] = 0;
+      }
+    }
+    rc = xbinGatherRows(pTab, aRow, aRec, pCur->nPoint * nCorner);
+  }
+  for (i = 0; rc == SQLITE_OK && i < pCur->nPoint; i++) {
+    if ( pCur->aNull[i] ) continue;
+    pCur->aNull[i] = !xbinInterpValue(pTab, iCol, &aRow[i * nCorner], &aW[i * nCorner],
+                                      &aRec[i * nCorner], &pCur->aVal[i]);
+  }
+  if ( rc != SQLITE_OK ) pCur->nPoint = 0;
+  sqlite3_free(aX);
+  sqlite3_free(aRow);
+  sqlite3_free(aW);
+  sqlite3_free(aRec);
+  return rc;
+}
+
+static int xbinInterpEof(sqlite3_vtab_cursor *cur) {
+  XbinInterpCursor *pCur = (XbinInterpCursor*)cur;
+  return pCur->iPoint >= pCur->nPoint;
+}
+
+static int xbinInterpColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinInterpCursor *pCur = (XbinInterpCursor*)cur;
+  if ( i == 0 ) {
+    sqlite3_result_int(ctx, pCur->iPoint + 1);
+  } else if ( i == 1 ) {
+    if ( !pCur->aNull[pCur->iPoint] ) sqlite3_result_double(ctx, pCur->aVal[pCur->iPoint]);
+  } else if ( pCur->apArg[i - XBIN_INTERP_TAB] ) {
+    sqlite3_result_value(ctx, pCur->apArg[i - XBIN_INTERP_TAB]);
+  }
+  return SQLITE_OK;
+}
+
+static int xbinInterpRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  *pRowid = ((XbinInterpCursor*)cur)->iPoint + 1;
+  return SQLITE_OK;
+}
+
+/*
+** TABLE, COLUMN and POINTS must all be given with =.
+*/
+static int xbinInterpBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+  int aIdx[3] = { -1, -1, -1 };
+  int i;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    int iArg = pCons->iColumn - XBIN_INTERP_TAB;
+    if ( iArg < 0 || iArg > 2 ) continue;
+    if ( !pCons->usable ) return SQLITE_CONSTRAINT;
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ) aIdx[iArg] = i;
+  }
+  if ( aIdx[0] < 0 || aIdx[1] < 0 || aIdx[2] < 0 ) {
+    sqlite3_free(tab->zErrMsg);
+    tab->zErrMsg = sqlite3_mprintf("xbin_interp_batch: TABLE, COLUMN and POINTS are required");
+    return SQLITE_ERROR;
+  }
+  for (i = 0; i < 3; i++) {
+    pIdxInfo->aConstraintUsage[aIdx[i]].argvIndex = i + 1;
+    pIdxInfo->aConstraintUsage[aIdx[i]].omit = 1;
+  }
+  pIdxInfo->estimatedCost = 100.0;
+  pIdxInfo->estimatedRows = 100;
+  return SQLITE_OK;
+}
+
+static sqlite3_module xbinInterpModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ xbinInterpConnect,
+  /* xBestIndex  */ xbinInterpBestIndex,
+  /* xDisconnect */ xbinFuncDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ xbinInterpOpen,
+  /* xClose      */ xbinInterpClose,
+  /* xFilter     */ xbinInterpFilter,
+  /* xNext       */ xbinInterpNext,
+  /* xEof        */ xbinInterpEof,
+  /* xColumn     */ xbinInterpColumn,
+  /* xRowid      */ xbinInterpRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+
+/*
+** xbin_downsample(TABLE, COLUMN, ROW_FROM, ROW_TO, BUCKETS) is a
+** table-valued function that splits rows ROW_FROM..ROW_TO of the xbin
+** table TABLE into BUCKETS runs of rows as even as can be, and returns
+** the min, max, avg and count of COLUMN over each of them, for plotting
+** a signal one pixel per bucket:
+**
+**    select bucket, min, max from xbin_downsample('log', 'torque', 1, 5000000, 1000);
+**
+** A NULL ROW_FROM or ROW_TO stands for the first or last record.  When
+** the buckets are wide, they are summed up from the rollup pyramid of
+** COLUMN (see xbinPyrRefresh()), reading O(BUCKETS) records instead of
+** all of them.  Narrow buckets are summed up in one pass over the rows.
+** The results are exact either way.
+*/
+typedef struct XbinDownsampleCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  XbinRollup *aOut;           /* One entry per bucket */
+  sqlite3_int64 iFrom;        /* First row of the first bucket */
+  sqlite3_int64 nRange;       /* Rows in all the buckets */
+  sqlite3_int64 nBucket;      /* Number of buckets */
+  sqlite3_int64 iBucket;      /* Current bucket */
+  int iCol;                   /* Column summed up, for xbinDownsampleBlock() */
+  sqlite3_value *apArg[5];    /* Arguments, for the hidden columns */
+} XbinDownsampleCursor;
+
+#define XBIN_DOWNSAMPLE_TAB  7  /* Hidden column TABLE, then COLUMN .. BUCKETS */
+
+/* First row of bucket i, or one past the last row if i is nBucket */
+static sqlite3_int64 xbinDownsampleStart(const XbinDownsampleCursor *pCur, sqlite3_int64 i) {
+  return pCur->iFrom + (sqlite3_int64)((double)i * pCur->nRange / pCur->nBucket);
+}
+
+/* Add the records of a block to the buckets they fall in */
+static int xbinDownsampleBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinDownsampleCursor *pCur = (XbinDownsampleCursor*)pArg;
+  int i = 0;
+  while ( i < nRec ) {
+    sqlite3_int64 n = xbinDownsampleStart(pCur, pCur->iBucket + 1) - (iRow + i);
+    if ( n <= 0 ) {
+      pCur->iBucket++;
+      continue;
+    }
+    if ( n > nRec - i ) n = nRec - i;
+    xbinRollupAdd(&pCur->aOut[pCur->iBucket], &aRec[i], (int)n, pCur->iCol);
+    i += (int)n;
+  }
+  return SQLITE_OK;
+}
+
+static int xbinDownsampleConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinFuncTab *pDown;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db,
+                            "CREATE TABLE x(bucket INTEGER, first_row INTEGER, last_row INTEGER, "
+                            "min REAL, max REAL, avg REAL, count INTEGER, tab HIDDEN, "
+                            "col HIDDEN, row_from HIDDEN, row_to HIDDEN, buckets HIDDEN)"
+                           );
+  if ( rc != SQLITE_OK ) return rc;
+  pDown = sqlite3_malloc( sizeof(*pDown) );
+  *ppVtab = (sqlite3_vtab*)pDown;
+  if ( pDown == 0 ) return SQLITE_NOMEM;
+  memset(pDown, 0, sizeof(*pDown));
+  pDown->pReg = (XbinRegistry*)pAux;
+  return SQLITE_OK;
+}
+
+static int xbinDownsampleOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinDownsampleCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void xbinDownsampleReset(XbinDownsampleCursor *pCur) {
+  int i;
+  sqlite3_free(pCur->aOut);
+  for (i = 0; i < 5; i++) {
+    sqlite3_value_free(pCur->apArg[i]);
+    pCur->apArg[i] = 0;
+  }
+  pCur->aOut = 0;
+  pCur->nBucket = 0;
+  pCur->iBucket = 0;
+}
+
+static int xbinDownsampleClose(sqlite3_vtab_cursor *cur) {
+  XbinDownsampleCursor *pCur = (XbinDownsampleCursor*)cur;
+  xbinDownsampleReset(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+static int xbinDownsampleNext(sqlite3_vtab_cursor *cur) {
+  ((XbinDownsampleCursor*)cur)->iBucket++;
+  return SQLITE_OK;
+}
+
+static int xbinDownsampleFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinDownsampleCursor *pCur = (XbinDownsampleCursor*)pVtabCursor;
+  sqlite3_vtab *pVtab = pVtabCursor->pVtab;
+  XbinTable *pTab;
+  const char *zCol;
+  sqlite3_int64 iFrom, iTo;
+  sqlite3_int64 i;
+  int rc = SQLITE_OK;
+  (void)idxNum; (void)idxStr;
+
+  xbinDownsampleReset(pCur);
+  if ( argc != 5 ) return SQLITE_OK;
+  for (i = 0; i < argc; i++) {
+    pCur->apArg[i] = sqlite3_value_dup(argv[i]);
+    if ( pCur->apArg[i] == 0 ) return SQLITE_NOMEM;
+  }
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = 0;
+  pTab = xbinFindTable(((XbinFuncTab*)pVtab)->pReg, (const char*)sqlite3_value_text(argv[0]),
+                       &pVtab->zErrMsg);
+  if ( pTab == 0 ) return SQLITE_ERROR;
+  zCol = (const char*)sqlite3_value_text(argv[1]);
+  pCur->iCol = zCol ? xbinColumnIndex(zCol, (int)strlen(zCol)) : 0;
+  if ( pCur->iCol == 0 ) {
+    pVtab->zErrMsg = sqlite3_mprintf("xbin_downsample: no such column: %s",
+                                     zCol ? zCol : "NULL");
+    return SQLITE_ERROR;
+  }
+
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  iFrom = sqlite3_value_type(argv[2]) == SQLITE_NULL ? 1 : sqlite3_value_int64(argv[2]);
+  iTo = sqlite3_value_type(argv[3]) == SQLITE_NULL ? pTab->nRow : sqlite3_value_int64(argv[3]);
+  if ( iFrom < 1 ) iFrom = 1;
+  if ( iTo > pTab->nRow ) iTo = pTab->nRow;
+  if ( iFrom > iTo ) return SQLITE_OK;
+  pCur->iFrom = iFrom;
+  pCur->nRange = iTo - iFrom + 1;
+  pCur->nBucket = sqlite3_value_int64(argv[4]);
+  if ( pCur->nBucket > pCur->nRange ) pCur->nBucket = pCur->nRange;
+  if ( pCur->nBucket <= 0 ) {
+    pCur->nBucket = 0;
+    return SQLITE_OK;
+  }
+  if ( pCur->nBucket > 0x7fffffff / (int)sizeof(XbinRollup) ) {
+    pCur->nBucket = 0;
+    return SQLITE_TOOBIG;
+  }
+  pCur->aOut = sqlite3_malloc64( pCur->nBucket * sizeof(XbinRollup) );
+  if ( pCur->aOut == 0 ) {
+    pCur->nBucket = 0;
+    return SQLITE_NOMEM;
+  }
+
+  if ( pCur->nRange / pCur->nBucket < (2 << XBIN_PYR_SHIFT) ) {
+    for (i = 0; i < pCur->nBucket; i++) xbinRollupInit(&pCur->aOut[i]);
+    rc = xbinForEachBlock(pTab->fptr, iFrom, iTo, xbinDownsampleBlock, pCur);
+  } else {
+    rc = xbinPyrRefresh(pTab, pCur->iCol, 1);
+    for (i = 0; rc == SQLITE_OK && i < pCur->nBucket; i++) {
+      xbinPyrRange(pTab->apPyr[pCur->iCol - 1], pTab->fptr, xbinDownsampleStart(pCur, i),
+                   xbinDownsampleStart(pCur, i + 1) - 1, &pCur->aOut[i]);
+    }
+  }
+  pCur->iBucket = 0;
+  if ( rc != SQLITE_OK ) pCur->nBucket = 0;
+  return rc;
+}
+
+static int xbinDownsampleEof(sqlite3_vtab_cursor *cur) {
+  XbinDownsampleCursor *pCur = (XbinDownsampleCursor*)cur;
+  return pCur->iBucket >= pCur->nBucket;
+}
+
+static int xbinDownsampleColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinDownsampleCursor *pCur = (XbinDownsampleCursor*)cur;
+  const XbinRollup *p = &pCur->aOut[pCur->iBucket];
+  switch ( i ) {
+    case 0:
+      sqlite3_result_int64(ctx, pCur->iBucket + 1);
+      break;
+    case 1:
+      sqlite3_result_int64(ctx, xbinDownsampleStart(pCur, pCur->iBucket));
+      break;
+    case 2:
+      sqlite3_result_int64(ctx, xbinDownsampleStart(pCur, pCur->iBucket + 1) - 1);
+      break;
+    case 3:
+      if ( p->nValue ) sqlite3_result_double(ctx, p->rMin);
+      break;
+    case 4:
+      if ( p->nValue ) sqlite3_result_double(ctx, p->rMax);
+      break;
+    case 5:
+      if ( p->nValue ) sqlite3_result_double(ctx, p->rSum / p->nValue);
+      break;
+    case 6:
+      sqlite3_result_int64(ctx, p->nValue);
+      break;
+    default:
+      if ( pCur->apArg[i - XBIN_DOWNSAMPLE_TAB] ) {
+        sqlite3_result_value(ctx, pCur->apArg[i - XBIN_DOWNSAMPLE_TAB]);
+      }
+      break;
+  }
+  return SQLITE_OK;
+}
+
+static int xbinDownsampleRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  *pRowid = ((XbinDownsampleCursor*)cur)->iBucket + 1;
+  return SQLITE_OK;
+}
+
+/*
+** All five arguments must be given with =.
+*/
+static int xbinDownsampleBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+  int aIdx[5] = { -1, -1, -1, -1, -1 };
+  int i;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    int iArg = pCons->iColumn - XBIN_DOWNSAMPLE_TAB;
+    if ( iArg < 0 || iArg > 4 ) continue;
+    if ( !pCons->usable ) return SQLITE_CONSTRAINT;
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ) aIdx[iArg] = i;
+  }
+  for (i = 0; i < 5; i++) {
+    if ( aIdx[i] < 0 ) {
+      sqlite3_free(tab->zErrMsg);
+      tab->zErrMsg = sqlite3_mprintf("xbin_downsample: TABLE, COLUMN, ROW_FROM, ROW_TO "
+                                     "and BUCKETS are required");
+      return SQLITE_ERROR;
+    }
+    pIdxInfo->aConstraintUsage[aIdx[i]].argvIndex = i + 1;
+    pIdxInfo->aConstraintUsage[aIdx[i]].omit = 1;
+  }
+  pIdxInfo->estimatedCost = 1000.0;
+  pIdxInfo->estimatedRows = 1000;
+  return SQLITE_OK;
+}
+
+static sqlite3_module xbinDownsampleModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ xbinDownsampleConnect,
+  /* xBestIndex  */ xbinDownsampleBestIndex,
+  /* xDisconnect */ xbinFuncDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ xbinDownsampleOpen,
+  /* xClose      */ xbinDownsampleClose,
+  /* xFilter     */ xbinDownsampleFilter,
+  /* xNext       */ xbinDownsampleNext,
+  /* xEof        */ xbinDownsampleEof,
+  /* xColumn     */ xbinDownsampleColumn,
+  /* xRowid      */ xbinDownsampleRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+
+/*
+** xbin_agg(TABLE, COLUMN, AGGS, ROW_FROM, ROW_TO) is a table-valued
+** function that returns one row with the count, sum, min, max and avg
+** of COLUMN over rows ROW_FROM..ROW_TO of the xbin table TABLE:
+**
+**    select sum, min, max from xbin_agg('xbin', 'torque', 'sum,min,max', 1, 1000000);
+**
+** AGGS lists the aggregates wanted, the others coming back NULL, and
+** ROW_FROM and ROW_TO default to the first and last record; all three
+** may be left out or NULL.  The records are read a block at a time and
+** the column summed up by a vector kernel (see xbinRollupAdd()), none
+** of them going through xColumn and an aggregate step.  If the column
+** has a rollup pyramid (see xbin_downsample()), most of the rows are
+** not even read.
+*/
+typedef struct XbinAggCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  XbinRollup r;               /* The aggregates */
+  unsigned int mAgg;          /* Columns of the aggregates wanted */
+  int iCol;                   /* Column summed up */
+  int bEof;                   /* True once the row has been returned */
+  sqlite3_value *apArg[5];    /* Arguments, for the hidden columns */
+} XbinAggCursor;
+
+#define XBIN_AGG_TAB  5       /* Hidden column TABLE, then COLUMN .. ROW_TO */
+
+static const char *const azXbinAgg[] = { "count", "sum", "min", "max", "avg" };
+
+/*
+** Parse AGGS, a comma separated list of names of columns of xbin_agg(),
+** into a mask of them.  Return 0, with an error in *pzErr, if one of
+** the names is unknown.
+*/
+static unsigned int xbinAggParse(const char *z, char **pzErr) {
+  unsigned int mAgg = 0;
+  while ( *z ) {
+    int n, i;
+    while ( *z == ',' || isspace((unsigned char)*z) ) z++;
+    for (n = 0; z[n] && z[n] != ',' && !isspace((unsigned char)z[n]); n++) {}
+    if ( n == 0 ) break;
+    for (i = 0; i < 5; i++) {
+      if ( sqlite3_strnicmp(z, azXbinAgg[i], n) == 0 && azXbinAgg[i][n] == 0 ) break;
+    }
+    if ( i == 5 ) {
+      *pzErr = sqlite3_mprintf("xbin_agg: unknown aggregate: %.*s", n, z);
+      return 0;
+    }
+    mAgg |= 1u << i;
+    z += n;
+  }
+  if ( mAgg == 0 ) *pzErr = sqlite3_mprintf("xbin_agg: no aggregate in AGGS");
+  return mAgg;
+}
+
+static int xbinAggBlock(void *pArg, sqlite3_int64 iRow, const xbinData *aRec, int nRec) {
+  XbinAggCursor *pCur = (XbinAggCursor*)pArg;
+  (void)iRow;
+  xbinRollupAdd(&pCur->r, aRec, nRec, pCur->iCol);
+  return SQLITE_OK;
+}
+
+static int xbinAggConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinFuncTab *pAgg;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db,
+                            "CREATE TABLE x(count INTEGER, sum REAL, min REAL, max REAL, "
+                            "avg REAL, tab HIDDEN, col HIDDEN, aggs HIDDEN, "
+                            "row_from HIDDEN, row_to HIDDEN)"
+                           );
+  if ( rc != SQLITE_OK ) return rc;
+  pAgg = sqlite3_malloc( sizeof(*pAgg) );
+  *ppVtab = (sqlite3_vtab*)pAgg;
+  if ( pAgg == 0 ) return SQLITE_NOMEM;
+  memset(pAgg, 0, sizeof(*pAgg));
+  pAgg->pReg = (XbinRegistry*)pAux;
+  return SQLITE_OK;
+}
+
+static int xbinAggOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinAggCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  pCur->bEof = 1;
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void xbinAggReset(XbinAggCursor *pCur) {
+  int i;
+  for (i = 0; i < 5; i++) {
+    sqlite3_value_free(pCur->apArg[i]);
+    pCur->apArg[i] = 0;
+  }
+  xbinRollupInit(&pCur->r);
+  pCur->bEof = 1;
+}
+
+static int xbinAggClose(sqlite3_vtab_cursor *cur) {
+  XbinAggCursor *pCur = (XbinAggCursor*)cur;
+  xbinAggReset(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+static int xbinAggNext(sqlite3_vtab_cursor *cur) {
+  ((XbinAggCursor*)cur)->bEof = 1;
+  return SQLITE_OK;
+}
+
+/*
+** Bit i of idxNum is set if argument i of xbin_agg() is in argv[].
+*/
+static int xbinAggFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinAggCursor *pCur = (XbinAggCursor*)pVtabCursor;
+  sqlite3_vtab *pVtab = pVtabCursor->pVtab;
+  sqlite3_value *apArg[5] = { 0, 0, 0, 0, 0 };
+  XbinTable *pTab;
+  const char *zCol;
+  sqlite3_int64 iFrom, iTo;
+  int rc = SQLITE_OK;
+  int i, j;
+  (void)idxStr;
+
+  xbinAggReset(pCur);
+  for (i = j = 0; i < 5 && j < argc; i++) {
+    if ( idxNum & (1 << i) ) {
+      apArg[i] = argv[j++];
+      pCur->apArg[i] = sqlite3_value_dup(apArg[i]);
+      if ( pCur->apArg[i] == 0 ) return SQLITE_NOMEM;
+    }
+  }
+  if ( apArg[0] == 0 || apArg[1] == 0 ) return SQLITE_OK;
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = 0;
+  pTab = xbinFindTable(((XbinFuncTab*)pVtab)->pReg, (const char*)sqlite3_value_text(apArg[0]),
+                       &pVtab->zErrMsg);
+  if ( pTab == 0 ) return SQLITE_ERROR;
+  zCol = (const char*)sqlite3_value_text(apArg[1]);
+  pCur->iCol = zCol ? xbinColumnIndex(zCol, (int)strlen(zCol)) : 0;
+  if ( pCur->iCol == 0 ) {
+    pVtab->zErrMsg = sqlite3_mprintf("xbin_agg: no such column: %s", zCol ? zCol : "NULL");
+    return SQLITE_ERROR;
+  }
+  if ( apArg[2] && sqlite3_value_type(apArg[2]) != SQLITE_NULL ) {
+    pCur->mAgg = xbinAggParse((const char*)sqlite3_value_text(apArg[2]), &pVtab->zErrMsg);
+    if ( pCur->mAgg == 0 ) return pVtab->zErrMsg ? SQLITE_ERROR : SQLITE_NOMEM;
+  } else {
+    pCur->mAgg = 0x1f;
+  }
+
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  iFrom = 1;
+  iTo = pTab->nRow;
+  if ( apArg[3] && sqlite3_value_type(apArg[3]) != SQLITE_NULL ) {
+    iFrom = sqlite3_value_int64(apArg[3]);
+    if ( iFrom < 1 ) iFrom = 1;
+  }
+  if ( apArg[4] && sqlite3_value_type(apArg[4]) != SQLITE_NULL ) {
+    iTo = sqlite3_value_int64(apArg[4]);
+    if ( iTo > pTab->nRow ) iTo = pTab->nRow;
+  }
+  if ( iFrom <= iTo ) {
+    rc = xbinPyrRefresh(pTab, pCur->iCol, 0);
+    if ( rc == SQLITE_OK ) {
+      xbinPyrRange(pTab->apPyr[pCur->iCol - 1], pTab->fptr, iFrom, iTo, &pCur->r);
+    } else if ( rc == SQLITE_NOTFOUND ) {
+      rc = xbinForEachBlock(pTab->fptr, iFrom, iTo, xbinAggBlock, pCur);
+    }
+  }
+  if ( rc == SQLITE_OK ) pCur->bEof = 0;
+  return rc;
+}
+
+static int xbinAggEof(sqlite3_vtab_cursor *cur) {
+  return ((XbinAggCursor*)cur)->bEof;
+}
+
+static int xbinAggColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinAggCursor *pCur = (XbinAggCursor*)cur;
+  const XbinRollup *p = &pCur->r;
+  if ( i >= XBIN_AGG_TAB ) {
+    if ( pCur->apArg[i - XBIN_AGG_TAB] ) {
+      sqlite3_result_value(ctx, pCur->apArg[i - XBIN_AGG_TAB]);
+    }
+    return SQLITE_OK;
+  }
+  if ( (pCur->mAgg & (1u << i)) == 0 ) return SQLITE_OK;
+  if ( i == 0 ) {
+    sqlite3_result_int64(ctx, p->nValue);
+  } else if ( p->nValue ) {
+    switch ( i ) {
+      case 1: sqlite3_result_double(ctx, p->rSum); break;
+      case 2: sqlite3_result_double(ctx, p->rMin); break;
+      case 3: sqlite3_result_double(ctx, p->rMax); break;
+      case 4: sqlite3_result_double(ctx, p->rSum / p->nValue); break;
+    }
+  }
+  return SQLITE_OK;
+}
+
+static int xbinAggRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  (void)cur;
+  *pRowid = 1;
+  return SQLITE_OK;
+}
+
+/*
+** TABLE and COLUMN must be given with =, and so must the other
+** arguments if they are given at all.
+*/
+static int xbinAggBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+  int aIdx[5] = { -1, -1, -1, -1, -1 };
+  int nArg = 0;
+  int i;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    int iArg = pCons->iColumn - XBIN_AGG_TAB;
+    if ( iArg < 0 || iArg > 4 ) continue;
+    if ( !pCons->usable ) return SQLITE_CONSTRAINT;
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ) aIdx[iArg] = i;
+  }
+  if ( aIdx[0] < 0 || aIdx[1] < 0 ) {
+    sqlite3_free(tab->zErrMsg);
+    tab->zErrMsg = sqlite3_mprintf("xbin_agg: TABLE and COLUMN are required");
+    return SQLITE_ERROR;
+  }
+  pIdxInfo->idxNum = 0;
+  for (i = 0; i < 5; i++) {
+    if ( aIdx[i] < 0 ) continue;
+    pIdxInfo->aConstraintUsage[aIdx[i]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[aIdx[i]].omit = 1;
+    pIdxInfo->idxNum |= 1 << i;
+  }
+  pIdxInfo->estimatedCost = 1000.0;
+  pIdxInfo->estimatedRows = 1;
+  pIdxInfo->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+  return SQLITE_OK;
+}
+
+static sqlite3_module xbinAggModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ xbinAggConnect,
+  /* xBestIndex  */ xbinAggBestIndex,
+  /* xDisconnect */ xbinFuncDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ xbinAggOpen,
+  /* xClose      */ xbinAggClose,
+  /* xFilter     */ xbinAggFilter,
+  /* xNext       */ xbinAggNext,
+  /* xEof        */ xbinAggEof,
+  /* xColumn     */ xbinAggColumn,
+  /* xRowid      */ xbinAggRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+
+/*
+** xbin_stats(TABLE) is a table-valued function that returns a row per
+** column of the xbin table TABLE, with the count of values that are
+** not NULL, the count of NULLs, and the min, max, mean and sample
+** standard deviation of the values:
+**
+**    select * from xbin_stats('xbin');
+**
+** The statistics are made by one parallel pass over the file, then kept
+** and brought up to date as xbinStatsRefresh() tells, so that they come
+** back without reading the file again.
+*/
+typedef struct XbinStatsCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  XbinColStats aStats[XBIN_NCOL];  /* The statistics */
+  sqlite3_int64 nRow;         /* Records they cover */
+  int iCol;                   /* Current column, from 1 */
+  sqlite3_value *pArg;        /* TABLE, for the hidden column */
+} XbinStatsCursor;
+
+#define XBIN_STATS_TAB  7     /* Hidden column TABLE */
+
+static int xbinStatsConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinFuncTab *pStats;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db,
+                            "CREATE TABLE x(name TEXT, count INTEGER, nulls INTEGER, "
+                            "min REAL, max REAL, mean REAL, stddev REAL, tab HIDDEN)"
+                           );
+  if ( rc != SQLITE_OK ) return rc;
+  pStats = sqlite3_malloc( sizeof(*pStats) );
+  *ppVtab = (sqlite3_vtab*)pStats;
+  if ( pStats == 0 ) return SQLITE_NOMEM;
+  memset(pStats, 0, sizeof(*pStats));
+  pStats->pReg = (XbinRegistry*)pAux;
+  return SQLITE_OK;
+}
+
+static int xbinStatsOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinStatsCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  pCur->iCol = XBIN_NCOL + 1;
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static int xbinStatsClose(sqlite3_vtab_cursor *cur) {
+  XbinStatsCursor *pCur = (XbinStatsCursor*)cur;
+  sqlite3_value_free(pCur->pArg);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+static int xbinStatsNext(sqlite3_vtab_cursor *cur) {
+  ((XbinStatsCursor*)cur)->iCol++;
+  return SQLITE_OK;
+}
+
+static int xbinStatsFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinStatsCursor *pCur = (XbinStatsCursor*)pVtabCursor;
+  sqlite3_vtab *pVtab = pVtabCursor->pVtab;
+  XbinTable *pTab;
+  int rc;
+  (void)idxNum; (void)idxStr;
+
+  sqlite3_value_free(pCur->pArg);
+  pCur->pArg = 0;
+  pCur->iCol = XBIN_NCOL + 1;
+  if ( argc != 1 ) return SQLITE_OK;
+  pCur->pArg = sqlite3_value_dup(argv[0]);
+  if ( pCur->pArg == 0 ) return SQLITE_NOMEM;
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = 0;
+  pTab = xbinFindTable(((XbinFuncTab*)pVtab)->pReg, (const char*)sqlite3_value_text(argv[0]),
+                       &pVtab->zErrMsg);
+  if ( pTab == 0 ) return SQLITE_ERROR;
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  rc = xbinStatsRefresh(pTab);
+  if ( rc != SQLITE_OK ) return rc;
+  memcpy(pCur->aStats, pTab->aStats, sizeof(pCur->aStats));
+  pCur->nRow = pTab->nRow;
+  pCur->iCol = 1;
+  return SQLITE_OK;
+}
+
+static int xbinStatsEof(sqlite3_vtab_cursor *cur) {
+  return ((XbinStatsCursor*)cur)->iCol > XBIN_NCOL;
+}
+
+static int xbinStatsColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinStatsCursor *pCur = (XbinStatsCursor*)cur;
+  const XbinColStats *p = &pCur->aStats[pCur->iCol - 1];
+  switch ( i ) {
+    case 0:
+      sqlite3_result_text(ctx, azXbinCol[pCur->iCol], -1, SQLITE_STATIC);
+      break;
+    case 1:
+      sqlite3_result_int64(ctx, p->nValue);
+      break;
+    case 2:
+      sqlite3_result_int64(ctx, pCur->nRow - p->nValue);
+      break;
+    case 3:
+      if ( p->nValue ) sqlite3_result_double(ctx, p->rMin);
+      break;
+    case 4:
+      if ( p->nValue ) sqlite3_result_double(ctx, p->rMax);
+      break;
+    case 5:
+      if ( p->nValue ) sqlite3_result_double(ctx, p->rMean);
+      break;
+    case 6:
+      if ( p->nValue > 1 ) sqlite3_result_double(ctx, sqrt(p->rM2 / (p->nValue - 1)));
+      break;
+    default:
+      if ( pCur->pArg ) sqlite3_result_value(ctx, pCur->pArg);
+      break;
+  }
+  return SQLITE_OK;
+}
+
+static int xbinStatsRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  *pRowid = ((XbinStatsCursor*)cur)->iCol;
+  return SQLITE_OK;
+}
+
+/*
+** TABLE must be given with =.
+*/
+static int xbinStatsBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+  int iTab = -1;
+  int i;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    if ( pCons->iColumn != XBIN_STATS_TAB ) continue;
+    if ( !pCons->usable ) return SQLITE_CONSTRAINT;
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ) iTab = i;
+  }
+  if ( iTab < 0 ) {
+    sqlite3_free(tab->zErrMsg);
+    tab->zErrMsg = sqlite3_mprintf("xbin_stats: TABLE is required");
+    return SQLITE_ERROR;
+  }
+  pIdxInfo->aConstraintUsage[iTab].argvIndex = 1;
+  pIdxInfo->aConstraintUsage[iTab].omit = 1;
+  pIdxInfo->estimatedCost = 10.0;
+  pIdxInfo->estimatedRows = XBIN_NCOL;
+  return SQLITE_OK;
+}
+
+static sqlite3_module xbinStatsModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ xbinStatsConnect,
+  /* xBestIndex  */ xbinStatsBestIndex,
+  /* xDisconnect */ xbinFuncDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ xbinStatsOpen,
+  /* xClose      */ xbinStatsClose,
+  /* xFilter     */ xbinStatsFilter,
+  /* xNext       */ xbinStatsNext,
+  /* xEof        */ xbinStatsEof,
+  /* xColumn     */ xbinStatsColumn,
+  /* xRowid      */ xbinStatsRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+
+/*
+** Compile argument pVal, the FILTER of table-valued function zFunc, into
+** predicate p the way the filter column of pTab reads it.  Return
+** SQLITE_ERROR with an error in *pzErr if it does not compile.  The
+** caller frees p->pExpr.
+*/
+static int xbinFilterArg(
+  XbinTable *pTab,
+  const char *zFunc,
+  sqlite3_value *pVal,
+  XbinPred *p,
+  char **pzErr
+) {
+  const char *z = (const char*)sqlite3_value_text(pVal);
+  char *zErr = 0;
+
+  memset(p, 0, sizeof(*p));
+  p->iCol = XBIN_FILTER_COL;
+  p->eType = XBIN_PRED_EXPR;
+  if ( z == 0 ) return SQLITE_NOMEM;
+  p->pExpr = xbinExprCompile(pTab, z, &zErr);
+  if ( p->pExpr == 0 ) {
+    *pzErr = sqlite3_mprintf("%s: %s in filter '%s'", zFunc, zErr, z);
+    sqlite3_free(zErr);
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Point *ppFilter of a thread at p and give it the room to evaluate p
+** a block at a time.  The caller frees *paOut and *paReg.
+*/
+static int xbinJobFilter(
+  const XbinPred **ppFilter,
+  double **paOut,
+  double **paReg,
+  const XbinPred *p
+) {
+  *ppFilter = p;
+  *paOut = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(double) );
+  *paReg = sqlite3_malloc64( (sqlite3_uint64)p->pExpr->nReg * XBIN_BLOCK_ROWS * sizeof(double) );
+  return *paOut && *paReg ? SQLITE_OK : SQLITE_NOMEM;
+}
+
+/*
+** xbin_histogram(TABLE, COLX, NX, COLY, NY, FILTER) is a table-valued
+** function that counts the records of the xbin table TABLE in NX bins
+** of column COLX, or in NX by NY bins of COLX and COLY:
+**
+**    select * from xbin_histogram('log', 'speed', 100, 'torque', 50);
+**    select * from xbin_histogram('log', 'speed', '30,0,3000', null, null, 'torque > 10');
+**
+** NX (and NY) is the number of bins, spread evenly from the smallest to
+** the largest value of the column as xbin_stats() has them, or a list
+** 'N,LO,HI' of the number of bins and the bounds.  Values outside the
+** bounds, and NULLs, are not counted.  FILTER, if not NULL, keeps only
+** the records that pass it, as the filter column of TABLE reads it
+** (see the "filter" constraint of the xbin table).  A row comes
+** back for every bin, numbered from 1, with its bounds and count.
+**
+** The records are split into runs of whole blocks, one per thread,
+** each counting into bins of its own that are added up at the end.
+** Blocks that the zone maps show no record of passes FILTER are not
+** read.
+*/
+#define XBIN_HIST_MAX_BINS  (1 << 20)
+
+/* Bins of one column */
+typedef struct XbinHistAxis {
+  int iCol;                   /* Column, 0 for the Y axis of a 1-D histogram */
+  int nBin;                   /* Number of bins */
+  double rLo, rHi;            /* Lowest and highest value counted */
+  double rScale;              /* Bins per unit of value */
+} XbinHistAxis;
+
+typedef struct XbinHistJob {
+  XbinTask task;
+  XbinTable *pTab;            /* For its zone maps only */
+  FILE *fptr;                 /* File handle of this thread */
+  xbinData *aRec;             /* Buffer of XBIN_BLOCK_ROWS records */
+  int *aSel;                  /* Selection vector of XBIN_BLOCK_ROWS rows */
+  const XbinHistAxis *aAxis;  /* The two axes */
+  const XbinPred *pFilter;    /* FILTER, or NULL */
+  double *aFilter;            /* Values of FILTER over a block */
+  double *aReg;               /* Registers for FILTER */
+  sqlite3_int64 iStart;       /* First row, at the start of a block */
+  sqlite3_int64 iEnd;         /* Last row */
+  sqlite3_int64 *aCount;      /* Count of each bin, X moving fastest */
+} XbinHistJob;
+
+/* Bin of value v on axis p, or -1 if it is not counted */
+static int xbinHistBin(const XbinHistAxis *p, double v) {
+  int i;
+  if ( !(v >= p->rLo && v <= p->rHi) ) return -1;
+  i = (int)((v - p->rLo) * p->rScale);
+  return i < p->nBin ? i : p->nBin - 1;
+}
+
+static void xbinHistWork(void *pArg) {
+  XbinHistJob *pJob = (XbinHistJob*)pArg;
+  const XbinHistAxis *pX = &pJob->aAxis[0];
+  const XbinHistAxis *pY = &pJob->aAxis[1];
+  sqlite3_int64 iRow = pJob->iStart;
+  int bSeek = 1;
+  int i;
+
+  while ( iRow <= pJob->iEnd ) {
+    sqlite3_int64 iZone = (iRow - 1) / XBIN_BLOCK_ROWS;
+    sqlite3_int64 n = pJob->iEnd - iRow + 1;
+    int nSel;
+    if ( n > XBIN_BLOCK_ROWS ) n = XBIN_BLOCK_ROWS;
+    if ( pJob->pFilter && iRow + n - 1 <= pJob->pTab->nZoneRow
+      && xbinZoneSkip(pJob->pTab, iZone, pJob->pFilter, 1) ) {
+      iRow += n;
+      bSeek = 1;
+      continue;
+    }
+    if ( bSeek
+      && xbin_fseek(pJob->fptr, (iRow - 1) * (sqlite3_int64)sizeof(xbinData), SEEK_SET) != 0 ) {
+      return;
+    }
+    bSeek = 0;
+    n = (sqlite3_int64)fread(pJob->aRec, sizeof(xbinData), (size_t)n, pJob->fptr);
+    if ( n <= 0 ) break;
+    for (i = 0; i < n; i++) pJob->aSel[i] = i;
+    nSel = (int)n;
+    if ( pJob->pFilter ) {
+      nSel = xbinExprSelect(pJob->pFilter->pExpr, pJob->aRec, pJob->aSel, nSel,
+                            pJob->aFilter, pJob->aReg);
+    }
+    for (i = 0; i < nSel; i++) {
+      const xbinData *p = &pJob->aRec[pJob->aSel[i]];
+      int ix = xbinHistBin(pX, XBIN_VALUE(p, pX->iCol));
+      int iy = 0;
+      if ( ix < 0 ) continue;
+      if ( pY->iCol ) {
+        iy = xbinHistBin(pY, XBIN_VALUE(p, pY->iCol));
+        if ( iy < 0 ) continue;
+      }
+      pJob->aCount[(sqlite3_int64)iy * pX->nBin + ix]++;
+    }
+    iRow += n;
+  }
+}
+
+typedef struct XbinHistCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  XbinHistAxis aAxis[2];      /* X and Y axes */
+  sqlite3_int64 *aCount;      /* Count of each bin, X moving fastest */
+  sqlite3_int64 nBin;         /* Number of bins */
+  sqlite3_int64 iBin;         /* Current bin */
+  sqlite3_value *apArg[6];    /* Arguments, for the hidden columns */
+} XbinHistCursor;
+
+#define XBIN_HIST_TAB  7      /* Hidden column TABLE, then COLX .. FILTER */
+
+/*
+** Set up axis p for column zCol and NX argument pN of xbin_histogram().
+** Return SQLITE_ERROR with an error in *pzErr if they are not usable.
+*/
+static int xbinHistAxis(
+  XbinTable *pTab,
+  const char *zCol,
+  sqlite3_value *pN,
+  XbinHistAxis *p,
+  char **pzErr
+) {
+  double *a = 0;
+  int n;
+
+  p->iCol = zCol ? xbinColumnIndex(zCol, (int)strlen(zCol)) : 0;
+  if ( p->iCol == 0 ) {
+    *pzErr = sqlite3_mprintf("xbin_histogram: no such column: %s", zCol ? zCol : "NULL");
+    return SQLITE_ERROR;
+  }
+  n = xbinRealList(pN, &a);
+  if ( n < 0 ) return SQLITE_NOMEM;
+  if ( n == 1 || n == 3 ) {
+    p->nBin = a[0] >= 1 && a[0] <= XBIN_HIST_MAX_BINS ? (int)a[0] : 0;
+    if ( n == 3 ) {
+      p->rLo = a[1];
+      p->rHi = a[2];
+    }
+  }
+  sqlite3_free(a);
+  if ( (n != 1 && n != 3) || p->nBin == 0 || (n == 3 && !(p->rLo <= p->rHi)) ) {
+    *pzErr = sqlite3_mprintf("xbin_histogram: bins of %s must be N or 'N,LO,HI' "
+                             "with N from 1 to %d", azXbinCol[p->iCol], XBIN_HIST_MAX_BINS);
+    return SQLITE_ERROR;
+  }
+  if ( n == 1 ) {
+    int rc;
+    pTab->nRow = xbinRowCount(pTab->fptr);
+    rc = xbinStatsRefresh(pTab);
+    if ( rc != SQLITE_OK ) return rc;
+    p->rLo = pTab->aStats[p->iCol - 1].rMin;
+    p->rHi = pTab->aStats[p->iCol - 1].rMax;
+  }
+  p->rScale = p->rHi > p->rLo ? p->nBin / (p->rHi - p->rLo) : 0.0;
+  return SQLITE_OK;
+}
+
+static int xbinHistConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinFuncTab *pHist;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db,
+                            "CREATE TABLE x(bin_x INTEGER, bin_y INTEGER, count INTEGER, "
+                            "x_lo REAL, x_hi REAL, y_lo REAL, y_hi REAL, tab HIDDEN, "
+                            "colx HIDDEN, nx HIDDEN, coly HIDDEN, ny HIDDEN, filter HIDDEN)"
+                           );
+  if ( rc != SQLITE_OK ) return rc;
+  pHist = sqlite3_malloc( sizeof(*pHist) );
+  *ppVtab = (sqlite3_vtab*)pHist;
+  if ( pHist == 0 ) return SQLITE_NOMEM;
+  memset(pHist, 0, sizeof(*pHist));
+  pHist->pReg = (XbinRegistry*)pAux;
+  return SQLITE_OK;
+}
+
+static int xbinHistOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinHistCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void xbinHistReset(XbinHistCursor *pCur) {
+  int i;
+  sqlite3_free(pCur->aCount);
+  for (i = 0; i < 6; i++) {
+    sqlite3_value_free(pCur->apArg[i]);
+    pCur->apArg[i] = 0;
+  }
+  memset(pCur->aAxis, 0, sizeof(pCur->aAxis));
+  pCur->aCount = 0;
+  pCur->nBin = 0;
+  pCur->iBin = 0;
+}
+
+static int xbinHistClose(sqlite3_vtab_cursor *cur) {
+  XbinHistCursor *pCur = (XbinHistCursor*)cur;
+  xbinHistReset(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+static int xbinHistNext(sqlite3_vtab_cursor *cur) {
+  ((XbinHistCursor*)cur)->iBin++;
+  return SQLITE_OK;
+}
+
+/*
+** Bit i of idxNum is set if argument i of xbin_histogram() is in argv[].
+*/
+static int xbinHistFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinHistCursor *pCur = (XbinHistCursor*)pVtabCursor;
+  sqlite3_vtab *pVtab = pVtabCursor->pVtab;
+  sqlite3_value *apArg[6] = { 0, 0, 0, 0, 0, 0 };
+  XbinHistJob aJob[XBIN_MAX_THREADS];
+  XbinPred filter;
+  XbinTable *pTab;
+  sqlite3_int64 nBlock;
+  int bFilter = 0;
+  int nJob = xbinCpuCount();
+  int rc = SQLITE_OK;
+  int i, j;
+  (void)idxStr;
+
+  xbinHistReset(pCur);
+  for (i = j = 0; i < 6 && j < argc; i++) {
+    if ( idxNum & (1 << i) ) {
+      apArg[i] = argv[j++];
+      pCur->apArg[i] = sqlite3_value_dup(apArg[i]);
+      if ( pCur->apArg[i] == 0 ) return SQLITE_NOMEM;
+    }
+  }
+  if ( apArg[0] == 0 || apArg[1] == 0 || apArg[2] == 0 ) return SQLITE_OK;
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = 0;
+  pTab = xbinFindTable(((XbinFuncTab*)pVtab)->pReg, (const char*)sqlite3_value_text(apArg[0]),
+                       &pVtab->zErrMsg);
+  if ( pTab == 0 ) return SQLITE_ERROR;
+  rc = xbinHistAxis(pTab, (const char*)sqlite3_value_text(apArg[1]), apArg[2],
+                    &pCur->aAxis[0], &pVtab->zErrMsg);
+  if ( rc == SQLITE_OK && apArg[3] && sqlite3_value_type(apArg[3]) != SQLITE_NULL ) {
+    if ( apArg[4] == 0 || sqlite3_value_type(apArg[4]) == SQLITE_NULL ) {
+      pVtab->zErrMsg = sqlite3_mprintf("xbin_histogram: COLY needs NY");
+      return SQLITE_ERROR;
+    }
+    rc = xbinHistAxis(pTab, (const char*)sqlite3_value_text(apArg[3]), apArg[4],
+                      &pCur->aAxis[1], &pVtab->zErrMsg);
+  } else {
+    pCur->aAxis[1].nBin = 1;
+  }
+  if ( rc != SQLITE_OK ) return rc;
+  pCur->nBin = (sqlite3_int64)pCur->aAxis[0].nBin * pCur->aAxis[1].nBin;
+  if ( pCur->nBin > XBIN_HIST_MAX_BINS ) {
+    pVtab->zErrMsg = sqlite3_mprintf("xbin_histogram: more than %d bins", XBIN_HIST_MAX_BINS);
+    pCur->nBin = 0;
+    return SQLITE_ERROR;
+  }
+  if ( apArg[5] && sqlite3_value_type(apArg[5]) != SQLITE_NULL ) {
+    rc = xbinFilterArg(pTab, "xbin_histogram", apArg[5], &filter, &pVtab->zErrMsg);
+    if ( rc != SQLITE_OK ) {
+      pCur->nBin = 0;
+      return rc;
+    }
+    bFilter = 1;
+  }
+
+  /* Count in parallel, then add up the bins of every thread */
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  if ( bFilter && xbinZoneRefresh(pTab) != SQLITE_OK ) pTab->nZoneRow = 0;
+  nBlock = (pTab->nRow + XBIN_BLOCK_ROWS - 1) / XBIN_BLOCK_ROWS;
+  if ( nJob > nBlock / XBIN_STATS_RUN ) nJob = (int)(nBlock / XBIN_STATS_RUN);
+  if ( nJob < 1 ) nJob = 1;
+  memset(aJob, 0, sizeof(aJob));
+  for (i = 0; i < nJob; i++) {
+    aJob[i].pTab = pTab;
+    aJob[i].aAxis = pCur->aAxis;
+    aJob[i].iStart = (nBlock * i / nJob) * XBIN_BLOCK_ROWS + 1;
+    aJob[i].iEnd = (nBlock * (i + 1) / nJob) * XBIN_BLOCK_ROWS;
+    if ( aJob[i].iEnd > pTab->nRow ) aJob[i].iEnd = pTab->nRow;
+    aJob[i].aRec = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(xbinData) );
+    aJob[i].aSel = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(int) );
+    aJob[i].aCount = sqlite3_malloc64( pCur->nBin * sizeof(sqlite3_int64) );
+    aJob[i].fptr = i == 0 ? pTab->fptr : fopen(pTab->filename, "rb");
+    if ( aJob[i].aRec == 0 || aJob[i].aSel == 0 || aJob[i].aCount == 0 ) rc = SQLITE_NOMEM;
+    if ( bFilter && xbinJobFilter(&aJob[i].pFilter, &aJob[i].aFilter, &aJob[i].aReg,
+                                  &filter) != SQLITE_OK ) {
+      rc = SQLITE_NOMEM;
+    }
+    if ( aJob[i].fptr == 0 ) rc = SQLITE_CANTOPEN;
+    if ( aJob[i].aCount ) memset(aJob[i].aCount, 0, pCur->nBin * sizeof(sqlite3_int64));
+  }
+  if ( rc == SQLITE_OK ) {
+    for (i = 0; i < nJob; i++) xbinTaskStart(&aJob[i].task, xbinHistWork, &aJob[i]);
+    for (i = 0; i < nJob; i++) xbinTaskJoin(&aJob[i].task);
+    for (i = 1; i < nJob; i++) {
+      sqlite3_int64 k;
+      for (k = 0; k < pCur->nBin; k++) aJob[0].aCount[k] += aJob[i].aCount[k];
+    }
+    pCur->aCount = aJob[0].aCount;
+    aJob[0].aCount = 0;
+  }
+  for (i = 0; i < nJob; i++) {
+    if ( i > 0 && aJob[i].fptr ) fclose(aJob[i].fptr);
+    sqlite3_free(aJob[i].aRec);
+    sqlite3_free(aJob[i].aSel);
+    sqlite3_free(aJob[i].aCount);
+    sqlite3_free(aJob[i].aFilter);
+    sqlite3_free(aJob[i].aReg);
+  }
+  if ( bFilter ) sqlite3_free(filter.pExpr);
+  if ( rc != SQLITE_OK ) pCur->nBin = 0;
+  return rc;
+}
+
+static int xbinHistEof(sqlite3_vtab_cursor *cur) {
+  XbinHistCursor *pCur = (XbinHistCursor*)cur;
+  return pCur->iBin >= pCur->nBin;
+}
+
+static int xbinHistColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinHistCursor *pCur = (XbinHistCursor*)cur;
+  const XbinHistAxis *pX = &pCur->aAxis[0];
+  const XbinHistAxis *pY = &pCur->aAxis[1];
+  int ix = (int)(pCur->iBin % pX->nBin);
+  int iy = (int)(pCur->iBin / pX->nBin);
+  const XbinHistAxis *p = i == 3 || i == 4 ? pX : pY;
+  int iBin = i == 3 || i == 4 ? ix : iy;
+
+  switch ( i ) {
+    case 0:
+      sqlite3_result_int(ctx, ix + 1);
+      break;
+    case 1:
+      if ( pY->iCol ) sqlite3_result_int(ctx, iy + 1);
+      break;
+    case 2:
+      sqlite3_result_int64(ctx, pCur->aCount[pCur->iBin]);
+      break;
+    case 3: case 5:
+      if ( p->iCol ) sqlite3_result_double(ctx, p->rLo + (p->rHi - p->rLo) * iBin / p->nBin);
+      break;
+    case 4: case 6:
+      if ( p->iCol ) {
+        sqlite3_result_double(ctx, iBin + 1 == p->nBin ? p->rHi
+                              : p->rLo + (p->rHi - p->rLo) * (iBin + 1) / p->nBin);
+      }
+      break;
+    default:
+      if ( pCur->apArg[i - XBIN_HIST_TAB] ) {
+        sqlite3_result_value(ctx, pCur->apArg[i - XBIN_HIST_TAB]);
+      }
+      break;
+  }
+  return SQLITE_OK;
+}
+
+static int xbinHistRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  *pRowid = ((XbinHistCursor*)cur)->iBin + 1;
+  return SQLITE_OK;
+}
+
+/*
+** TABLE, COLX and NX must be given with =, and so must the other
+** arguments if they are given at all.
+*/
+static int xbinHistBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+  int aIdx[6] = { -1, -1, -1, -1, -1, -1 };
+  int nArg = 0;
+  int i;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    int iArg = pCons->iColumn - XBIN_HIST_TAB;
+    if ( iArg < 0 || iArg > 5 ) continue;
+    if ( !pCons->usable ) return SQLITE_CONSTRAINT;
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ) aIdx[iArg] = i;
+  }
+  if ( aIdx[0] < 0 || aIdx[1] < 0 || aIdx[2] < 0 ) {
+    sqlite3_free(tab->zErrMsg);
+    tab->zErrMsg = sqlite3_mprintf("xbin_histogram: TABLE, COLX and NX are required");
+    return SQLITE_ERROR;
+  }
+  pIdxInfo->idxNum = 0;
+  for (i = 0; i < 6; i++) {
+    if ( aIdx[i] < 0 ) continue;
+    pIdxInfo->aConstraintUsage[aIdx[i]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[aIdx[i]].omit = 1;
+    pIdxInfo->idxNum |= 1 << i;
+  }
+  pIdxInfo->estimatedCost = 1000.0;
+  pIdxInfo->estimatedRows = 1000;
+  return SQLITE_OK;
+}
+
+static sqlite3_module xbinHistModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ xbinHistConnect,
+  /* xBestIndex  */ xbinHistBestIndex,
+  /* xDisconnect */ xbinFuncDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ xbinHistOpen,
+  /* xClose      */ xbinHistClose,
+  /* xFilter     */ xbinHistFilter,
+  /* xNext       */ xbinHistNext,
+  /* xEof        */ xbinHistEof,
+  /* xColumn     */ xbinHistColumn,
+  /* xRowid      */ xbinHistRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+
+/*
+** xbin_rolling(TABLE, COLUMN, WINDOW, ROW_FROM, ROW_TO) is a table-valued
+** function that returns, for each row of ROW_FROM..ROW_TO of the xbin
+** table TABLE, the count, mean, RMS and max of the values of COLUMN over
+** the WINDOW rows that end with it, as xbin_movavg() and the others
+** would with "rows WINDOW-1 preceding":
+**
+**    select row, avg, max from xbin_rolling('log', 'torque', 100, 1, 1000000);
+**
+** ROW_FROM and ROW_TO default to the first and last record.  The window
+** of ROW_FROM reaches back before it, to the first record at most.  The
+** file is read a block at a time, the column pulled out of the block
+** and the moving aggregates run over it in one pass into arrays that
+** xColumn returns from, with no row going through an aggregate step.
+*/
+#define XBIN_ROLL_MAX_WINDOW  (1 << 24)
+
+typedef struct XbinRollCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  FILE *fptr;                 /* Handle on the file of the cursor's own */
+  int iCol;                   /* Column aggregated */
+  int nWindow;                /* Rows in the window */
+  sqlite3_int64 iFrom, iTo;   /* Rows returned */
+  sqlite3_int64 iStart;       /* First row read, the window of iFrom */
+  sqlite3_int64 iNext;        /* First row of the next block */
+  sqlite3_int64 iBlock;       /* Row of entry 0 of the block */
+  int nBlock;                 /* Rows in the block */
+  int iCur;                   /* Entry of the current row */
+  double *aHist;              /* Last nWindow values, by (row-1) % nWindow */
+  XbinMovSum sum;             /* Sum of the window */
+  XbinMovSum sumsq;           /* Sum of squares of the window */
+  XbinMovMax max;             /* Max of the window */
+  xbinData *aRec;             /* Records of the block */
+  double *aOut;               /* 4 x XBIN_BLOCK_ROWS: value, avg, rms, max */
+  sqlite3_int64 *aCount;      /* Count of each row of the block */
+  sqlite3_value *apArg[5];    /* Arguments, for the hidden columns */
+} XbinRollCursor;
+
+#define XBIN_ROLL_TAB  6      /* Hidden column TABLE, then COLUMN .. ROW_TO */
+
+/*
+** Read the next block and run the moving aggregates over it.  Rows
+** before iFrom only fill the window.  Set nBlock to 0 at the end.
+*/
+static int xbinRollBlock(XbinRollCursor *pCur) {
+  double *aVal = pCur->aOut;
+  double *aAvg = &pCur->aOut[XBIN_BLOCK_ROWS];
+  double *aRms = &pCur->aOut[XBIN_BLOCK_ROWS * 2];
+  double *aMax = &pCur->aOut[XBIN_BLOCK_ROWS * 3];
+  sqlite3_int64 n;
+  int iSlot, i;
+
+  n = pCur->iTo - pCur->iNext + 1;
+  if ( n > XBIN_BLOCK_ROWS ) n = XBIN_BLOCK_ROWS;
+  n = xbinReadRecords(pCur->fptr, pCur->iNext, n, pCur->aRec);
+  pCur->iBlock = pCur->iNext;
+  pCur->nBlock = (int)n;
+  pCur->iCur = 0;
+  pCur->iNext += n;
+  if ( n <= 0 ) {
+    pCur->nBlock = 0;
+    return SQLITE_OK;
+  }
+
+  for (i = 0; i < n; i++) aVal[i] = XBIN_VALUE(&pCur->aRec[i], pCur->iCol);
+  iSlot = (int)((pCur->iBlock - 1) % pCur->nWindow);
+  for (i = 0; i < n; i++) {
+    sqlite3_int64 iOut = pCur->iBlock + i - pCur->nWindow;
+    double v = aVal[i];
+    if ( iOut >= pCur->iStart ) {
+      double vOut = pCur->aHist[iSlot];
+      xbinMovSumAdd(&pCur->sum, vOut, -1);
+      xbinMovSumAdd(&pCur->sumsq, vOut * vOut, -1);
+      xbinMovMaxRemove(&pCur->max, iOut);
+    }
+    xbinMovSumAdd(&pCur->sum, v, 1);
+    xbinMovSumAdd(&pCur->sumsq, v * v, 1);
+    if ( xbinMovMaxAdd(&pCur->max, pCur->iBlock + i, v) != SQLITE_OK ) return SQLITE_NOMEM;
+    pCur->aHist[iSlot] = v;
+    if ( ++iSlot == pCur->nWindow ) iSlot = 0;
+    pCur->aCount[i] = pCur->sum.nValue;
+    xbinMovSumMean(&pCur->sum, &aAvg[i]);
+    if ( xbinMovSumMean(&pCur->sumsq, &aRms[i]) ) aRms[i] = sqrt(aRms[i]);
+    xbinMovMaxValue(&pCur->max, &aMax[i]);
+  }
+  if ( pCur->iBlock < pCur->iFrom ) {
+    pCur->iCur = (int)(pCur->iFrom - pCur->iBlock);
+  }
+  return SQLITE_OK;
+}
+
+static int xbinRollConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinFuncTab *pRoll;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db,
+                            "CREATE TABLE x(row INTEGER, value REAL, count INTEGER, "
+                            "avg REAL, rms REAL, max REAL, tab HIDDEN, col HIDDEN, "
+                            "window HIDDEN, row_from HIDDEN, row_to HIDDEN)"
+                           );
+  if ( rc != SQLITE_OK ) return rc;
+  pRoll = sqlite3_malloc( sizeof(*pRoll) );
+  *ppVtab = (sqlite3_vtab*)pRoll;
+  if ( pRoll == 0 ) return SQLITE_NOMEM;
+  memset(pRoll, 0, sizeof(*pRoll));
+  pRoll->pReg = (XbinRegistry*)pAux;
+  return SQLITE_OK;
+}
+
+static int xbinRollOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinRollCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void xbinRollReset(XbinRollCursor *pCur) {
+  int i;
+  if ( pCur->fptr ) fclose(pCur->fptr);
+  sqlite3_free(pCur->aHist);
+  sqlite3_free(pCur->aRec);
+  sqlite3_free(pCur->aOut);
+  sqlite3_free(pCur->aCount);
+  sqlite3_free(pCur->max.a);
+  for (i = 0; i < 5; i++) {
+    sqlite3_value_free(pCur->apArg[i]);
+    pCur->apArg[i] = 0;
+  }
+  pCur->fptr = 0;
+  pCur->aHist = 0;
+  pCur->aRec = 0;
+  pCur->aOut = 0;
+  pCur->aCount = 0;
+  memset(&pCur->sum, 0, sizeof(pCur->sum));
+  memset(&pCur->sumsq, 0, sizeof(pCur->sumsq));
+  memset(&pCur->max, 0, sizeof(pCur->max));
+  pCur->nBlock = 0;
+  pCur->iCur = 0;
+}
+
+static int xbinRollClose(sqlite3_vtab_cursor *cur) {
+  XbinRollCursor *pCur = (XbinRollCursor*)cur;
+  xbinRollReset(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+static int xbinRollNext(sqlite3_vtab_cursor *cur) {
+  XbinRollCursor *pCur = (XbinRollCursor*)cur;
+  if ( ++pCur->iCur < pCur->nBlock ) return SQLITE_OK;
+  return xbinRollBlock(pCur);
+}
+
+/*
+** Bit i of idxNum is set if argument i of xbin_rolling() is in argv[].
+*/
+static int xbinRollFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinRollCursor *pCur = (XbinRollCursor*)pVtabCursor;
+  sqlite3_vtab *pVtab = pVtabCursor->pVtab;
+  sqlite3_value *apArg[5] = { 0, 0, 0, 0, 0 };
+  XbinTable *pTab;
+  const char *zCol;
+  sqlite3_int64 nWindow;
+  int i, j;
+  (void)idxStr;
+
+  xbinRollReset(pCur);
+  for (i = j = 0; i < 5 && j < argc; i++) {
+    if ( idxNum & (1 << i) ) {
+      apArg[i] = argv[j++];
+      pCur->apArg[i] = sqlite3_value_dup(apArg[i]);
+      if ( pCur->apArg[i] == 0 ) return SQLITE_NOMEM;
+    }
+  }
+  if ( apArg[0] == 0 || apArg[1] == 0 || apArg[2] == 0 ) return SQLITE_OK;
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = 0;
+  pTab = xbinFindTable(((XbinFuncTab*)pVtab)->pReg, (const char*)sqlite3_value_text(apArg[0]),
+                       &pVtab->zErrMsg);
+  if ( pTab == 0 ) return SQLITE_ERROR;
+  zCol = (const char*)sqlite3_value_text(apArg[1]);
+  pCur->iCol = zCol ? xbinColumnIndex(zCol, (int)strlen(zCol)) : 0;
+  if ( pCur->iCol == 0 ) {
+    pVtab->zErrMsg = sqlite3_mprintf("xbin_rolling: no such column: %s", zCol ? zCol : "NULL");
+    return SQLITE_ERROR;
+  }
+  nWindow = sqlite3_value_int64(apArg[2]);
+  if ( nWindow < 1 || nWindow > XBIN_ROLL_MAX_WINDOW ) {
+    pVtab->zErrMsg = sqlite3_mprintf("xbin_rolling: WINDOW must be from 1 to %d",
+                                     XBIN_ROLL_MAX_WINDOW);
+    return SQLITE_ERROR;
+  }
+  pCur->nWindow = (int)nWindow;
+
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  pCur->iFrom = 1;
+  pCur->iTo = pTab->nRow;
+  if ( apArg[3] && sqlite3_value_type(apArg[3]) != SQLITE_NULL ) {
+    pCur->iFrom = sqlite3_value_int64(apArg[3]);
+    if ( pCur->iFrom < 1 ) pCur->iFrom = 1;
+  }
+  if ( apArg[4] && sqlite3_value_type(apArg[4]) != SQLITE_NULL ) {
+    pCur->iTo = sqlite3_value_int64(apArg[4]);
+    if ( pCur->iTo > pTab->nRow ) pCur->iTo = pTab->nRow;
+  }
+  if ( pCur->iFrom > pCur->iTo ) return SQLITE_OK;
+
+  pCur->aHist = sqlite3_malloc64( nWindow * sizeof(double) );
+  pCur->aRec = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(xbinData) );
+  pCur->aOut = sqlite3_malloc( XBIN_BLOCK_ROWS * 4 * sizeof(double) );
+  pCur->aCount = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(sqlite3_int64) );
+  if ( pCur->aHist == 0 || pCur->aRec == 0 || pCur->aOut == 0 || pCur->aCount == 0 ) {
+    return SQLITE_NOMEM;
+  }
+  pCur->fptr = fopen(pTab->filename, "rb");
+  if ( pCur->fptr == 0 ) return SQLITE_CANTOPEN;
+  pCur->iStart = pCur->iFrom - nWindow + 1;
+  if ( pCur->iStart < 1 ) pCur->iStart = 1;
+  pCur->iNext = pCur->iStart;
+  /* Skip the blocks wholly before iFrom, which only fill the window */
+  do {
+    int rc = xbinRollBlock(pCur);
+    if ( rc != SQLITE_OK ) return rc;
+  } while ( pCur->nBlock > 0 && pCur->iCur >= pCur->nBlock );
+  return SQLITE_OK;
+}
+
+static int xbinRollEof(sqlite3_vtab_cursor *cur) {
+  XbinRollCursor *pCur = (XbinRollCursor*)cur;
+  return pCur->iCur >= pCur->nBlock;
+}
+
+static int xbinRollColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinRollCursor *pCur = (XbinRollCursor*)cur;
+  int k = pCur->iCur;
+  switch ( i ) {
+    case 0:
+      sqlite3_result_int64(ctx, pCur->iBlock + k);
+      break;
+    case 1:
+      sqlite3_result_double(ctx, pCur->aOut[k]);
+      break;
+    case 2:
+      sqlite3_result_int64(ctx, pCur->aCount[k]);
+      break;
+    case 3: case 4: case 5:
+      if ( pCur->aCount[k] > 0 ) {
+        sqlite3_result_double(ctx, pCur->aOut[XBIN_BLOCK_ROWS * (i - 2) + k]);
+      }
+      break;
+    default:
+      if ( pCur->apArg[i - XBIN_ROLL_TAB] ) {
+        sqlite3_result_value(ctx, pCur->apArg[i - XBIN_ROLL_TAB]);
+      }
+      break;
+  }
+  return SQLITE_OK;
+}
+
+static int xbinRollRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  XbinRollCursor *pCur = (XbinRollCursor*)cur;
+  *pRowid = pCur->iBlock + pCur->iCur;
+  return SQLITE_OK;
+}
+
+/*
+** TABLE, COLUMN and WINDOW must be given with =, and so must the other
+** arguments if they are given at all.
+*/
+static int xbinRollBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+  int aIdx[5] = { -1, -1, -1, -1, -1 };
+  int nArg = 0;
+  int i;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    int iArg = pCons->iColumn - XBIN_ROLL_TAB;
+    if ( iArg < 0 || iArg > 4 ) continue;
+    if ( !pCons->usable ) return SQLITE_CONSTRAINT;
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ) aIdx[iArg] = i;
+  }
+  if ( aIdx[0] < 0 || aIdx[1] < 0 || aIdx[2] < 0 ) {
+    sqlite3_free(tab->zErrMsg);
+    tab->zErrMsg = sqlite3_mprintf("xbin_rolling: TABLE, COLUMN and WINDOW are required");
+    return SQLITE_ERROR;
+  }
+  pIdxInfo->idxNum = 0;
+  for (i = 0; i < 5; i++) {
+    if ( aIdx[i] < 0 ) continue;
+    pIdxInfo->aConstraintUsage[aIdx[i]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[aIdx[i]].omit = 1;
+    pIdxInfo->idxNum |= 1 << i;
+  }
+  pIdxInfo->estimatedCost = 1000000.0;
+  pIdxInfo->estimatedRows = 1000000;
+  return SQLITE_OK;
+}
+
+static sqlite3_module xbinRollModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ xbinRollConnect,
+  /* xBestIndex  */ xbinRollBestIndex,
+  /* xDisconnect */ xbinFuncDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ xbinRollOpen,
+  /* xClose      */ xbinRollClose,
+  /* xFilter     */ xbinRollFilter,
+  /* xNext       */ xbinRollNext,
+  /* xEof        */ xbinRollEof,
+  /* xColumn     */ xbinRollColumn,
+  /* xRowid      */ xbinRollRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+
+/*
+** xbin_groupby(TABLE, KEYS, AGGS, FILTER) is a table-valued function that
+** groups the records of the xbin table TABLE by the columns in KEYS and
+** returns a row for each group, in no particular order:
+**
+**    select k1 as id, k2 as iq, a1 as torque, a2 as speed
+**      from xbin_groupby('xbin', 'id,iq', 'avg(torque),max(speed)');
+**
+** KEYS lists up to XBIN_GROUPBY_MAX_KEY columns, which come back as k1,
+** k2 .., and AGGS up to XBIN_GROUPBY_MAX_AGG of count(*), and count,
+** sum, avg, min and max of a column, which come back as a1, a2 ..; n is
+** the number of records in the group.  NULL keys make a group of their
+** own, as in SQL.  FILTER, if not NULL, keeps only the records that pass
+** it, as in xbin_histogram().
+**
+** Each thread groups a run of whole blocks into an open addressing hash
+** table of its own, a slot holding the keys and the aggregates of its
+** group side by side, and the tables are merged into the first one at
+** the end.  A thread cannot allocate, so it stops before a block that
+** could fill its table past half; the table is grown by the calling
+** thread and the thread started again where it stopped.
+*/
+#define XBIN_GROUPBY_MAX_KEY  4
+#define XBIN_GROUPBY_MAX_AGG  8
+#define XBIN_GROUPBY_MIN_SLOT (XBIN_BLOCK_ROWS * 4)
+
+/* Aggregates of xbin_groupby() */
+#define XBIN_GB_COUNT_STAR  0
+#define XBIN_GB_COUNT       1
+#define XBIN_GB_SUM         2
+#define XBIN_GB_AVG         3
+#define XBIN_GB_MIN         4
+#define XBIN_GB_MAX         5
+
+static const char *const azXbinGroupAgg[] = { "count(*)", "count", "sum", "avg", "min", "max" };
+
+/* Slot of a group table.  aAgg[] is followed by the rest of the aggregates. */
+typedef struct XbinGroup {
+  unsigned int iTag;          /* Nonzero if the slot holds a group */
+  unsigned int aKey[XBIN_GROUPBY_MAX_KEY];  /* Bits of the keys */
+  sqlite3_int64 nRow;         /* Records in the group */
+  XbinRollup aAgg[1];         /* Aggregates, one for each column of AGGS */
+} XbinGroup;
+
+/* Open addressing hash table of groups, probed linearly */
+typedef struct XbinGroupTab {
+  unsigned char *aSlot;       /* nSlot slots of szSlot bytes */
+  sqlite3_int64 nSlot;        /* A power of two */
+  sqlite3_int64 nGroup;       /* Slots used */
+} XbinGroupTab;
+
+/* What to group and aggregate, shared by the threads */
+typedef struct XbinGroupSpec {
+  int nKey;
+  int aKeyCol[XBIN_GROUPBY_MAX_KEY];
+  int nAgg;
+  int aAggCol[XBIN_GROUPBY_MAX_AGG];  /* Column of each aggregate, 0 for count(*) */
+  int aAggOp[XBIN_GROUPBY_MAX_AGG];   /* XBIN_GB_* */
+  size_t szSlot;              /* Bytes of a slot */
+} XbinGroupSpec;
+
+typedef struct XbinGroupJob {
+  XbinTask task;
+  XbinTable *pTab;            /* For its zone maps only */
+  const XbinGroupSpec *pSpec;
+  FILE *fptr;                 /* File handle of this thread */
+  xbinData *aRec;             /* Buffer of XBIN_BLOCK_ROWS records */
+  int *aSel;                  /* Selection vector of XBIN_BLOCK_ROWS rows */
+  const XbinPred *pFilter;    /* FILTER, or NULL */
+  double *aFilter;            /* Values of FILTER over a block */
+  double *aReg;               /* Registers for FILTER */
+  sqlite3_int64 iStart;       /* Next row, at the start of a block */
+  sqlite3_int64 iEnd;         /* Last row */
+  XbinGroupTab gt;            /* Groups of this thread */
+  int bFull;                  /* Stopped at iStart for want of slots */
+  int bError;                 /* Stopped by a read error */
+} XbinGroupJob;
+
+#define XBIN_GROUP_SLOT(pGt, sz, i)  ((XbinGroup*)&(pGt)->aSlot[(size_t)(i) * (sz)])
+
+/* Bits of key value v, with all NaNs (NULLs) alike and -0.0 as 0.0 */
+static unsigned int xbinGroupKeyBits(float v) {
+  unsigned int u;
+  if ( v != v ) return 0x7fc00000;
+  if ( v == 0.0f ) return 0;
+  memcpy(&u, &v, sizeof(u));
+  return u;
+}
+
+static sqlite3_uint64 xbinGroupHash(const unsigned int *aKey) {
+  sqlite3_uint64 a = aKey[0] | (sqlite3_uint64)aKey[1] << 32;
+  sqlite3_uint64 b = aKey[2] | (sqlite3_uint64)aKey[3] << 32;
+  return xbinMix64(a ^ xbinMix64(b + 0x9e3779b97f4a7c15ULL));
+}
+
+/*
+** Return the slot of the group with keys aKey[] and hash h, making it
+** if there is none.  The table must have room for one more group.
+*/
+static XbinGroup *xbinGroupFind(
+  XbinGroupTab *pGt,
+  const XbinGroupSpec *pSpec,
+  const unsigned int *aKey,
+  sqlite3_uint64 h
+) {
+  sqlite3_int64 mask = pGt->nSlot - 1;
+  sqlite3_int64 i = (sqlite3_int64)(h & mask);
+  unsigned int iTag = (unsigned int)(h >> 32) | 1;
+  XbinGroup *g;
+  int k;
+
+  while ( 1 ) {
+    g = XBIN_GROUP_SLOT(pGt, pSpec->szSlot, i);
+    if ( g->iTag == 0 ) break;
+    if ( g->iTag == iTag && memcmp(g->aKey, aKey, sizeof(g->aKey)) == 0 ) return g;
+    i = (i + 1) & mask;
+  }
+  g->iTag = iTag;
+  memcpy(g->aKey, aKey, sizeof(g->aKey));
+  g->nRow = 0;
+  for (k = 0; k < pSpec->nAgg; k++) xbinRollupInit(&g->aAgg[k]);
+  pGt->nGroup++;
+  return g;
+}
+
+/*
+** Make the slots of pGt nSlot, moving the groups over.  Return
+** SQLITE_NOMEM if they cannot be allocated.
+*/
+static int xbinGroupResize(XbinGroupTab *pGt, const XbinGroupSpec *pSpec, sqlite3_int64 nSlot) {
+  XbinGroupTab gtNew;
+  sqlite3_int64 i;
+
+  gtNew.aSlot = sqlite3_malloc64( nSlot * pSpec->szSlot );
+  if ( gtNew.aSlot == 0 ) return SQLITE_NOMEM;
+  memset(gtNew.aSlot, 0, nSlot * pSpec->szSlot);
+  gtNew.nSlot = nSlot;
+  gtNew.nGroup = 0;
+  for (i = 0; i < pGt->nSlot; i++) {
+    XbinGroup *g = XBIN_GROUP_SLOT(pGt, pSpec->szSlot, i);
+    if ( g->iTag ) {
+      XbinGroup *gNew = xbinGroupFind(&gtNew, pSpec, g->aKey, xbinGroupHash(g->aKey));
+      memcpy(gNew, g, pSpec->szSlot);
+    }
+  }
+  sqlite3_free(pGt->aSlot);
+  *pGt = gtNew;
+  return SQLITE_OK;
+}
+
+static void xbinGroupWork(void *pArg) {
+  XbinGroupJob *pJob = (XbinGroupJob*)pArg;
+  const XbinGroupSpec *pSpec = pJob->pSpec;
+  int bSeek = 1;
+  int i, k;
+
+  pJob->bFull = 0;
+  while ( pJob->iStart <= pJob->iEnd ) {
+    sqlite3_int64 iRow = pJob->iStart;
+    sqlite3_int64 iZone = (iRow - 1) / XBIN_BLOCK_ROWS;
+    sqlite3_int64 n = pJob->iEnd - iRow + 1;
+    int nSel;
+    if ( n > XBIN_BLOCK_ROWS ) n = XBIN_BLOCK_ROWS;
+    if ( pJob->pFilter && iRow + n - 1 <= pJob->pTab->nZoneRow
+      && xbinZoneSkip(pJob->pTab, iZone, pJob->pFilter, 1) ) {
+      pJob->iStart += n;
+      bSeek = 1;
+      continue;
+    }
+    if ( (pJob->gt.nGroup + n) * 2 > pJob->gt.nSlot ) {
+      pJob->bFull = 1;
+      return;
+    }
+    if ( bSeek
+      && xbin_fseek(pJob->fptr, (iRow - 1) * (sqlite3_int64)sizeof(xbinData), SEEK_SET) != 0 ) {
+      pJob->bError = 1;
+      return;
+    }
+    bSeek = 0;
+    n = (sqlite3_int64)fread(pJob->aRec, sizeof(xbinData), (size_t)n, pJob->fptr);
+    if ( n <= 0 ) {
+      pJob->bError = 1;
+      return;
+    }
+    for (i = 0; i < n; i++) pJob->aSel[i] = i;
+    nSel = (int)n;
+    if ( pJob->pFilter ) {
+      nSel = xbinExprSelect(pJob->pFilter->pExpr, pJob->aRec, pJob->aSel, nSel,
+                            pJob->aFilter, pJob->aReg);
+    }
+    for (i = 0; i < nSel; i++) {
+      const xbinData *p = &pJob->aRec[pJob->aSel[i]];
+      unsigned int aKey[XBIN_GROUPBY_MAX_KEY] = { 0, 0, 0, 0 };
+      XbinGroup *g;
+      for (k = 0; k < pSpec->nKey; k++) {
+        aKey[k] = xbinGroupKeyBits(XBIN_VALUE(p, pSpec->aKeyCol[k]));
+      }
+      g = xbinGroupFind(&pJob->gt, pSpec, aKey, xbinGroupHash(aKey));
+      g->nRow++;
+      for (k = 0; k < pSpec->nAgg; k++) {
+        XbinRollup *r = &g->aAgg[k];
+        float v;
+        if ( pSpec->aAggCol[k] == 0 ) continue;
+        v = XBIN_VALUE(p, pSpec->aAggCol[k]);
+        if ( v != v ) continue;
+        if ( v < r->rMin ) r->rMin = v;
+        if ( v > r->rMax ) r->rMax = v;
+        r->nValue++;
+        r->rSum += v;
+      }
+    }
+    pJob->iStart += n;
+  }
+}
+
+/*
+** Parse KEYS of xbin_groupby() into pSpec.  Return SQLITE_ERROR, with
+** an error in *pzErr, if it is not a list of 1 to XBIN_GROUPBY_MAX_KEY
+** columns.
+*/
+static int xbinGroupParseKeys(const char *z, XbinGroupSpec *pSpec, char **pzErr) {
+  pSpec->nKey = 0;
+  while ( z && *z ) {
+    int n, iCol;
+    while ( *z == ',' || isspace((unsigned char)*z) ) z++;
+    for (n = 0; z[n] && z[n] != ',' && !isspace((unsigned char)z[n]); n++) {}
+    if ( n == 0 ) break;
+    iCol = xbinColumnIndex(z, n);
+    if ( iCol == 0 ) {
+      *pzErr = sqlite3_mprintf("xbin_groupby: no such column: %.*s", n, z);
+      return SQLITE_ERROR;
+    }
+    if ( pSpec->nKey == XBIN_GROUPBY_MAX_KEY ) {
+      *pzErr = sqlite3_mprintf("xbin_groupby: more than %d keys", XBIN_GROUPBY_MAX_KEY);
+      return SQLITE_ERROR;
+    }
+    pSpec->aKeyCol[pSpec->nKey++] = iCol;
+    z += n;
+  }
+  if ( pSpec->nKey == 0 ) {
+    *pzErr = sqlite3_mprintf("xbin_groupby: no column in KEYS");
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Parse AGGS of xbin_groupby(), a comma separated list such as
+** "avg(torque),count(*)", into pSpec.  An empty list is allowed, for
+** the count of each group alone.  Return SQLITE_ERROR, with an error in
+** *pzErr, if it cannot be read.
+*/
+static int xbinGroupParseAggs(const char *z, XbinGroupSpec *pSpec, char **pzErr) {
+  pSpec->nAgg = 0;
+  while ( z && *z ) {
+    const char *zAgg;
+    int n, iOp, iCol = 0;
+    while ( *z == ',' || isspace((unsigned char)*z) ) z++;
+    if ( *z == 0 ) break;
+    zAgg = z;
+    for (n = 0; isalpha((unsigned char)z[n]); n++) {}
+    for (iOp = 0; iOp < 6; iOp++) {
+      const char *zName = azXbinGroupAgg[iOp];
+      if ( iOp != XBIN_GB_COUNT_STAR
+        && sqlite3_strnicmp(z, zName, n) == 0 && zName[n] == 0 ) break;
+    }
+    z += n;
+    while ( isspace((unsigned char)*z) ) z++;
+    if ( iOp < 6 && *z == '(' ) {
+      z++;
+      while ( isspace((unsigned char)*z) ) z++;
+      if ( iOp == XBIN_GB_COUNT && *z == '*' ) {
+        iOp = XBIN_GB_COUNT_STAR;
+        z++;
+      } else {
+        for (n = 0; isalnum((unsigned char)z[n]) || z[n] == '_'; n++) {}
+        iCol = n > 0 ? xbinColumnIndex(z, n) : 0;
+        z += n;
+      }
+      while ( isspace((unsigned char)*z) ) z++;
+    }
+    if ( iOp == 6 || *z != ')' || (iCol == 0 && iOp != XBIN_GB_COUNT_STAR) ) {
+      *pzErr = sqlite3_mprintf("xbin_groupby: cannot parse aggregate near \"%.20s\"", zAgg);
+      return SQLITE_ERROR;
+    }
+    z++;
+    if ( pSpec->nAgg == XBIN_GROUPBY_MAX_AGG ) {
+      *pzErr = sqlite3_mprintf("xbin_groupby: more than %d aggregates", XBIN_GROUPBY_MAX_AGG);
+      return SQLITE_ERROR;
+    }
+    pSpec->aAggOp[pSpec->nAgg] = iOp;
+    pSpec->aAggCol[pSpec->nAgg] = iCol;
+    pSpec->nAgg++;
+  }
+  return SQLITE_OK;
+}
+
+typedef struct XbinGroupCursor {
+  sqlite3_vtab_cursor base;   /* Base class - must be first */
+  XbinGroupSpec spec;         /* What was grouped */
+  XbinGroupTab gt;            /* The groups */
+  sqlite3_int64 iSlot;        /* Slot of the current group */
+  sqlite3_int64 iRowid;       /* Groups returned so far */
+  sqlite3_value *apArg[4];    /* Arguments, for the hidden columns */
+} XbinGroupCursor;
+
+/* Columns k1..k4, a1..a8, n, then the hidden arguments */
+#define XBIN_GROUPBY_N    (XBIN_GROUPBY_MAX_KEY + XBIN_GROUPBY_MAX_AGG)
+#define XBIN_GROUPBY_TAB  (XBIN_GROUPBY_N + 1)
+
+static int xbinGroupConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+) {
+  XbinFuncTab *pGroup;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db,
+                            "CREATE TABLE x(k1 REAL, k2 REAL, k3 REAL, k4 REAL, "
+                            "a1, a2, a3, a4, a5, a6, a7, a8, n INTEGER, "
+                            "tab HIDDEN, keys HIDDEN, aggs HIDDEN, filter HIDDEN)"
+                           );
+  if ( rc != SQLITE_OK ) return rc;
+  pGroup = sqlite3_malloc( sizeof(*pGroup) );
+  *ppVtab = (sqlite3_vtab*)pGroup;
+  if ( pGroup == 0 ) return SQLITE_NOMEM;
+  memset(pGroup, 0, sizeof(*pGroup));
+  pGroup->pReg = (XbinRegistry*)pAux;
+  return SQLITE_OK;
+}
+
+static int xbinGroupOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **cur) {
+  XbinGroupCursor *pCur = sqlite3_malloc( sizeof(*pCur) );
+  if ( pCur == 0 ) return SQLITE_NOMEM;
+  memset(pCur, 0, sizeof(*pCur));
+  *cur = &pCur->base;
+  return SQLITE_OK;
+}
+
+static void xbinGroupReset(XbinGroupCursor *pCur) {
+  int i;
+  sqlite3_free(pCur->gt.aSlot);
+  memset(&pCur->gt, 0, sizeof(pCur->gt));
+  for (i = 0; i < 4; i++) {
+    sqlite3_value_free(pCur->apArg[i]);
+    pCur->apArg[i] = 0;
+  }
+  pCur->iSlot = 0;
+  pCur->iRowid = 0;
+}
+
+static int xbinGroupClose(sqlite3_vtab_cursor *cur) {
+  XbinGroupCursor *pCur = (XbinGroupCursor*)cur;
+  xbinGroupReset(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
+}
+
+/* Move iSlot on to the first group at or after it */
+static void xbinGroupSeek(XbinGroupCursor *pCur) {
+  while ( pCur->iSlot < pCur->gt.nSlot
+       && XBIN_GROUP_SLOT(&pCur->gt, pCur->spec.szSlot, pCur->iSlot)->iTag == 0 ) {
+    pCur->iSlot++;
+  }
+}
+
+static int xbinGroupNext(sqlite3_vtab_cursor *cur) {
+  XbinGroupCursor *pCur = (XbinGroupCursor*)cur;
+  pCur->iSlot++;
+  pCur->iRowid++;
+  xbinGroupSeek(pCur);
+  return SQLITE_OK;
+}
+
+/*
+** Bit i of idxNum is set if argument i of xbin_groupby() is in argv[].
+*/
+static int xbinGroupFilter(
+  sqlite3_vtab_cursor *pVtabCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+) {
+  XbinGroupCursor *pCur = (XbinGroupCursor*)pVtabCursor;
+  sqlite3_vtab *pVtab = pVtabCursor->pVtab;
+  XbinGroupSpec *pSpec = &pCur->spec;
+  sqlite3_value *apArg[4] = { 0, 0, 0, 0 };
+  XbinGroupJob aJob[XBIN_MAX_THREADS];
+  XbinPred filter;
+  XbinTable *pTab;
+  sqlite3_int64 nBlock;
+  int bFilter = 0;
+  int nJob = xbinCpuCount();
+  int rc = SQLITE_OK;
+  int i, j;
+  (void)idxStr;
+
+  xbinGroupReset(pCur);
+  for (i = j = 0; i < 4 && j < argc; i++) {
+    if ( idxNum & (1 << i) ) {
+      apArg[i] = argv[j++];
+      pCur->apArg[i] = sqlite3_value_dup(apArg[i]);
+      if ( pCur->apArg[i] == 0 ) return SQLITE_NOMEM;
+    }
+  }
+  if ( apArg[0] == 0 || apArg[1] == 0 ) return SQLITE_OK;
+  sqlite3_free(pVtab->zErrMsg);
+  pVtab->zErrMsg = 0;
+  pTab = xbinFindTable(((XbinFuncTab*)pVtab)->pReg, (const char*)sqlite3_value_text(apArg[0]),
+                       &pVtab->zErrMsg);
+  if ( pTab == 0 ) return SQLITE_ERROR;
+  memset(pSpec, 0, sizeof(*pSpec));
+  rc = xbinGroupParseKeys((const char*)sqlite3_value_text(apArg[1]), pSpec, &pVtab->zErrMsg);
+  if ( rc == SQLITE_OK && apArg[2] ) {
+    rc = xbinGroupParseAggs((const char*)sqlite3_value_text(apArg[2]), pSpec, &pVtab->zErrMsg);
+  }
+  if ( rc != SQLITE_OK ) return rc;
+  pSpec->szSlot = sizeof(XbinGroup);
+  if ( pSpec->nAgg > 1 ) pSpec->szSlot += (pSpec->nAgg - 1) * sizeof(XbinRollup);
+  if ( apArg[3] && sqlite3_value_type(apArg[3]) != SQLITE_NULL ) {
+    rc = xbinFilterArg(pTab, "xbin_groupby", apArg[3], &filter, &pVtab->zErrMsg);
+    if ( rc != SQLITE_OK ) return rc;
+    bFilter = 1;
+  }
+
+  /* Group in parallel, growing the tables of the threads that fill up */
+  pTab->nRow = xbinRowCount(pTab->fptr);
+  if ( bFilter && xbinZoneRefresh(pTab) != SQLITE_OK ) pTab->nZoneRow = 0;
+  nBlock = (pTab->nRow + XBIN_BLOCK_ROWS - 1) / XBIN_BLOCK_ROWS;
+  if ( nJob > nBlock / XBIN_STATS_RUN ) nJob = (int)(nBlock / XBIN_STATS_RUN);
+  if ( nJob < 1 ) nJob = 1;
+  memset(aJob, 0, sizeof(aJob));
+  for (i = 0; i < nJob; i++) {
+    aJob[i].pTab = pTab;
+    aJob[i].pSpec = pSpec;
+    aJob[i].iStart = (nBlock * i / nJob) * XBIN_BLOCK_ROWS + 1;
+    aJob[i].iEnd = (nBlock * (i + 1) / nJob) * XBIN_BLOCK_ROWS;
+    if ( aJob[i].iEnd > pTab->nRow ) aJob[i].iEnd = pTab->nRow;
+    aJob[i].aRec = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(xbinData) );
+    aJob[i].aSel = sqlite3_malloc( XBIN_BLOCK_ROWS * sizeof(int) );
+    aJob[i].fptr = i == 0 ? pTab->fptr : fopen(pTab->filename, "rb");
+    if ( aJob[i].aRec == 0 || aJob[i].aSel == 0 ) rc = SQLITE_NOMEM;
+    if ( bFilter && xbinJobFilter(&aJob[i].pFilter, &aJob[i].aFilter, &aJob[i].aReg,
+                                  &filter) != SQLITE_OK ) {
+      rc = SQLITE_NOMEM;
+    }
+    if ( aJob[i].fptr == 0 ) rc = SQLITE_CANTOPEN;
+    if ( rc == SQLITE_OK ) rc = xbinGroupResize(&aJob[i].gt, pSpec, XBIN_GROUPBY_MIN_SLOT);
+    aJob[i].bFull = 1;
+  }
+  while ( rc == SQLITE_OK ) {
+    int nRun = 0;
+    for (i = 0; i < nJob; i++) {
+      if ( aJob[i].bFull ) {
+        xbinTaskStart(&aJob[i].task, xbinGroupWork, &aJob[i]);
+        nRun++;
+      }
+    }
+    if ( nRun == 0 ) break;
+    for (i = 0; i < nJob; i++) xbinTaskJoin(&aJob[i].task);
+    for (i = 0; i < nJob && rc == SQLITE_OK; i++) {
+      if ( aJob[i].bError ) rc = SQLITE_IOERR;
+      if ( aJob[i].bFull && rc == SQLITE_OK ) {
+        rc = xbinGroupResize(&aJob[i].gt, pSpec, aJob[i].gt.nSlot * 2);
+      }
+    }
+  }
+
+  /* Merge the groups of the other threads into those of the first */
+  for (i = 1; i < nJob && rc == SQLITE_OK; i++) {
+    XbinGroupTab *pGt = &aJob[0].gt;
+    sqlite3_int64 iSlot;
+    for (iSlot = 0; iSlot < aJob[i].gt.nSlot && rc == SQLITE_OK; iSlot++) {
+      XbinGroup *g = XBIN_GROUP_SLOT(&aJob[i].gt, pSpec->szSlot, iSlot);
+      XbinGroup *gOut;
+      int k;
+      if ( g->iTag == 0 ) continue;
+      if ( (pGt->nGroup + 1) * 2 > pGt->nSlot ) {
+        rc = xbinGroupResize(pGt, pSpec, pGt->nSlot * 2);
+        if ( rc != SQLITE_OK ) break;
+      }
+      gOut = xbinGroupFind(pGt, pSpec, g->aKey, xbinGroupHash(g->aKey));
+      gOut->nRow += g->nRow;
+      for (k = 0; k < pSpec->nAgg; k++) xbinRollupMerge(&gOut->aAgg[k], &g->aAgg[k]);
+    }
+  }
+  if ( rc == SQLITE_OK ) {
+    pCur->gt = aJob[0].gt;
+    aJob[0].gt.aSlot = 0;
+  }
+  for (i = 0; i < nJob; i++) {
+    if ( i > 0 && aJob[i].fptr ) fclose(aJob[i].fptr);
+    sqlite3_free(aJob[i].aRec);
+    sqlite3_free(aJob[i].aSel);
+    sqlite3_free(aJob[i].gt.aSlot);
+    sqlite3_free(aJob[i].aFilter);
+    sqlite3_free(aJob[i].aReg);
+  }
+  if ( bFilter ) sqlite3_free(filter.pExpr);
+  xbinGroupSeek(pCur);
+  return rc;
+}
+
+static int xbinGroupEof(sqlite3_vtab_cursor *cur) {
+  XbinGroupCursor *pCur = (XbinGroupCursor*)cur;
+  return pCur->iSlot >= pCur->gt.nSlot;
+}
+
+static int xbinGroupColumn(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i) {
+  XbinGroupCursor *pCur = (XbinGroupCursor*)cur;
+  const XbinGroupSpec *pSpec = &pCur->spec;
+  const XbinGroup *g = XBIN_GROUP_SLOT(&pCur->gt, pSpec->szSlot, pCur->iSlot);
+
+  if ( i < XBIN_GROUPBY_MAX_KEY ) {
+    if ( i < pSpec->nKey ) {
+      float v;
+      memcpy(&v, &g->aKey[i], sizeof(v));
+      sqlite3_result_double(ctx, v);
+    }
+  } else if ( i < XBIN_GROUPBY_N ) {
+    const XbinRollup *r;
+    i -= XBIN_GROUPBY_MAX_KEY;
+    if ( i >= pSpec->nAgg ) return SQLITE_OK;
+    r = &g->aAgg[i];
+    switch ( pSpec->aAggOp[i] ) {
+      case XBIN_GB_COUNT_STAR: sqlite3_result_int64(ctx, g->nRow); break;
+      case XBIN_GB_COUNT:      sqlite3_result_int64(ctx, r->nValue); break;
+      default:
+        if ( r->nValue == 0 ) break;
+        switch ( pSpec->aAggOp[i] ) {
+          case XBIN_GB_SUM: sqlite3_result_double(ctx, r->rSum); break;
+          case XBIN_GB_AVG: sqlite3_result_double(ctx, r->rSum / r->nValue); break;
+          case XBIN_GB_MIN: sqlite3_result_double(ctx, r->rMin); break;
+          case XBIN_GB_MAX: sqlite3_result_double(ctx, r->rMax); break;
+        }
+        break;
+    }
+  } else if ( i == XBIN_GROUPBY_N ) {
+    sqlite3_result_int64(ctx, g->nRow);
+  } else if ( pCur->apArg[i - XBIN_GROUPBY_TAB] ) {
+    sqlite3_result_value(ctx, pCur->apArg[i - XBIN_GROUPBY_TAB]);
+  }
+  return SQLITE_OK;
+}
+
+static int xbinGroupRowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid) {
+  *pRowid = ((XbinGroupCursor*)cur)->iRowid + 1;
+  return SQLITE_OK;
+}
+
+/*
+** TABLE and KEYS must be given with =, and so must AGGS and FILTER if
+** they are given at all.
+*/
+static int xbinGroupBestIndex(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo) {
+  int aIdx[4] = { -1, -1, -1, -1 };
+  int nArg = 0;
+  int i;
+  for (i = 0; i < pIdxInfo->nConstraint; i++) {
+    const struct sqlite3_index_constraint *pCons = &pIdxInfo->aConstraint[i];
+    int iArg = pCons->iColumn - XBIN_GROUPBY_TAB;
+    if ( iArg < 0 || iArg > 3 ) continue;
+    if ( !pCons->usable ) return SQLITE_CONSTRAINT;
+    if ( pCons->op == SQLITE_INDEX_CONSTRAINT_EQ ) aIdx[iArg] = i;
+  }
+  if ( aIdx[0] < 0 || aIdx[1] < 0 ) {
+    sqlite3_free(tab->zErrMsg);
+    tab->zErrMsg = sqlite3_mprintf("xbin_groupby: TABLE and KEYS are required");
+    return SQLITE_ERROR;
+  }
+  pIdxInfo->idxNum = 0;
+  for (i = 0; i < 4; i++) {
+    if ( aIdx[i] < 0 ) continue;
+    pIdxInfo->aConstraintUsage[aIdx[i]].argvIndex = ++nArg;
+    pIdxInfo->aConstraintUsage[aIdx[i]].omit = 1;
+    pIdxInfo->idxNum |= 1 << i;
+  }
+  pIdxInfo->estimatedCost = 1000000.0;
+  pIdxInfo->estimatedRows = 10000;
+  return SQLITE_OK;
+}
+
+static sqlite3_module xbinGroupModule = {
+  /* iVersion    */ 0,
+  /* xCreate     */ 0,
+  /* xConnect    */ xbinGroupConnect,
+  /* xBestIndex  */ xbinGroupBestIndex,
+  /* xDisconnect */ xbinFuncDisconnect,
+  /* xDestroy    */ 0,
+  /* xOpen       */ xbinGroupOpen,
+  /* xClose      */ xbinGroupClose,
+  /* xFilter     */ xbinGroupFilter,
+  /* xNext       */ xbinGroupNext,
+  /* xEof        */ xbinGroupEof,
+  /* xColumn     */ xbinGroupColumn,
+  /* xRowid      */ xbinGroupRowid,
+  /* xUpdate     */ 0,
+  /* xBegin      */ 0,
+  /* xSync       */ 0,
+  /* xCommit     */ 0,
+  /* xRollback   */ 0,
+  /* xFindMethod */ 0,
+  /* xRename     */ 0,
+  /* xSavepoint  */ 0,
+  /* xRelease    */ 0,
+  /* xRollbackTo */ 0,
+  /* xShadowName */ 0
+};
+
+/*
+** Destructor of the registry, the client data of the xbin module.
+*/
+static void xbinRegistryFree(void *p) {
+  XbinRegistry *pReg = (XbinRegistry*)p;
+  while ( pReg->pMeta ) {
+    XbinMetaCache *pCache = pReg->pMeta;
+    pReg->pMeta = pCache->pNext;
+    sqlite3_free(pCache->zPath);
+    sqlite3_free(pCache->zText);
+    sqlite3_free(pCache);
+  }
+  sqlite3_free(pReg);
+}
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int sqlite3_xbin_init(
+  sqlite3 *db,
+  char **pzErrMsg,
+  const sqlite3_api_routines *pApi
+) {
+  int rc = SQLITE_OK;
+  XbinRegistry *pReg;
+  SQLITE_EXTENSION_INIT2(pApi);
+  pReg = sqlite3_malloc( sizeof(*pReg) );
+  if ( pReg == 0 ) return SQLITE_NOMEM;
+  memset(pReg, 0, sizeof(*pReg));
+  pReg->db = db;
+#ifdef XBIN_SIMD_AVX2
+  xbinSimdAvx2 = __builtin_cpu_supports("avx2");
+#endif
+  rc = sqlite3_create_module_v2(db, "xbin", &xbinModule, pReg, xbinRegistryFree);
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module(db, "xbin_gather", &xbinGatherModule, pReg);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module(db, "xbin_knn", &xbinKnnModule, pReg);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module(db, "xbin_interp_batch", &xbinInterpModule, pReg);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module(db, "xbin_downsample", &xbinDownsampleModule, pReg);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module(db, "xbin_agg", &xbinAggModule, pReg);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module(db, "xbin_stats", &xbinStatsModule, pReg);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module(db, "xbin_histogram", &xbinHistModule, pReg);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module(db, "xbin_rolling", &xbinRollModule, pReg);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module(db, "xbin_groupby", &xbinGroupModule, pReg);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "near", 2, SQLITE_UTF8|SQLITE_DETERMINISTIC, 0,
+                                 xbinNearFunc, 0, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "near", 3, SQLITE_UTF8|SQLITE_DETERMINISTIC, 0,
+                                 xbinNearFunc, 0, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "in_box", -1, SQLITE_UTF8|SQLITE_DETERMINISTIC, 0,
+                                 xbinInBoxFunc, 0, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "xbin_create_index", 2, SQLITE_UTF8, pReg,
+                                 xbinCreateIndexFunc, 0, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "xbin_create_index", 3, SQLITE_UTF8, pReg,
+                                 xbinCreateIndexFunc, 0, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "xbin_interp", -1, SQLITE_UTF8, pReg,
+                                 xbinInterpFunc, 0, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "xbin_approx_distinct", 1, SQLITE_UTF8, 0,
+                                 0, xbinApproxDistinctStep, xbinApproxDistinctFinal);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "xbin_approx_distinct", 2, SQLITE_UTF8, pReg,
+                                 xbinApproxDistinctFunc, 0, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "xbin_quantile", 2, SQLITE_UTF8, 0,
+                                 0, xbinQuantileStep, xbinQuantileFinal);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_function(db, "xbin_quantile", 3, SQLITE_UTF8, pReg,
+                                 xbinQuantileFunc, 0, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_window_function(db, "xbin_movavg", 1, SQLITE_UTF8, (void*)"xbin_movavg",
+                                        xbinMovAvgStep, xbinMovAvgFinal, xbinMovAvgValue,
+                                        xbinMovAvgInverse, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_window_function(db, "xbin_movrms", 1, SQLITE_UTF8, (void*)"xbin_movrms",
+                                        xbinMovRmsStep, xbinMovRmsFinal, xbinMovRmsValue,
+                                        xbinMovRmsInverse, 0);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_window_function(db, "xbin_movmax", 1, SQLITE_UTF8, (void*)"xbin_movmax",
+                                        xbinMovMaxStep, xbinMovMaxFinal, xbinMovMaxValueFunc,
+                                        xbinMovMaxInverse, 0);
+  }
+  return rc;
+}